@@ -0,0 +1,49 @@
+#version 460
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 inNormal;
+layout (location = 1) flat in uint inMaterialIndex;
+layout (location = 2) in vec3 inWorldPosition;
+
+layout (location = 0) out vec4 outFragColor;
+
+// Base colors of the materials, until materials have their own buffer
+const vec3 materialColors[8] = vec3[8](
+    vec3(0.80f, 0.25f, 0.20f),
+    vec3(0.25f, 0.60f, 0.30f),
+    vec3(0.20f, 0.40f, 0.80f),
+    vec3(0.85f, 0.70f, 0.25f),
+    vec3(0.60f, 0.30f, 0.70f),
+    vec3(0.25f, 0.70f, 0.75f),
+    vec3(0.75f, 0.75f, 0.75f),
+    vec3(0.90f, 0.50f, 0.20f)
+);
+
+// Streamed textures of the materials (INSTANCING_MATERIAL_TEXTURE_COUNT in vk_instancing.h): white until loaded.
+// The instances of a draw may use different materials, hence the non-uniform index.
+layout (set = 0, binding = 2) uniform sampler2D materialTextures[8];
+
+// Meters covered by a texture's width (MATERIAL_TEXTURE_WORLD_SIZE in vk_engine.h)
+const float textureWorldSize = 1.0f;
+
+const vec3 lightDirection = vec3(0.3f, 0.8f, 0.5f);
+
+void main() {
+    // Triplanar mapping (the built-in meshes have no texture coordinates): the three planar projections of the world
+    // position, blended by the normal
+    uint textureIndex = inMaterialIndex % 8;
+    vec3 normal = normalize(inNormal);
+    vec3 weights = abs(normal);
+    weights /= weights.x + weights.y + weights.z;
+    vec3 position = inWorldPosition / textureWorldSize;
+    vec3 texel = texture(materialTextures[nonuniformEXT(textureIndex)], position.zy).rgb * weights.x
+        + texture(materialTextures[nonuniformEXT(textureIndex)], position.xz).rgb * weights.y
+        + texture(materialTextures[nonuniformEXT(textureIndex)], position.xy).rgb * weights.z;
+
+    vec3 baseColor = materialColors[inMaterialIndex % 8] * texel;
+
+    // Lambert from a fixed directional light, with a constant ambient term
+    float diffuse = max(dot(normal, normalize(lightDirection)), 0.0f);
+    outFragColor = vec4(baseColor * (0.2f + 0.8f * diffuse), 1.0f);
+}
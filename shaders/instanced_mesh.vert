@@ -0,0 +1,57 @@
+#version 460
+
+// Must match GPUInstanceData (vk_instancing.h)
+struct InstanceData {
+    mat4 worldMatrix;
+    uint materialIndex;
+    uint padding0;
+    uint padding1;
+    uint padding2;
+};
+
+// Must match GPUMeshVertex (vk_instancing.h)
+struct Vertex {
+    vec3 position;
+    float uvX;
+    vec3 normal;
+    float uvY;
+};
+
+// The instances of the frame, grouped by mesh
+layout (std430, set = 0, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+// The shared vertices of the meshes (the draws' vertexOffset is already added to gl_VertexIndex)
+layout (std430, set = 0, binding = 1) readonly buffer VertexBuffer {
+    Vertex vertices[];
+};
+
+// The indices of the instances that passed the occlusion culling, compacted per draw: each draw's firstInstance points
+// at its range (written by hiz_cull.comp)
+layout (std430, set = 0, binding = 3) readonly buffer VisibleInstanceBuffer {
+    uint visibleInstances[];
+};
+
+layout (push_constant) uniform PushConstants {
+    mat4 viewProjection;
+} pushConstants;
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) flat out uint outMaterialIndex;
+layout (location = 2) out vec3 outWorldPosition;
+
+void main()
+{
+    // gl_InstanceIndex includes the draw's firstInstance
+    InstanceData instance = instances[visibleInstances[gl_InstanceIndex]];
+    Vertex vertex = vertices[gl_VertexIndex];
+
+    vec4 worldPosition = instance.worldMatrix * vec4(vertex.position, 1.0f);
+    gl_Position = pushConstants.viewProjection * worldPosition;
+    outWorldPosition = worldPosition.xyz;
+
+    // Fine for the rotations and uniform scales of the scene nodes
+    outNormal = mat3(instance.worldMatrix) * vertex.normal;
+    outMaterialIndex = instance.materialIndex;
+}
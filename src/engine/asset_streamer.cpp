@@ -0,0 +1,640 @@
+#include "asset_streamer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+    #define ASSET_STREAMER_IO_URING 1
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+#include "vk_logger.h"
+#include "vk_trace.h"
+
+namespace {
+
+    constexpr uint32_t BUFFER_SIZE_CLASS_COUNT {static_cast<uint32_t>(std::countr_zero(STREAMING_BUFFER_MAX_SIZE / STREAMING_BUFFER_MIN_SIZE)) + 1};
+    // Bytes per read submitted at once: larger requests are read in several parts
+    constexpr uint64_t MAX_READ_PART_SIZE {uint64_t {1} << 30};
+
+    static_assert(std::has_single_bit(STREAMING_BUFFER_MIN_SIZE) && std::has_single_bit(STREAMING_BUFFER_MAX_SIZE));
+    static_assert(STREAMING_BUFFER_MIN_SIZE % STREAMING_BUFFER_ALIGNMENT == 0);
+
+    int32_t get_buffer_size_class(size_t size) {
+        if (size > STREAMING_BUFFER_MAX_SIZE) {
+            return -1;
+        }
+        const size_t classSize = std::bit_ceil(std::max(size, STREAMING_BUFFER_MIN_SIZE));
+        return std::countr_zero(classSize / STREAMING_BUFFER_MIN_SIZE);
+    }
+
+}
+
+#ifdef ASSET_STREAMER_IO_URING
+
+/// @brief The submission and completion rings of an io_uring instance, through the raw system calls.
+///
+/// The SQ ring is only written by the I/O thread, the CQ ring only read by it: the kernel is the other side of both.
+class AssetStreamer::IoUring {
+public:
+    /// Returns nullptr if io_uring, or its read operation, is unavailable.
+    static std::unique_ptr<IoUring> create(uint32_t entryCount) {
+        io_uring_params params {};
+        const int ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entryCount, &params));
+        if (ringFd < 0) {
+            VK_LOG_WARN("io_uring is unavailable ({}), streaming with blocking reads", std::strerror(errno));
+            return nullptr;
+        }
+
+        std::unique_ptr<IoUring> ring(new IoUring());
+        ring->_ringFd = ringFd;
+
+        // IORING_OP_READ came with Linux 5.6, along with the probe
+        if (!ring->is_read_supported() || (params.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+            VK_LOG_WARN("io_uring has no read operation on this kernel, streaming with blocking reads");
+            return nullptr;
+        }
+
+        // The SQ and CQ rings share one mapping (IORING_FEAT_SINGLE_MMAP), the SQEs have their own
+        ring->_ringSize = std::max(
+            params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe)
+        );
+        void* rings = mmap(nullptr, ring->_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (rings == MAP_FAILED) {
+            VK_LOG_WARN("Failed to map the io_uring rings ({}), streaming with blocking reads", std::strerror(errno));
+            return nullptr;
+        }
+        ring->_rings = static_cast<std::byte*>(rings);
+
+        ring->_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, ring->_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            VK_LOG_WARN("Failed to map the io_uring submission entries ({}), streaming with blocking reads", std::strerror(errno));
+            return nullptr;
+        }
+        ring->_sqes = static_cast<io_uring_sqe*>(sqes);
+
+        std::byte* base = ring->_rings;
+        ring->_sqTail = reinterpret_cast<uint32_t*>(base + params.sq_off.tail);
+        ring->_sqMask = *reinterpret_cast<uint32_t*>(base + params.sq_off.ring_mask);
+        ring->_sqArray = reinterpret_cast<uint32_t*>(base + params.sq_off.array);
+        ring->_cqHead = reinterpret_cast<uint32_t*>(base + params.cq_off.head);
+        ring->_cqTail = reinterpret_cast<uint32_t*>(base + params.cq_off.tail);
+        ring->_cqMask = *reinterpret_cast<uint32_t*>(base + params.cq_off.ring_mask);
+        ring->_cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+        return ring;
+    }
+
+    ~IoUring() {
+        if (_sqes != nullptr) {
+            munmap(_sqes, _sqesSize);
+        }
+        if (_rings != nullptr) {
+            munmap(_rings, _ringSize);
+        }
+        if (_ringFd >= 0) {
+            close(_ringFd);
+        }
+    }
+
+    /// Writes a read into the submission ring, submitted by the next submit_and_wait().
+    /// @attention At most entryCount reads in flight (the ring is never full then)
+    void queue_read(int fileDescriptor, std::byte* buffer, uint32_t size, uint64_t offset, uint64_t userData) {
+        const uint32_t tail = *_sqTail;
+        const uint32_t index = tail & _sqMask;
+
+        io_uring_sqe& sqe = _sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fileDescriptor;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = size;
+        sqe.off = offset;
+        sqe.user_data = userData;
+        _sqArray[index] = index;
+
+        // Publishes the entry to the kernel
+        std::atomic_ref<uint32_t>(*_sqTail).store(tail + 1, std::memory_order_release);
+        _unsubmittedCount++;
+    }
+
+    /// Submits the queued reads, and blocks until at least one read completed. Returns false on an unexpected error.
+    bool submit_and_wait() {
+        while (true) {
+            const long result = syscall(__NR_io_uring_enter, _ringFd, _unsubmittedCount, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result >= 0) {
+                // The entries the kernel didn't take stay in the ring, for the next call
+                _unsubmittedCount -= static_cast<uint32_t>(result);
+                return true;
+            }
+            // Interrupted by a signal, or out of kernel resources for now: the completions already there are reaped
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                return true;
+            }
+            VK_LOG_ERROR("io_uring_enter failed: {}", std::strerror(errno));
+            return false;
+        }
+    }
+
+    /// Takes the next completed read. Returns false if there is none.
+    bool pop_completion(uint64_t& userData, int32_t& result) {
+        const uint32_t head = *_cqHead;
+        if (head == std::atomic_ref<uint32_t>(*_cqTail).load(std::memory_order_acquire)) {
+            return false;
+        }
+        const io_uring_cqe& cqe = _cqes[head & _cqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        // Gives the entry back to the kernel
+        std::atomic_ref<uint32_t>(*_cqHead).store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    int _ringFd {-1};
+    std::byte* _rings {nullptr};
+    size_t _ringSize {0};
+    io_uring_sqe* _sqes {nullptr};
+    size_t _sqesSize {0};
+
+    uint32_t* _sqTail {nullptr};
+    uint32_t _sqMask {0};
+    uint32_t* _sqArray {nullptr};
+    uint32_t _unsubmittedCount {0};
+
+    uint32_t* _cqHead {nullptr};
+    uint32_t* _cqTail {nullptr};
+    uint32_t _cqMask {0};
+    io_uring_cqe* _cqes {nullptr};
+
+    bool is_read_supported() const {
+        constexpr uint32_t probeOpCount {256};
+        std::vector<std::byte> probeMemory(sizeof(io_uring_probe) + probeOpCount * sizeof(io_uring_probe_op));
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probeMemory.data());
+        if (syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_PROBE, probe, probeOpCount) < 0) {
+            return false;
+        }
+        return probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+};
+
+#else
+
+// No io_uring on this platform: the streamer always uses the pread threads
+class AssetStreamer::IoUring {
+public:
+    static std::unique_ptr<IoUring> create(uint32_t) { return nullptr; }
+
+    void queue_read(int, std::byte*, uint32_t, uint64_t, uint64_t) {}
+    bool submit_and_wait() { return false; }
+    bool pop_completion(uint64_t&, int32_t&) { return false; }
+};
+
+#endif
+
+AssetStreamer::AssetStreamer() = default;
+
+// Here, where IoUring is a complete type
+AssetStreamer::~AssetStreamer() = default;
+
+void AssetStreamer::init(JobSystem& jobSystem) {
+    _jobSystem = &jobSystem;
+    _bStopping = false;
+    _freeBuffers.resize(BUFFER_SIZE_CLASS_COUNT);
+
+    _ioUring = IoUring::create(STREAMING_MAX_READS_IN_FLIGHT);
+    if (_ioUring != nullptr) {
+        _threads.emplace_back([this]() { io_uring_thread_main(); });
+    }
+    else {
+        for (uint32_t i {0}; i < STREAMING_PREAD_THREAD_COUNT; i++) {
+            _threads.emplace_back([this, i]() { pread_thread_main(i); });
+        }
+    }
+
+    VK_LOG_SUCCESS("Initialized asset streaming ({})", get_stats().backend);
+}
+
+void AssetStreamer::destroy() {
+    {
+        std::lock_guard lock(_mutex);
+        _bStopping = true;
+        // The queued requests are dropped by the threads, the reads in flight are finished
+        for (auto& [id, state] : _pendingRequests) {
+            state->bCancelled.store(true, std::memory_order_release);
+        }
+    }
+    _queueCondition.notify_all();
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+    _threads.clear();
+
+    // The decode jobs queue their completion (dropped, as cancelled)
+    _jobSystem->wait(_decodeCounter);
+    {
+        std::lock_guard lock(_mutex);
+        for (const RequestPointer& state : _completedRequests) {
+            release_request(*state);
+        }
+        _completedRequests.clear();
+        _pendingRequests.clear();
+        _queue = {};
+        _queuedCount = 0;
+    }
+    _ioUring.reset();
+
+    std::lock_guard poolLock(_poolMutex);
+    for (std::vector<StreamBuffer>& freeBuffers : _freeBuffers) {
+        for (const StreamBuffer& buffer : freeBuffers) {
+            ::operator delete(buffer.data, std::align_val_t {STREAMING_BUFFER_ALIGNMENT});
+        }
+    }
+    _freeBuffers.clear();
+    _pooledBufferBytes = 0;
+}
+
+StreamRequestId AssetStreamer::submit(StreamRequest request) {
+    RequestPointer state = std::make_shared<RequestState>();
+    state->request = std::move(request);
+    {
+        std::lock_guard lock(_mutex);
+        state->id = _nextRequestId++;
+        state->sequence = _nextSequence++;
+        state->result.id = state->id;
+        state->bQueued = true;
+        _queue.push(state);
+        _pendingRequests.emplace(state->id, state);
+        _queuedCount++;
+    }
+    _queueCondition.notify_one();
+    return state->id;
+}
+
+bool AssetStreamer::cancel(StreamRequestId id) {
+    std::lock_guard lock(_mutex);
+    auto it = _pendingRequests.find(id);
+    if (it == _pendingRequests.end()) {
+        return false;
+    }
+
+    // Wherever the request is, its next stage drops it (and gives its buffer back)
+    RequestState& state = *it->second;
+    state.bCancelled.store(true, std::memory_order_release);
+    if (state.bQueued) {
+        _queuedCount--;
+    }
+    _pendingRequests.erase(it);
+    _cancelledCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+uint32_t AssetStreamer::dispatch_completions(uint32_t maxCount) {
+    ZONE("AssetStreamer::dispatch_completions");
+    std::vector<RequestPointer> requests {};
+    {
+        std::lock_guard lock(_mutex);
+        // Cancelled after they were queued here
+        std::erase_if(_completedRequests, [this](const RequestPointer& state) {
+            if (state->bCancelled.load(std::memory_order_acquire)) {
+                release_request(*state);
+                return true;
+            }
+            return false;
+        });
+        if (_completedRequests.empty() || maxCount == 0) {
+            return 0;
+        }
+        // Over budget: the most urgent go first, the others wait for the next call
+        if (_completedRequests.size() > maxCount) {
+            std::stable_sort(_completedRequests.begin(), _completedRequests.end(), [](const RequestPointer& a, const RequestPointer& b) {
+                return a->request.priority < b->request.priority;
+            });
+        }
+        const size_t count = std::min<size_t>(maxCount, _completedRequests.size());
+        requests.assign(_completedRequests.begin(), _completedRequests.begin() + count);
+        _completedRequests.erase(_completedRequests.begin(), _completedRequests.begin() + count);
+
+        // From here, cancel() doesn't find them anymore
+        for (const RequestPointer& state : requests) {
+            _pendingRequests.erase(state->id);
+        }
+    }
+
+    for (const RequestPointer& state : requests) {
+        if (state->result.status == StreamStatus::COMPLETE) {
+            _completedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            _failedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (state->request.complete) {
+            state->request.complete(state->result);
+        }
+        release_request(*state);
+    }
+    return static_cast<uint32_t>(requests.size());
+}
+
+AssetStreamerStats AssetStreamer::get_stats() const {
+    AssetStreamerStats stats {};
+    stats.backend = _ioUring != nullptr ? "io_uring" : "blocking pread threads";
+    {
+        std::lock_guard lock(_mutex);
+        stats.queuedCount = _queuedCount;
+        stats.completingCount = static_cast<uint32_t>(_completedRequests.size());
+    }
+    stats.readingCount = _readingCount.load(std::memory_order_relaxed);
+    stats.decodingCount = _decodingCount.load(std::memory_order_relaxed);
+    stats.completedCount = _completedCount.load(std::memory_order_relaxed);
+    stats.cancelledCount = _cancelledCount.load(std::memory_order_relaxed);
+    stats.failedCount = _failedCount.load(std::memory_order_relaxed);
+    stats.bytesRead = _bytesRead.load(std::memory_order_relaxed);
+    stats.pooledBufferBytes = _pooledBufferBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+AssetStreamer::RequestPointer AssetStreamer::wait_for_request(bool bBlock) {
+    std::unique_lock lock(_mutex);
+    while (true) {
+        if (bBlock) {
+            _queueCondition.wait(lock, [this]() { return _bStopping || !_queue.empty(); });
+        }
+        if (_bStopping || _queue.empty()) {
+            return nullptr;
+        }
+
+        RequestPointer state = _queue.top();
+        _queue.pop();
+        // Cancelled while queued (and already counted by cancel())
+        if (state->bCancelled.load(std::memory_order_acquire)) {
+            continue;
+        }
+        state->bQueued = false;
+        _queuedCount--;
+        return state;
+    }
+}
+
+bool AssetStreamer::begin_read(RequestState& state) {
+    _readingCount.fetch_add(1, std::memory_order_relaxed);
+    const std::string path = state.request.path.string();
+
+    state.fileDescriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (state.fileDescriptor < 0) {
+        VK_LOG_WARN("Streaming: failed to open {} ({})", path, std::strerror(errno));
+        return false;
+    }
+
+    struct stat fileStat {};
+    if (fstat(state.fileDescriptor, &fileStat) != 0) {
+        VK_LOG_WARN("Streaming: failed to stat {} ({})", path, std::strerror(errno));
+        return false;
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(fileStat.st_size);
+    const uint64_t offset = state.request.offset;
+    state.readSize = state.request.size > 0 ? state.request.size : fileSize - std::min(offset, fileSize);
+    if (offset > fileSize || state.readSize > fileSize - offset) {
+        VK_LOG_WARN("Streaming: {} bytes at offset {} are out of {} ({} bytes)", state.readSize, offset, path, fileSize);
+        return false;
+    }
+
+    state.buffer = acquire_buffer(state.readSize);
+    state.bytesDone = 0;
+    return true;
+}
+
+void AssetStreamer::finish_read(const RequestPointer& state, bool bSucceeded) {
+    if (state->fileDescriptor >= 0) {
+        close(state->fileDescriptor);
+        state->fileDescriptor = -1;
+    }
+    _readingCount.fetch_sub(1, std::memory_order_relaxed);
+    _bytesRead.fetch_add(state->bytesDone, std::memory_order_relaxed);
+
+    if (state->bCancelled.load(std::memory_order_acquire)) {
+        release_request(*state);
+        return;
+    }
+
+    StreamResult& result = state->result;
+    result.fileData = std::span<const std::byte>(state->buffer.data, bSucceeded ? state->readSize : 0);
+    if (!bSucceeded) {
+        result.status = StreamStatus::FAILED;
+        finish_request(state);
+        return;
+    }
+    if (!state->request.decode) {
+        finish_request(state);
+        return;
+    }
+
+    _decodingCount.fetch_add(1, std::memory_order_relaxed);
+    _jobSystem->run([this, state]() {
+        ZONE("AssetStreamer decode");
+        if (!state->bCancelled.load(std::memory_order_acquire)) {
+            // Jobs must not throw: a throwing decode fails its request
+            try {
+                if (!state->request.decode(state->result)) {
+                    VK_LOG_WARN("Streaming: failed to decode {}", state->request.path.string());
+                    state->result.status = StreamStatus::FAILED;
+                }
+            }
+            catch (const std::exception& exception) {
+                VK_LOG_WARN("Streaming: failed to decode {} ({})", state->request.path.string(), exception.what());
+                state->result.status = StreamStatus::FAILED;
+            }
+        }
+        _decodingCount.fetch_sub(1, std::memory_order_relaxed);
+        finish_request(state);
+    }, &_decodeCounter);
+}
+
+void AssetStreamer::finish_request(const RequestPointer& state) {
+    {
+        std::lock_guard lock(_mutex);
+        // Checked under the lock: cancel() can't miss a request between here and dispatch_completions()
+        if (!state->bCancelled.load(std::memory_order_acquire)) {
+            _completedRequests.push_back(state);
+            return;
+        }
+    }
+    release_request(*state);
+}
+
+void AssetStreamer::release_request(RequestState& state) {
+    release_buffer(state.buffer);
+    state.result.fileData = {};
+    state.result.decodedData = {};
+}
+
+void AssetStreamer::io_uring_thread_main() {
+    vktrace::set_thread_name("Asset Streaming");
+
+    // The reads in flight, by slot (the user data of their submission)
+    std::vector<RequestPointer> slots(STREAMING_MAX_READS_IN_FLIGHT);
+    std::vector<uint32_t> freeSlots {};
+    for (uint32_t slot {STREAMING_MAX_READS_IN_FLIGHT}; slot > 0; slot--) {
+        freeSlots.push_back(slot - 1);
+    }
+
+    auto queue_read_part = [&](uint32_t slot) {
+        RequestState& state = *slots[slot];
+        const uint64_t partSize = std::min(state.readSize - state.bytesDone, MAX_READ_PART_SIZE);
+        _ioUring->queue_read(state.fileDescriptor, state.buffer.data + state.bytesDone, static_cast<uint32_t>(partSize), state.request.offset + state.bytesDone, slot);
+    };
+    auto finish_slot = [&](uint32_t slot, bool bSucceeded) {
+        finish_read(slots[slot], bSucceeded);
+        slots[slot] = nullptr;
+        freeSlots.push_back(slot);
+    };
+
+    while (true) {
+        // Fills the free slots with the most urgent requests: one system call submits them all. Blocks for new
+        // requests only when no read is in flight (otherwise, the new ones are taken after the next completion).
+        while (!freeSlots.empty()) {
+            const bool bIdle = freeSlots.size() == STREAMING_MAX_READS_IN_FLIGHT;
+            RequestPointer state = wait_for_request(bIdle);
+            if (state == nullptr) {
+                break;
+            }
+            const bool bOpened = begin_read(*state);
+            if (!bOpened || state->readSize == 0) {
+                finish_read(state, bOpened);
+                continue;
+            }
+            const uint32_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            slots[slot] = std::move(state);
+            queue_read_part(slot);
+        }
+        if (freeSlots.size() == STREAMING_MAX_READS_IN_FLIGHT) {
+            // Nothing in flight, and nothing queued: stopping
+            std::lock_guard lock(_mutex);
+            if (_bStopping) {
+                return;
+            }
+            continue;
+        }
+
+        ZONE("io_uring wait");
+        if (!_ioUring->submit_and_wait()) {
+            // The reads in flight are failed, but their buffers are leaked: the kernel may still write into them
+            VK_LOG_ERROR("Streaming: io_uring failed, falling back to blocking reads");
+            for (uint32_t slot {0}; slot < STREAMING_MAX_READS_IN_FLIGHT; slot++) {
+                if (slots[slot] != nullptr) {
+                    slots[slot]->buffer = StreamBuffer {};
+                    finish_slot(slot, false);
+                }
+            }
+            pread_thread_main(0);
+            return;
+        }
+
+        uint64_t userData {0};
+        int32_t result {0};
+        while (_ioUring->pop_completion(userData, result)) {
+            const uint32_t slot = static_cast<uint32_t>(userData);
+            RequestState& state = *slots[slot];
+            if (result == -EINTR || result == -EAGAIN) {
+                queue_read_part(slot);
+            }
+            else if (result <= 0) {
+                // An error, or the end of the file before the end of the read (the file shrank since begin_read())
+                VK_LOG_WARN("Streaming: failed to read {} ({})", state.request.path.string(), result < 0 ? std::strerror(-result) : "end of file");
+                finish_slot(slot, false);
+            }
+            else {
+                // A short read goes on from where it stopped
+                state.bytesDone += static_cast<uint64_t>(result);
+                if (state.bytesDone < state.readSize) {
+                    queue_read_part(slot);
+                }
+                else {
+                    finish_slot(slot, true);
+                }
+            }
+        }
+    }
+}
+
+void AssetStreamer::pread_thread_main(uint32_t threadIndex) {
+    if (_ioUring == nullptr) {
+        const std::string threadName = "Asset Streaming " + std::to_string(threadIndex);
+        vktrace::set_thread_name(threadName.c_str());
+    }
+
+    while (RequestPointer state = wait_for_request(true)) {
+        if (!begin_read(*state)) {
+            finish_read(state, false);
+            continue;
+        }
+
+        bool bSucceeded {true};
+        while (state->bytesDone < state->readSize && !state->bCancelled.load(std::memory_order_relaxed)) {
+            const uint64_t partSize = std::min(state->readSize - state->bytesDone, MAX_READ_PART_SIZE);
+            const ssize_t result = pread(state->fileDescriptor, state->buffer.data + state->bytesDone, static_cast<size_t>(partSize), static_cast<off_t>(state->request.offset + state->bytesDone));
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                VK_LOG_WARN("Streaming: failed to read {} ({})", state->request.path.string(), result < 0 ? std::strerror(errno) : "end of file");
+                bSucceeded = false;
+                break;
+            }
+            state->bytesDone += static_cast<uint64_t>(result);
+        }
+        finish_read(state, bSucceeded);
+    }
+}
+
+AssetStreamer::StreamBuffer AssetStreamer::acquire_buffer(size_t size) {
+    StreamBuffer buffer {};
+    buffer.sizeClass = get_buffer_size_class(size);
+    if (buffer.sizeClass >= 0) {
+        std::lock_guard lock(_poolMutex);
+        std::vector<StreamBuffer>& freeBuffers = _freeBuffers[buffer.sizeClass];
+        if (!freeBuffers.empty()) {
+            buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            return buffer;
+        }
+    }
+
+    // A new buffer: pooled ones are a whole size class, the others just large enough
+    buffer.capacity = buffer.sizeClass >= 0
+        ? STREAMING_BUFFER_MIN_SIZE << buffer.sizeClass
+        : (size + STREAMING_BUFFER_ALIGNMENT - 1) / STREAMING_BUFFER_ALIGNMENT * STREAMING_BUFFER_ALIGNMENT;
+    buffer.data = static_cast<std::byte*>(::operator new(buffer.capacity, std::align_val_t {STREAMING_BUFFER_ALIGNMENT}));
+    if (buffer.sizeClass >= 0) {
+        _pooledBufferBytes.fetch_add(buffer.capacity, std::memory_order_relaxed);
+    }
+    return buffer;
+}
+
+void AssetStreamer::release_buffer(StreamBuffer& buffer) {
+    if (buffer.data == nullptr) {
+        return;
+    }
+    if (buffer.sizeClass >= 0) {
+        std::lock_guard lock(_poolMutex);
+        _freeBuffers[buffer.sizeClass].push_back(buffer);
+    }
+    else {
+        ::operator delete(buffer.data, std::align_val_t {STREAMING_BUFFER_ALIGNMENT});
+    }
+    buffer = StreamBuffer {};
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "vk_jobs.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Handle to a read request of an AssetStreamer.
+using StreamRequestId = uint64_t;
+constexpr StreamRequestId STREAM_REQUEST_NONE {0};
+
+/// @brief Reads in flight at once (the io_uring queue depth, or the pread threads' share of the queue).
+constexpr uint32_t STREAMING_MAX_READS_IN_FLIGHT {32};
+/// @brief Blocking pread threads, when io_uring is unavailable.
+constexpr uint32_t STREAMING_PREAD_THREAD_COUNT {2};
+/// @brief Alignment of the read buffers (a page, as O_DIRECT and most decoders want).
+constexpr size_t STREAMING_BUFFER_ALIGNMENT {4096};
+/// @brief Size classes of the pooled read buffers: powers of two from the smallest to the largest. Larger reads get
+/// a buffer of their own, freed after use.
+constexpr size_t STREAMING_BUFFER_MIN_SIZE {64 * 1024};
+constexpr size_t STREAMING_BUFFER_MAX_SIZE {16 * 1024 * 1024};
+
+/// @brief Order in which the queued reads are issued. Requests of the same priority are read first-come first-served.
+enum class StreamPriority : uint8_t {
+	CRITICAL = 0,   // Needed for the current frame (e.g. the lowest mips of a visible texture)
+	HIGH,
+	NORMAL,
+	LOW             // Prefetching
+};
+
+/// @brief How a request ended, given to its completion.
+enum class StreamStatus : uint8_t {
+	COMPLETE,
+	FAILED      // The file could not be opened or read, or the decode failed (logged)
+};
+
+/// @brief The data of a request, from the read to the completion.
+struct StreamResult {
+	StreamRequestId id {STREAM_REQUEST_NONE};
+	StreamStatus status {StreamStatus::COMPLETE};
+	/// The bytes read, in a pooled buffer: valid until the completion returns
+	std::span<const std::byte> fileData {};
+	/// Written by the decode, if it doesn't work in place: the completion then uses it instead of fileData
+	std::vector<std::byte> decodedData {};
+
+	std::span<const std::byte> get_data() const { return decodedData.empty() ? fileData : std::span<const std::byte>(decodedData); }
+};
+
+/// @brief A read of a byte range of a file.
+struct StreamRequest {
+	std::filesystem::path path {};
+	uint64_t offset {0};
+	uint64_t size {0};                                    // 0: up to the end of the file
+	StreamPriority priority {StreamPriority::NORMAL};
+
+	/// Runs on a job after the read (may be empty). Returns false if the data is invalid.
+	/// @attention Must not throw (jobs must not throw)
+	std::function<bool(StreamResult& result)> decode {};
+	/// Runs on the thread calling AssetStreamer::dispatch_completions(), e.g. to queue the GPU upload of the data.
+	std::function<void(StreamResult& result)> complete {};
+};
+
+/// @brief Counters of an AssetStreamer, since its init().
+struct AssetStreamerStats {
+	const char* backend {""};
+	uint32_t queuedCount {0};       // Waiting for their read
+	uint32_t readingCount {0};
+	uint32_t decodingCount {0};
+	uint32_t completingCount {0};   // Waiting for dispatch_completions()
+	uint64_t completedCount {0};
+	uint64_t cancelledCount {0};
+	uint64_t failedCount {0};
+	uint64_t bytesRead {0};
+	uint64_t pooledBufferBytes {0};  // Allocated by the buffer pool, in use or not
+};
+
+/// @brief Reads asset files in the background, decodes them on the job system, and hands them back to the frame.
+///
+/// submit() queues a request and returns right away. A dedicated I/O thread takes the queued requests by priority
+/// and issues their reads in batches through io_uring (Linux): up to STREAMING_MAX_READS_IN_FLIGHT at once, with a
+/// single system call per batch. Without io_uring (other platforms, older kernels, or when disabled by a seccomp
+/// policy), STREAMING_PREAD_THREAD_COUNT threads read the requests with blocking preads instead.
+///
+/// The data is read into page-aligned buffers from a pool (per power-of-two size class), so streaming doesn't
+/// allocate once the pool is warm. A read is then handed to a decode job, and its completion is queued for
+/// dispatch_completions(), which the render thread calls once per frame, with a budget, before recording. The
+/// completions queue the GPU uploads (see UploadQueue): the frame never waits for a file.
+///
+/// cancel() drops a request wherever it is: a queued request is never read, the data of a read already issued is
+/// dropped once it arrives. Cancelled requests don't run their completion.
+/// @note Thread-safe: requests may be submitted and cancelled from any thread
+class AssetStreamer {
+public:
+	AssetStreamer();
+	~AssetStreamer();
+
+	/// Starts the I/O thread (io_uring), or the pread threads if io_uring is unavailable.
+	void init(JobSystem& jobSystem);
+	/// Drops the queued requests, waits for the reads and decodes in progress, then stops the threads.
+	/// The completions not dispatched yet are dropped.
+	void destroy();
+
+	StreamRequestId submit(StreamRequest request);
+	/// True if the request was still pending (its completion won't run), false if it already completed (or was
+	/// already dispatched).
+	bool cancel(StreamRequestId id);
+
+	/// Runs the completions of the requests done reading and decoding, on the calling thread, up to maxCount.
+	/// Returns the number run.
+	uint32_t dispatch_completions(uint32_t maxCount = UINT32_MAX);
+
+	AssetStreamerStats get_stats() const;
+	bool is_using_io_uring() const { return _ioUring != nullptr; }
+
+private:
+	// A read buffer of the pool
+	struct StreamBuffer {
+		std::byte* data {nullptr};
+		size_t capacity {0};
+		int32_t sizeClass {-1};   // -1: not pooled (larger than STREAMING_BUFFER_MAX_SIZE)
+	};
+
+	struct RequestState {
+		StreamRequestId id {STREAM_REQUEST_NONE};
+		StreamRequest request {};
+		uint64_t sequence {0};                      // Submission order, among the requests of the same priority
+		std::atomic<bool> bCancelled {false};
+		bool bQueued {false};                       // Still in the queue (guarded by the streamer's mutex)
+
+		// Set by the reading thread
+		int fileDescriptor {-1};
+		StreamBuffer buffer {};
+		uint64_t readSize {0};
+		uint64_t bytesDone {0};
+		StreamResult result {};
+	};
+	using RequestPointer = std::shared_ptr<RequestState>;
+
+	struct QueueOrder {
+		bool operator()(const RequestPointer& a, const RequestPointer& b) const {
+			// A max-heap: the "largest" is the most urgent, then the oldest
+			if (a->request.priority != b->request.priority) {
+				return a->request.priority > b->request.priority;
+			}
+			return a->sequence > b->sequence;
+		}
+	};
+
+	class IoUring;
+
+	JobSystem* _jobSystem {nullptr};
+	std::unique_ptr<IoUring> _ioUring {};
+	std::vector<std::thread> _threads {};
+
+	// Requests waiting for their read, by priority, and every request not completed yet (for cancel())
+	mutable std::mutex _mutex {};
+	std::condition_variable _queueCondition {};
+	std::priority_queue<RequestPointer, std::vector<RequestPointer>, QueueOrder> _queue {};
+	std::unordered_map<StreamRequestId, RequestPointer> _pendingRequests {};
+	uint32_t _queuedCount {0};   // The queue also holds the cancelled requests, until they are popped
+	StreamRequestId _nextRequestId {1};
+	uint64_t _nextSequence {0};
+	bool _bStopping {false};
+
+	// Done reading and decoding, waiting for dispatch_completions()
+	std::vector<RequestPointer> _completedRequests {};
+	JobCounter _decodeCounter {};
+
+	// Free buffers, per size class
+	mutable std::mutex _poolMutex {};
+	std::vector<std::vector<StreamBuffer>> _freeBuffers {};
+
+	std::atomic<uint32_t> _readingCount {0};
+	std::atomic<uint32_t> _decodingCount {0};
+	std::atomic<uint64_t> _completedCount {0};
+	std::atomic<uint64_t> _cancelledCount {0};
+	std::atomic<uint64_t> _failedCount {0};
+	std::atomic<uint64_t> _bytesRead {0};
+	std::atomic<uint64_t> _pooledBufferBytes {0};
+
+	/// Blocks until a request is queued (or destroy()). Returns nullptr when stopping. Skips the cancelled ones.
+	RequestPointer wait_for_request(bool bBlock);
+	/// Opens the file and takes a buffer for the read. False if it failed (the request is then finished).
+	bool begin_read(RequestState& state);
+	/// Closes the file, and hands the request to its decode job (or drops it if it was cancelled).
+	void finish_read(const RequestPointer& state, bool bSucceeded);
+	/// Queues the completion, or drops the request if it was cancelled meanwhile.
+	void finish_request(const RequestPointer& state);
+	void release_request(RequestState& state);
+
+	void io_uring_thread_main();
+	void pread_thread_main(uint32_t threadIndex);
+
+	StreamBuffer acquire_buffer(size_t size);
+	void release_buffer(StreamBuffer& buffer);
+};
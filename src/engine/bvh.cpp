@@ -0,0 +1,218 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+#include <glm/common.hpp>
+
+#include "vk_logger.h"
+
+// Relative cost of traversing a node, against intersecting one primitive
+constexpr float BVH_TRAVERSAL_COST {1.0f};
+
+namespace {
+    struct Bounds {
+        glm::vec3 min {std::numeric_limits<float>::max()};
+        glm::vec3 max {std::numeric_limits<float>::lowest()};
+
+        void grow(const glm::vec3& point) {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+        void grow(const Bounds& other) {
+            min = glm::min(min, other.min);
+            max = glm::max(max, other.max);
+        }
+        float surface_area() const {
+            if (min.x > max.x) {
+                return 0.f; // empty
+            }
+            const glm::vec3 extent = max - min;
+            return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+        }
+    };
+
+    struct Bin {
+        Bounds bounds {};
+        uint32_t primitiveCount {0};
+    };
+}
+
+
+void BVHBuilder::build(std::span<const BVHPrimitiveBounds> primitiveBounds) {
+    _nodes.clear();
+    _depth = 0;
+    _primitiveOrder.clear();
+    _centroids.clear();
+
+    const uint32_t primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+    if (primitiveCount == 0) {
+        return;
+    }
+
+    _primitiveOrder.resize(primitiveCount);
+    _centroids.resize(primitiveCount);
+    for (uint32_t i {0}; i < primitiveCount; i++) {
+        _primitiveOrder[i] = i;
+        _centroids[i] = (primitiveBounds[i].aabbMin + primitiveBounds[i].aabbMax) * 0.5f;
+    }
+
+    // A binary tree with N leaves at most has 2N - 1 nodes
+    _nodes.reserve(2 * primitiveCount - 1);
+
+    GPUBVHNode root {};
+    root.leftFirst = 0;
+    root.primitiveCount = primitiveCount;
+    update_node_bounds(root, primitiveBounds);
+    _nodes.push_back(root);
+
+    // Subdivide iteratively (deep trees would overflow the call-stack with recursion): the nodes, with their depth
+    std::vector<std::pair<uint32_t, uint32_t>> nodesToSplit {{0, 0}};
+    while (!nodesToSplit.empty()) {
+        const auto [nodeIndex, depth] = nodesToSplit.back();
+        nodesToSplit.pop_back();
+        GPUBVHNode node = _nodes[nodeIndex];
+        _depth = std::max(_depth, depth);
+
+        // The GPU traversal stack has room for BVH_MAX_DEPTH levels
+        if (depth == BVH_MAX_DEPTH) {
+            continue;
+        }
+
+        int axis {0};
+        float splitPosition {0.f};
+        const float splitCost = find_best_split(node, primitiveBounds, axis, splitPosition);
+        const float leafCost = static_cast<float>(node.primitiveCount);
+
+        // Stay a leaf when splitting is impossible, or not worth it for an already small node
+        if (splitCost == std::numeric_limits<float>::infinity()) {
+            continue;
+        }
+        if (node.primitiveCount <= _maxLeafSize && splitCost >= leafCost) {
+            continue;
+        }
+
+        // Partition the node's primitives around the split plane
+        auto first = _primitiveOrder.begin() + node.leftFirst;
+        auto last = first + node.primitiveCount;
+        auto middle = std::partition(first, last, [&](uint32_t primitiveIndex) {
+            return _centroids[primitiveIndex][axis] < splitPosition;
+        });
+        const uint32_t leftCount = static_cast<uint32_t>(middle - first);
+        if (leftCount == 0 || leftCount == node.primitiveCount) {
+            continue;
+        }
+
+        // Create the two children next to each other
+        const uint32_t leftChildIndex = static_cast<uint32_t>(_nodes.size());
+
+        GPUBVHNode leftChild {};
+        leftChild.leftFirst = node.leftFirst;
+        leftChild.primitiveCount = leftCount;
+        update_node_bounds(leftChild, primitiveBounds);
+
+        GPUBVHNode rightChild {};
+        rightChild.leftFirst = node.leftFirst + leftCount;
+        rightChild.primitiveCount = node.primitiveCount - leftCount;
+        update_node_bounds(rightChild, primitiveBounds);
+
+        _nodes.push_back(leftChild);
+        _nodes.push_back(rightChild);
+
+        // The node becomes an interior node
+        _nodes[nodeIndex].leftFirst = leftChildIndex;
+        _nodes[nodeIndex].primitiveCount = 0;
+
+        nodesToSplit.emplace_back(leftChildIndex, depth + 1);
+        nodesToSplit.emplace_back(leftChildIndex + 1, depth + 1);
+    }
+    assert(_depth <= BVH_MAX_DEPTH);
+
+    VK_LOG_INFO("Built SAH BVH: {} primitives, {} nodes, depth {}", primitiveCount, _nodes.size(), _depth);
+}
+
+void BVHBuilder::update_node_bounds(GPUBVHNode& node, std::span<const BVHPrimitiveBounds> primitiveBounds) const {
+    Bounds bounds {};
+    for (uint32_t i {0}; i < node.primitiveCount; i++) {
+        const BVHPrimitiveBounds& primitive = primitiveBounds[_primitiveOrder[node.leftFirst + i]];
+        bounds.grow(primitive.aabbMin);
+        bounds.grow(primitive.aabbMax);
+    }
+    node.aabbMin = bounds.min;
+    node.aabbMax = bounds.max;
+}
+
+float BVHBuilder::find_best_split(const GPUBVHNode& node, std::span<const BVHPrimitiveBounds> primitiveBounds, int& outAxis, float& outSplitPosition) const {
+    float bestCost = std::numeric_limits<float>::infinity();
+    if (node.primitiveCount <= 1) {
+        return bestCost;
+    }
+
+    // Bin by centroid, so the bins are spread over the range where the primitives actually are
+    Bounds centroidBounds {};
+    for (uint32_t i {0}; i < node.primitiveCount; i++) {
+        centroidBounds.grow(_centroids[_primitiveOrder[node.leftFirst + i]]);
+    }
+
+    Bounds nodeBounds {node.aabbMin, node.aabbMax};
+    const float nodeArea = nodeBounds.surface_area();
+    if (nodeArea <= 0.f) {
+        return bestCost;
+    }
+
+    std::vector<Bin> bins(_binCount);
+    std::vector<float> leftArea(_binCount - 1), rightArea(_binCount - 1);
+    std::vector<uint32_t> leftCount(_binCount - 1), rightCount(_binCount - 1);
+
+    for (int axis {0}; axis < 3; axis++) {
+        const float axisMin = centroidBounds.min[axis];
+        const float axisMax = centroidBounds.max[axis];
+        if (axisMin == axisMax) {
+            continue; // All centroids on one plane along this axis
+        }
+
+        // Fill the bins
+        std::fill(bins.begin(), bins.end(), Bin {});
+        const float binScale = static_cast<float>(_binCount) / (axisMax - axisMin);
+        for (uint32_t i {0}; i < node.primitiveCount; i++) {
+            const uint32_t primitiveIndex = _primitiveOrder[node.leftFirst + i];
+            const uint32_t binIndex = std::min(_binCount - 1, static_cast<uint32_t>((_centroids[primitiveIndex][axis] - axisMin) * binScale));
+            bins[binIndex].primitiveCount++;
+            bins[binIndex].bounds.grow(primitiveBounds[primitiveIndex].aabbMin);
+            bins[binIndex].bounds.grow(primitiveBounds[primitiveIndex].aabbMax);
+        }
+
+        // Sweep from both sides to get the area and count on each side of every bin boundary
+        Bounds leftBounds {}, rightBounds {};
+        uint32_t leftSum {0}, rightSum {0};
+        for (uint32_t i {0}; i < _binCount - 1; i++) {
+            leftSum += bins[i].primitiveCount;
+            leftBounds.grow(bins[i].bounds);
+            leftCount[i] = leftSum;
+            leftArea[i] = leftBounds.surface_area();
+
+            rightSum += bins[_binCount - 1 - i].primitiveCount;
+            rightBounds.grow(bins[_binCount - 1 - i].bounds);
+            rightCount[_binCount - 2 - i] = rightSum;
+            rightArea[_binCount - 2 - i] = rightBounds.surface_area();
+        }
+
+        // Evaluate the SAH at every boundary
+        const float binWidth = (axisMax - axisMin) / static_cast<float>(_binCount);
+        for (uint32_t i {0}; i < _binCount - 1; i++) {
+            if (leftCount[i] == 0 || rightCount[i] == 0) {
+                continue;
+            }
+            const float cost = BVH_TRAVERSAL_COST + (leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i]) / nodeArea;
+            if (cost < bestCost) {
+                bestCost = cost;
+                outAxis = axis;
+                outSplitPosition = axisMin + binWidth * static_cast<float>(i + 1);
+            }
+        }
+    }
+
+    return bestCost;
+}
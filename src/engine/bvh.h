@@ -0,0 +1,61 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <glm/vec3.hpp>
+
+/// @brief Deepest level of the built trees (the root is at depth 0): the nodes there stay leaves, however many
+/// primitives they hold. The nearest-child-first traversal holds at most one node per level, plus the one being split.
+/// @attention Must be BVH_STACK_SIZE - 1 in raytraced_scene.comp
+constexpr uint32_t BVH_MAX_DEPTH {31};
+
+/// @brief A node of the flattened BVH, as uploaded to the GPU.
+/// @attention Must match the @code BVHNode@endcode struct in raytraced_scene.comp (std430, 32 bytes)
+///
+/// Interior node (primitiveCount == 0): the two children are at indices leftFirst and leftFirst + 1.
+/// Leaf node: holds the primitives [leftFirst, leftFirst + primitiveCount) of the BVH-ordered primitive array.
+struct GPUBVHNode {
+	glm::vec3 aabbMin;
+	uint32_t leftFirst;
+	glm::vec3 aabbMax;
+	uint32_t primitiveCount;
+};
+
+/// @brief World-space bounds of one primitive fed to the BVHBuilder.
+struct BVHPrimitiveBounds {
+	glm::vec3 aabbMin;
+	glm::vec3 aabbMax;
+};
+
+/// @brief Builds a bounding volume hierarchy using the binned Surface Area Heuristic (SAH).
+///
+/// The result is a flat node array (root at index 0, siblings stored next to each other) and the order in which the
+/// primitives must be laid out, so that every leaf references a contiguous range of them.
+class BVHBuilder {
+public:
+	/// @param binCount     Number of SAH bins evaluated per axis, for each split
+	/// @param maxLeafSize  Nodes with more primitives than this are always split (when their centroids allow it, above
+	/// BVH_MAX_DEPTH)
+	explicit BVHBuilder(uint32_t binCount = 16, uint32_t maxLeafSize = 4) : _binCount(binCount), _maxLeafSize(maxLeafSize) {}
+
+	void build(std::span<const BVHPrimitiveBounds> primitiveBounds);
+
+	const std::vector<GPUBVHNode>& get_nodes() const { return _nodes; }
+	/// Depth of the deepest leaf of the last build, at most BVH_MAX_DEPTH
+	uint32_t get_depth() const { return _depth; }
+	/// Entry i is the index (in the input array) of the i-th primitive in BVH order
+	const std::vector<uint32_t>& get_primitive_order() const { return _primitiveOrder; }
+
+private:
+	uint32_t _binCount;
+	uint32_t _maxLeafSize;
+
+	std::vector<GPUBVHNode> _nodes {};
+	uint32_t _depth {0};
+	std::vector<uint32_t> _primitiveOrder {};
+	std::vector<glm::vec3> _centroids {};
+
+	void update_node_bounds(GPUBVHNode& node, std::span<const BVHPrimitiveBounds> primitiveBounds) const;
+	/// Returns the SAH cost of the best split found, or +infinity when the node cannot be split.
+	float find_best_split(const GPUBVHNode& node, std::span<const BVHPrimitiveBounds> primitiveBounds, int& outAxis, float& outSplitPosition) const;
+};
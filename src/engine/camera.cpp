@@ -1 +1,23 @@
 #include "camera.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+glm::mat4 Camera::get_view_matrix() const {
+    // The camera's world transform is translation * rotation; the view matrix is its inverse
+    glm::mat4 cameraTranslation = glm::translate(glm::mat4(1.f), position);
+    glm::mat4 cameraRotation = glm::rotate(glm::mat4(1.f), yaw, glm::vec3(0.f, 1.f, 0.f));
+    cameraRotation = glm::rotate(cameraRotation, pitch, glm::vec3(1.f, 0.f, 0.f));
+    return glm::inverse(cameraTranslation * cameraRotation);
+}
+
+glm::mat4 Camera::get_projection_matrix(float aspectRatio) const {
+    // Right-handed, depth in [0, 1]
+    glm::mat4 projection = glm::perspectiveRH_ZO(verticalFov, aspectRatio, nearPlane, farPlane);
+    // Vulkan's clip-space Y points down
+    projection[1][1] *= -1.f;
+    return projection;
+}
+
+glm::mat4 Camera::get_view_projection_matrix(float aspectRatio) const {
+    return get_projection_matrix(aspectRatio) * get_view_matrix();
+}
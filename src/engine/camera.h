@@ -1,7 +1,24 @@
+#pragma once
 
 #include "vk_types.h"
 
+#include <glm/vec3.hpp>
+
+/// @brief A simple perspective camera, producing the view and projection matrices used by the renderer.
+///
+/// Orientation is stored as yaw (around +Y) and pitch (around +X), in radians.
+/// The projection maps depth to [0, 1] (Vulkan convention) with the Y-axis flipped for Vulkan clip-space.
 class Camera {
 public:
+	glm::vec3 position {0.f, 1.f, 5.f};
+	float yaw {0.f};
+	float pitch {0.f};
+
+	float verticalFov {1.2217305f}; // 70 degrees
+	float nearPlane {0.1f};
+	float farPlane {1000.f};
 
+	glm::mat4 get_view_matrix() const;
+	glm::mat4 get_projection_matrix(float aspectRatio) const;
+	glm::mat4 get_view_projection_matrix(float aspectRatio) const;
 };
@@ -0,0 +1,242 @@
+#include "ecs.h"
+
+#include <algorithm>
+#include <bit>
+#include <mutex>
+#include <new>
+
+#include "vk_logger.h"
+
+namespace {
+
+    // The registered component types: registration happens once per type, lookups are lock-free afterwards
+    std::array<ComponentTypeInfo, ECS_MAX_COMPONENT_TYPES> componentTypeInfos {};
+    std::atomic<uint32_t> componentTypeCount {0};
+    std::mutex componentTypeMutex {};
+
+    // Chunks are aligned for the widest component alignment
+    constexpr std::align_val_t ECS_CHUNK_ALIGNMENT {64};
+
+    size_t align_up(size_t offset, size_t alignment) {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+}
+
+uint32_t ecs_detail::register_component_type(uint32_t size, uint32_t alignment) {
+    std::scoped_lock lock {componentTypeMutex};
+    const uint32_t componentTypeId = componentTypeCount.load(std::memory_order_relaxed);
+    if (componentTypeId >= ECS_MAX_COMPONENT_TYPES) {
+        VK_LOG_ERROR("ECS: more than {} component types", ECS_MAX_COMPONENT_TYPES);
+        throw std::runtime_error("ECS: too many component types");
+    }
+    if (alignment > static_cast<uint32_t>(ECS_CHUNK_ALIGNMENT)) {
+        VK_LOG_ERROR("ECS: component alignment {} is over the chunk alignment", alignment);
+        throw std::runtime_error("ECS: component alignment is over the chunk alignment");
+    }
+
+    componentTypeInfos[componentTypeId] = ComponentTypeInfo {size, alignment};
+    componentTypeCount.store(componentTypeId + 1, std::memory_order_release);
+    return componentTypeId;
+}
+
+const ComponentTypeInfo& ecs_detail::get_component_type_info(uint32_t componentTypeId) {
+    return componentTypeInfos[componentTypeId];
+}
+
+
+// Archetype method definitions:
+
+Archetype::Archetype(ComponentMask mask) : _mask(mask) {
+    _columnOffsets.fill(UINT32_MAX);
+
+    // The most entities whose handles and components (each array aligned) fit in a chunk
+    size_t bytesPerEntity {sizeof(Entity)};
+    size_t alignmentPadding {0};
+    for (uint32_t componentTypeId {0}; componentTypeId < ECS_MAX_COMPONENT_TYPES; componentTypeId++) {
+        if ((mask & (ComponentMask {1} << componentTypeId)) != 0) {
+            const ComponentTypeInfo& typeInfo = ecs_detail::get_component_type_info(componentTypeId);
+            bytesPerEntity += typeInfo.size;
+            alignmentPadding += typeInfo.alignment - 1;
+        }
+    }
+    _chunkCapacity = static_cast<uint32_t>((ECS_CHUNK_SIZE - alignmentPadding) / bytesPerEntity);
+
+    // Lay out the arrays: entity handles first, then the components in type-id order
+    size_t offset {sizeof(Entity) * _chunkCapacity};
+    for (uint32_t componentTypeId {0}; componentTypeId < ECS_MAX_COMPONENT_TYPES; componentTypeId++) {
+        if ((mask & (ComponentMask {1} << componentTypeId)) != 0) {
+            const ComponentTypeInfo& typeInfo = ecs_detail::get_component_type_info(componentTypeId);
+            offset = align_up(offset, typeInfo.alignment);
+            _columnOffsets[componentTypeId] = static_cast<uint32_t>(offset);
+            offset += size_t {typeInfo.size} * _chunkCapacity;
+        }
+    }
+}
+
+Archetype::~Archetype() {
+    for (ArchetypeChunk* chunk : _chunks) {
+        ::operator delete(chunk->data, ECS_CHUNK_ALIGNMENT);
+        delete chunk;
+    }
+}
+
+uint32_t Archetype::get_entity_count() const {
+    return _chunks.empty() ? 0 : static_cast<uint32_t>(_chunks.size() - 1) * _chunkCapacity + _chunks.back()->count;
+}
+
+std::pair<uint32_t, uint32_t> Archetype::push_entity(Entity entity) {
+    if (_chunks.empty() || _chunks.back()->count == _chunkCapacity) {
+        ArchetypeChunk* chunk = new ArchetypeChunk {};
+        chunk->archetype = this;
+        chunk->data = static_cast<std::byte*>(::operator new(ECS_CHUNK_SIZE, ECS_CHUNK_ALIGNMENT));
+        _chunks.push_back(chunk);
+    }
+
+    ArchetypeChunk* chunk = _chunks.back();
+    const uint32_t row = chunk->count++;
+    chunk->get_entities()[row] = entity;
+    return {static_cast<uint32_t>(_chunks.size() - 1), row};
+}
+
+Entity Archetype::remove_entity(uint32_t chunkIndex, uint32_t row) {
+    ArchetypeChunk* lastChunk = _chunks.back();
+    const uint32_t lastRow = lastChunk->count - 1;
+    Entity movedEntity {};
+
+    // Fill the hole with the last entity, so the chunks stay packed
+    if (_chunks[chunkIndex] != lastChunk || row != lastRow) {
+        ArchetypeChunk* chunk = _chunks[chunkIndex];
+        movedEntity = lastChunk->get_entities()[lastRow];
+        chunk->get_entities()[row] = movedEntity;
+
+        for (uint32_t componentTypeId {0}; componentTypeId < ECS_MAX_COMPONENT_TYPES; componentTypeId++) {
+            if ((_mask & (ComponentMask {1} << componentTypeId)) != 0) {
+                const size_t size = ecs_detail::get_component_type_info(componentTypeId).size;
+                std::memcpy(chunk->data + _columnOffsets[componentTypeId] + row * size,
+                    lastChunk->data + _columnOffsets[componentTypeId] + lastRow * size, size);
+            }
+        }
+    }
+
+    lastChunk->count--;
+    if (lastChunk->count == 0) {
+        ::operator delete(lastChunk->data, ECS_CHUNK_ALIGNMENT);
+        delete lastChunk;
+        _chunks.pop_back();
+    }
+    return movedEntity;
+}
+
+
+// EntityRegistry method definitions:
+
+void EntityRegistry::destroy_entity(Entity entity) {
+    if (!is_alive(entity)) {
+        VK_LOG_WARN("ECS: destroying an entity that is not alive ({}:{})", entity.index, entity.generation);
+        return;
+    }
+    unplace_entity(entity);
+
+    EntityRecord& record = _entityRecords[entity.index];
+    record.archetype = nullptr;
+    record.generation++;
+    _freeEntityIndices.push_back(entity.index);
+    _aliveEntityCount--;
+}
+
+bool EntityRegistry::is_alive(Entity entity) const {
+    return entity.index < _entityRecords.size() && _entityRecords[entity.index].generation == entity.generation
+        && _entityRecords[entity.index].archetype != nullptr;
+}
+
+std::vector<ArchetypeChunk*> EntityRegistry::get_matching_chunks(ComponentMask mask) const {
+    std::vector<ArchetypeChunk*> chunks {};
+    for (const auto& [archetypeMask, archetype] : _archetypes) {
+        if ((archetypeMask & mask) == mask) {
+            chunks.insert(chunks.end(), archetype->get_chunks().begin(), archetype->get_chunks().end());
+        }
+    }
+    return chunks;
+}
+
+Entity EntityRegistry::allocate_entity() {
+    Entity entity {};
+    if (!_freeEntityIndices.empty()) {
+        entity.index = _freeEntityIndices.back();
+        _freeEntityIndices.pop_back();
+    }
+    else {
+        entity.index = static_cast<uint32_t>(_entityRecords.size());
+        _entityRecords.emplace_back();
+    }
+    entity.generation = _entityRecords[entity.index].generation;
+    _aliveEntityCount++;
+    return entity;
+}
+
+Archetype* EntityRegistry::get_or_create_archetype(ComponentMask mask) {
+    auto it = _archetypes.find(mask);
+    if (it == _archetypes.end()) {
+        it = _archetypes.emplace(mask, std::make_unique<Archetype>(mask)).first;
+    }
+    return it->second.get();
+}
+
+ComponentMask EntityRegistry::get_entity_mask(Entity entity) const {
+    if (!is_alive(entity)) {
+        return 0;
+    }
+    return _entityRecords[entity.index].archetype->get_mask();
+}
+
+void EntityRegistry::place_entity(Entity entity, Archetype* archetype) {
+    const auto [chunkIndex, row] = archetype->push_entity(entity);
+    EntityRecord& record = _entityRecords[entity.index];
+    record.archetype = archetype;
+    record.chunkIndex = chunkIndex;
+    record.row = row;
+}
+
+void EntityRegistry::move_entity(Entity entity, ComponentMask mask) {
+    if (!is_alive(entity)) {
+        VK_LOG_ERROR("ECS: changing the components of an entity that is not alive ({}:{})", entity.index, entity.generation);
+        throw std::runtime_error("ECS: changing the components of an entity that is not alive");
+    }
+
+    const EntityRecord oldRecord = _entityRecords[entity.index];
+    if (oldRecord.archetype->get_mask() == mask) {
+        return;
+    }
+
+    // Copy the components both archetypes have, then remove the entity from its old archetype
+    Archetype* newArchetype = get_or_create_archetype(mask);
+    place_entity(entity, newArchetype);
+    const EntityRecord& newRecord = _entityRecords[entity.index];
+
+    ComponentMask sharedMask = oldRecord.archetype->get_mask() & mask;
+    while (sharedMask != 0) {
+        const uint32_t componentTypeId = static_cast<uint32_t>(std::countr_zero(sharedMask));
+        sharedMask &= sharedMask - 1;
+        std::memcpy(newArchetype->get_component(newRecord.chunkIndex, newRecord.row, componentTypeId),
+            oldRecord.archetype->get_component(oldRecord.chunkIndex, oldRecord.row, componentTypeId),
+            ecs_detail::get_component_type_info(componentTypeId).size);
+    }
+
+    const Entity movedEntity = oldRecord.archetype->remove_entity(oldRecord.chunkIndex, oldRecord.row);
+    if (movedEntity.index != UINT32_MAX) {
+        EntityRecord& movedRecord = _entityRecords[movedEntity.index];
+        movedRecord.chunkIndex = oldRecord.chunkIndex;
+        movedRecord.row = oldRecord.row;
+    }
+}
+
+void EntityRegistry::unplace_entity(Entity entity) {
+    const EntityRecord& record = _entityRecords[entity.index];
+    const Entity movedEntity = record.archetype->remove_entity(record.chunkIndex, record.row);
+    if (movedEntity.index != UINT32_MAX) {
+        EntityRecord& movedRecord = _entityRecords[movedEntity.index];
+        movedRecord.chunkIndex = record.chunkIndex;
+        movedRecord.row = record.row;
+    }
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_jobs.h"
+
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+
+/// @brief Size of the memory blocks holding the components of an archetype's entities.
+constexpr size_t ECS_CHUNK_SIZE {16 * 1024};
+
+/// @brief Maximum number of component types (the bits of a ComponentMask).
+constexpr uint32_t ECS_MAX_COMPONENT_TYPES {64};
+
+using ComponentMask = uint64_t;
+
+/// @brief Handle to an entity. The generation tells a destroyed entity apart from a newer one reusing its index.
+struct Entity {
+	uint32_t index {UINT32_MAX};
+	uint32_t generation {0};
+
+	bool operator==(const Entity& other) const = default;
+};
+
+/// @brief Size and alignment of a component type, registered on its first use.
+struct ComponentTypeInfo {
+	uint32_t size;
+	uint32_t alignment;
+};
+
+namespace ecs_detail {
+
+	uint32_t register_component_type(uint32_t size, uint32_t alignment);
+	const ComponentTypeInfo& get_component_type_info(uint32_t componentTypeId);
+
+}
+
+/// Id of a component type (its bit in a ComponentMask).
+/// @attention Components are moved around with memcpy: they must be trivially copyable (plain data, no owned memory)
+template <typename T>
+uint32_t get_component_type_id() {
+	using Component = std::remove_cv_t<T>;
+	static_assert(std::is_trivially_copyable_v<Component>, "ECS components must be trivially copyable");
+	static const uint32_t componentTypeId = ecs_detail::register_component_type(sizeof(Component), alignof(Component));
+	return componentTypeId;
+}
+
+template <typename... Components>
+ComponentMask get_component_mask() {
+	return (ComponentMask {0} | ... | (ComponentMask {1} << get_component_type_id<Components>()));
+}
+
+class Archetype;
+
+/// @brief A block of ECS_CHUNK_SIZE bytes holding up to Archetype::get_chunk_capacity() entities of an archetype,
+/// as a structure of arrays: the entity handles, then one contiguous array per component type.
+struct ArchetypeChunk {
+	Archetype* archetype {nullptr};
+	std::byte* data {nullptr};
+	uint32_t count {0};
+
+	Entity* get_entities() const { return reinterpret_cast<Entity*>(data); }
+
+	/// The array of a component of the archetype (count elements are in use).
+	template <typename T>
+	T* get_array() const;
+};
+
+/// @brief The entities with exactly the same set of component types, packed into chunks.
+///
+/// Chunks are kept full except the last one: removing an entity moves the archetype's last entity into its place.
+class Archetype {
+public:
+	Archetype(ComponentMask mask);
+	~Archetype();
+
+	Archetype(const Archetype&) = delete;
+	Archetype& operator=(const Archetype&) = delete;
+
+	ComponentMask get_mask() const { return _mask; }
+	uint32_t get_chunk_capacity() const { return _chunkCapacity; }
+	std::span<ArchetypeChunk* const> get_chunks() const { return _chunks; }
+	uint32_t get_entity_count() const;
+
+	/// Offset of a component's array inside the chunks (UINT32_MAX if the archetype doesn't have the component).
+	uint32_t get_column_offset(uint32_t componentTypeId) const { return _columnOffsets[componentTypeId]; }
+
+	/// Appends an entity, with uninitialized components. Returns its chunk and row.
+	std::pair<uint32_t, uint32_t> push_entity(Entity entity);
+	/// Removes the entity at the chunk and row, moving the last entity of the archetype into its place.
+	/// Returns the moved entity (its index is UINT32_MAX if none was moved).
+	Entity remove_entity(uint32_t chunkIndex, uint32_t row);
+
+	void* get_component(uint32_t chunkIndex, uint32_t row, uint32_t componentTypeId) const {
+		const ComponentTypeInfo& typeInfo = ecs_detail::get_component_type_info(componentTypeId);
+		return _chunks[chunkIndex]->data + _columnOffsets[componentTypeId] + size_t {row} * typeInfo.size;
+	}
+
+private:
+	ComponentMask _mask {0};
+	uint32_t _chunkCapacity {0};
+	std::array<uint32_t, ECS_MAX_COMPONENT_TYPES> _columnOffsets {};
+	std::vector<ArchetypeChunk*> _chunks {};
+};
+
+template <typename T>
+T* ArchetypeChunk::get_array() const {
+	return reinterpret_cast<T*>(data + archetype->get_column_offset(get_component_type_id<T>()));
+}
+
+/// @brief The entity-component system of the scene: entities, and their components stored by archetype.
+///
+/// The components of the entities sharing a set of component types live in the chunks of their archetype, as
+/// contiguous arrays, so systems stream through memory linearly instead of chasing per-object allocations.
+/// Queries visit the chunks of every archetype having (at least) the requested components, sequentially or in
+/// parallel on the job system (one job per chunk).
+///
+/// @attention Structural changes (create/destroy entities, add/remove components) must not happen during a query,
+/// and are not thread-safe. Queries may run in parallel with each other if they don't write the same components.
+class EntityRegistry {
+public:
+	EntityRegistry() = default;
+	EntityRegistry(const EntityRegistry&) = delete;
+	EntityRegistry& operator=(const EntityRegistry&) = delete;
+
+	template <typename... Components>
+	Entity create_entity(const Components&... components) {
+		Entity entity = allocate_entity();
+		place_entity(entity, get_or_create_archetype(get_component_mask<Components...>()));
+		(write_component(entity, components), ...);
+		return entity;
+	}
+
+	void destroy_entity(Entity entity);
+	bool is_alive(Entity entity) const;
+
+	/// Adds the component (or overwrites it, if the entity already has it).
+	template <typename T>
+	void add_component(Entity entity, const T& component) {
+		const ComponentMask mask = get_entity_mask(entity) | (ComponentMask {1} << get_component_type_id<T>());
+		move_entity(entity, mask);
+		write_component(entity, component);
+	}
+
+	template <typename T>
+	void remove_component(Entity entity) {
+		move_entity(entity, get_entity_mask(entity) & ~(ComponentMask {1} << get_component_type_id<T>()));
+	}
+
+	template <typename T>
+	bool has_component(Entity entity) const {
+		return (get_entity_mask(entity) & (ComponentMask {1} << get_component_type_id<T>())) != 0;
+	}
+
+	/// Returns nullptr if the entity doesn't have the component.
+	/// @attention Invalidated by structural changes
+	template <typename T>
+	T* get_component(Entity entity) const {
+		if (!has_component<T>(entity)) {
+			return nullptr;
+		}
+		const EntityRecord& record = _entityRecords[entity.index];
+		return static_cast<T*>(record.archetype->get_component(record.chunkIndex, record.row, get_component_type_id<T>()));
+	}
+
+	/// The chunks of every archetype having (at least) the components of the mask.
+	std::vector<ArchetypeChunk*> get_matching_chunks(ComponentMask mask) const;
+
+	/// Calls @code function(uint32_t count, const Entity* entities, Components*... arrays)@endcode for each chunk with the components.
+	template <typename... Components, typename Function>
+	void for_each_chunk(Function&& function) const {
+		for (ArchetypeChunk* chunk : get_matching_chunks(get_component_mask<Components...>())) {
+			function(chunk->count, static_cast<const Entity*>(chunk->get_entities()), chunk->template get_array<Components>()...);
+		}
+	}
+
+	/// Calls @code function(Components&... components)@endcode for each entity with the components.
+	template <typename... Components, typename Function>
+	void for_each(Function&& function) const {
+		for_each_chunk<Components...>([&](uint32_t count, const Entity*, Components*... arrays) {
+			for (uint32_t i {0}; i < count; i++) {
+				function(arrays[i]...);
+			}
+		});
+	}
+
+	/// Like for_each_chunk(), with the chunks spread over the workers of the job system. Returns once all are done.
+	template <typename... Components, typename Function>
+	void parallel_for_each_chunk(JobSystem& jobSystem, Function&& function) const {
+		const std::vector<ArchetypeChunk*> chunks = get_matching_chunks(get_component_mask<Components...>());
+		jobSystem.parallel_for(static_cast<uint32_t>(chunks.size()), 1, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i {begin}; i < end; i++) {
+				function(chunks[i]->count, static_cast<const Entity*>(chunks[i]->get_entities()), chunks[i]->template get_array<Components>()...);
+			}
+		});
+	}
+
+	/// Number of entities having (at least) the components.
+	template <typename... Components>
+	uint32_t count() const {
+		uint32_t entityCount {0};
+		for (ArchetypeChunk* chunk : get_matching_chunks(get_component_mask<Components...>())) {
+			entityCount += chunk->count;
+		}
+		return entityCount;
+	}
+
+	uint32_t get_entity_count() const { return _aliveEntityCount; }
+	uint32_t get_archetype_count() const { return static_cast<uint32_t>(_archetypes.size()); }
+
+private:
+	// Where the components of an entity are
+	struct EntityRecord {
+		Archetype* archetype {nullptr};
+		uint32_t chunkIndex {0};
+		uint32_t row {0};
+		uint32_t generation {0};
+	};
+
+	std::unordered_map<ComponentMask, std::unique_ptr<Archetype>> _archetypes {};
+	std::vector<EntityRecord> _entityRecords {};
+	std::vector<uint32_t> _freeEntityIndices {};
+	uint32_t _aliveEntityCount {0};
+
+	Entity allocate_entity();
+	Archetype* get_or_create_archetype(ComponentMask mask);
+	ComponentMask get_entity_mask(Entity entity) const;
+	/// Appends the entity to the archetype (with uninitialized components), and updates its record.
+	void place_entity(Entity entity, Archetype* archetype);
+	/// Moves the entity to the archetype of the mask, keeping the components both archetypes have.
+	void move_entity(Entity entity, ComponentMask mask);
+	/// Removes the entity from its archetype, and updates the record of the entity moved into its place.
+	void unplace_entity(Entity entity);
+
+	template <typename T>
+	void write_component(Entity entity, const T& component) {
+		const EntityRecord& record = _entityRecords[entity.index];
+		std::memcpy(record.archetype->get_component(record.chunkIndex, record.row, get_component_type_id<T>()), &component, sizeof(T));
+	}
+};
@@ -0,0 +1,52 @@
+#include "imgui_draw_snapshot.h"
+
+#include <cstring>
+
+namespace {
+
+    // ImVector's assignment frees the destination's buffer first: resizing keeps it, once large enough
+    template <typename T>
+    void copy_im_vector(ImVector<T>& destination, const ImVector<T>& source) {
+        destination.resize(source.Size);
+        if (source.Size > 0) {
+            std::memcpy(destination.Data, source.Data, source.size_in_bytes());
+        }
+    }
+
+}
+
+ImGuiDrawDataSnapshot::~ImGuiDrawDataSnapshot() {
+    for (ImDrawList* drawList : _drawLists) {
+        IM_DELETE(drawList);
+    }
+}
+
+void ImGuiDrawDataSnapshot::capture(const ImDrawData* drawData) {
+    _drawData.Clear();
+    if (drawData == nullptr || !drawData->Valid) {
+        return;
+    }
+
+    _drawData.Valid = true;
+    _drawData.TotalIdxCount = drawData->TotalIdxCount;
+    _drawData.TotalVtxCount = drawData->TotalVtxCount;
+    _drawData.DisplayPos = drawData->DisplayPos;
+    _drawData.DisplaySize = drawData->DisplaySize;
+    _drawData.FramebufferScale = drawData->FramebufferScale;
+
+    for (int i {0}; i < drawData->CmdListsCount; i++) {
+        if (static_cast<size_t>(i) == _drawLists.size()) {
+            // Only the output buffers are used: the lists don't need ImGui's shared draw data
+            _drawLists.push_back(IM_NEW(ImDrawList)(nullptr));
+        }
+        const ImDrawList* source = drawData->CmdLists[i];
+        ImDrawList* drawList = _drawLists[i];
+        copy_im_vector(drawList->CmdBuffer, source->CmdBuffer);
+        copy_im_vector(drawList->IdxBuffer, source->IdxBuffer);
+        copy_im_vector(drawList->VtxBuffer, source->VtxBuffer);
+        drawList->Flags = source->Flags;
+
+        _drawData.CmdLists.push_back(drawList);
+        _drawData.CmdListsCount++;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include "imgui.h"
+
+/// @brief A copy of ImGui's draw data, so the UI of a frame can be rendered on another thread than the one building it.
+///
+/// ImGui::Render() fills draw data that points into ImGui's own draw lists, which the next ImGui::NewFrame() reuses.
+/// capture() copies the command, vertex and index buffers of every list into lists owned by the snapshot (kept from one
+/// capture to the next, so their buffers stop growing after a few frames).
+///
+/// @attention The texture ids of the commands are copied as they are: the textures must outlive the snapshot
+class ImGuiDrawDataSnapshot {
+public:
+	ImGuiDrawDataSnapshot() = default;
+	~ImGuiDrawDataSnapshot();
+
+	ImGuiDrawDataSnapshot(const ImGuiDrawDataSnapshot&) = delete;
+	ImGuiDrawDataSnapshot& operator=(const ImGuiDrawDataSnapshot&) = delete;
+
+	/// Copies the draw data (an invalid snapshot if drawData is null or not valid).
+	void capture(const ImDrawData* drawData);
+
+	/// Null if the captured draw data wasn't valid.
+	/// Non-const for ImGui's renderer backends, which only read the draw data but take a non-const pointer.
+	ImDrawData* get() const { return _drawData.Valid ? const_cast<ImDrawData*>(&_drawData) : nullptr; }
+
+private:
+	ImDrawData _drawData {};
+	std::vector<ImDrawList*> _drawLists {};
+};
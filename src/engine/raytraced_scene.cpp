@@ -0,0 +1,105 @@
+#include "raytraced_scene.h"
+
+#include <random>
+
+#include <glm/common.hpp>
+#include <glm/trigonometric.hpp>
+
+void RaytracedScene::add_sphere(glm::vec3 center, float radius, glm::vec3 color, SphereMaterial material, float ior) {
+    GPUSphere sphere {};
+    sphere.center = center;
+    sphere.radius = radius;
+    sphere.color = color;
+    sphere.material = static_cast<int32_t>(material);
+    sphere.ior = ior;
+    _spheres.push_back(sphere);
+}
+
+void RaytracedScene::clear() {
+    _spheres.clear();
+    _bvhNodes.clear();
+}
+
+void RaytracedScene::create_default_scene(uint32_t scatteredSphereCount) {
+    // Center glass sphere
+    add_sphere(glm::vec3(0.0f, 0.5f, 0.0f), 1.2f, glm::vec3(0.95f, 0.95f, 1.0f), SphereMaterial::GLASS, 1.5f);
+
+    // Two emissive lights
+    add_sphere(glm::vec3(3.0f, 3.0f, 2.0f), 0.5f, glm::vec3(1.0f, 0.5f, 0.8f), SphereMaterial::EMISSIVE);
+    add_sphere(glm::vec3(-3.0f, 2.5f, 2.0f), 0.5f, glm::vec3(0.5f, 0.8f, 1.0f), SphereMaterial::EMISSIVE);
+
+    // Ring of colored spheres
+    for (int i {0}; i < 8; i++) {
+        const float angle = static_cast<float>(i) / 8.0f * 6.28318f;
+        const float ringRadius = 3.5f;
+
+        const float hue = static_cast<float>(i) / 8.0f;
+        glm::vec3 color;
+        if (hue < 0.33f) color = glm::mix(glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), hue * 3.0f);
+        else if (hue < 0.66f) color = glm::mix(glm::vec3(0, 1, 0), glm::vec3(0, 0, 1), (hue - 0.33f) * 3.0f);
+        else color = glm::mix(glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), (hue - 0.66f) * 3.0f);
+
+        add_sphere(glm::vec3(glm::cos(angle) * ringRadius, 0.3f, glm::sin(angle) * ringRadius), 0.4f, color, SphereMaterial::DIFFUSE);
+    }
+
+    // Few glass spheres
+    add_sphere(glm::vec3(2.0f, 1.5f, 1.0f), 0.5f, glm::vec3(1.0f, 0.9f, 0.9f), SphereMaterial::GLASS, 1.7f);
+    add_sphere(glm::vec3(-2.0f, 1.8f, 1.5f), 0.4f, glm::vec3(0.9f, 1.0f, 0.9f), SphereMaterial::GLASS, 1.6f);
+
+    // Couple mirrors
+    add_sphere(glm::vec3(-2.5f, 1.0f, -1.0f), 0.8f, glm::vec3(0.95f, 0.95f, 0.98f), SphereMaterial::MIRROR);
+    add_sphere(glm::vec3(3.0f, 1.2f, 0.0f), 0.7f, glm::vec3(0.98f, 0.95f, 0.95f), SphereMaterial::MIRROR);
+
+    // A few more colorful diffuse
+    add_sphere(glm::vec3(1.5f, 0.4f, 3.0f), 0.4f, glm::vec3(1.0f, 0.7f, 0.2f), SphereMaterial::DIFFUSE);
+    add_sphere(glm::vec3(-1.5f, 0.5f, 3.5f), 0.5f, glm::vec3(0.7f, 0.2f, 1.0f), SphereMaterial::DIFFUSE);
+    add_sphere(glm::vec3(0.0f, 0.3f, 4.0f), 0.3f, glm::vec3(0.2f, 1.0f, 0.7f), SphereMaterial::DIFFUSE);
+
+    // Small accent sphere
+    add_sphere(glm::vec3(0.0f, 2.5f, 0.0f), 0.3f, glm::vec3(1.0f, 0.9f, 0.5f), SphereMaterial::GLASS, 2.0f);
+
+    // Colorful checkered ground plane
+    add_sphere(glm::vec3(0.0f, -100.5f, 0.0f), 100.0f, glm::vec3(1.0f), SphereMaterial::CHECKERED);
+
+    // Small spheres resting on the ground, scattered outside the showcase ring (fixed seed: same scene every run)
+    std::mt19937 randomGenerator {1337};
+    std::uniform_real_distribution<float> unit {0.f, 1.f};
+    for (uint32_t i {0}; i < scatteredSphereCount; i++) {
+        const float angle = unit(randomGenerator) * 6.28318f;
+        const float distance = 5.0f + unit(randomGenerator) * 20.0f;
+        const float radius = 0.08f + unit(randomGenerator) * 0.17f;
+        const glm::vec3 center {glm::cos(angle) * distance, -0.5f + radius, glm::sin(angle) * distance};
+
+        const float materialRoll = unit(randomGenerator);
+        const glm::vec3 color {unit(randomGenerator), unit(randomGenerator), unit(randomGenerator)};
+        if (materialRoll < 0.8f) {
+            add_sphere(center, radius, color * 0.8f + 0.2f, SphereMaterial::DIFFUSE);
+        } else if (materialRoll < 0.9f) {
+            add_sphere(center, radius, glm::vec3(0.95f), SphereMaterial::MIRROR);
+        } else if (materialRoll < 0.97f) {
+            add_sphere(center, radius, glm::vec3(0.95f), SphereMaterial::GLASS, 1.5f);
+        } else {
+            add_sphere(center, radius, color, SphereMaterial::EMISSIVE);
+        }
+    }
+}
+
+void RaytracedScene::build_bvh() {
+    std::vector<BVHPrimitiveBounds> primitiveBounds {};
+    primitiveBounds.reserve(_spheres.size());
+    for (const GPUSphere& sphere : _spheres) {
+        primitiveBounds.push_back(BVHPrimitiveBounds {sphere.center - glm::vec3(sphere.radius), sphere.center + glm::vec3(sphere.radius)});
+    }
+
+    BVHBuilder bvhBuilder {};
+    bvhBuilder.build(primitiveBounds);
+
+    // Lay the spheres out in BVH order
+    std::vector<GPUSphere> orderedSpheres {};
+    orderedSpheres.reserve(_spheres.size());
+    for (uint32_t sphereIndex : bvhBuilder.get_primitive_order()) {
+        orderedSpheres.push_back(_spheres[sphereIndex]);
+    }
+    _spheres = std::move(orderedSpheres);
+    _bvhNodes = bvhBuilder.get_nodes();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "vk_types.h"
+#include "bvh.h"
+
+#include <glm/vec3.hpp>
+
+/// @brief Sphere materials understood by raytraced_scene.comp
+enum class SphereMaterial : int32_t {
+	DIFFUSE = 0,
+	GLASS = 1,
+	MIRROR = 2,
+	EMISSIVE = 3,
+	CHECKERED = 4
+};
+
+/// @brief A sphere, as uploaded to the GPU.
+/// @attention Must match the @code Sphere@endcode struct in raytraced_scene.comp (std430, 48 bytes)
+struct GPUSphere {
+	glm::vec3 center;
+	float radius;
+	glm::vec3 color;
+	int32_t material;
+	float ior;
+	float padding[3];
+};
+
+/// @brief CPU side of the ray-traced compute scene: the spheres, and the BVH built over them.
+///
+/// After build_bvh(), the spheres are stored in BVH order, so the leaves of the node array index them directly.
+class RaytracedScene {
+public:
+	void add_sphere(glm::vec3 center, float radius, glm::vec3 color, SphereMaterial material, float ior = 0.f);
+	void clear();
+
+	/// The showcase scene: glass, mirror, emissive and diffuse spheres on a checkered ground,
+	/// plus @code scatteredSphereCount@endcode small random spheres scattered around them.
+	void create_default_scene(uint32_t scatteredSphereCount);
+
+	/// Builds the SAH BVH and reorders the spheres to match its leaves.
+	void build_bvh();
+
+	std::span<const GPUSphere> get_spheres() const { return _spheres; }
+	std::span<const GPUBVHNode> get_bvh_nodes() const { return _bvhNodes; }
+
+private:
+	std::vector<GPUSphere> _spheres {};
+	std::vector<GPUBVHNode> _bvhNodes {};
+};
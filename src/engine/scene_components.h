@@ -0,0 +1,50 @@
+#pragma once
+
+#include "vk_types.h"
+#include "transform_hierarchy.h"
+
+#include <glm/vec3.hpp>
+
+// Components of the scene entities (see EntityRegistry). Plain data: they are moved with memcpy.
+
+/// @brief The node of an entity in the scene's TransformHierarchy.
+struct TransformNode {
+	TransformNodeId node;
+};
+
+/// @brief Bounding box of an entity's mesh, in its local space. Transformed into its WorldBounds when its node moves.
+struct LocalBounds {
+	glm::vec3 aabbMin;
+	glm::vec3 aabbMax;
+};
+
+/// @brief World-space bounding box of an entity, tested by the occlusion culling.
+struct WorldBounds {
+	glm::vec3 aabbMin;
+	glm::vec3 aabbMax;
+};
+
+/// @brief The index range of the mesh an entity is drawn with, in the shared index/vertex buffers.
+struct MeshDraw {
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+};
+
+/// @brief The material an entity is drawn with (per-instance data of the instanced draws).
+struct MeshMaterial {
+	uint32_t materialIndex;
+};
+
+/// @brief The local transform of an entity's node at the last two fixed-timestep simulation steps. Each frame writes
+/// the state in between (by the time left over since the last step) into its node of the TransformHierarchy.
+struct SimulatedTransform {
+	LocalTransform previous;
+	LocalTransform current;
+};
+
+/// @brief Turns an entity's simulated transform at a constant rate, around an axis of its parent's space.
+struct Spin {
+	glm::vec3 axis;
+	float radiansPerSecond;
+};
@@ -0,0 +1,311 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <glm/common.hpp>
+
+#include "vk_logger.h"
+#include "vk_trace.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define TRANSFORM_HIERARCHY_USE_SSE 1
+#else
+    #define TRANSFORM_HIERARCHY_USE_SSE 0
+#endif
+
+namespace {
+
+    // The matrix of a translation * rotation * scale
+    glm::mat4 compose_local_matrix(const LocalTransform& localTransform) {
+        const glm::mat3 rotation = glm::mat3_cast(localTransform.rotation);
+        glm::mat4 matrix {};
+        matrix[0] = glm::vec4(rotation[0] * localTransform.scale.x, 0.f);
+        matrix[1] = glm::vec4(rotation[1] * localTransform.scale.y, 0.f);
+        matrix[2] = glm::vec4(rotation[2] * localTransform.scale.z, 0.f);
+        matrix[3] = glm::vec4(localTransform.translation, 1.f);
+        return matrix;
+    }
+
+    // result = parent * local (column-major). Each column of the result is a linear combination of the parent's
+    // columns, computed 4 floats at a time.
+    void multiply_matrices(const glm::mat4& parent, const glm::mat4& local, glm::mat4& result) {
+#if TRANSFORM_HIERARCHY_USE_SSE
+        const __m128 parentColumn0 = _mm_loadu_ps(&parent[0][0]);
+        const __m128 parentColumn1 = _mm_loadu_ps(&parent[1][0]);
+        const __m128 parentColumn2 = _mm_loadu_ps(&parent[2][0]);
+        const __m128 parentColumn3 = _mm_loadu_ps(&parent[3][0]);
+        for (int column {0}; column < 4; column++) {
+            __m128 resultColumn = _mm_mul_ps(parentColumn0, _mm_set1_ps(local[column][0]));
+            resultColumn = _mm_add_ps(resultColumn, _mm_mul_ps(parentColumn1, _mm_set1_ps(local[column][1])));
+            resultColumn = _mm_add_ps(resultColumn, _mm_mul_ps(parentColumn2, _mm_set1_ps(local[column][2])));
+            resultColumn = _mm_add_ps(resultColumn, _mm_mul_ps(parentColumn3, _mm_set1_ps(local[column][3])));
+            _mm_storeu_ps(&result[column][0], resultColumn);
+        }
+#else
+        result = parent * local;
+#endif
+    }
+
+}
+
+LocalTransform interpolate_local_transform(const LocalTransform& from, const LocalTransform& to, float alpha) {
+    LocalTransform localTransform {};
+    localTransform.translation = glm::mix(from.translation, to.translation, alpha);
+    localTransform.rotation = glm::slerp(from.rotation, to.rotation, alpha);
+    localTransform.scale = glm::mix(from.scale, to.scale, alpha);
+    return localTransform;
+}
+
+TransformNodeId TransformHierarchy::create_node(const LocalTransform& localTransform, TransformNodeId parent) {
+    TransformNodeId node {};
+    if (!_freeNodes.empty()) {
+        node = _freeNodes.back();
+        _freeNodes.pop_back();
+        _nodes[node] = NodeRecord {};
+    }
+    else {
+        node = static_cast<TransformNodeId>(_nodes.size());
+        _nodes.emplace_back();
+    }
+
+    // Appended after the sorted slots, until the next update() rebuilds the depth order
+    NodeRecord& record = _nodes[node];
+    record.bAlive = true;
+    record.slot = static_cast<uint32_t>(_slotNodes.size());
+    _localTransforms.push_back(localTransform);
+    _worldMatrices.push_back(glm::mat4 {1.f});
+    _parentSlots.push_back(UINT32_MAX);
+    _slotNodes.push_back(node);
+    _bLocalDirty.push_back(1);
+    _updateGenerations.push_back(0);
+
+    if (parent != TRANSFORM_NODE_NONE) {
+        link_child(node, parent);
+    }
+    _bStructureDirty = true;
+    return node;
+}
+
+void TransformHierarchy::destroy_node(TransformNodeId node) {
+    const TransformNodeId parent = _nodes[node].parent;
+
+    // Re-attach the children to the parent: their world matrices change
+    while (_nodes[node].firstChild != TRANSFORM_NODE_NONE) {
+        const TransformNodeId child = _nodes[node].firstChild;
+        unlink_child(child);
+        if (parent != TRANSFORM_NODE_NONE) {
+            link_child(child, parent);
+        }
+        mark_local_dirty(_nodes[child].slot);
+    }
+    if (parent != TRANSFORM_NODE_NONE) {
+        unlink_child(node);
+    }
+
+    // Its slot is dropped by the next rebuild, then the id can be reused
+    _nodes[node].bAlive = false;
+    _destroyedNodes.push_back(node);
+    _bStructureDirty = true;
+}
+
+void TransformHierarchy::set_parent(TransformNodeId node, TransformNodeId parent) {
+    if (_nodes[node].parent == parent) {
+        return;
+    }
+
+    // The node can't become a descendant of itself
+    for (TransformNodeId ancestor {parent}; ancestor != TRANSFORM_NODE_NONE; ancestor = _nodes[ancestor].parent) {
+        if (ancestor == node) {
+            VK_LOG_ERROR("Transform hierarchy: node {} can't be parented to its descendant {}", node, parent);
+            throw std::runtime_error("Transform hierarchy: cycle in the hierarchy");
+        }
+    }
+
+    if (_nodes[node].parent != TRANSFORM_NODE_NONE) {
+        unlink_child(node);
+    }
+    if (parent != TRANSFORM_NODE_NONE) {
+        link_child(node, parent);
+    }
+    mark_local_dirty(_nodes[node].slot);
+    _bStructureDirty = true;
+}
+
+void TransformHierarchy::set_local_transform(TransformNodeId node, const LocalTransform& localTransform) {
+    const uint32_t slot = _nodes[node].slot;
+    _localTransforms[slot] = localTransform;
+    mark_local_dirty(slot);
+}
+
+void TransformHierarchy::update(JobSystem& jobSystem) {
+    ZONE("TransformHierarchy::update");
+    _updateGeneration++;
+    _stats = TransformHierarchyStats {};
+
+    if (_bStructureDirty) {
+        rebuild_depth_order();
+        _stats.bRebuilt = true;
+    }
+
+    // Level by level: a level only needs visiting if it has dirty nodes, or if its parents' level changed
+    bool bPreviousLevelChanged {false};
+    const uint32_t levelCount = static_cast<uint32_t>(_levelOffsets.size()) - 1;
+    for (uint32_t level {0}; level < levelCount; level++) {
+        if (_levelDirtyCounts[level] == 0 && !bPreviousLevelChanged) {
+            _stats.skippedLevelCount++;
+            continue;
+        }
+
+        const uint32_t levelBegin = _levelOffsets[level];
+        const uint32_t levelEnd = _levelOffsets[level + 1];
+        uint32_t updatedNodeCount {0};
+        if (levelEnd - levelBegin <= TRANSFORM_UPDATE_BATCH_SIZE) {
+            updatedNodeCount = update_slots(levelBegin, levelEnd);
+        }
+        else {
+            std::atomic<uint32_t> updatedCount {0};
+            jobSystem.parallel_for(levelEnd - levelBegin, TRANSFORM_UPDATE_BATCH_SIZE, [&](uint32_t begin, uint32_t end) {
+                updatedCount.fetch_add(update_slots(levelBegin + begin, levelBegin + end), std::memory_order_relaxed);
+            });
+            updatedNodeCount = updatedCount.load(std::memory_order_relaxed);
+        }
+
+        _levelDirtyCounts[level] = 0;
+        bPreviousLevelChanged = updatedNodeCount > 0;
+        _stats.updatedNodeCount += updatedNodeCount;
+    }
+
+    _stats.nodeCount = static_cast<uint32_t>(_slotNodes.size());
+    _stats.depthCount = levelCount;
+}
+
+void TransformHierarchy::link_child(TransformNodeId node, TransformNodeId parent) {
+    NodeRecord& record = _nodes[node];
+    NodeRecord& parentRecord = _nodes[parent];
+    record.parent = parent;
+    record.previousSibling = TRANSFORM_NODE_NONE;
+    record.nextSibling = parentRecord.firstChild;
+    if (parentRecord.firstChild != TRANSFORM_NODE_NONE) {
+        _nodes[parentRecord.firstChild].previousSibling = node;
+    }
+    parentRecord.firstChild = node;
+}
+
+void TransformHierarchy::unlink_child(TransformNodeId node) {
+    NodeRecord& record = _nodes[node];
+    if (record.previousSibling != TRANSFORM_NODE_NONE) {
+        _nodes[record.previousSibling].nextSibling = record.nextSibling;
+    }
+    else {
+        _nodes[record.parent].firstChild = record.nextSibling;
+    }
+    if (record.nextSibling != TRANSFORM_NODE_NONE) {
+        _nodes[record.nextSibling].previousSibling = record.previousSibling;
+    }
+    record.parent = TRANSFORM_NODE_NONE;
+    record.nextSibling = TRANSFORM_NODE_NONE;
+    record.previousSibling = TRANSFORM_NODE_NONE;
+}
+
+void TransformHierarchy::mark_local_dirty(uint32_t slot) {
+    if (_bLocalDirty[slot]) {
+        return;
+    }
+    _bLocalDirty[slot] = 1;
+    // Otherwise the counts are recomputed by the rebuild
+    if (!_bStructureDirty) {
+        _levelDirtyCounts[get_slot_level(slot)]++;
+    }
+}
+
+uint32_t TransformHierarchy::get_slot_level(uint32_t slot) const {
+    // The last level whose offset is <= slot
+    return static_cast<uint32_t>(std::upper_bound(_levelOffsets.begin(), _levelOffsets.end(), slot) - _levelOffsets.begin()) - 1;
+}
+
+void TransformHierarchy::rebuild_depth_order() {
+    ZONE("TransformHierarchy::rebuild_depth_order");
+
+    // Breadth-first from the roots: every level follows its parents' level
+    std::vector<TransformNodeId> order {};
+    order.reserve(_slotNodes.size());
+    for (TransformNodeId node {0}; node < _nodes.size(); node++) {
+        if (_nodes[node].bAlive && _nodes[node].parent == TRANSFORM_NODE_NONE) {
+            order.push_back(node);
+        }
+    }
+    _levelOffsets.assign(1, 0);
+    size_t levelBegin {0};
+    while (levelBegin < order.size()) {
+        const size_t levelEnd = order.size();
+        _levelOffsets.push_back(static_cast<uint32_t>(levelEnd));
+        for (size_t i {levelBegin}; i < levelEnd; i++) {
+            for (TransformNodeId child {_nodes[order[i]].firstChild}; child != TRANSFORM_NODE_NONE; child = _nodes[child].nextSibling) {
+                order.push_back(child);
+            }
+        }
+        levelBegin = levelEnd;
+    }
+
+    // Move the slots into the new order (the parents get their new slot before their children)
+    const uint32_t slotCount = static_cast<uint32_t>(order.size());
+    std::vector<LocalTransform> localTransforms(slotCount);
+    std::vector<glm::mat4> worldMatrices(slotCount);
+    std::vector<uint32_t> parentSlots(slotCount);
+    std::vector<uint8_t> bLocalDirty(slotCount);
+    std::vector<uint32_t> updateGenerations(slotCount);
+    for (uint32_t slot {0}; slot < slotCount; slot++) {
+        NodeRecord& record = _nodes[order[slot]];
+        localTransforms[slot] = _localTransforms[record.slot];
+        worldMatrices[slot] = _worldMatrices[record.slot];
+        bLocalDirty[slot] = _bLocalDirty[record.slot];
+        updateGenerations[slot] = _updateGenerations[record.slot];
+        parentSlots[slot] = record.parent != TRANSFORM_NODE_NONE ? _nodes[record.parent].slot : UINT32_MAX;
+        record.slot = slot;
+    }
+    _localTransforms = std::move(localTransforms);
+    _worldMatrices = std::move(worldMatrices);
+    _parentSlots = std::move(parentSlots);
+    _bLocalDirty = std::move(bLocalDirty);
+    _updateGenerations = std::move(updateGenerations);
+    _slotNodes = std::move(order);
+
+    const uint32_t levelCount = static_cast<uint32_t>(_levelOffsets.size()) - 1;
+    _levelDirtyCounts.assign(levelCount, 0);
+    for (uint32_t level {0}; level < levelCount; level++) {
+        for (uint32_t slot {_levelOffsets[level]}; slot < _levelOffsets[level + 1]; slot++) {
+            _levelDirtyCounts[level] += _bLocalDirty[slot];
+        }
+    }
+
+    // The destroyed nodes no longer have a slot: their ids can be reused
+    for (TransformNodeId node : _destroyedNodes) {
+        _nodes[node].slot = UINT32_MAX;
+    }
+    _freeNodes.insert(_freeNodes.end(), _destroyedNodes.begin(), _destroyedNodes.end());
+    _destroyedNodes.clear();
+    _bStructureDirty = false;
+}
+
+uint32_t TransformHierarchy::update_slots(uint32_t begin, uint32_t end) {
+    uint32_t updatedNodeCount {0};
+    for (uint32_t slot {begin}; slot < end; slot++) {
+        const uint32_t parentSlot = _parentSlots[slot];
+        const bool bParentChanged = parentSlot != UINT32_MAX && _updateGenerations[parentSlot] == _updateGeneration;
+        if (!_bLocalDirty[slot] && !bParentChanged) {
+            continue;
+        }
+
+        const glm::mat4 localMatrix = compose_local_matrix(_localTransforms[slot]);
+        if (parentSlot == UINT32_MAX) {
+            _worldMatrices[slot] = localMatrix;
+        }
+        else {
+            multiply_matrices(_worldMatrices[parentSlot], localMatrix, _worldMatrices[slot]);
+        }
+        _bLocalDirty[slot] = 0;
+        _updateGenerations[slot] = _updateGeneration;
+        updatedNodeCount++;
+    }
+    return updatedNodeCount;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_jobs.h"
+
+#include <glm/vec3.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/// @brief Handle to a node of a TransformHierarchy.
+using TransformNodeId = uint32_t;
+constexpr TransformNodeId TRANSFORM_NODE_NONE {UINT32_MAX};
+
+/// @brief Nodes per job when a depth level of the hierarchy is updated in parallel.
+constexpr uint32_t TRANSFORM_UPDATE_BATCH_SIZE {512};
+
+/// @brief Translation, rotation and scale of a node, relative to its parent.
+struct LocalTransform {
+	glm::vec3 translation {0.f};
+	glm::quat rotation {1.f, 0.f, 0.f, 0.f};
+	glm::vec3 scale {1.f};
+};
+
+/// Blends two transforms: linearly for the translation and scale, spherically for the rotation (alpha 0: from, 1: to).
+LocalTransform interpolate_local_transform(const LocalTransform& from, const LocalTransform& to, float alpha);
+
+/// @brief Counters of the last TransformHierarchy::update().
+struct TransformHierarchyStats {
+	uint32_t nodeCount {0};
+	uint32_t depthCount {0};
+	uint32_t updatedNodeCount {0};   // World matrices recomputed
+	uint32_t skippedLevelCount {0};  // Depth levels without any change, skipped entirely
+	bool bRebuilt {false};           // The node order was rebuilt (after a structural change)
+};
+
+/// @brief Scene-graph transforms: local TRS per node, composed into world matrices by update().
+///
+/// The nodes are stored as arrays sorted by depth (parents always before their children), so an update is a single
+/// linear pass per depth level. Within a level, the nodes don't depend on each other: large levels are split into
+/// batches of TRANSFORM_UPDATE_BATCH_SIZE nodes, updated in parallel on the job system.
+///
+/// Only the dirty subtrees are recomputed: a node whose local transform changed, or whose parent's world matrix
+/// changed during the same update. A level without any of those is skipped without visiting its nodes.
+///
+/// Structural changes (create, destroy, re-parent) are deferred: the depth order is rebuilt by the next update().
+class TransformHierarchy {
+public:
+	TransformNodeId create_node(const LocalTransform& localTransform, TransformNodeId parent = TRANSFORM_NODE_NONE);
+	/// The children of the node are re-attached to its parent (keeping their local transforms).
+	void destroy_node(TransformNodeId node);
+	void set_parent(TransformNodeId node, TransformNodeId parent);
+
+	void set_local_transform(TransformNodeId node, const LocalTransform& localTransform);
+	const LocalTransform& get_local_transform(TransformNodeId node) const { return _localTransforms[_nodes[node].slot]; }
+
+	/// @attention Up to date after update()
+	const glm::mat4& get_world_matrix(TransformNodeId node) const { return _worldMatrices[_nodes[node].slot]; }
+	/// True if the node's world matrix was recomputed by the last update() (e.g. to refresh its world bounds).
+	bool was_updated(TransformNodeId node) const { return _updateGenerations[_nodes[node].slot] == _updateGeneration; }
+
+	/// Rebuilds the depth order if the structure changed, then recomputes the world matrices of the dirty subtrees.
+	void update(JobSystem& jobSystem);
+
+	const TransformHierarchyStats& get_stats() const { return _stats; }
+
+private:
+	// Per node id: its place in the hierarchy, and its slot in the depth-sorted arrays
+	struct NodeRecord {
+		TransformNodeId parent {TRANSFORM_NODE_NONE};
+		TransformNodeId firstChild {TRANSFORM_NODE_NONE};
+		TransformNodeId nextSibling {TRANSFORM_NODE_NONE};
+		TransformNodeId previousSibling {TRANSFORM_NODE_NONE};
+		uint32_t slot {UINT32_MAX};
+		bool bAlive {false};
+	};
+
+	std::vector<NodeRecord> _nodes {};
+	std::vector<TransformNodeId> _freeNodes {};          // Reusable ids
+	std::vector<TransformNodeId> _destroyedNodes {};     // Reusable once their slots are dropped by the next rebuild
+
+	// Depth-sorted arrays, indexed by slot. Level d is [_levelOffsets[d], _levelOffsets[d + 1]).
+	std::vector<LocalTransform> _localTransforms {};
+	std::vector<glm::mat4> _worldMatrices {};
+	std::vector<uint32_t> _parentSlots {};
+	std::vector<TransformNodeId> _slotNodes {};
+	std::vector<uint8_t> _bLocalDirty {};
+	std::vector<uint32_t> _updateGenerations {};        // Update during which the world matrix last changed
+	std::vector<uint32_t> _levelOffsets {0};
+	std::vector<uint32_t> _levelDirtyCounts {};          // Nodes with a dirty local transform, per level
+
+	uint32_t _updateGeneration {0};
+	bool _bStructureDirty {false};
+	TransformHierarchyStats _stats {};
+
+	void link_child(TransformNodeId node, TransformNodeId parent);
+	void unlink_child(TransformNodeId node);
+	void mark_local_dirty(uint32_t slot);
+	uint32_t get_slot_level(uint32_t slot) const;
+	void rebuild_depth_order();
+	/// Recomputes the dirty nodes of the slots [begin, end). Returns the number of world matrices recomputed.
+	uint32_t update_slots(uint32_t begin, uint32_t end);
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/// @brief Lock-free handoff of values from one producer thread to one consumer thread, through three slots.
+///
+/// At any time the producer owns one slot (the one it writes), the consumer owns another (the one it reads), and the
+/// third is shared: publish() swaps the written slot with the shared one, acquire() swaps the shared slot with the
+/// read one. Both swaps are a single atomic exchange, so neither side ever waits for the other to finish with a slot,
+/// and the slots are reused (their allocations too) instead of being copied.
+///
+/// The shared index carries a flag telling whether the shared slot holds a value not acquired yet. A value published
+/// before the previous one is acquired replaces it: use wait_until_consumed() before publishing to never drop one.
+///
+/// @attention One producer thread and one consumer thread. A slot's contents are only valid on its owner's side.
+template <typename T>
+class TripleBuffer {
+public:
+	// Producer side
+
+	/// The slot to fill before publish(). Still holds the value published three swaps ago (to reuse its allocations).
+	T& get_write_slot() { return _slots[_writeIndex]; }
+
+	/// Makes the written slot the latest value, and takes back the shared slot for the next write.
+	void publish() {
+		const uint32_t previous = _shared.exchange(_writeIndex | NEW_VALUE_BIT, std::memory_order_acq_rel);
+		_writeIndex = previous & INDEX_MASK;
+		_shared.notify_all();
+	}
+
+	/// Blocks until the consumer acquired the last published value.
+	void wait_until_consumed() const {
+		uint32_t shared = _shared.load(std::memory_order_acquire);
+		while ((shared & NEW_VALUE_BIT) != 0) {
+			_shared.wait(shared, std::memory_order_acquire);
+			shared = _shared.load(std::memory_order_acquire);
+		}
+	}
+
+	/// Blocks until the consumer is waiting in acquire() for a new value (it is done with the previous one).
+	void wait_until_consumer_waiting() const {
+		while (!_bConsumerWaiting.load(std::memory_order_acquire)) {
+			_bConsumerWaiting.wait(false, std::memory_order_acquire);
+		}
+	}
+
+	// Consumer side
+
+	/// Takes the latest published value, waiting for one if it was already acquired.
+	T& acquire() {
+		uint32_t shared = _shared.load(std::memory_order_acquire);
+		if ((shared & NEW_VALUE_BIT) == 0) {
+			_bConsumerWaiting.store(true, std::memory_order_release);
+			_bConsumerWaiting.notify_all();
+			while ((shared & NEW_VALUE_BIT) == 0) {
+				_shared.wait(shared, std::memory_order_acquire);
+				shared = _shared.load(std::memory_order_acquire);
+			}
+			// Cleared before the swap: once the producer sees the value consumed, it sees the consumer busy too
+			_bConsumerWaiting.store(false, std::memory_order_release);
+		}
+		return swap_read_slot();
+	}
+
+	/// Takes the latest published value if there is a new one, otherwise keeps the one acquired last. Never blocks.
+	T& acquire_latest() {
+		if ((_shared.load(std::memory_order_acquire) & NEW_VALUE_BIT) == 0) {
+			return _slots[_readIndex];
+		}
+		return swap_read_slot();
+	}
+
+private:
+	static constexpr uint32_t INDEX_MASK {0x3};
+	static constexpr uint32_t NEW_VALUE_BIT {0x4};
+
+	std::array<T, 3> _slots {};
+	uint32_t _writeIndex {0};                 // Owned by the producer
+	uint32_t _readIndex {1};                  // Owned by the consumer
+	std::atomic<uint32_t> _shared {2};        // Index of the shared slot, and NEW_VALUE_BIT
+	std::atomic<bool> _bConsumerWaiting {false};
+
+	T& swap_read_slot() {
+		const uint32_t previous = _shared.exchange(_readIndex, std::memory_order_acq_rel);
+		_readIndex = previous & INDEX_MASK;
+		_shared.notify_all();
+		return _slots[_readIndex];
+	}
+};
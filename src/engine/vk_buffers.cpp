@@ -0,0 +1,32 @@
+#include "vk_buffers.h"
+#include "vk_logger.h"
+
+AllocatedBuffer vkutil::create_buffer(VmaAllocator allocator, size_t allocationSize, VkBufferUsageFlags bufferUsageFlags, VmaMemoryUsage memoryUsage) {
+    // Specify the buffer
+    VkBufferCreateInfo bufferCreateInfo {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.pNext = nullptr;
+    bufferCreateInfo.size = allocationSize;
+    bufferCreateInfo.usage = bufferUsageFlags;
+
+    // Specify the allocation. Anything the CPU touches is kept persistently mapped.
+    VmaAllocationCreateInfo allocationCreateInfo {};
+    allocationCreateInfo.usage = memoryUsage;
+    if (memoryUsage != VMA_MEMORY_USAGE_GPU_ONLY) {
+        allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    }
+
+    // Allocate and create the buffer
+    AllocatedBuffer newBuffer {};
+    VkResult result = vmaCreateBuffer(allocator, &bufferCreateInfo, &allocationCreateInfo, &newBuffer.buffer, &newBuffer.vmaAllocation, &newBuffer.vmaAllocationInfo);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create buffer of size {} bytes", allocationSize);
+        throw std::runtime_error("Failed to create buffer");
+    }
+
+    return newBuffer;
+}
+
+void vkutil::destroy_buffer(VmaAllocator allocator, const AllocatedBuffer& buffer) {
+    vmaDestroyBuffer(allocator, buffer.buffer, buffer.vmaAllocation);
+}
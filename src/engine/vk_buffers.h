@@ -0,0 +1,21 @@
+#pragma once
+
+#include "vk_types.h"
+
+namespace vkutil {
+
+    /// @brief Creates a buffer and allocates its memory using the VMA allocator.
+    /// @note Host-visible allocations (CPU_TO_GPU / GPU_TO_CPU / CPU_ONLY) are created persistently mapped,
+    /// the mapped pointer is available in @code vmaAllocationInfo.pMappedData@endcode
+    /// @throws std::runtime_error if the buffer could not be created
+    AllocatedBuffer create_buffer(
+        VmaAllocator allocator,
+        size_t allocationSize,
+        VkBufferUsageFlags bufferUsageFlags,
+        VmaMemoryUsage memoryUsage
+    );
+
+    /// @brief Destroys the buffer and frees its VMA allocation.
+    void destroy_buffer(VmaAllocator allocator, const AllocatedBuffer& buffer);
+
+};
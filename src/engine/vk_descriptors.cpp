@@ -3,11 +3,11 @@
 
 // Descriptor Layout Builder: Method Definitions
 
-void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType descriptor_type) {
+void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType descriptor_type, uint32_t descriptor_count) {
     VkDescriptorSetLayoutBinding newBinding{};
     newBinding.binding = binding;
     newBinding.descriptorType = descriptor_type;
-    newBinding.descriptorCount = 1;
+    newBinding.descriptorCount = descriptor_count;
     // The stageFlags are set when building the VkDescriptorSetLayout [in the build() function]
 
     layout_bindings.push_back(newBinding);
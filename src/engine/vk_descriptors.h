@@ -7,7 +7,8 @@ private:
     std::vector<VkDescriptorSetLayoutBinding> layout_bindings;
 
 public:
-    void add_binding(uint32_t binding, VkDescriptorType descriptor_type);
+    /// @param descriptor_count Size of the binding's array (1: not an array)
+    void add_binding(uint32_t binding, VkDescriptorType descriptor_type, uint32_t descriptor_count = 1);
     void clear_all_bindings();
     VkDescriptorSetLayout build(VkDevice device, VkShaderStageFlags shaderStageFlags, void* pNext = nullptr, VkDescriptorSetLayoutCreateFlags descriptorSetLayoutCreateFlags = 0);
 };
@@ -5,21 +5,44 @@
 #include <SDL3/SDL_vulkan.h>
 #include "vk_initializers.h"
 #include "vk_types.h"
+#include <algorithm>
+#include <cfloat>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <thread>
 #include <VkBootstrap.h>
+#include <glm/vec2.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
 #include "imgui.h"
 #include "imgui_impl_sdl3.h"
 #include "imgui_impl_vulkan.h"
 
+#include "vk_buffers.h"
 #include "vk_images.h"
 #include "vk_logger.h"
 #include "vk_pipelines.h"
+#include "vk_trace.h"
+#include "vk_workgroup_tuner.h"
 
 constexpr bool bUseValidationLayers {true};
+// Set (to anything but "0"): captures a trace of the initialization and of the first TRACE_CAPTURE_FRAMES frames
+// (written to TRACE_FILE). Off by default, a capture can still be started with F2.
+constexpr const char* TRACE_STARTUP_ENV_VAR {"VKENGINE_TRACE_STARTUP"};
 constexpr uint64_t ENGINE_TIMEOUT_1_SECOND      {1000000000};   // in nanoseconds
 constexpr uint64_t ENGINE_TIMEOUT_10_SECONDS    {10000000000};  // in nanoseconds
 
+// Push-constants of the tonemap-present compute-shader
+struct TonemapPresentPushConstants {
+    glm::ivec2 srcSize;
+    glm::ivec2 dstSize;
+    float exposure;
+    uint32_t tonemapOperator;
+};
+
 // Global pointer to the Singleton Instance of the engine.
 VulkanEngine* loadedEngine = nullptr;
 
@@ -27,7 +50,18 @@ VulkanEngine& VulkanEngine::Get() { return *loadedEngine; }
 
 
 void VulkanEngine::init() {
+    vktrace::set_thread_name("Main");
+    const char* traceStartup = std::getenv(TRACE_STARTUP_ENV_VAR);
+    if (traceStartup != nullptr && std::strcmp(traceStartup, "0") != 0) {
+        vktrace::begin_capture();
+        _traceCaptureFramesLeft = TRACE_CAPTURE_FRAMES;
+    }
+    ZONE("VulkanEngine::init");
+
     VK_LOG_INFO("Initializing VulkanEngine");
+
+    // The shared scheduler of the engine's CPU work. The main thread is its worker 0, hence one thread less.
+    _jobSystem.init(std::max(std::thread::hardware_concurrency(), 2u) - 1);
     // Only one engine initialization is allowed with the application [Singleton Instance]
     if (loadedEngine == nullptr) {
         loadedEngine = this;
@@ -57,8 +91,14 @@ void VulkanEngine::init() {
     init_swapchain();
     init_commands();
     init_sync_structures();
+    init_raytraced_scene();
     init_descriptors();
     init_pipelines();
+    init_compute_workgroup_tuning();
+    init_render_graph();
+    init_occlusion_culling();
+    init_instanced_meshes();
+    init_asset_streaming();
     init_imgui();
 
     // Everything went fine
@@ -67,6 +107,11 @@ void VulkanEngine::init() {
 }
 
 void VulkanEngine::cleanup() {
+    // Write out a capture still in progress
+    if (vktrace::is_capturing()) {
+        vktrace::end_capture(TRACE_FILE);
+    }
+
     if (_isInitialized) {
         // Ensure that the GPU is done with all work
         vkDeviceWaitIdle(_device);
@@ -78,7 +123,6 @@ void VulkanEngine::cleanup() {
             // Destroy synchronization objects
             vkDestroyFence(_device, _frames.at(i).renderFence, nullptr);
             vkDestroySemaphore(_device, _frames.at(i).swapchainImageAvailableSemaphore, nullptr);
-            vkDestroySemaphore(_device, _frames.at(i).renderFinishedSemaphore, nullptr);
 
             _frames.at(i).deletionQueue.flush();
         }
@@ -92,13 +136,22 @@ void VulkanEngine::cleanup() {
         vkDestroyInstance(_vulkanInstance, nullptr);
         SDL_DestroyWindow(_window);
     }
+    _jobSystem.destroy();
+
     // clear engine pointer
     loadedEngine = nullptr;
 }
 
-void VulkanEngine::draw() {
+void VulkanEngine::draw(const FramePacket& packet) {
+    ZONE("VulkanEngine::draw");
+    _framePacket = &packet;
+
     // Wait for the GPU to finish rendering the last frame (timeout of 1s)
-    VkResult result = vkWaitForFences(_device, 1, &get_current_frame().renderFence, VK_TRUE, ENGINE_TIMEOUT_1_SECOND);
+    VkResult result {};
+    {
+        ZONE("Wait Render Fence");
+        result = vkWaitForFences(_device, 1, &get_current_frame().renderFence, VK_TRUE, ENGINE_TIMEOUT_1_SECOND);
+    }
     if (result != VK_SUCCESS) {
         if (result == VK_TIMEOUT) {
             VK_LOG_WARN("VK_TIMEOUT - vkWaitForFences - Render Fence");
@@ -112,6 +165,18 @@ void VulkanEngine::draw() {
     // Delete the resources of the current frame, since it's done rendering.
     get_current_frame().deletionQueue.flush();
 
+    // React to memory budget pressure, and advance the defragmentation (the GPU is done with this frame's resources)
+    _memoryManager.update(static_cast<uint64_t>(_frameNumber));
+
+    // The staging memory of this frame is free again: the completed asset reads queue their uploads into it. None are
+    // taken while uploads are still waiting for a frame with room for them.
+    _uploadQueue.begin_frame(_frameNumber % FRAME_OVERLAP);
+    _mipmapGenerator.begin_frame(_frameNumber % FRAME_OVERLAP);
+    if (!_uploadQueue.has_backlog()) {
+        _assetStreamer.dispatch_completions(STREAMING_MAX_COMPLETIONS_PER_FRAME);
+    }
+    update_texture_streaming(packet);
+
     // Reset the render fence
     result = vkResetFences(_device, 1, &get_current_frame().renderFence);
     if (result != VK_SUCCESS) {
@@ -121,7 +186,10 @@ void VulkanEngine::draw() {
 
     // Request the index of an available image from the Swapchain (timeout of 1s)
     uint32_t swapchainImageIndex{};
-    result = vkAcquireNextImageKHR(_device, _swapchain, ENGINE_TIMEOUT_1_SECOND, get_current_frame().swapchainImageAvailableSemaphore, VK_NULL_HANDLE, &swapchainImageIndex);
+    {
+        ZONE("Acquire Swapchain Image");
+        result = vkAcquireNextImageKHR(_device, _swapchain, ENGINE_TIMEOUT_1_SECOND, get_current_frame().swapchainImageAvailableSemaphore, VK_NULL_HANDLE, &swapchainImageIndex);
+    }
     if (result != VK_SUCCESS) {
         if (result == VK_TIMEOUT) {
             VK_LOG_WARN("VK_TIMEOUT - vkAcquireNextImageKHR");
@@ -155,166 +223,48 @@ void VulkanEngine::draw() {
 
     //
     // 1) Command buffer is now ready for recording commands onto it...
-    // NEW CODE: We use the draw-image to render, and blit-copy it into the swapchain-image for presentation
+    // We use the draw-image to render, and blit-copy it into the swapchain-image for presentation.
+    // The passes and their barriers are recorded by the render-graph (see init_render_graph()).
 
     // Re-set the draw-extent (width and height) each frame
     _drawImageExtent.width = _drawImage.imageExtent.width;
     _drawImageExtent.height = _drawImage.imageExtent.height;
 
-    // OPTIMIZED: Transition draw-image for writing into it
-    // From undefined (don't care) to general for compute-shader write operation
-    vkutil::transition_image_layout(
-        commandBuffer,
-        _drawImage.image,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_GENERAL,
-        VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,        // No previous work to wait for
-        0,                                          // No previous access to sync
-        VK_PIPELINE_STAGE_2_CLEAR_BIT,              // Wait for clear stage
-        VK_ACCESS_2_TRANSFER_WRITE_BIT              // Clear operation writes
-    );
-
-    // Draw into the image using the Compute-Pipeline:
-    VkImageSubresourceRange imageSubresourceRange {};
-    imageSubresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageSubresourceRange.baseMipLevel = 0;
-    imageSubresourceRange.levelCount = 1;
-    imageSubresourceRange.baseArrayLayer = 0;
-    imageSubresourceRange.layerCount = 1;
-
-    // Bind the pipeline for drawing with compute (Use the currently selected one in the UI)
-    ComputeShaderEffects& currentShaderEffect = _computeShaderBackgroundEffects.at(_currentComputeShaderBackgroundEffect);
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, currentShaderEffect.pipeline);
-    // Bind the descriptor sets
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _backgroundImgPipelineLayout, 0, 1, &_drawImageDescriptorSet, 0, nullptr);
-
-    // Set the values of the Push-Constants for the shaders
-    float time_elapsed = (SDL_GetTicks() / 1000.f);
-    float speed_multiplier = 1.0f;
-    currentShaderEffect.push_constants_data.data_1 = glm::vec4(time_elapsed * speed_multiplier, 0, 0, 0);
-    currentShaderEffect.push_constants_data.data_2 = glm::vec4(0, 0, 0, 0);
-    currentShaderEffect.push_constants_data.data_3 = glm::vec4(0, 0, 0, 0);
-    currentShaderEffect.push_constants_data.data_4 = glm::vec4(0, 0, 0, 0);
-    vkCmdPushConstants(commandBuffer, _backgroundImgPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputeShaderPushConstants), &currentShaderEffect.push_constants_data);
-
-    // Execute the compute pipeline dispatch. We are using 16x16 workgroup size so we need to divide by it to get total group-counts needed along X and Y
-    vkCmdDispatch(commandBuffer, std::ceil(_drawImageExtent.width / 16.0), std::ceil(_drawImageExtent.height / 16.0), 1);
-
-
-    // Draw onto the image using the Graphics-Pipeline:
-    // Transition the draw-image from GENERAL to VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-    vkutil::transition_image_layout(
-        commandBuffer,
-        _drawImage.image,
-        VK_IMAGE_LAYOUT_GENERAL,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,             // Wait for compute shader to finish
-        VK_ACCESS_2_SHADER_WRITE_BIT,                       // Compute shader was writing
-        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,    // Before color attachment writes
-        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT              // Graphics will write to color attachment
-    );
-
-    // Draw the geometry:
-    VkRenderingAttachmentInfo colorAttachmentInfo {};
-    colorAttachmentInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
-    colorAttachmentInfo.pNext = nullptr;
-    colorAttachmentInfo.imageView = _drawImage.imageView;
-    colorAttachmentInfo.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    colorAttachmentInfo.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-    colorAttachmentInfo.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-
-    VkRenderingInfo renderingInfo {};
-    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
-    renderingInfo.pNext = nullptr;
-    renderingInfo.renderArea = VkRect2D { VkOffset2D { 0, 0 }, _drawImageExtent };
-    renderingInfo.layerCount = 1;
-    renderingInfo.colorAttachmentCount = 1;
-    renderingInfo.pColorAttachments = &colorAttachmentInfo;
-    renderingInfo.pDepthAttachment = nullptr;
-    renderingInfo.pStencilAttachment = nullptr;
-
-    vkCmdBeginRendering(commandBuffer, &renderingInfo);
-
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
-
-    // Set dynamic viewport and scissor
-    VkViewport dynamicViewport {};
-    dynamicViewport.x = 0;
-    dynamicViewport.y = 0;
-    dynamicViewport.width = _drawImageExtent.width;
-    dynamicViewport.height = _drawImageExtent.height;
-    dynamicViewport.minDepth = 0.0f;
-    dynamicViewport.maxDepth = 1.0f;
-
-    vkCmdSetViewport(commandBuffer, 0, 1, &dynamicViewport);
-
-    VkRect2D dynamicScissor {};
-    dynamicScissor.offset.x = 0;
-    dynamicScissor.offset.y = 0;
-    dynamicScissor.extent.width = _drawImageExtent.width;
-    dynamicScissor.extent.height = _drawImageExtent.height;
-
-    vkCmdSetScissor(commandBuffer, 0, 1, &dynamicScissor);
-
-    // Launch a draw-command to draw 3 vertices
-    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
-
-    vkCmdEndRendering(commandBuffer);
-
-
-
-
-    // OPTIMIZED: Transition draw-image for blit source
-    // From general (after clear) to transfer source optimal
-    vkutil::transition_image_layout(
-        commandBuffer,
-        _drawImage.image,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,  // Wait for color attachment writes
-        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,           // Graphics wrote to attachment
-        VK_PIPELINE_STAGE_2_BLIT_BIT,                     // Before blit operation
-        VK_ACCESS_2_TRANSFER_READ_BIT                     // Blit will read from image
-    );
-
-    // OPTIMIZED: Transition swapchain image for blit destination
-    // From undefined (don't care) to transfer destination optimal
-    vkutil::transition_image_layout(
-        commandBuffer,
-        _swapchainImages.at(swapchainImageIndex),
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,        // No previous work to wait for
-        0,                                          // No previous access to sync
-        VK_PIPELINE_STAGE_2_BLIT_BIT,               // Prepare for blit
-        VK_ACCESS_2_TRANSFER_WRITE_BIT              // Blit will write to image
-    );
-
-
-    // Blit-copy from the draw-image to the swapchain-image to prepare it for presentation:
-    vkutil::blit_image_to_image(
-        commandBuffer,
-        _drawImage.image,
+    // Present into the acquired swapchain-image. It becomes available once the acquire semaphore is signalled,
+    // which the submission waits for at the first stage writing it (blit or compute, depending on the present path).
+    _frameSwapchainImageIndex = swapchainImageIndex;
+    _renderGraph.set_imported_image(
+        _graphSwapchainImage,
         _swapchainImages.at(swapchainImageIndex),
-        _drawImageExtent,
-        _swapchainExtent
+        _swapchainImageViews.at(swapchainImageIndex),
+        get_swapchain_write_stage()
     );
 
-    // Draw the ImGui UI onto the current swapchain-image
-    draw_imgui(commandBuffer, _swapchainImageViews.at(swapchainImageIndex));
+    // The GPU is done with the previous frame that used this frame index (its fence), so the frame's culler and
+    // instance buffers can be rewritten. The instances were extracted by the simulation thread: copied as they are
+    // into the mapped buffers.
+    _occlusionCuller.begin_frame(_frameNumber % FRAME_OVERLAP);
+    _occlusionCuller.set_instances(packet.cullInstances, packet.cullBatches);
+    const std::span<GPUInstanceData> instances = _instancedMeshRenderer.begin_frame(_frameNumber % FRAME_OVERLAP);
+    std::memcpy(instances.data(), packet.instances.data(), std::min(packet.instances.size(), instances.size()) * sizeof(GPUInstanceData));
+    _instancedMeshRenderer.set_batches(packet.instanceBatches);
+    build_render_queue(packet);
+
+    _frameCommandCounters = CommandCounters {};
+    // Before the passes, which may read the uploaded data. The textures swapped by the uploads and the mip drops are
+    // written into the frame's descriptor-set before the passes bind it.
+    _uploadQueue.record(commandBuffer, _frameCommandCounters);
+    _textureStreamer.record(commandBuffer, _frameCommandCounters);
+    std::array<VkImageView, INSTANCING_MATERIAL_TEXTURE_COUNT> materialImageViews {};
+    for (uint32_t i {0}; i < INSTANCING_MATERIAL_TEXTURE_COUNT; i++) {
+        materialImageViews[i] = _textureStreamer.get_image_view(_materialTextures[i]);
+        _textureStreamer.mark_used(_materialTextures[i]);
+    }
+    _instancedMeshRenderer.set_material_textures(_device, materialImageViews, _materialSampler, _textureStreamer.get_generation());
+    _renderGraph.execute(commandBuffer);
 
-    // OPTIMIZED: Transition swapchain image for presentation
-    // From transfer destination (after blit) to present source
-    vkutil::transition_image_layout(
-        commandBuffer,
-        _swapchainImages.at(swapchainImageIndex),
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        VK_PIPELINE_STAGE_2_BLIT_BIT,               // Wait for blit to finish
-        VK_ACCESS_2_TRANSFER_WRITE_BIT,             // Blit wrote to image
-        VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,     // No specific stage needs it after
-        0                                           // No specific access needed
-    );
+    // The render-graph just read back the GPU timings of the frame that last used this frame's resources
+    trace_gpu_passes(get_current_frame().submitTime);
 
     // Finish recording the command buffer
     result = vkEndCommandBuffer(commandBuffer);
@@ -334,23 +284,23 @@ void VulkanEngine::draw() {
     commandBufferSubmitInfo.commandBuffer = commandBuffer;
     commandBufferSubmitInfo.deviceMask = 0;
 
-    // OPTIMIZED: Wait for swapchain image availability at transfer stage
+    // OPTIMIZED: Wait for swapchain image availability at the stage that first writes it
     VkSemaphoreSubmitInfo waitSemaphoreInfo {};
     waitSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
     waitSemaphoreInfo.pNext = nullptr;
     waitSemaphoreInfo.deviceIndex = 0;
     waitSemaphoreInfo.value = 1;
     waitSemaphoreInfo.semaphore = get_current_frame().swapchainImageAvailableSemaphore;
-    waitSemaphoreInfo.stageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;  // Wait for blit operations
+    waitSemaphoreInfo.stageMask = get_swapchain_write_stage();  // Wait for the blit or the tonemap-present dispatch
 
-    // OPTIMIZED: Signal when all transfer operations complete
+    // Signal once every command of the frame completes: the present reads what any pass may have written
     VkSemaphoreSubmitInfo signalSemaphoreInfo {};
     signalSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
     signalSemaphoreInfo.pNext = nullptr;
     signalSemaphoreInfo.deviceIndex = 0;
     signalSemaphoreInfo.value = 1;
-    signalSemaphoreInfo.semaphore = get_current_frame().renderFinishedSemaphore;
-    signalSemaphoreInfo.stageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;  // Signal after blit completes
+    signalSemaphoreInfo.semaphore = _swapchainRenderFinishedSemaphores.at(swapchainImageIndex);
+    signalSemaphoreInfo.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;  // Signal after all the passes (and the final layout transition) complete
 
     // Pass all the submission info to VkSubmitInfo2 struct
     VkSubmitInfo2 cmdSubmitInfo{};
@@ -365,12 +315,21 @@ void VulkanEngine::draw() {
 
     // Submit the command buffer to the queue for execution:
     // render-fence will now be blocked until these graphics commands finish execution
+    get_current_frame().submitTime = vktrace::now();
     result = vkQueueSubmit2(_graphicsQueue, 1, &cmdSubmitInfo, get_current_frame().renderFence);
     if (result != VK_SUCCESS) {
         VK_LOG_ERROR("vkQueueSubmit2 failed");
         throw std::runtime_error("vkQueueSubmit2 failed");
     }
 
+    // The frames the GPU is still working on, this one included (at most FRAME_OVERLAP)
+    _framesInFlight = 0;
+    for (const FrameData& frame : _frames) {
+        if (vkGetFenceStatus(_device, frame.renderFence) == VK_NOT_READY) {
+            _framesInFlight++;
+        }
+    }
+
     //
     // 3) We now present the image that finished rendering in the previous step...
     //
@@ -383,22 +342,328 @@ void VulkanEngine::draw() {
     presentInfo.pSwapchains = &_swapchain;
     presentInfo.pImageIndices = &swapchainImageIndex;
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &get_current_frame().renderFinishedSemaphore;
+    presentInfo.pWaitSemaphores = &_swapchainRenderFinishedSemaphores.at(swapchainImageIndex);
+    // Tags the present with an id, to measure when it is displayed
+    _framePacer.prepare_present(presentInfo, packet.inputTime);
 
-    result = vkQueuePresentKHR(_graphicsQueue, &presentInfo);
+    {
+        ZONE("Present");
+        result = vkQueuePresentKHR(_graphicsQueue, &presentInfo);
+    }
+    _framePacer.end_frame(packet.inputTime);
     if (result != VK_SUCCESS) {
         VK_LOG_ERROR("vkQueuePresentKHR failed");
         throw std::runtime_error("vkQueuePresentKHR failed");
     }
 
-    // Increment the frame number drawn:
+    // Increment the frame number drawn. The next frame only waits on the fence of the frame that last used its
+    // resources: the GPU keeps working on this one meanwhile.
     ++_frameNumber;
+}
+
+void VulkanEngine::update_simulation(double frameSeconds) {
+    ZONE("VulkanEngine::update_simulation");
+    const double timestep = 1.0 / static_cast<double>(_simulationRate);
+
+    // Catch up with the real time, in fixed steps. Clamped to SIMULATION_MAX_STEPS_PER_FRAME: a long frame (or a
+    // minimized window) slows the simulation down instead of making the next frames longer too.
+    _simulationAccumulator += frameSeconds;
+    const double maxAccumulatedSeconds = timestep * SIMULATION_MAX_STEPS_PER_FRAME;
+    if (_simulationAccumulator > maxAccumulatedSeconds) {
+        _simulationDroppedSeconds += _simulationAccumulator - maxAccumulatedSeconds;
+        _simulationAccumulator = maxAccumulatedSeconds;
+    }
+
+    _simulationStepsLastFrame = 0;
+    while (_simulationAccumulator >= timestep) {
+        step_simulation(static_cast<float>(timestep));
+        _simulationAccumulator -= timestep;
+        _simulationTime += timestep;
+        _simulationStepsLastFrame++;
+    }
+
+    // How far the frame is between the last two steps
+    _simulationAlpha = static_cast<float>(_simulationAccumulator / timestep);
+}
+
+void VulkanEngine::step_simulation(float deltaSeconds) {
+    ZONE("VulkanEngine::step_simulation");
+    _sceneRegistry.parallel_for_each_chunk<SimulatedTransform>(_jobSystem,
+        [](uint32_t count, const Entity*, SimulatedTransform* simulatedTransforms) {
+            for (uint32_t i {0}; i < count; i++) {
+                simulatedTransforms[i].previous = simulatedTransforms[i].current;
+            }
+        });
 
-    // Ensures that the presentation engine is done presenting the image, before proceeding...
-    vkQueueWaitIdle(_graphicsQueue);
+    _sceneRegistry.parallel_for_each_chunk<const Spin, SimulatedTransform>(_jobSystem,
+        [deltaSeconds](uint32_t count, const Entity*, const Spin* spins, SimulatedTransform* simulatedTransforms) {
+            for (uint32_t i {0}; i < count; i++) {
+                const glm::quat stepRotation = glm::angleAxis(spins[i].radiansPerSecond * deltaSeconds, spins[i].axis);
+                simulatedTransforms[i].current.rotation = glm::normalize(stepRotation * simulatedTransforms[i].current.rotation);
+            }
+        });
+}
+
+void VulkanEngine::interpolate_simulated_transforms() {
+    // Setting a local transform marks its node dirty, which isn't thread-safe: sequentially
+    _sceneRegistry.for_each<const TransformNode, const SimulatedTransform>([this](const TransformNode& transformNode, const SimulatedTransform& simulatedTransform) {
+        _sceneTransforms.set_local_transform(transformNode.node, interpolate_local_transform(simulatedTransform.previous, simulatedTransform.current, _simulationAlpha));
+    });
+}
+
+void VulkanEngine::update_scene_transforms() {
+    _sceneTransforms.update(_jobSystem);
+
+    // Only the entities whose node moved get new world bounds (transformed center and extents of their local box)
+    _sceneRegistry.parallel_for_each_chunk<const TransformNode, const LocalBounds, WorldBounds>(_jobSystem,
+        [this](uint32_t count, const Entity*, const TransformNode* transformNodes, const LocalBounds* localBounds, WorldBounds* worldBounds) {
+            for (uint32_t i {0}; i < count; i++) {
+                if (!_sceneTransforms.was_updated(transformNodes[i].node)) {
+                    continue;
+                }
+                const glm::mat4& worldMatrix = _sceneTransforms.get_world_matrix(transformNodes[i].node);
+                const glm::vec3 localCenter = (localBounds[i].aabbMin + localBounds[i].aabbMax) * 0.5f;
+                const glm::vec3 localExtent = (localBounds[i].aabbMax - localBounds[i].aabbMin) * 0.5f;
+
+                const glm::vec3 worldCenter = glm::vec3(worldMatrix * glm::vec4(localCenter, 1.f));
+                const glm::vec3 worldExtent =
+                    glm::abs(glm::vec3(worldMatrix[0])) * localExtent.x +
+                    glm::abs(glm::vec3(worldMatrix[1])) * localExtent.y +
+                    glm::abs(glm::vec3(worldMatrix[2])) * localExtent.z;
+                worldBounds[i].aabbMin = worldCenter - worldExtent;
+                worldBounds[i].aabbMax = worldCenter + worldExtent;
+            }
+        });
+}
+
+void VulkanEngine::extract_instance_batches(FramePacket& packet) {
+    ZONE("VulkanEngine::extract_instance_batches");
+    std::vector<InstancedDrawBatch>& batches = packet.instanceBatches;
+
+    const std::vector<ArchetypeChunk*> chunks = _sceneRegistry.get_matching_chunks(get_component_mask<TransformNode, MeshDraw, MeshMaterial, WorldBounds>());
+    std::vector<uint32_t> chunkOffsets(chunks.size());
+    uint32_t entityCount {0};
+    for (size_t i {0}; i < chunks.size(); i++) {
+        chunkOffsets[i] = entityCount;
+        entityCount += chunks[i]->count;
+    }
+
+    // 1) Group the entities by mesh, told apart by their index range: the batch of each entity, and its instance count.
+    // Entities of the same mesh tend to be next to each other, so the lookup is skipped while the mesh doesn't change.
+    batches.clear();
+    _instanceBatchLookup.clear();
+    _frameInstanceSlots.resize(entityCount);
+    uint64_t lastMeshKey {UINT64_MAX};
+    uint32_t lastBatchIndex {0};
+    for (size_t i {0}; i < chunks.size(); i++) {
+        const MeshDraw* meshDraws = chunks[i]->get_array<MeshDraw>();
+        uint32_t* batchIndices = _frameInstanceSlots.data() + chunkOffsets[i];
+
+        for (uint32_t j {0}; j < chunks[i]->count; j++) {
+            const uint64_t meshKey = (uint64_t {meshDraws[j].firstIndex} << 32) | meshDraws[j].indexCount;
+            if (meshKey != lastMeshKey) {
+                const auto [it, bInserted] = _instanceBatchLookup.try_emplace(meshKey, static_cast<uint32_t>(batches.size()));
+                if (bInserted) {
+                    batches.push_back(InstancedDrawBatch {meshDraws[j].indexCount, meshDraws[j].firstIndex, meshDraws[j].vertexOffset, 0, 0});
+                }
+                lastMeshKey = meshKey;
+                lastBatchIndex = it->second;
+            }
+            batchIndices[j] = lastBatchIndex;
+            batches[lastBatchIndex].instanceCount++;
+        }
+    }
+
+    // 2) Lay the batches out one after the other in the instance buffer, clamped to its capacity
+    const uint32_t maxInstances = _instancedMeshRenderer.get_max_instances();
+    uint32_t instanceCount {0};
+    for (InstancedDrawBatch& batch : batches) {
+        batch.firstInstance = instanceCount;
+        batch.instanceCount = std::min(batch.instanceCount, maxInstances - instanceCount);
+        instanceCount += batch.instanceCount;
+    }
+    if (entityCount > instanceCount) {
+        VK_LOG_WARN("Instancing: {} instances extracted, only {} are drawn", entityCount, instanceCount);
+    }
+    packet.instances.resize(instanceCount);
+    packet.cullInstances.resize(instanceCount);
+
+    // The culling passes compact the visible instances of each batch at the start of its range
+    packet.cullBatches.resize(batches.size());
+    for (size_t i {0}; i < batches.size(); i++) {
+        packet.cullBatches[i] = CullDrawBatch {batches[i].indexCount, batches[i].firstIndex, batches[i].vertexOffset, batches[i].firstInstance};
+    }
+
+    // 3) Turn the batch of each entity into its slot in the buffer (UINT32_MAX if its batch was clamped)
+    std::vector<uint32_t> batchCursors(batches.size(), 0);
+    for (uint32_t& slot : _frameInstanceSlots) {
+        const uint32_t batchIndex = slot;
+        const InstancedDrawBatch& batch = batches[batchIndex];
+        const uint32_t cursor = batchCursors[batchIndex]++;
+        slot = (cursor < batch.instanceCount ? batch.firstInstance + cursor : UINT32_MAX);
+        if (slot != UINT32_MAX) {
+            packet.cullInstances[slot].batchIndex = batchIndex;
+        }
+    }
+
+    // 4) Write the instances into the packet, one job per chunk. The render thread copies them into the instance buffer,
+    // and their culling input into the culler's, at the same slots: the visible instances are compacted by their slot.
+    GPUInstanceData* instances = packet.instances.data();
+    GPUCullInstance* cullInstances = packet.cullInstances.data();
+    _jobSystem.parallel_for(static_cast<uint32_t>(chunks.size()), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i {begin}; i < end; i++) {
+            const TransformNode* transformNodes = chunks[i]->get_array<TransformNode>();
+            const MeshMaterial* materials = chunks[i]->get_array<MeshMaterial>();
+            const WorldBounds* bounds = chunks[i]->get_array<WorldBounds>();
+            const uint32_t* slots = _frameInstanceSlots.data() + chunkOffsets[i];
+
+            for (uint32_t j {0}; j < chunks[i]->count; j++) {
+                if (slots[j] != UINT32_MAX) {
+                    instances[slots[j]] = GPUInstanceData {_sceneTransforms.get_world_matrix(transformNodes[j].node), materials[j].materialIndex, {0, 0, 0}};
+
+                    // Its batchIndex was set by 3)
+                    cullInstances[slots[j]].aabbMin = glm::vec4(bounds[j].aabbMin, 0.f);
+                    cullInstances[slots[j]].aabbMax = glm::vec4(bounds[j].aabbMax, 0.f);
+                }
+            }
+        }
+    });
+}
+
+void VulkanEngine::build_render_queue(const FramePacket& packet) {
+    ZONE("VulkanEngine::build_render_queue");
+    _renderQueue.clear();
+
+    // A triangle in clip-space, at the near plane
+    RenderQueueDraw triangleDraw {};
+    triangleDraw.pipeline = _pipelineRegistry.get_pipeline(_trianglePipeline);
+    triangleDraw.pipelineLayout = _trianglePipelineLayout;
+    triangleDraw.dynamicState = &_triangleDynamicState;
+    triangleDraw.vertexOrIndexCount = 3;
+    _renderQueue.push(make_draw_key(RenderQueuePass::GEOMETRY, _trianglePipeline, 0, 0.f), triangleDraw);
+
+    // The scene meshes: the indirect draws of the culling passes, a command per mesh
+    _instancedMeshRenderer.enqueue_draws(_renderQueue, packet.viewProjection, _occlusionCuller);
+
+    _renderQueue.sort(_jobSystem);
+}
+
+void VulkanEngine::update_texture_streaming(const FramePacket& packet) {
+    ZONE("VulkanEngine::update_texture_streaming");
+
+    // The materials' textures are used by the instances drawn this frame only (materialIndex modulo the texture count)
+    std::array<float, INSTANCING_MATERIAL_TEXTURE_COUNT> nearestDistances {};
+    nearestDistances.fill(FLT_MAX);
+    for (const GPUInstanceData& instance : packet.instances) {
+        float& nearestDistance = nearestDistances[instance.materialIndex % INSTANCING_MATERIAL_TEXTURE_COUNT];
+        nearestDistance = std::min(nearestDistance, glm::distance(glm::vec3(instance.worldMatrix[3]), packet.cameraPosition));
+    }
+    for (uint32_t i {0}; i < INSTANCING_MATERIAL_TEXTURE_COUNT; i++) {
+        if (_materialTextures[i] != TEXTURE_HANDLE_NONE && nearestDistances[i] != FLT_MAX) {
+            _textureStreamer.request_view_distance(_materialTextures[i], nearestDistances[i]);
+        }
+    }
+
+    _textureStreamer.update(static_cast<uint64_t>(_frameNumber), static_cast<float>(_drawImage.imageExtent.height), packet.cameraVerticalFov, _memoryManager.get_heap_budgets());
+}
+
+void VulkanEngine::spawn_mesh_field(uint32_t instanceCount) {
+    for (Entity entity : _meshFieldEntities) {
+        _sceneTransforms.destroy_node(_sceneRegistry.get_component<TransformNode>(entity)->node);
+        _sceneRegistry.destroy_entity(entity);
+    }
+    _meshFieldEntities.clear();
+    if (_meshFieldRoot != TRANSFORM_NODE_NONE) {
+        _sceneTransforms.destroy_node(_meshFieldRoot);
+        _sceneRegistry.destroy_entity(_meshFieldRootEntity);
+        _meshFieldRoot = TRANSFORM_NODE_NONE;
+    }
+    if (instanceCount == 0 || _builtinMeshes.empty()) {
+        return;
+    }
+
+    // A square grid on the ground, in front of the camera. Meshes, rotations and materials are picked by a hash of the index.
+    // The root is at the center of the grid, which turns around it like a turntable.
+    constexpr float spacing {1.5f};
+    const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(instanceCount))));
+    const uint32_t rowCount = (instanceCount + side - 1) / side;
+    const float halfDepth = 0.5f * static_cast<float>(rowCount - 1) * spacing;
+    const LocalTransform rootTransform {glm::vec3(0.f, -1.5f, -3.f - halfDepth)};
+    _meshFieldRoot = _sceneTransforms.create_node(rootTransform);
+    _meshFieldRootEntity = _sceneRegistry.create_entity(
+        TransformNode {_meshFieldRoot},
+        SimulatedTransform {rootTransform, rootTransform},
+        Spin {glm::vec3(0.f, 1.f, 0.f), 0.2f}
+    );
+
+    _meshFieldEntities.reserve(instanceCount);
+    for (uint32_t i {0}; i < instanceCount; i++) {
+        const uint32_t hash = i * 2654435761u;
+        const uint32_t meshIndex = (hash >> 16) % static_cast<uint32_t>(_builtinMeshes.size());
+
+        LocalTransform localTransform {};
+        localTransform.translation = glm::vec3((static_cast<float>(i % side) - 0.5f * static_cast<float>(side - 1)) * spacing, 0.f, halfDepth - static_cast<float>(i / side) * spacing);
+        localTransform.rotation = glm::angleAxis(static_cast<float>(hash >> 8 & 0xFF) * (6.2831853f / 256.f), glm::normalize(glm::vec3(0.3f, 1.f, 0.2f)));
+
+        const TransformNodeId node = _sceneTransforms.create_node(localTransform, _meshFieldRoot);
+        const LocalBounds& bounds = _builtinMeshBounds[meshIndex];
+        _meshFieldEntities.push_back(_sceneRegistry.create_entity(
+            TransformNode {node},
+            bounds,
+            WorldBounds {bounds.aabbMin, bounds.aabbMax},   // Recomputed by the next update, the node is new
+            _builtinMeshes[meshIndex],
+            MeshMaterial {(hash >> 24) % 8}
+        ));
+    }
+    VK_LOG_INFO("Spawned a field of {} meshes", instanceCount);
+}
+
+void VulkanEngine::trace_gpu_passes(uint64_t frameSubmitTime) {
+    const std::span<const RenderGraphPassTiming> passTimings = _renderGraph.get_pass_timings();
+    if (!vktrace::is_capturing() || !_renderGraph.has_new_pass_timings() || passTimings.empty() || frameSubmitTime == 0) {
+        return;
+    }
+
+    // Maps the device's timestamps onto the trace's time-base, through a reference point known on both clocks.
+    // With calibrated timestamps, the device's current timestamp, read while sampling the CPU clock.
+    // Otherwise, an approximation: the frame's first pass is placed at its submission time (it can only start later).
+    uint64_t referenceTimestamp = passTimings.front().beginTimestamp;
+    uint64_t referenceTime = frameSubmitTime;
+    if (_vkGetCalibratedTimestamps != nullptr) {
+        VkCalibratedTimestampInfoEXT calibratedTimestampInfo {};
+        calibratedTimestampInfo.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+        calibratedTimestampInfo.pNext = nullptr;
+        calibratedTimestampInfo.timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+
+        uint64_t deviceTimestamp {0};
+        uint64_t maxDeviation {0};
+        const uint64_t timeBefore = vktrace::now();
+        if (_vkGetCalibratedTimestamps(_device, 1, &calibratedTimestampInfo, &deviceTimestamp, &maxDeviation) == VK_SUCCESS) {
+            const uint64_t timeAfter = vktrace::now();
+            referenceTimestamp = deviceTimestamp;
+            referenceTime = timeBefore + (timeAfter - timeBefore) / 2;
+        }
+    }
+
+    const double nanosecondsPerTick = _renderGraph.get_timestamp_period();
+    auto to_trace_time = [&](uint64_t timestamp) {
+        const double offset = static_cast<double>(static_cast<int64_t>(timestamp - referenceTimestamp)) * nanosecondsPerTick;
+        return static_cast<uint64_t>(static_cast<double>(referenceTime) + offset);
+    };
+
+    vktrace::add_gpu_zone("GPU Frame", to_trace_time(passTimings.front().beginTimestamp), to_trace_time(passTimings.back().endTimestamp));
+    for (const RenderGraphPassTiming& passTiming : passTimings) {
+        vktrace::add_gpu_zone(passTiming.name, to_trace_time(passTiming.beginTimestamp), to_trace_time(passTiming.endTimestamp));
+    }
 }
 
 void VulkanEngine::draw_imgui(VkCommandBuffer commandBuffer, VkImageView targetImageView) {
+    // The UI of the packet, copied out of ImGui by the simulation thread
+    ImDrawData* drawData = _framePacket->uiDrawData.get();
+    if (drawData == nullptr) {
+        return;
+    }
+
     VkRenderingAttachmentInfo colorAttachment {};
     colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
     colorAttachment.pNext = nullptr;
@@ -419,7 +684,125 @@ void VulkanEngine::draw_imgui(VkCommandBuffer commandBuffer, VkImageView targetI
 
     vkCmdBeginRendering(commandBuffer, &renderingInfo);
 
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
+    ImGui_ImplVulkan_RenderDrawData(drawData, commandBuffer);
+    for (const ImDrawList* drawList : drawData->CmdLists) {
+        _frameCommandCounters.draws += static_cast<uint32_t>(drawList->CmdBuffer.Size);
+    }
+
+    vkCmdEndRendering(commandBuffer);
+}
+
+void VulkanEngine::record_background_pass(VkCommandBuffer commandBuffer) {
+    // Bind the pipeline for drawing with compute (Use the currently selected one in the UI)
+    // The variant matching the effect's workgroup size and quality is compiled on its first use.
+    ComputeShaderEffects& currentShaderEffect = _computeShaderBackgroundEffects.at(_framePacket->computeEffectIndex);
+    const std::vector<uint32_t> qualityValues = get_compute_effect_quality_values(currentShaderEffect, *_framePacket);
+    const VkPipeline currentPipeline = get_compute_effect_variant(currentShaderEffect, currentShaderEffect.workgroup_size, qualityValues);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, currentPipeline);
+    // Bind the descriptor sets
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _backgroundImgPipelineLayout, 0, 1, &_drawImageDescriptorSet, 0, nullptr);
+
+    // The values of the Push-Constants for the shaders, set by the simulation thread (see build_frame_packet())
+    ComputeShaderPushConstants pushConstants = _framePacket->computeEffectPushConstants;
+
+    // Restart the accumulation whenever anything that affects the image changed since the last frame: the effect or
+    // its variant (quality), or the push-constants (the frame count in data_2.y is still 0 at this point, on both sides).
+    // The shader overwrites the history on the first frame, the render-graph orders the frames' read-modify-writes.
+    if (currentPipeline != _lastComputeShaderPipeline
+        || std::memcmp(&pushConstants, &_lastPushConstants, sizeof(ComputeShaderPushConstants)) != 0) {
+        _accumulatedFrameCount = 0;
+    }
+    _lastPushConstants = pushConstants;
+    _lastComputeShaderPipeline = currentPipeline;
+    pushConstants.data_2.y = static_cast<float>(_accumulatedFrameCount);
+    // Without the tonemap-present pass, the ray-traced scene writes display values (the blit copies them as they are)
+    pushConstants.data_2.z = _bStoragePresentSupported ? 0.f : 1.f;
+    if (_framePacket->bAccumulateRaytracedScene) {
+        _accumulatedFrameCount = std::min(_accumulatedFrameCount + 1, ACCUMULATION_MAX_FRAMES);
+    }
+    vkCmdPushConstants(commandBuffer, _backgroundImgPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputeShaderPushConstants), &pushConstants);
+
+    // Execute the compute pipeline dispatch. Divide by the (tuned) workgroup size of the effect to get the total group-counts needed along X and Y
+    const VkExtent2D workgroupSize = currentShaderEffect.workgroup_size;
+    vkCmdDispatch(commandBuffer,
+        (_drawImageExtent.width + workgroupSize.width - 1) / workgroupSize.width,
+        (_drawImageExtent.height + workgroupSize.height - 1) / workgroupSize.height,
+        1);
+    _frameCommandCounters.descriptorSetBinds++;
+    _frameCommandCounters.dispatches++;
+}
+
+void VulkanEngine::record_tonemap_present_pass(VkCommandBuffer commandBuffer) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _tonemapPresentPipeline);
+    // One descriptor-set per swapchain-image
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _tonemapPresentPipelineLayout, 0, 1, &_tonemapPresentDescriptorSets.at(_frameSwapchainImageIndex), 0, nullptr);
+
+    TonemapPresentPushConstants pushConstants {};
+    pushConstants.srcSize = glm::ivec2(_drawImageExtent.width, _drawImageExtent.height);
+    pushConstants.dstSize = glm::ivec2(_swapchainExtent.width, _swapchainExtent.height);
+    pushConstants.exposure = _framePacket->presentExposure;
+    pushConstants.tonemapOperator = static_cast<uint32_t>(_framePacket->presentTonemapOperator);
+    vkCmdPushConstants(commandBuffer, _tonemapPresentPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TonemapPresentPushConstants), &pushConstants);
+
+    // 16x16 workgroup size, one invocation per swapchain pixel
+    vkCmdDispatch(commandBuffer, (_swapchainExtent.width + 15) / 16, (_swapchainExtent.height + 15) / 16, 1);
+    _frameCommandCounters.descriptorSetBinds++;
+    _frameCommandCounters.dispatches++;
+}
+
+void VulkanEngine::record_geometry_pass(VkCommandBuffer commandBuffer, RenderQueuePass pass) {
+    // Draw the geometry:
+    VkRenderingAttachmentInfo colorAttachmentInfo {};
+    colorAttachmentInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    colorAttachmentInfo.pNext = nullptr;
+    colorAttachmentInfo.imageView = _drawImage.imageView;
+    colorAttachmentInfo.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachmentInfo.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    colorAttachmentInfo.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+    // Depth is cleared to the far-plane by the first pass (kept by the late one), and stored for building the Hi-Z pyramid
+    VkRenderingAttachmentInfo depthAttachmentInfo {};
+    depthAttachmentInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depthAttachmentInfo.pNext = nullptr;
+    depthAttachmentInfo.imageView = _depthImage.imageView;
+    depthAttachmentInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    depthAttachmentInfo.loadOp = (pass == RenderQueuePass::GEOMETRY ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD);
+    depthAttachmentInfo.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachmentInfo.clearValue.depthStencil.depth = 1.f;
+
+    VkRenderingInfo renderingInfo {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    renderingInfo.pNext = nullptr;
+    renderingInfo.renderArea = VkRect2D { VkOffset2D { 0, 0 }, _drawImageExtent };
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachmentInfo;
+    renderingInfo.pDepthAttachment = &depthAttachmentInfo;
+    renderingInfo.pStencilAttachment = nullptr;
+
+    vkCmdBeginRendering(commandBuffer, &renderingInfo);
+
+    // Set dynamic viewport and scissor
+    VkViewport dynamicViewport {};
+    dynamicViewport.x = 0;
+    dynamicViewport.y = 0;
+    dynamicViewport.width = _drawImageExtent.width;
+    dynamicViewport.height = _drawImageExtent.height;
+    dynamicViewport.minDepth = 0.0f;
+    dynamicViewport.maxDepth = 1.0f;
+
+    vkCmdSetViewport(commandBuffer, 0, 1, &dynamicViewport);
+
+    VkRect2D dynamicScissor {};
+    dynamicScissor.offset.x = 0;
+    dynamicScissor.offset.y = 0;
+    dynamicScissor.extent.width = _drawImageExtent.width;
+    dynamicScissor.extent.height = _drawImageExtent.height;
+
+    vkCmdSetScissor(commandBuffer, 0, 1, &dynamicScissor);
+
+    // The draws of this pass, sorted by build_render_queue()
+    _renderQueue.record(commandBuffer, pass, _graphicsPipelineFeatures, _frameCommandCounters);
 
     vkCmdEndRendering(commandBuffer);
 }
@@ -427,36 +810,85 @@ void VulkanEngine::draw_imgui(VkCommandBuffer commandBuffer, VkImageView targetI
 void VulkanEngine::run() {
     SDL_Event e;
     bool bQuit = false;
+    // CPU frame-time: from the start of one frame to the start of the next
+    auto frameStartTime = std::chrono::steady_clock::now();
+
+    // The render thread draws the packets built by this loop, while the next one is being built
+    std::thread renderThread([this]() { render_loop(); });
 
     // main loop
     while (!bQuit) {
-        // Handle events on queue
-        while (SDL_PollEvent(&e) != 0) {
-            // close the window when user alt-f4s or clicks the X button
-            if (e.type == SDL_EVENT_QUIT)  // SDL3: SDL_EVENT_QUIT instead of SDL_QUIT
-                bQuit = true;
-
-            // SDL3: Window events are now SDL_EVENT_WINDOW_*
-            if (e.type == SDL_EVENT_WINDOW_MINIMIZED) {
-                stop_rendering = true;
-            }
-            if (e.type == SDL_EVENT_WINDOW_RESTORED) {
-                stop_rendering = false;
+        // A capture stops after its frames (frame boundaries, so the zones of the last frame are all closed)
+        if (_traceCaptureFramesLeft > 0 && --_traceCaptureFramesLeft == 0) {
+            vktrace::end_capture(TRACE_FILE);
+        }
+        vktrace::mark_frame(_simulationFrameNumber);
+        ZONE("Frame");
+
+        // The render thread stopped on an exception: stop too (re-thrown below)
+        if (_bRenderThreadFailed.load(std::memory_order_acquire)) {
+            break;
+        }
+
+        // Wait for the render thread to take the last packet, so none is dropped and the simulation stays at most
+        // one frame ahead. In low-latency mode, also wait until it's done drawing it (and done with the frame pacing
+        // waits), so the input is sampled as late as possible.
+        {
+            ZONE("Wait Render Thread");
+            _framePackets.wait_until_consumed();
+            if (_bLowLatency) {
+                _framePackets.wait_until_consumer_waiting();
             }
+        }
+        const auto inputTime = std::chrono::steady_clock::now();
 
-            // SDL3: Key events are now SDL_EVENT_KEY_DOWN
-            if (e.type == SDL_EVENT_KEY_DOWN) {
-                switch (e.key.scancode) {
-                    // If ESCAPE key was pressed, quit the application
-                    case SDL_SCANCODE_ESCAPE:
-                        VK_LOG_INFO("ESCAPE - Exiting application");
-                        bQuit = true;
-                    default: break;
+        // Handle events on queue
+        {
+            ZONE("Poll Events");
+            while (SDL_PollEvent(&e) != 0) {
+                // close the window when user alt-f4s or clicks the X button
+                if (e.type == SDL_EVENT_QUIT)  // SDL3: SDL_EVENT_QUIT instead of SDL_QUIT
+                    bQuit = true;
+
+                // SDL3: Window events are now SDL_EVENT_WINDOW_*
+                if (e.type == SDL_EVENT_WINDOW_MINIMIZED) {
+                    stop_rendering = true;
+                }
+                if (e.type == SDL_EVENT_WINDOW_RESTORED) {
+                    stop_rendering = false;
+                }
+
+                // SDL3: Key events are now SDL_EVENT_KEY_DOWN
+                if (e.type == SDL_EVENT_KEY_DOWN) {
+                    switch (e.key.scancode) {
+                        // If ESCAPE key was pressed, quit the application
+                        case SDL_SCANCODE_ESCAPE:
+                            VK_LOG_INFO("ESCAPE - Exiting application");
+                            bQuit = true;
+                            break;
+                        // Show/hide the performance overlay
+                        case SDL_SCANCODE_F1:
+                            _performanceOverlay.toggle();
+                            break;
+                        // Capture a trace of the next frames, or stop the capture in progress
+                        case SDL_SCANCODE_F2:
+                            if (vktrace::is_capturing()) {
+                                _traceCaptureFramesLeft = 0;
+                                vktrace::end_capture(TRACE_FILE);
+                            }
+                            else {
+                                VK_LOG_INFO("Capturing a trace of the next {} frames", TRACE_CAPTURE_FRAMES);
+                                vktrace::begin_capture();
+                                _traceCaptureFramesLeft = TRACE_CAPTURE_FRAMES;
+                            }
+                            break;
+                        default: break;
+                    }
                 }
-            }
 
-            // Pass the ImGui events to SDL-Event Handler
-            ImGui_ImplSDL3_ProcessEvent(&e);
+                // Pass the ImGui events to SDL-Event Handler
+                ImGui_ImplSDL3_ProcessEvent(&e);
+            }
         }
 
         // do not draw if we are minimized
@@ -466,36 +898,359 @@ void VulkanEngine::run() {
             continue;
         }
 
+        const auto now = std::chrono::steady_clock::now();
+        _performanceOverlay.add_frame_time(std::chrono::duration<float, std::milli>(now - frameStartTime).count());
+        update_simulation(std::chrono::duration<double>(now - frameStartTime).count());
+        frameStartTime = now;
+
+        // The packet of this frame: the UI sets its one-shot requests, build_frame_packet() the rest
+        FramePacket& packet = _framePackets.get_write_slot();
+        packet.inputTime = inputTime;
+        packet.presentModeRequest.reset();
+        packet.bRetuneComputeEffect = false;
+        packet.bDefragmentMemory = false;
+        packet.bDumpMemoryStats = false;
+
+        // The statistics of the last frame drawn, for the UI
+        const RenderFrameStats& renderStats = _renderFrameStats.acquire_latest();
+
         // ImGui new frame
         ImGui_ImplVulkan_NewFrame();
         ImGui_ImplSDL3_NewFrame();
         ImGui::NewFrame();
 
         if (ImGui::Begin("Switch Compute-Shader")) {
-            ComputeShaderEffects& selected = _computeShaderBackgroundEffects[_currentComputeShaderBackgroundEffect];
+            ComputeEffectSettings& selected = _computeEffectSettings[_currentComputeShaderBackgroundEffect];
 
             ImGui::Text("Selected effect: %s", selected.name);
 
-            ImGui::SliderInt("Effect Index", &_currentComputeShaderBackgroundEffect, 0, _computeShaderBackgroundEffects.size() - 1);
+            ImGui::SliderInt("Effect Index", &_currentComputeShaderBackgroundEffect, 0, _computeEffectSettings.size() - 1);
+
+            // Switches between the pipeline variants of the effect (compiled on first use)
+            ComputeEffectSettings& current = _computeEffectSettings[_currentComputeShaderBackgroundEffect];
+            // The preset's name is not a format string: drawn next to the slider as it is
+            ImGui::SliderInt("Quality", &current.qualityPreset, 0, static_cast<int>(current.qualityPresetNames.size()) - 1, "%d");
+            ImGui::SameLine();
+            ImGui::TextUnformatted(current.qualityPresetNames.at(current.qualityPreset));
+
+            ImGui::InputFloat4("data-1",reinterpret_cast<float *>(&selected.pushConstants.data_1));
+            ImGui::InputFloat4("data-2",reinterpret_cast<float *>(&selected.pushConstants.data_2));
+            ImGui::InputFloat4("data-3",reinterpret_cast<float *>(&selected.pushConstants.data_3));
+            ImGui::InputFloat4("data-4",reinterpret_cast<float *>(&selected.pushConstants.data_4));
+
+            // Progressive accumulation of the ray-traced scene (pauses its animation while enabled).
+            // The samples per frame and bounces select a pipeline variant, like the quality presets.
+            ImGui::Separator();
+            ImGui::Checkbox("Accumulate (Ray-Traced Scene)", &_bAccumulateRaytracedScene);
+            ImGui::SliderInt("Samples per frame", &_accumulationSamplesPerFrame, 1, RAYTRACED_SCENE_SAMPLES_PER_PIXEL);
+            ImGui::SliderInt("Max bounces", &_accumulationMaxBounces, 1, RAYTRACED_SCENE_MAX_BOUNCES);
+            ImGui::Text("Accumulated frames: %u", renderStats.accumulatedFrameCount);
+
+            // Workgroup size of the effect, picked by the tuner (re-tuned by the render thread, between frames)
+            ImGui::Separator();
+            if (static_cast<size_t>(_currentComputeShaderBackgroundEffect) < renderStats.computeEffectWorkgroupSizes.size()) {
+                const VkExtent2D workgroupSize = renderStats.computeEffectWorkgroupSizes[_currentComputeShaderBackgroundEffect];
+                ImGui::Text("Workgroup size: %ux%u", workgroupSize.width, workgroupSize.height);
+            }
+            if (_workgroupSizeTuner.is_supported() && ImGui::Button("Re-tune workgroup size")) {
+                packet.bRetuneComputeEffect = true;
+            }
+        }
+        ImGui::End();
 
-            ImGui::InputFloat4("data-1",reinterpret_cast<float *>(&selected.push_constants_data.data_1));
-            ImGui::InputFloat4("data-2",reinterpret_cast<float *>(&selected.push_constants_data.data_2));
-            ImGui::InputFloat4("data-3",reinterpret_cast<float *>(&selected.push_constants_data.data_3));
-            ImGui::InputFloat4("data-4",reinterpret_cast<float *>(&selected.push_constants_data.data_4));
+        _performanceOverlay.draw(PerformanceOverlayFrameInfo {
+            renderStats.passTimings,
+            &renderStats.renderGraphStats,
+            renderStats.commandCounters,
+            _vmaAllocator,
+            renderStats.framesInFlight,
+            FRAME_OVERLAP,
+            renderStats.presentMode
+        });
+
+        if (ImGui::Begin("Memory")) {
+            const MemoryManagerStats& memoryStats = renderStats.memoryStats;
+            ImGui::Text("Budgets: %s", _bMemoryBudgetSupported ? "driver (VK_EXT_memory_budget)" : "estimated");
+            ImGui::Text("Evicted: %u resources (%.1f MiB)", memoryStats.evictedResourceCount, memoryStats.evictedBytes / (1024.0 * 1024.0));
+            ImGui::Text("Defragmentation: %u passes, moved %u allocations (%.1f MiB)%s", memoryStats.defragmentationPassCount,
+                memoryStats.movedAllocationCount, memoryStats.movedBytes / (1024.0 * 1024.0), memoryStats.bDefragmenting ? ", in progress" : "");
+            if (ImGui::Button("Dump statistics (JSON)")) {
+                packet.bDumpMemoryStats = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Defragment")) {
+                packet.bDefragmentMemory = true;
+            }
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Asset Streaming")) {
+            const AssetStreamerStats streamerStats = _assetStreamer.get_stats();
+            const UploadQueueStats& uploadStats = renderStats.uploadQueueStats;
+            ImGui::Text("Reads: %s", streamerStats.backend);
+            ImGui::Text("Requests: %u queued, %u reading, %u decoding, %u completing", streamerStats.queuedCount,
+                streamerStats.readingCount, streamerStats.decodingCount, streamerStats.completingCount);
+            ImGui::Text("Completed: %llu (%llu cancelled, %llu failed)", static_cast<unsigned long long>(streamerStats.completedCount),
+                static_cast<unsigned long long>(streamerStats.cancelledCount), static_cast<unsigned long long>(streamerStats.failedCount));
+            ImGui::Text("Read: %.1f MiB, read buffers: %.1f MiB", streamerStats.bytesRead / (1024.0 * 1024.0), streamerStats.pooledBufferBytes / (1024.0 * 1024.0));
+            ImGui::Separator();
+            ImGui::Text("Uploads: %u copies (%.2f MiB) last frame, of %.0f MiB", uploadStats.copyCount, uploadStats.frameBytes / (1024.0 * 1024.0),
+                UPLOAD_QUEUE_FRAME_BUDGET / (1024.0 * 1024.0));
+            ImGui::Text("Waiting for the next frames: %.2f MiB", uploadStats.backlogBytes / (1024.0 * 1024.0));
+            ImGui::Text("Uploaded: %.1f MiB", uploadStats.totalBytes / (1024.0 * 1024.0));
+
+            // The budget is clamped further by the room left in device-local memory
+            const TextureStreamerStats& textureStats = renderStats.textureStreamerStats;
+            ImGui::Separator();
+            ImGui::SliderInt("Texture budget (MiB)", &_textureStreamingBudgetMiB, 1, 2048, "%d", ImGuiSliderFlags_Logarithmic);
+            ImGui::Text("Textures: %u, %u loading", textureStats.textureCount, textureStats.loadsInFlight);
+            ImGui::Text("Resident: %.1f MiB of %.1f MiB (wanted: %.1f MiB)", textureStats.residentBytes / (1024.0 * 1024.0),
+                textureStats.budgetBytes / (1024.0 * 1024.0), textureStats.wantedBytes / (1024.0 * 1024.0));
+            ImGui::Text("Loads: %llu (%llu cancelled, %llu failed), drops: %llu", static_cast<unsigned long long>(textureStats.loadCount),
+                static_cast<unsigned long long>(textureStats.cancelledCount), static_cast<unsigned long long>(textureStats.failedCount),
+                static_cast<unsigned long long>(textureStats.dropCount));
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Scene")) {
+            ImGui::Text("Entities: %u (%u archetypes)", _sceneRegistry.get_entity_count(), _sceneRegistry.get_archetype_count());
+            ImGui::Text("Transform nodes: %u, updated: %u", _sceneTransforms.get_stats().nodeCount, _sceneTransforms.get_stats().updatedNodeCount);
+
+            // Re-spawned once the slider is released
+            ImGui::SliderInt("Mesh field", &_meshFieldInstanceCount, 0, static_cast<int>(INSTANCING_MAX_INSTANCES));
+            if (ImGui::IsItemDeactivatedAfterEdit()) {
+                spawn_mesh_field(static_cast<uint32_t>(_meshFieldInstanceCount));
+            }
+            ImGui::Text("Instanced draws: %u (%u instances)", renderStats.instanceBatchCount, renderStats.instanceCount);
+
+            // The simulation steps at a fixed rate, independent of the frame rate
+            ImGui::Separator();
+            ImGui::SliderInt("Simulation rate (Hz)", &_simulationRate, 10, 240);
+            ImGui::Text("Steps this frame: %u, interpolation: %.2f", _simulationStepsLastFrame, _simulationAlpha);
+            ImGui::Text("Dropped (catch-up clamp): %.1f ms", _simulationDroppedSeconds * 1000.0);
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Frame Pacing")) {
+            // Present modes: FIFO waits for the vertical blank, MAILBOX replaces the queued image, IMMEDIATE tears
+            // The modes supported by the surface don't change: queried once, by init_swapchain()
+            if (ImGui::BeginCombo("Present mode", string_VkPresentModeKHR(renderStats.presentMode))) {
+                for (VkPresentModeKHR presentMode : {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR}) {
+                    const bool bSupported = std::find(_supportedPresentModes.begin(), _supportedPresentModes.end(), presentMode) != _supportedPresentModes.end();
+                    if (ImGui::Selectable(string_VkPresentModeKHR(presentMode), presentMode == renderStats.presentMode, bSupported ? 0 : ImGuiSelectableFlags_Disabled)) {
+                        packet.presentModeRequest = presentMode;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+
+            ImGui::Checkbox("Frame limiter", &_bFrameLimiterEnabled);
+            ImGui::SameLine();
+            ImGui::SliderInt("Target FPS", &_frameLimiterTargetFrameRate, 10, 360);
+            ImGui::Checkbox(_framePacer.is_present_wait_supported() ? "Low latency (present wait)" : "Low latency (fence wait)", &_bLowLatency);
+
+            // Input-to-present latency: from the input sampling to the display (or to vkQueuePresentKHR, without present wait)
+            const FrameLatencyStats& latencyStats = renderStats.latencyStats;
+            const std::vector<float>& latencies = renderStats.latencyHistory;
+            if (!latencies.empty()) {
+                char overlayText[64];
+                std::snprintf(overlayText, sizeof(overlayText), "avg %.2f ms, max %.2f ms", latencyStats.averageMilliseconds, latencyStats.maxMilliseconds);
+                ImGui::Text("Input to %s: %.2f ms", latencyStats.bToDisplay ? "display" : "present call", latencyStats.lastMilliseconds);
+                ImGui::PlotLines("Latency", latencies.data(), static_cast<int>(latencies.size()), 0, overlayText, 0.f, std::max(latencyStats.maxMilliseconds, 33.4f), ImVec2(0, 60));
+            }
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Render Graph")) {
+            const RenderGraphStats& stats = renderStats.renderGraphStats;
+            ImGui::Text("Passes: %u (%u culled)", stats.passCount, stats.culledPassCount);
+            ImGui::Text("Transient images: %u, in %u memory blocks (%.2f MiB)", stats.transientImageCount, stats.transientMemoryBlockCount, stats.transientMemoryBytes / (1024.0 * 1024.0));
+            ImGui::Text("Barrier batches: %u (%u image, %u buffer barriers)", stats.barrierBatchCount, stats.imageBarrierCount, stats.bufferBarrierCount);
+
+            // Requests with an already known state are hits: they share its pipeline instead of compiling another
+            const PipelineRegistryStats pipelineStats = _pipelineRegistry.get_stats();
+            ImGui::Text("Graphics-pipelines: %u (%u compiling, %u failed)", pipelineStats.pipelineCount, pipelineStats.compilingCount, pipelineStats.failedCount);
+            ImGui::Text("Pipeline requests: %u (%u hits)", pipelineStats.requestCount, pipelineStats.hitCount);
+            if (_graphicsPipelineFeatures.bGraphicsPipelineLibrary) {
+                ImGui::Text("Linked from %u stage libraries", pipelineStats.libraryCount);
+            }
+            else {
+                ImGui::Text("Complete pipelines (no graphics-pipeline libraries)");
+            }
+
+            ImGui::Separator();
+            if (_bStoragePresentSupported) {
+                ImGui::Text("Present: compute tonemap");
+                ImGui::SliderFloat("Exposure", &_presentExposure, 0.1f, 8.f, "%.2f", ImGuiSliderFlags_Logarithmic);
+                ImGui::Combo("Tonemap", &_presentTonemapOperator, "None\0Reinhard\0ACES\0");
+            }
+            else {
+                ImGui::Text("Present: blit (swapchain has no storage support)");
+            }
         }
         ImGui::End();
 
         // ImGui's Render() method will only calculate the vertices/draws etc. needed by it to draw its frame
-        // But it doesn't do any drawing of its own. We will need to handle that in our Engine's draw function.
+        // But it doesn't do any drawing of its own. The draw data is copied into the packet, for the render thread.
         ImGui::Render();
 
+        build_frame_packet(packet);
+        _framePackets.publish();
+        _simulationFrameNumber++;
+    }
+
+    // The last packet stops the render thread
+    _framePackets.wait_until_consumed();
+    _framePackets.get_write_slot().bQuit = true;
+    _framePackets.publish();
+    renderThread.join();
+
+    if (_renderThreadException) {
+        std::rethrow_exception(_renderThreadException);
+    }
+}
+
+void VulkanEngine::build_frame_packet(FramePacket& packet) {
+    ZONE("VulkanEngine::build_frame_packet");
+
+    // The camera of the culling passes and of the meshes
+    const float aspectRatio = static_cast<float>(_drawImage.imageExtent.width) / static_cast<float>(_drawImage.imageExtent.height);
+    packet.viewProjection = _mainCamera.get_view_projection_matrix(aspectRatio);
+    packet.cameraPosition = _mainCamera.position;
+    packet.cameraVerticalFov = _mainCamera.verticalFov;
+
+    // The scene, after the UI's changes (e.g. a new mesh field), in between the last two simulation steps
+    interpolate_simulated_transforms();
+    update_scene_transforms();
+    extract_instance_batches(packet);
+
+    // The background effect: its variant, and the values of the Push-Constants for the shaders.
+    // The accumulated frame count (data_2.y) is added by the render thread, which restarts the accumulation.
+    // Animated by the simulation time, interpolated like the transforms.
+    ComputeEffectSettings& currentEffectSettings = _computeEffectSettings.at(_currentComputeShaderBackgroundEffect);
+    const double timestep = 1.0 / static_cast<double>(_simulationRate);
+    float time_elapsed = static_cast<float>(_simulationTime - (1.0 - _simulationAlpha) * timestep);
+    float speed_multiplier = 1.0f;
+    float animation_time = time_elapsed * speed_multiplier;
+    if (_bAccumulateRaytracedScene) {
+        // Freeze the animation (and so the orbiting camera), so the accumulated samples keep converging
+        animation_time = _accumulationFrozenTime;
+    }
+    else {
+        _accumulationFrozenTime = animation_time;
+    }
+    currentEffectSettings.pushConstants.data_1 = glm::vec4(animation_time, 0, 0, 0);
+    currentEffectSettings.pushConstants.data_2 = glm::vec4(_bAccumulateRaytracedScene ? 1 : 0, 0, 0, 0);
+    currentEffectSettings.pushConstants.data_3 = glm::vec4(0, 0, 0, 0);
+    currentEffectSettings.pushConstants.data_4 = glm::vec4(0, 0, 0, 0);
+
+    packet.computeEffectIndex = _currentComputeShaderBackgroundEffect;
+    packet.computeEffectQualityPreset = currentEffectSettings.qualityPreset;
+    packet.computeEffectPushConstants = currentEffectSettings.pushConstants;
+    packet.bAccumulateRaytracedScene = _bAccumulateRaytracedScene;
+    packet.accumulationSamplesPerFrame = static_cast<uint32_t>(_accumulationSamplesPerFrame);
+    packet.accumulationMaxBounces = static_cast<uint32_t>(_accumulationMaxBounces);
+
+    // Present and frame pacing settings
+    packet.presentExposure = _presentExposure;
+    packet.presentTonemapOperator = _presentTonemapOperator;
+    packet.targetFrameRate = _bFrameLimiterEnabled ? static_cast<uint32_t>(_frameLimiterTargetFrameRate) : 0;
+    packet.bLowLatency = _bLowLatency;
+    packet.textureStreamingBudget = static_cast<VkDeviceSize>(_textureStreamingBudgetMiB) * 1024 * 1024;
+
+    // The UI, copied out of ImGui's buffers (reused by the next frame)
+    packet.uiDrawData.capture(ImGui::GetDrawData());
+}
+
+void VulkanEngine::render_loop() {
+    vktrace::set_thread_name("Render");
+    try {
+        while (true) {
+            // Frame limiter and low-latency mode: the waiting happens here, before the simulation thread samples the
+            // input of the next packet (in low-latency mode, it waits for this thread to be waiting for the packet)
+            _framePacer.wait_for_frame_start(_swapchain, get_current_frame().renderFence);
+
+            const FramePacket& packet = _framePackets.acquire();
+            if (packet.bQuit) {
+                return;
+            }
+            apply_frame_packet_requests(packet);
+            draw(packet);
+            publish_render_frame_stats();
+        }
+    }
+    catch (const std::exception& exception) {
+        VK_LOG_ERROR("Render thread stopped: {}", exception.what());
+        _renderThreadException = std::current_exception();
+        _bRenderThreadFailed.store(true, std::memory_order_release);
+    }
 
-        // The Engine's draw function
-        draw();
+    // Keep taking the packets until the last one, so the simulation thread never waits for this one
+    while (!_framePackets.acquire().bQuit) {
     }
 }
 
+void VulkanEngine::apply_frame_packet_requests(const FramePacket& packet) {
+    // A present mode picked in the "Frame Pacing" window, applied between frames.
+    // If unsupported, the swapchain falls back to another mode.
+    if (packet.presentModeRequest.has_value() && packet.presentModeRequest.value() != _swapchainPresentMode) {
+        _requestedPresentMode = packet.presentModeRequest.value();
+        recreate_swapchain();
+    }
+
+    if (packet.targetFrameRate != _framePacer.get_target_frame_rate()) {
+        _framePacer.set_target_frame_rate(packet.targetFrameRate);
+    }
+    _framePacer.set_low_latency(packet.bLowLatency);
+    _textureStreamer.set_budget(packet.textureStreamingBudget);
+
+    if (packet.bRetuneComputeEffect) {
+        // The tuning dispatches write into the draw-image, which the frames in flight may still use
+        vkDeviceWaitIdle(_device);
+        tune_compute_effect_workgroup_size(_computeShaderBackgroundEffects.at(packet.computeEffectIndex));
+    }
+    if (packet.bDumpMemoryStats) {
+        _memoryManager.write_stats_json(MEMORY_STATS_FILE);
+    }
+    if (packet.bDefragmentMemory) {
+        _memoryManager.begin_defragmentation();
+    }
+}
+
+void VulkanEngine::publish_render_frame_stats() {
+    RenderFrameStats& stats = _renderFrameStats.get_write_slot();
+
+    const std::span<const RenderGraphPassTiming> passTimings = _renderGraph.get_pass_timings();
+    stats.passTimings.assign(passTimings.begin(), passTimings.end());
+    stats.renderGraphStats = _renderGraph.get_stats();
+    stats.commandCounters = _frameCommandCounters;
+    stats.memoryStats = _memoryManager.get_stats();
+    stats.uploadQueueStats = _uploadQueue.get_stats();
+    stats.textureStreamerStats = _textureStreamer.get_stats();
+
+    // The latency history, oldest first: the offset is the oldest entry once the history is full, its end until then
+    stats.latencyStats = _framePacer.get_latency_stats();
+    uint32_t latencyOffset {0};
+    const std::span<const float> latencies = _framePacer.get_latency_history(latencyOffset);
+    stats.latencyHistory.resize(latencies.size());
+    std::rotate_copy(latencies.begin(), latencies.begin() + latencyOffset, latencies.end(), stats.latencyHistory.begin());
+
+    stats.presentMode = _swapchainPresentMode;
+    stats.instanceBatchCount = _instancedMeshRenderer.get_batch_count();
+    stats.instanceCount = _instancedMeshRenderer.get_instance_count();
+    stats.accumulatedFrameCount = _accumulatedFrameCount;
+    stats.framesInFlight = _framesInFlight;
+    stats.computeEffectWorkgroupSizes.clear();
+    for (const ComputeShaderEffects& effect : _computeShaderBackgroundEffects) {
+        stats.computeEffectWorkgroupSizes.push_back(effect.workgroup_size);
+    }
+
+    _renderFrameStats.publish();
+}
+
 void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer)> &&function) {
+    ZONE("VulkanEngine::immediate_submit");
+
     // Reset the fence and the command-buffer used for immediate submit calls
     VkResult result = vkResetFences(_device, 1, &_immediateFence);
     if (result != VK_SUCCESS) {
@@ -556,7 +1311,10 @@ void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer)> &&funct
     VK_LOG_INFO("Submitted immediate command-buffer to the queue");
 
     // Wait for the immediate-fence (signals work completion of the immediate commands)
-    result = vkWaitForFences(_device, 1, &_immediateFence, true, ENGINE_TIMEOUT_10_SECONDS);
+    {
+        ZONE("Wait Immediate Fence");
+        result = vkWaitForFences(_device, 1, &_immediateFence, true, ENGINE_TIMEOUT_10_SECONDS);
+    }
     if (result != VK_SUCCESS) {
         if (result == VK_TIMEOUT) {
             VK_LOG_WARN("Timeout in waiting for _immediateFence inside immediate_submit() call");
@@ -565,6 +1323,24 @@ void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer)> &&funct
 
 }
 
+void VulkanEngine::upload_buffer_data(const AllocatedBuffer& dstBuffer, const void* data, size_t size) {
+    // Stage the data in host-visible memory
+    AllocatedBuffer stagingBuffer = vkutil::create_buffer(_vmaAllocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    std::memcpy(stagingBuffer.vmaAllocationInfo.pMappedData, data, size);
+
+    // Copy it into the destination buffer on the GPU
+    immediate_submit([&](VkCommandBuffer commandBuffer) {
+        VkBufferCopy bufferCopy {};
+        bufferCopy.srcOffset = 0;
+        bufferCopy.dstOffset = 0;
+        bufferCopy.size = size;
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer.buffer, dstBuffer.buffer, 1, &bufferCopy);
+    });
+
+    // immediate_submit() waited for the copy to finish
+    vkutil::destroy_buffer(_vmaAllocator, stagingBuffer);
+}
+
 
 /// @brief Initializes the core Vulkan components using vk-bootstrap library.
 ///
@@ -586,6 +1362,7 @@ void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer)> &&funct
 /// @throws std::runtime_error if any Vulkan component fails to initialize
 /// @note Sets internal handles: _vulkanInstance, _debugMessenger, _surface, _physicalDevice, _device, _graphicsQueue
 void VulkanEngine::init_vulkan() {
+    ZONE("VulkanEngine::init_vulkan");
     vkb::InstanceBuilder instanceBuilder;
     // Create the Vulkan instance with basic debug features
     auto instance_ret = instanceBuilder
@@ -614,6 +1391,11 @@ void VulkanEngine::init_vulkan() {
     vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
     vulkan12_features.bufferDeviceAddress = true;
     vulkan12_features.descriptorIndexing = true;
+    vulkan12_features.shaderSampledImageArrayNonUniformIndexing = true; // The material textures of the instanced meshes
+
+    // Vulkan 1.0 features
+    VkPhysicalDeviceFeatures vulkan10_features{};
+    vulkan10_features.multiDrawIndirect = true; // Occlusion culling issues one indirect draw per pass
 
     // Use vk-bootstrap to select a suitable GPU (physical device)
     vkb::PhysicalDeviceSelector physicalDeviceSelector {vkb_instance};
@@ -621,10 +1403,58 @@ void VulkanEngine::init_vulkan() {
         .set_minimum_version(1, 3)
         .set_required_features_13(vulkan13_features)
         .set_required_features_12(vulkan12_features)
+        .set_required_features(vulkan10_features)
         .set_surface(_surface)
         .select()
         .value();
 
+    // Optional: writing the swapchain-image from a compute-shader (its BGRA format has no GLSL format qualifier)
+    VkPhysicalDeviceFeatures optionalVulkan10Features {};
+    optionalVulkan10Features.shaderStorageImageWriteWithoutFormat = true;
+    _bStorageImageWriteWithoutFormat = vkb_physical_device.enable_features_if_present(optionalVulkan10Features);
+
+    // Optional: sampling the BC formats of the cooked textures (.ktx2), otherwise their source images are streamed
+    VkPhysicalDeviceFeatures textureCompressionFeatures {};
+    textureCompressionFeatures.textureCompressionBC = true;
+    _bTextureCompressionBC = vkb_physical_device.enable_features_if_present(textureCompressionFeatures);
+
+    // Optional: the driver's memory budgets, instead of VMA's estimates (heap sizes)
+    _bMemoryBudgetSupported = vkb_physical_device.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    // Optional: reading the device's clock from the CPU, to place the GPU timings on the trace's timeline
+    const bool bCalibratedTimestampsSupported = vkb_physical_device.enable_extension_if_present(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
+    // Optional: ids on the presents, and waiting for them to be displayed (low-latency mode, input-to-present latency)
+    VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures {};
+    presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    presentIdFeatures.presentId = VK_TRUE;
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures {};
+    presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    presentWaitFeatures.presentWait = VK_TRUE;
+    const bool bPresentWaitSupported =
+        vkb_physical_device.enable_extensions_if_present({VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME})
+        && vkb_physical_device.enable_extension_features_if_present(presentIdFeatures)
+        && vkb_physical_device.enable_extension_features_if_present(presentWaitFeatures);
+
+    // Optional: the polygon mode and color blend state set at draw time (the rest of the dynamic state is core in 1.3)
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extendedDynamicState3Features {};
+    extendedDynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+    extendedDynamicState3Features.extendedDynamicState3PolygonMode = VK_TRUE;
+    extendedDynamicState3Features.extendedDynamicState3ColorBlendEnable = VK_TRUE;
+    extendedDynamicState3Features.extendedDynamicState3ColorBlendEquation = VK_TRUE;
+    extendedDynamicState3Features.extendedDynamicState3ColorWriteMask = VK_TRUE;
+    _graphicsPipelineFeatures.bExtendedDynamicState3 =
+        vkb_physical_device.enable_extension_if_present(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)
+        && vkb_physical_device.enable_extension_features_if_present(extendedDynamicState3Features);
+
+    // Optional: graphics-pipelines linked from separately compiled stages (otherwise complete pipelines are built)
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphicsPipelineLibraryFeatures {};
+    graphicsPipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+    graphicsPipelineLibraryFeatures.graphicsPipelineLibrary = VK_TRUE;
+    _graphicsPipelineFeatures.bGraphicsPipelineLibrary =
+        vkb_physical_device.enable_extensions_if_present({VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME})
+        && vkb_physical_device.enable_extension_features_if_present(graphicsPipelineLibraryFeatures);
+
     // Create the final Vulkan device (logical device)
     vkb::DeviceBuilder deviceBuilder {vkb_physical_device};
     vkb::Device vkb_device = deviceBuilder.build().value();
@@ -637,11 +1467,45 @@ void VulkanEngine::init_vulkan() {
     _graphicsQueue = vkb_device.get_queue(vkb::QueueType::graphics).value();
     _graphicsQueueFamilyIndex = vkb_device.get_queue_index(vkb::QueueType::graphics).value();
 
+    if (bCalibratedTimestampsSupported) {
+        init_calibrated_timestamps();
+    }
+    _graphicsPipelineFeatures.load_functions(_device);
+    _framePacer.init(_device, bPresentWaitSupported);
+
     // Initialize VMA allocator
     init_vulkan_memory_allocator();
 }
 
+/// @brief Loads vkGetCalibratedTimestampsEXT, if the device's clock is one of the calibrateable time-domains.
+/// @note Leaves _vkGetCalibratedTimestamps null otherwise: the GPU zones of the traces are then approximately placed.
+void VulkanEngine::init_calibrated_timestamps() {
+    auto getCalibrateableTimeDomains = reinterpret_cast<PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT>(
+        vkGetInstanceProcAddr(_vulkanInstance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT"));
+    if (getCalibrateableTimeDomains == nullptr) {
+        return;
+    }
+
+    uint32_t timeDomainCount {0};
+    getCalibrateableTimeDomains(_physicalDevice, &timeDomainCount, nullptr);
+    std::vector<VkTimeDomainEXT> timeDomains(timeDomainCount);
+    getCalibrateableTimeDomains(_physicalDevice, &timeDomainCount, timeDomains.data());
+    if (std::find(timeDomains.begin(), timeDomains.end(), VK_TIME_DOMAIN_DEVICE_EXT) == timeDomains.end()) {
+        VK_LOG_WARN("Calibrated timestamps: the device's time-domain is not calibrateable");
+        return;
+    }
+
+    _vkGetCalibratedTimestamps = reinterpret_cast<PFN_vkGetCalibratedTimestampsEXT>(vkGetDeviceProcAddr(_device, "vkGetCalibratedTimestampsEXT"));
+}
+
 void VulkanEngine::init_swapchain() {
+    ZONE("VulkanEngine::init_swapchain");
+    // The present modes offered in the "Frame Pacing" window
+    uint32_t presentModeCount {0};
+    vkGetPhysicalDeviceSurfacePresentModesKHR(_physicalDevice, _surface, &presentModeCount, nullptr);
+    _supportedPresentModes.resize(presentModeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(_physicalDevice, _surface, &presentModeCount, _supportedPresentModes.data());
+
     // Create the swapchain
     create_swapchain(_windowExtent.width, _windowExtent.height);
 
@@ -652,6 +1516,7 @@ void VulkanEngine::init_swapchain() {
     // Hardcoding the draw format to 16-bit float (rgba)
     _drawImage.imageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
     _drawImage.imageExtent = drawImageExtent;
+    _drawImage.mipLevels = 1;
 
     // Specify the usages of the draw-image
     VkImageUsageFlags drawImageUsageFlags{};
@@ -659,6 +1524,7 @@ void VulkanEngine::init_swapchain() {
     drawImageUsageFlags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
     drawImageUsageFlags |= VK_IMAGE_USAGE_STORAGE_BIT;
     drawImageUsageFlags |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    drawImageUsageFlags |= VK_IMAGE_USAGE_SAMPLED_BIT;  // Read by the tonemap-present pass
 
     // We're now ready to allocate the draw-image...
     VkImageCreateInfo drawImageCreateInfo{};
@@ -667,7 +1533,7 @@ void VulkanEngine::init_swapchain() {
     drawImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
     drawImageCreateInfo.format = _drawImage.imageFormat;
     drawImageCreateInfo.extent = _drawImage.imageExtent;
-    drawImageCreateInfo.mipLevels = 1;
+    drawImageCreateInfo.mipLevels = _drawImage.mipLevels;
     drawImageCreateInfo.arrayLayers = 1;
     drawImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT; // For MSAA. Will not be using it now.
     drawImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -705,14 +1571,67 @@ void VulkanEngine::init_swapchain() {
     VK_LOG_SUCCESS("Draw image-view created");
 
 
+    // The depth-image matches the draw-image's size. It's a transient image of the render-graph, which allocates it
+    // (see init_render_graph()).
+    _depthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
+    _depthImage.imageExtent = drawImageExtent;
+    _depthImage.mipLevels = 1;
+
+
+    // Allocate the accumulation-image of the ray-traced scene, matching the draw-image's size.
+    // 32-bit floats, so that the running average doesn't lose the small contributions of late frames.
+    _accumulationImage.imageFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+    _accumulationImage.imageExtent = drawImageExtent;
+    _accumulationImage.mipLevels = 1;
+
+    VkImageCreateInfo accumulationImageCreateInfo{};
+    accumulationImageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    accumulationImageCreateInfo.pNext = nullptr;
+    accumulationImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    accumulationImageCreateInfo.format = _accumulationImage.imageFormat;
+    accumulationImageCreateInfo.extent = _accumulationImage.imageExtent;
+    accumulationImageCreateInfo.mipLevels = _accumulationImage.mipLevels;
+    accumulationImageCreateInfo.arrayLayers = 1;
+    accumulationImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    accumulationImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    accumulationImageCreateInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+    result = vmaCreateImage(_vmaAllocator, &accumulationImageCreateInfo, &drawImageAllocationCreateInfo, &_accumulationImage.image, &_accumulationImage.vmaAllocation, nullptr);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create accumulation image!");
+        throw std::runtime_error("Failed to create accumulation image!");
+    }
+    VK_LOG_SUCCESS("Accumulation image created");
+
+    VkImageViewCreateInfo accumulationImageViewCreateInfo{};
+    accumulationImageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    accumulationImageViewCreateInfo.pNext = nullptr;
+    accumulationImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    accumulationImageViewCreateInfo.image = _accumulationImage.image;
+    accumulationImageViewCreateInfo.format = _accumulationImage.imageFormat;
+    accumulationImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+    accumulationImageViewCreateInfo.subresourceRange.levelCount = 1;
+    accumulationImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    accumulationImageViewCreateInfo.subresourceRange.layerCount = 1;
+    accumulationImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    result = vkCreateImageView(_device, &accumulationImageViewCreateInfo, nullptr, &_accumulationImage.imageView);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create accumulation image-view!");
+        throw std::runtime_error("Failed to create accumulation image-view!");
+    }
+    VK_LOG_SUCCESS("Accumulation image-view created");
+
+
     // Add to main deletion queue:
     _mainDeletionQueue.push_deleter([&]() {
         vkDestroyImageView(_device, _drawImage.imageView, nullptr);
         vmaDestroyImage(_vmaAllocator, _drawImage.image, _drawImage.vmaAllocation);
+        vkDestroyImageView(_device, _accumulationImage.imageView, nullptr);
+        vmaDestroyImage(_vmaAllocator, _accumulationImage.image, _accumulationImage.vmaAllocation);
     });
 }
 
 void VulkanEngine::init_commands() {
+    ZONE("VulkanEngine::init_commands");
     // Have the command-pool allow resetting of individual command buffers
     VkCommandPoolCreateInfo command_pool_create_info{};
     command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -772,6 +1691,7 @@ void VulkanEngine::init_commands() {
 }
 
 void VulkanEngine::init_sync_structures() {
+    ZONE("VulkanEngine::init_sync_structures");
     // Initialize the synchronization structures for the draw-loop:
     for (int i{0}; i < FRAME_OVERLAP; i++) {
         // We want the Fence to start in the signalled state, so we can wait on it on the first frame.
@@ -797,11 +1717,6 @@ void VulkanEngine::init_sync_structures() {
             throw std::runtime_error("Failed to create swapchain image available semaphore");
         }
 
-        result = vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames.at(i).renderFinishedSemaphore);
-        if (result != VK_SUCCESS) {
-            VK_LOG_ERROR("Failed to create render finished semaphore");
-            throw std::runtime_error("Failed to create render finished semaphore");
-        }
     }
     VK_LOG_SUCCESS("Created sync structures for render-loop");
 
@@ -823,17 +1738,69 @@ void VulkanEngine::init_sync_structures() {
     });
 }
 
+void VulkanEngine::init_raytraced_scene() {
+    ZONE("VulkanEngine::init_raytraced_scene");
+    // Build the scene and its BVH on the CPU
+    _raytracedScene.create_default_scene(RAYTRACED_SCENE_SCATTERED_SPHERES);
+    _raytracedScene.build_bvh();
+
+    std::span<const GPUSphere> spheres = _raytracedScene.get_spheres();
+    std::span<const GPUBVHNode> bvhNodes = _raytracedScene.get_bvh_nodes();
+
+    // Upload both into GPU-only storage-buffers (copyable, so the defragmentation can move them)
+    constexpr VkBufferUsageFlags sceneBufferUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    _sceneSpheresBuffer = vkutil::create_buffer(_vmaAllocator, spheres.size_bytes(), sceneBufferUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+    _sceneBVHNodesBuffer = vkutil::create_buffer(_vmaAllocator, bvhNodes.size_bytes(), sceneBufferUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+    upload_buffer_data(_sceneSpheresBuffer, spheres.data(), spheres.size_bytes());
+    upload_buffer_data(_sceneBVHNodesBuffer, bvhNodes.data(), bvhNodes.size_bytes());
+    VK_LOG_SUCCESS("Uploaded ray-traced scene: {} spheres, {} BVH nodes", spheres.size(), bvhNodes.size());
+
+    // When moved, the descriptor-set is re-pointed at the new buffers
+    for (AllocatedBuffer* sceneBuffer : {&_sceneSpheresBuffer, &_sceneBVHNodesBuffer}) {
+        VkBufferCreateInfo bufferCreateInfo {};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.pNext = nullptr;
+        bufferCreateInfo.size = sceneBuffer->vmaAllocationInfo.size;
+        bufferCreateInfo.usage = sceneBufferUsage;
+
+        _memoryManager.register_movable_buffer(sceneBuffer->vmaAllocation, sceneBuffer->buffer, bufferCreateInfo, [this, sceneBuffer](VkBuffer newBuffer) {
+            sceneBuffer->buffer = newBuffer;
+            write_scene_buffer_descriptors();
+        });
+    }
+
+    _mainDeletionQueue.push_deleter([this]() {
+        _memoryManager.unregister(_sceneBVHNodesBuffer.vmaAllocation);
+        _memoryManager.unregister(_sceneSpheresBuffer.vmaAllocation);
+        vkutil::destroy_buffer(_vmaAllocator, _sceneBVHNodesBuffer);
+        vkutil::destroy_buffer(_vmaAllocator, _sceneSpheresBuffer);
+    });
+}
+
 void VulkanEngine::init_pipelines() {
+    ZONE("VulkanEngine::init_pipelines");
+    // Destroyed after the pipeline-layouts and shader-modules of its users (queued before them)
+    _pipelineRegistry.init(_device, _jobSystem, _graphicsPipelineFeatures);
+    _mainDeletionQueue.push_deleter([this]() {
+        _pipelineRegistry.destroy();
+    });
+
     init_background_img_pipeline();
     init_triangle_pipeline();
+    init_tonemap_present_pipeline();
 }
 
 void VulkanEngine::init_vulkan_memory_allocator() {
+    ZONE("VulkanEngine::init_vulkan_memory_allocator");
     VmaAllocatorCreateInfo allocator_create_info{};
     allocator_create_info.instance = _vulkanInstance;
     allocator_create_info.physicalDevice = _physicalDevice;
     allocator_create_info.device = _device;
+    allocator_create_info.vulkanApiVersion = VK_API_VERSION_1_3;
     allocator_create_info.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT; // Lets use GPU pointers
+    if (_bMemoryBudgetSupported) {
+        allocator_create_info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    }
 
     VkResult result = vmaCreateAllocator(&allocator_create_info, &_vmaAllocator);
     if (result != VK_SUCCESS) {
@@ -845,23 +1812,40 @@ void VulkanEngine::init_vulkan_memory_allocator() {
     _mainDeletionQueue.push_deleter([&]() {
         vmaDestroyAllocator(_vmaAllocator);
     });
+
+    // Budget tracking, eviction and defragmentation (copies go through immediate_submit, once initialized)
+    _memoryManager.init(_device, _vmaAllocator, FRAME_OVERLAP, [this](std::function<void(VkCommandBuffer)>&& function) {
+        immediate_submit(std::move(function));
+    });
+    _mainDeletionQueue.push_deleter([this]() {
+        _memoryManager.destroy();
+    });
 }
 
 void VulkanEngine::init_descriptors() {
-    // We'll create a descriptor-pool that will hold 10 sets of 1 descriptor each of type storage-image
+    ZONE("VulkanEngine::init_descriptors");
+    // We'll create a descriptor-pool that will hold up to 64 sets. Per set, on average:
+    // 2 storage-images, 2 combined image-samplers and 2 storage-buffers (the Hi-Z build and cull sets, and the
+    // material textures of the instanced meshes' sets)
     std::vector<DescriptorSetAllocator::PoolSizeRatio> sizeRatios = {
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1}
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2}
     };
 
-    // Max 10 Descriptor-Sets
-    // 10 Descriptors - all of them of type VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
-    _globalDescriptorSetAllocator.init_descriptor_pool(_device, 10, sizeRatios);
+    // Max 64 Descriptor-Sets
+    _globalDescriptorSetAllocator.init_descriptor_pool(_device, 64, sizeRatios);
 
     // Make the descriptor-set-layout for the compute-draw
-    // Each Descriptor-Set will only have 1 Descriptor of type VK_DESCRIPTOR_TYPE_STORAGE_IMAGE at binding 0
+    // Binding 0: the draw-image (storage-image)
+    // Binding 1, 2: the ray-traced scene's spheres and BVH nodes (storage-buffers, unused by the other effects)
+    // Binding 3: the ray-traced scene's accumulation-image (storage-image, unused by the other effects)
     {
         DescriptorLayoutBuilder layoutBuilder{};
         layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        layoutBuilder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        layoutBuilder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
         _drawImageDescriptorSetLayout = layoutBuilder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
     }
 
@@ -885,6 +1869,18 @@ void VulkanEngine::init_descriptors() {
     // Update the draw-image's descriptor-set with the info. regarding the image
     vkUpdateDescriptorSets(_device, 1, &drawImageWrite, 0, nullptr);
 
+    VkDescriptorImageInfo accumulationImageInfo{};
+    accumulationImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    accumulationImageInfo.imageView = _accumulationImage.imageView;
+
+    VkWriteDescriptorSet accumulationImageWrite = drawImageWrite;
+    accumulationImageWrite.dstBinding = 3;
+    accumulationImageWrite.pImageInfo = &accumulationImageInfo;
+    vkUpdateDescriptorSets(_device, 1, &accumulationImageWrite, 0, nullptr);
+
+    // Point the scene bindings at the ray-traced scene's buffers
+    write_scene_buffer_descriptors();
+
     // Ensuring that the global descriptor-set allocator and the layout gets cleaned up
     _mainDeletionQueue.push_deleter([&]() {
         _globalDescriptorSetAllocator.destroy_descriptor_pool(_device);
@@ -893,6 +1889,7 @@ void VulkanEngine::init_descriptors() {
 }
 
 void VulkanEngine::init_imgui() {
+    ZONE("VulkanEngine::init_imgui");
     // 1. Create the Descriptor-Pool for ImGui
     // The descriptor pool is very oversized, but its as per the ImGui-demo
     const VkDescriptorPoolSize imgui_descriptor_pool_sizes[] = {
@@ -950,6 +1947,9 @@ void VulkanEngine::init_imgui() {
     imgui_impl_vulkan_init_info.PipelineRenderingCreateInfo.pColorAttachmentFormats = &_swapchainImageFormat;
 
     ImGui_ImplVulkan_Init(&imgui_impl_vulkan_init_info);
+    // Uploaded now, rather than by the first ImGui_ImplVulkan_NewFrame(): that one runs on the simulation thread,
+    // while the render thread submits to the same queue
+    ImGui_ImplVulkan_CreateFontsTexture();
     VK_LOG_SUCCESS("Initialized ImGui");
 
     // Queue for deletion
@@ -960,7 +1960,285 @@ void VulkanEngine::init_imgui() {
 }
 
 
+/// @brief Declares the passes of a frame, and the images they use, then compiles the render-graph.
+///
+/// Passes: background (compute) -> early cull -> geometry -> Hi-Z build -> late cull -> late geometry -> Hi-Z rebuild ->
+/// tonemap-present (or blit to swapchain) -> ImGui.
+/// The culling passes and the Hi-Z build synchronize the culler's own resources, so they are marked with side effects.
+void VulkanEngine::init_render_graph() {
+    ZONE("VulkanEngine::init_render_graph");
+    // Images
+    _graphDrawImage = _renderGraph.import_image(
+        "Draw Image",
+        RenderGraphImageInfo {_drawImage.image, _drawImage.imageView, _drawImage.imageFormat, _drawImage.imageExtent, VK_IMAGE_ASPECT_COLOR_BIT},
+        false   // Fully re-drawn every frame
+    );
+    _graphAccumulationImage = _renderGraph.import_image(
+        "Accumulation Image",
+        RenderGraphImageInfo {_accumulationImage.image, _accumulationImage.imageView, _accumulationImage.imageFormat, _accumulationImage.imageExtent, VK_IMAGE_ASPECT_COLOR_BIT},
+        true    // The running average carries over from frame to frame
+    );
+    _graphSwapchainImage = _renderGraph.import_image(
+        "Swapchain Image",
+        RenderGraphImageInfo {VK_NULL_HANDLE, VK_NULL_HANDLE, _swapchainImageFormat, VkExtent3D {_swapchainExtent.width, _swapchainExtent.height, 1}, VK_IMAGE_ASPECT_COLOR_BIT},
+        false,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+    );
+    _graphDepthImage = _renderGraph.create_transient_image("Depth Image", _depthImage.imageFormat, _depthImage.imageExtent, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+    // Passes, in submission order
+    _renderGraph.add_pass("Background", [this](VkCommandBuffer commandBuffer) { record_background_pass(commandBuffer); })
+        .use_image(_graphDrawImage, RenderGraphImageUsage::COMPUTE_STORAGE_WRITE)
+        .use_image(_graphAccumulationImage, RenderGraphImageUsage::COMPUTE_STORAGE_READ_WRITE);
+
+    // Cull the scene instances against the previous frame's Hi-Z pyramid (does nothing without instances)
+    _renderGraph.add_pass("Early Cull", [this](VkCommandBuffer commandBuffer) {
+        _occlusionCuller.record_cull(commandBuffer, CullPhase::EARLY, _framePacket->viewProjection, _frameCommandCounters);
+    }).set_side_effects();
+
+    _renderGraph.add_pass("Geometry", [this](VkCommandBuffer commandBuffer) { record_geometry_pass(commandBuffer, RenderQueuePass::GEOMETRY); })
+        .use_image(_graphDrawImage, RenderGraphImageUsage::COLOR_ATTACHMENT_READ_WRITE)
+        .use_image(_graphDepthImage, RenderGraphImageUsage::DEPTH_ATTACHMENT_WRITE);
+
+    // Build the Hi-Z pyramid from the depth of the early draws, for the late pass
+    _renderGraph.add_pass("Hi-Z Build", [this](VkCommandBuffer commandBuffer) {
+        _occlusionCuller.record_hiz_pyramid_build(commandBuffer, _frameCommandCounters);
+    }).use_image(_graphDepthImage, RenderGraphImageUsage::COMPUTE_SAMPLED).set_side_effects();
+
+    // Re-test the instances rejected by the early pass, against the new pyramid, to catch the newly visible ones.
+    // Their draws go into a second rendering pass (loading color and depth), after the early-pass draws.
+    _renderGraph.add_pass("Late Cull", [this](VkCommandBuffer commandBuffer) {
+        _occlusionCuller.record_cull(commandBuffer, CullPhase::LATE, _framePacket->viewProjection, _frameCommandCounters);
+    }).set_side_effects();
+
+    _renderGraph.add_pass("Late Geometry", [this](VkCommandBuffer commandBuffer) { record_geometry_pass(commandBuffer, RenderQueuePass::LATE_GEOMETRY); })
+        .use_image(_graphDrawImage, RenderGraphImageUsage::COLOR_ATTACHMENT_READ_WRITE)
+        .use_image(_graphDepthImage, RenderGraphImageUsage::DEPTH_ATTACHMENT_WRITE);
+
+    // Rebuild the pyramid from the complete depth (the late draws included), for next frame's early pass: without it,
+    // the objects that became visible this frame would be tested against a depth they are missing from.
+    _renderGraph.add_pass("Hi-Z Rebuild", [this](VkCommandBuffer commandBuffer) {
+        _occlusionCuller.record_hiz_pyramid_build(commandBuffer, _frameCommandCounters);
+    }).use_image(_graphDepthImage, RenderGraphImageUsage::COMPUTE_SAMPLED).set_side_effects();
+
+    if (_bStoragePresentSupported) {
+        // Tonemap the draw-image and write it straight into the swapchain-image, in a single dispatch
+        _renderGraph.add_pass("Tonemap Present", [this](VkCommandBuffer commandBuffer) { record_tonemap_present_pass(commandBuffer); })
+            .use_image(_graphDrawImage, RenderGraphImageUsage::COMPUTE_SAMPLED)
+            .use_image(_graphSwapchainImage, RenderGraphImageUsage::COMPUTE_STORAGE_WRITE);
+    }
+    else {
+        // Blit-copy from the draw-image to the swapchain-image to prepare it for presentation
+        _renderGraph.add_pass("Blit To Swapchain", [this](VkCommandBuffer commandBuffer) {
+            vkutil::blit_image_to_image(
+                commandBuffer,
+                _drawImage.image,
+                _renderGraph.get_image(_graphSwapchainImage).image,
+                _drawImageExtent,
+                _swapchainExtent
+            );
+        })
+            .use_image(_graphDrawImage, RenderGraphImageUsage::TRANSFER_SRC)
+            .use_image(_graphSwapchainImage, RenderGraphImageUsage::TRANSFER_DST);
+    }
+
+    // Draw the ImGui UI onto the current swapchain-image
+    _renderGraph.add_pass("ImGui", [this](VkCommandBuffer commandBuffer) {
+        draw_imgui(commandBuffer, _renderGraph.get_image(_graphSwapchainImage).imageView);
+    }).use_image(_graphSwapchainImage, RenderGraphImageUsage::COLOR_ATTACHMENT_READ_WRITE);
+
+    _renderGraph.compile(_device, _vmaAllocator);
+    _renderGraph.enable_gpu_timing(_physicalDevice, _graphicsQueueFamilyIndex, FRAME_OVERLAP);
+
+    // The depth-image is owned by the render-graph
+    const RenderGraphImageInfo& depthImageInfo = _renderGraph.get_image(_graphDepthImage);
+    _depthImage.image = depthImageInfo.image;
+    _depthImage.imageView = depthImageInfo.imageView;
+    _depthImage.vmaAllocation = nullptr;
+
+    _mainDeletionQueue.push_deleter([this]() {
+        _renderGraph.destroy();
+    });
+}
+
+void VulkanEngine::init_occlusion_culling() {
+    ZONE("VulkanEngine::init_occlusion_culling");
+    _occlusionCuller.init(_device, _vmaAllocator, _globalDescriptorSetAllocator, _depthImage, OCCLUSION_MAX_INSTANCES, FRAME_OVERLAP);
+
+    // Clear the pyramid to the far-plane, and reset the visibility of every instance
+    immediate_submit([&](VkCommandBuffer commandBuffer) {
+        _occlusionCuller.record_initial_state(commandBuffer);
+    });
+
+    _mainDeletionQueue.push_deleter([this]() {
+        _occlusionCuller.destroy(_device, _vmaAllocator);
+    });
+}
+
+void VulkanEngine::init_instanced_meshes() {
+    ZONE("VulkanEngine::init_instanced_meshes");
+    _instancedMeshRenderer.init(_device, _vmaAllocator, _globalDescriptorSetAllocator, _pipelineRegistry, _drawImage.imageFormat, _depthImage.imageFormat, INSTANCING_MAX_INSTANCES, FRAME_OVERLAP);
+    _instancedMeshRenderer.set_visible_instance_buffer(_device, _occlusionCuller.get_visible_instance_buffer());
+
+    // The built-in meshes, flat-shaded and wound counter-clockwise seen from the outside
+    std::vector<GPUMeshVertex> vertices {};
+    std::vector<uint32_t> indices {};
+    auto add_triangle = [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        const glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+        const uint32_t firstVertex = static_cast<uint32_t>(vertices.size());
+        for (const glm::vec3& position : {a, b, c}) {
+            vertices.push_back(GPUMeshVertex {position, 0.f, normal, 0.f});
+        }
+        indices.insert(indices.end(), {firstVertex, firstVertex + 1, firstVertex + 2});
+    };
+    auto add_mesh = [&](auto&& build_triangles, float halfExtent) {
+        const uint32_t firstIndex = static_cast<uint32_t>(indices.size());
+        build_triangles();
+        _builtinMeshes.push_back(MeshDraw {static_cast<uint32_t>(indices.size()) - firstIndex, firstIndex, 0});
+        _builtinMeshBounds.push_back(LocalBounds {glm::vec3(-halfExtent), glm::vec3(halfExtent)});
+    };
+
+    // Unit cube: two triangles per face, its corners at +-0.5
+    add_mesh([&]() {
+        for (int axis {0}; axis < 3; axis++) {
+            for (float sign : {1.f, -1.f}) {
+                glm::vec3 normal {0.f};
+                normal[axis] = sign;
+                glm::vec3 tangent {0.f};
+                tangent[(axis + 1) % 3] = 1.f;
+                const glm::vec3 bitangent = glm::cross(normal, tangent);
+
+                const glm::vec3 corners[4] = {
+                    0.5f * (normal - tangent - bitangent), 0.5f * (normal + tangent - bitangent),
+                    0.5f * (normal + tangent + bitangent), 0.5f * (normal - tangent + bitangent)
+                };
+                add_triangle(corners[0], corners[1], corners[2]);
+                add_triangle(corners[0], corners[2], corners[3]);
+            }
+        }
+    }, 0.5f);
+
+    // Octahedron: one triangle per octant, its tips at +-0.6
+    add_mesh([&]() {
+        for (uint32_t octant {0}; octant < 8; octant++) {
+            const glm::vec3 sign {(octant & 1) ? -1.f : 1.f, (octant & 2) ? -1.f : 1.f, (octant & 4) ? -1.f : 1.f};
+            const glm::vec3 x {0.6f * sign.x, 0.f, 0.f};
+            const glm::vec3 y {0.f, 0.6f * sign.y, 0.f};
+            const glm::vec3 z {0.f, 0.f, 0.6f * sign.z};
+            // An odd number of mirrored axes flips the winding
+            if (sign.x * sign.y * sign.z > 0.f) {
+                add_triangle(x, y, z);
+            }
+            else {
+                add_triangle(x, z, y);
+            }
+        }
+    }, 0.6f);
+
+    const size_t vertexBufferSize = vertices.size() * sizeof(GPUMeshVertex);
+    const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
+    _meshVertexBuffer = vkutil::create_buffer(_vmaAllocator, vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    _meshIndexBuffer = vkutil::create_buffer(_vmaAllocator, indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    upload_buffer_data(_meshVertexBuffer, vertices.data(), vertexBufferSize);
+    upload_buffer_data(_meshIndexBuffer, indices.data(), indexBufferSize);
+    _instancedMeshRenderer.set_mesh_buffers(_device, _meshVertexBuffer, _meshIndexBuffer);
+    VK_LOG_SUCCESS("Uploaded {} built-in meshes: {} vertices, {} indices", _builtinMeshes.size(), vertices.size(), indices.size());
+
+    _mainDeletionQueue.push_deleter([this]() {
+        vkutil::destroy_buffer(_vmaAllocator, _meshIndexBuffer);
+        vkutil::destroy_buffer(_vmaAllocator, _meshVertexBuffer);
+        _instancedMeshRenderer.destroy(_device, _vmaAllocator);
+    });
+}
+
+void VulkanEngine::init_asset_streaming() {
+    ZONE("VulkanEngine::init_asset_streaming");
+    _assetStreamer.init(_jobSystem);
+    _uploadQueue.init(_vmaAllocator, UPLOAD_QUEUE_FRAME_BUDGET, FRAME_OVERLAP);
+    _mipmapGenerator.init(_device, _physicalDevice, _vmaAllocator, FRAME_OVERLAP, _bStorageImageWriteWithoutFormat);
+    _textureStreamer.init(_device, _vmaAllocator, _assetStreamer, _uploadQueue, _mipmapGenerator, _memoryManager, TEXTURE_STREAMING_DEFAULT_BUDGET, FRAME_OVERLAP);
+
+    // Trilinear, over whichever mips are resident (the views start at the finest one)
+    VkSamplerCreateInfo samplerCreateInfo {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.pNext = nullptr;
+    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerCreateInfo.minLod = 0.f;
+    samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkResult result = vkCreateSampler(_device, &samplerCreateInfo, nullptr, &_materialSampler);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create the material sampler");
+        throw std::runtime_error("Failed to create the material sampler");
+    }
+
+    // One texture per material, in name order. Without the directory, the materials keep their plain colors.
+    // A texture cooked by the texture_cooker (.ktx2) is preferred to the source image of the same name.
+    std::map<std::filesystem::path, std::filesystem::path> texturePathsByName {};
+    std::error_code errorCode {};
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(MATERIAL_TEXTURE_DIRECTORY, errorCode)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        const bool bCooked = entry.path().extension() == ".ktx2";
+        if (bCooked && !_bTextureCompressionBC) {
+            continue;
+        }
+        auto [it, bInserted] = texturePathsByName.try_emplace(entry.path().stem(), entry.path());
+        if (!bInserted && bCooked) {
+            it->second = entry.path();
+        }
+    }
+    if (errorCode) {
+        VK_LOG_WARN("No material textures: cannot read {} ({})", MATERIAL_TEXTURE_DIRECTORY, errorCode.message());
+    }
+    std::vector<std::filesystem::path> texturePaths {};
+    for (const auto& [name, path] : texturePathsByName) {
+        texturePaths.push_back(path);
+    }
+    _materialTextures.fill(TEXTURE_HANDLE_NONE);
+    for (size_t i {0}; i < std::min<size_t>(texturePaths.size(), INSTANCING_MATERIAL_TEXTURE_COUNT); i++) {
+        _materialTextures[i] = _textureStreamer.load_texture(texturePaths[i], true, MATERIAL_TEXTURE_WORLD_SIZE);
+    }
+    VK_LOG_INFO("Streaming {} material textures from {}", std::min<size_t>(texturePaths.size(), INSTANCING_MATERIAL_TEXTURE_COUNT), MATERIAL_TEXTURE_DIRECTORY);
+
+    // The reads and decodes in progress are finished (and dropped) first: their completions queue uploads
+    _mainDeletionQueue.push_deleter([this]() {
+        _assetStreamer.destroy();
+        _textureStreamer.destroy();
+        _mipmapGenerator.destroy();
+        _uploadQueue.destroy(_vmaAllocator);
+        vkDestroySampler(_device, _materialSampler, nullptr);
+    });
+}
+
+
+// Bindings 1 and 2 of the compute-draw descriptor-set. Re-written when the defragmentation moves the buffers.
+void VulkanEngine::write_scene_buffer_descriptors() {
+    std::array<VkDescriptorBufferInfo, 2> sceneBufferInfos {};
+    sceneBufferInfos[0] = VkDescriptorBufferInfo {_sceneSpheresBuffer.buffer, 0, VK_WHOLE_SIZE};
+    sceneBufferInfos[1] = VkDescriptorBufferInfo {_sceneBVHNodesBuffer.buffer, 0, VK_WHOLE_SIZE};
+
+    std::array<VkWriteDescriptorSet, 2> sceneBufferWrites {};
+    for (uint32_t i{0}; i < sceneBufferWrites.size(); i++) {
+        sceneBufferWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        sceneBufferWrites[i].pNext = nullptr;
+        sceneBufferWrites[i].dstSet = _drawImageDescriptorSet;
+        sceneBufferWrites[i].dstBinding = i + 1;
+        sceneBufferWrites[i].descriptorCount = 1;
+        sceneBufferWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        sceneBufferWrites[i].pBufferInfo = &sceneBufferInfos[i];
+    }
+    vkUpdateDescriptorSets(_device, static_cast<uint32_t>(sceneBufferWrites.size()), sceneBufferWrites.data(), 0, nullptr);
+}
+
 void VulkanEngine::init_background_img_pipeline() {
+    ZONE("VulkanEngine::init_background_img_pipeline");
     // Create the Pipeline-Layout
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
     pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -985,7 +2263,8 @@ void VulkanEngine::init_background_img_pipeline() {
     VK_LOG_SUCCESS("Created pipeline-layout for background-img draw");
 
     // Create the Compute-Pipelines
-    // Load the SpirV compiled compute-shaders
+    // Load the SpirV compiled compute-shaders. The shader-modules are kept alive, to create the variants of the
+    // pipelines (workgroup sizes) from them.
     VkShaderModule fractalShaderModule;
     if (!vkutil::load_shader_module(_device, &fractalShaderModule, "./shaders/fractal.comp.spv")) {
         VK_LOG_ERROR("Failed to load SpirV shader: fractal.comp.spv");
@@ -1002,86 +2281,223 @@ void VulkanEngine::init_background_img_pipeline() {
     VK_LOG_INFO("Loaded SpirV shader: raytraced_scene.comp.spv");
     VK_LOG_INFO("Created compute shader-module from shader: raytraced_scene.comp.spv");
 
-    // Create the compute pipeline for the fractal-shader:
-    VkPipelineShaderStageCreateInfo fractalStageInfo{};
-    fractalStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fractalStageInfo.pNext = nullptr;
-    fractalStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    fractalStageInfo.module = fractalShaderModule;
-    fractalStageInfo.pName = "main";
-
-    VkComputePipelineCreateInfo fractalPipelineCreateInfo{};
-    fractalPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    fractalPipelineCreateInfo.pNext = nullptr;
-    fractalPipelineCreateInfo.layout = _backgroundImgPipelineLayout;
-    fractalPipelineCreateInfo.stage = fractalStageInfo;
-
+    // Describe the fractal-shader effect. Its pipeline variants are created on first use, with the default workgroup
+    // size until it gets tuned.
+    // Quality constant: FBM octaves
     ComputeShaderEffects fractalShaderEffect {};
     fractalShaderEffect.name = "Fractal Tunnel";
     fractalShaderEffect.pipeline_layout = _backgroundImgPipelineLayout;
-    fractalShaderEffect.push_constants_data = {};
-
-    result = vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &fractalPipelineCreateInfo, nullptr, &fractalShaderEffect.pipeline);
-    if (result != VK_SUCCESS) {
-        VK_LOG_ERROR("Failed to create compute pipeline for fractal-shader");
-        throw std::runtime_error("Failed to create compute pipeline for fractal-shader");
-    }
-    VK_LOG_SUCCESS("Created compute pipeline for fractal-shader");
-
-    // Create the compute pipeline for the raytraced-scene shader:
-    VkPipelineShaderStageCreateInfo raytracedStageInfo{};
-    raytracedStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    raytracedStageInfo.pNext = nullptr;
-    raytracedStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    raytracedStageInfo.module = rayTracedShaderModule;
-    raytracedStageInfo.pName = "main";
-
-    VkComputePipelineCreateInfo raytracedPipelineCreateInfo{};
-    raytracedPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    raytracedPipelineCreateInfo.pNext = nullptr;
-    raytracedPipelineCreateInfo.layout = _backgroundImgPipelineLayout;
-    raytracedPipelineCreateInfo.stage = raytracedStageInfo;
+    fractalShaderEffect.shader_module = fractalShaderModule;
+    fractalShaderEffect.workgroup_size = WORKGROUP_SIZE_DEFAULT;
+    fractalShaderEffect.quality_presets = {
+        {"Low", {2}},
+        {"Medium", {3}},
+        {"High", {5}}
+    };
+    fractalShaderEffect.supports_accumulation = false;
 
+    // Describe the raytraced-scene shader effect:
+    // Quality constants: samples per pixel, max bounces
     ComputeShaderEffects rayTracedSceneEffect {};
     rayTracedSceneEffect.name = "Ray-Traced Scene";
     rayTracedSceneEffect.pipeline_layout = _backgroundImgPipelineLayout;
-    rayTracedSceneEffect.push_constants_data = {};
-
-    result = vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &raytracedPipelineCreateInfo, nullptr, &rayTracedSceneEffect.pipeline);
-    if (result != VK_SUCCESS) {
-        VK_LOG_ERROR("Failed to create compute pipeline for raytraced-scene-shader");
-        throw std::runtime_error("Failed to create compute pipeline for raytraced-scene-shader");
-    }
-    VK_LOG_SUCCESS("Created compute pipeline for raytraced-scene-shader");
+    rayTracedSceneEffect.shader_module = rayTracedShaderModule;
+    rayTracedSceneEffect.workgroup_size = WORKGROUP_SIZE_DEFAULT;
+    rayTracedSceneEffect.quality_presets = {
+        {"Low", {4, 3}},
+        {"Medium", {16, 6}},
+        {"High", {RAYTRACED_SCENE_SAMPLES_PER_PIXEL, RAYTRACED_SCENE_MAX_BOUNCES}}
+    };
+    rayTracedSceneEffect.supports_accumulation = true;
 
 
     // Add the 2 compute-shader background effects to the array of effects:
     _computeShaderBackgroundEffects.push_back(fractalShaderEffect);
     _computeShaderBackgroundEffects.push_back(rayTracedSceneEffect);
 
+    // What the UI edits, on the simulation thread: the effects themselves belong to the render thread.
+    // The highest quality preset by default.
+    for (const ComputeShaderEffects& effect : _computeShaderBackgroundEffects) {
+        ComputeEffectSettings settings {effect.name, {}, static_cast<int>(effect.quality_presets.size()) - 1, {}};
+        for (const ComputeShaderQualityPreset& preset : effect.quality_presets) {
+            settings.qualityPresetNames.push_back(preset.name);
+        }
+        _computeEffectSettings.push_back(std::move(settings));
+    }
 
-    // Schedule cleanup
-    vkDestroyShaderModule(_device, fractalShaderModule, nullptr);   // We no longer need it after creating the pipeline
-    vkDestroyShaderModule(_device, rayTracedShaderModule, nullptr); // We no longer need it after creating the pipeline
-    _mainDeletionQueue.push_deleter([=, this]() {
+
+    // Schedule cleanup of every pipeline variant that got created
+    _mainDeletionQueue.push_deleter([this]() {
         vkDestroyPipelineLayout(_device, _backgroundImgPipelineLayout, nullptr);
-        vkDestroyPipeline(_device, rayTracedSceneEffect.pipeline, nullptr);
-        vkDestroyPipeline(_device, fractalShaderEffect.pipeline, nullptr);
+        for (const ComputeShaderEffects& effect : _computeShaderBackgroundEffects) {
+            for (const auto& [specializationValues, pipeline] : effect.pipeline_variants) {
+                vkDestroyPipeline(_device, pipeline, nullptr);
+            }
+            vkDestroyShaderModule(_device, effect.shader_module, nullptr);
+        }
+    });
+}
+
+VkPipeline VulkanEngine::create_compute_effect_pipeline(const ComputeShaderEffects& effect, VkExtent2D workgroupSize, std::span<const uint32_t> qualityValues) {
+    // Specialization-constants 0 and 1: local_size_x_id and local_size_y_id of the shader
+    // Specialization-constants 2, 3, ...: the quality constants of the shader
+    SpecializationConstants specializationConstants {};
+    specializationConstants.add_constant(0, workgroupSize.width);
+    specializationConstants.add_constant(1, workgroupSize.height);
+    for (uint32_t i {0}; i < qualityValues.size(); i++) {
+        specializationConstants.add_constant(COMPUTE_EFFECT_QUALITY_CONSTANT_ID + i, qualityValues[i]);
+    }
+    const VkSpecializationInfo specializationInfo = specializationConstants.get_specialization_info();
+
+    return vkutil::create_compute_pipeline(_device, effect.pipeline_layout, effect.shader_module, &specializationInfo);
+}
+
+VkPipeline VulkanEngine::get_compute_effect_variant(ComputeShaderEffects& effect, VkExtent2D workgroupSize, std::span<const uint32_t> qualityValues) {
+    std::vector<uint32_t> variantKey {workgroupSize.width, workgroupSize.height};
+    variantKey.insert(variantKey.end(), qualityValues.begin(), qualityValues.end());
+
+    auto it = effect.pipeline_variants.find(variantKey);
+    if (it != effect.pipeline_variants.end()) {
+        return it->second;
+    }
+
+    VkPipeline pipeline = create_compute_effect_pipeline(effect, workgroupSize, qualityValues);
+    effect.pipeline_variants.emplace(std::move(variantKey), pipeline);
+    VK_LOG_INFO("Compiled a pipeline variant of {} (workgroup {}x{}, {} variants)", effect.name, workgroupSize.width, workgroupSize.height, effect.pipeline_variants.size());
+
+    return pipeline;
+}
+
+std::vector<uint32_t> VulkanEngine::get_compute_effect_quality_values(const ComputeShaderEffects& effect, const FramePacket& packet) const {
+    // While accumulating, the ray-traced scene takes a few cheap samples per frame instead of the preset's
+    if (effect.supports_accumulation && packet.bAccumulateRaytracedScene) {
+        return {packet.accumulationSamplesPerFrame, packet.accumulationMaxBounces};
+    }
+    return effect.quality_presets.at(packet.computeEffectQualityPreset).values;
+}
+
+void VulkanEngine::init_compute_workgroup_tuning() {
+    ZONE("VulkanEngine::init_compute_workgroup_tuning");
+    _workgroupSizeTuner.init(_device, _physicalDevice, _graphicsQueueFamilyIndex, WORKGROUP_TUNING_CACHE_FILE);
+    _mainDeletionQueue.push_deleter([this]() {
+        _workgroupSizeTuner.destroy();
+    });
+
+    for (ComputeShaderEffects& effect : _computeShaderBackgroundEffects) {
+        std::optional<VkExtent2D> cachedWorkgroupSize = _workgroupSizeTuner.get_cached_workgroup_size(effect.name);
+        if (cachedWorkgroupSize.has_value()) {
+            // Tuned in a previous run, on this device and driver
+            VK_LOG_INFO("Using the cached workgroup {}x{} for {}", cachedWorkgroupSize->width, cachedWorkgroupSize->height, effect.name);
+            effect.workgroup_size = cachedWorkgroupSize.value();
+        }
+        else {
+            tune_compute_effect_workgroup_size(effect);
+        }
+    }
+
+    // With the workgroup sizes settled, compile the variants of the quality presets up-front
+    compile_compute_effect_variants();
+}
+
+void VulkanEngine::compile_compute_effect_variants() {
+    ZONE("VulkanEngine::compile_compute_effect_variants");
+
+    // The variants not compiled yet: a preset of an effect, with its workgroup size
+    struct PendingVariant {
+        ComputeShaderEffects* effect;
+        std::vector<uint32_t> key;
+        VkPipeline pipeline;
+    };
+    std::vector<PendingVariant> pendingVariants {};
+    for (ComputeShaderEffects& effect : _computeShaderBackgroundEffects) {
+        for (const ComputeShaderQualityPreset& preset : effect.quality_presets) {
+            std::vector<uint32_t> variantKey {effect.workgroup_size.width, effect.workgroup_size.height};
+            variantKey.insert(variantKey.end(), preset.values.begin(), preset.values.end());
+            if (!effect.pipeline_variants.contains(variantKey)) {
+                pendingVariants.push_back(PendingVariant {&effect, std::move(variantKey), VK_NULL_HANDLE});
+            }
+        }
+    }
+
+    // Pipeline creation is thread-safe (no pipeline-cache is shared), so each job compiles one variant.
+    // The variant maps are only updated afterwards, from this thread.
+    _jobSystem.parallel_for(static_cast<uint32_t>(pendingVariants.size()), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i {begin}; i < end; i++) {
+            PendingVariant& variant = pendingVariants[i];
+            const std::span<const uint32_t> qualityValues = std::span<const uint32_t>(variant.key).subspan(2);
+            variant.pipeline = create_compute_effect_pipeline(*variant.effect, variant.effect->workgroup_size, qualityValues);
+        }
+    });
+
+    for (PendingVariant& variant : pendingVariants) {
+        variant.effect->pipeline_variants.emplace(std::move(variant.key), variant.pipeline);
+    }
+    VK_LOG_INFO("Compiled {} compute-effect pipeline variants on {} workers", pendingVariants.size(), _jobSystem.get_worker_count());
+}
+
+void VulkanEngine::tune_compute_effect_workgroup_size(ComputeShaderEffects& effect) {
+    // Time a cheap but representative frame: no accumulation, with the lowest quality preset
+    ComputeShaderPushConstants tuningPushConstants {};
+    const std::vector<uint32_t>& tuningQualityValues = effect.quality_presets.front().values;
+
+    // The variants write into the draw-image
+    immediate_submit([&](VkCommandBuffer commandBuffer) {
+        vkutil::transition_image_layout(
+            commandBuffer,
+            _drawImage.image,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+            0,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+        );
     });
+
+    WorkgroupSizeTuner::TuningResult tuningResult = _workgroupSizeTuner.tune(
+        effect.name,
+        [&](VkExtent2D workgroupSize) {
+            return create_compute_effect_pipeline(effect, workgroupSize, tuningQualityValues);
+        },
+        [&](VkCommandBuffer commandBuffer, VkPipeline pipeline, VkExtent2D workgroupSize) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline_layout, 0, 1, &_drawImageDescriptorSet, 0, nullptr);
+            vkCmdPushConstants(commandBuffer, effect.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputeShaderPushConstants), &tuningPushConstants);
+            vkCmdDispatch(commandBuffer,
+                (_drawImage.imageExtent.width + workgroupSize.width - 1) / workgroupSize.width,
+                (_drawImage.imageExtent.height + workgroupSize.height - 1) / workgroupSize.height,
+                1);
+        },
+        [this](std::function<void(VkCommandBuffer)>&& function) {
+            immediate_submit(std::move(function));
+        }
+    );
+
+    // Keep the current workgroup size when tuning is unsupported
+    if (tuningResult.pipeline == VK_NULL_HANDLE) {
+        return;
+    }
+    effect.workgroup_size = tuningResult.workgroupSize;
+
+    // Keep the winning pipeline as a variant, unless that variant already exists
+    std::vector<uint32_t> variantKey {tuningResult.workgroupSize.width, tuningResult.workgroupSize.height};
+    variantKey.insert(variantKey.end(), tuningQualityValues.begin(), tuningQualityValues.end());
+    if (!effect.pipeline_variants.emplace(std::move(variantKey), tuningResult.pipeline).second) {
+        vkDestroyPipeline(_device, tuningResult.pipeline, nullptr);
+    }
 }
 
 void VulkanEngine::init_triangle_pipeline() {
+    ZONE("VulkanEngine::init_triangle_pipeline");
     // Load the SpirV compiled fragment-shaders
-    VkShaderModule triangleVertexShaderModule;
-    if (!vkutil::load_shader_module(_device, &triangleVertexShaderModule, "./shaders/triangle.vert.spv")) {
+    if (!vkutil::load_shader_module(_device, &_triangleVertexShaderModule, "./shaders/triangle.vert.spv")) {
         VK_LOG_ERROR("Failed to load SpirV shader: triangle.vert.spv");
         throw std::runtime_error("Failed to load SpirV shader: triangle.vert.spv");
     }
     VK_LOG_INFO("Loaded SpirV shader: triangle.vert.spv");
     VK_LOG_INFO("Created compute shader-module from shader: triangle.vert.spv");
 
-    VkShaderModule triangleFragmentShaderModule;
-    if (!vkutil::load_shader_module(_device, &triangleFragmentShaderModule, "./shaders/triangle.frag.spv")) {
+    if (!vkutil::load_shader_module(_device, &_triangleFragmentShaderModule, "./shaders/triangle.frag.spv")) {
         VK_LOG_ERROR("Failed to load SpirV shader: triangle.frag.spv");
         throw std::runtime_error("Failed to load SpirV shader: triangle.frag.spv");
     }
@@ -1110,47 +2526,203 @@ void VulkanEngine::init_triangle_pipeline() {
     // Create the Graphics-Pipeline
     GraphicsPipelineBuilder graphics_pipeline_builder{};
     graphics_pipeline_builder.set_pipeline_layout(_trianglePipelineLayout);
-    graphics_pipeline_builder.set_shader_modules(triangleVertexShaderModule, triangleFragmentShaderModule);
+    graphics_pipeline_builder.set_shader_modules(_triangleVertexShaderModule, _triangleFragmentShaderModule);
     graphics_pipeline_builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
     graphics_pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
     graphics_pipeline_builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
     graphics_pipeline_builder.set_multisampling_none();
     graphics_pipeline_builder.set_blending_none();
-    graphics_pipeline_builder.disable_depth_testing();
+    graphics_pipeline_builder.enable_depth_testing(true, VK_COMPARE_OP_LESS_OR_EQUAL);
     graphics_pipeline_builder.set_color_attachment_format(_drawImage.imageFormat);
-    graphics_pipeline_builder.set_depth_attachment_format(VK_FORMAT_UNDEFINED);
+    graphics_pipeline_builder.set_depth_attachment_format(_depthImage.imageFormat);
+    graphics_pipeline_builder.enable_dynamic_state(_graphicsPipelineFeatures);
+    _triangleDynamicState = graphics_pipeline_builder.get_dynamic_state();
+
+    // Drawn every frame, from the first one: waited for instead of using a placeholder
+    _trianglePipeline = _pipelineRegistry.request_graphics_pipeline(graphics_pipeline_builder);
+    if (_pipelineRegistry.wait_for_pipeline(_trianglePipeline) == VK_NULL_HANDLE) {
+        VK_LOG_ERROR("Failed to create triangle graphics-pipeline");
+        throw std::runtime_error("Failed to create triangle graphics-pipeline");
+    }
+
+
+    // Queue cleanup deletion (the pipeline belongs to the registry, the shader-modules live as long as it is registered)
+    _mainDeletionQueue.push_deleter([&]() {
+        vkDestroyPipelineLayout(_device, _trianglePipelineLayout, nullptr);
+        vkDestroyShaderModule(_device, _triangleVertexShaderModule, nullptr);
+        vkDestroyShaderModule(_device, _triangleFragmentShaderModule, nullptr);
+    });
+}
+
+void VulkanEngine::init_tonemap_present_pipeline() {
+    ZONE("VulkanEngine::init_tonemap_present_pipeline");
+    if (!_bStoragePresentSupported) {
+        VK_LOG_INFO("Swapchain-images do not support storage writes, presenting with a blit");
+        return;
+    }
+
+    // Bilinear sampling of the draw-image, when its size differs from the swapchain's
+    VkSamplerCreateInfo samplerCreateInfo {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.pNext = nullptr;
+    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.minLod = 0.f;
+    samplerCreateInfo.maxLod = 0.f;
+
+    VkResult result = vkCreateSampler(_device, &samplerCreateInfo, nullptr, &_drawImageLinearSampler);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create the draw-image sampler");
+        throw std::runtime_error("Failed to create the draw-image sampler");
+    }
 
-    _trianglePipeline = graphics_pipeline_builder.build_pipeline(_device);
+    // Binding 0: the draw-image (combined image-sampler), binding 1: the swapchain-image (storage-image)
+    {
+        DescriptorLayoutBuilder layoutBuilder{};
+        layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        _tonemapPresentDescriptorSetLayout = layoutBuilder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
 
-    // Destroy the shader-modules
-    vkDestroyShaderModule(_device, triangleVertexShaderModule, nullptr);
-    vkDestroyShaderModule(_device, triangleFragmentShaderModule, nullptr);
+    write_tonemap_present_descriptors();
 
+    // Pipeline-layout and pipeline
+    VkPushConstantRange pushConstantRange {};
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(TonemapPresentPushConstants);
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
-    // Queue cleanup deletion
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.pNext = nullptr;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &_tonemapPresentDescriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    result = vkCreatePipelineLayout(_device, &pipelineLayoutCreateInfo, nullptr, &_tonemapPresentPipelineLayout);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create pipeline-layout for tonemap-present");
+        throw std::runtime_error("Failed to create pipeline-layout for tonemap-present");
+    }
+
+    VkShaderModule tonemapPresentShaderModule;
+    if (!vkutil::load_shader_module(_device, &tonemapPresentShaderModule, "./shaders/tonemap_present.comp.spv")) {
+        VK_LOG_ERROR("Failed to load SpirV shader: tonemap_present.comp.spv");
+        throw std::runtime_error("Failed to load SpirV shader: tonemap_present.comp.spv");
+    }
+    _tonemapPresentPipeline = vkutil::create_compute_pipeline(_device, _tonemapPresentPipelineLayout, tonemapPresentShaderModule);
+    vkDestroyShaderModule(_device, tonemapPresentShaderModule, nullptr);
+    VK_LOG_SUCCESS("Created tonemap-present pipeline, presenting from a compute-shader");
+
+    // Queue cleanup deletion. The descriptor-sets are freed with the global pool.
     _mainDeletionQueue.push_deleter([&]() {
-        vkDestroyPipelineLayout(_device, _trianglePipelineLayout, nullptr);
-        vkDestroyPipeline(_device, _trianglePipeline, nullptr);
+        vkDestroyPipeline(_device, _tonemapPresentPipeline, nullptr);
+        vkDestroyPipelineLayout(_device, _tonemapPresentPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(_device, _tonemapPresentDescriptorSetLayout, nullptr);
+        vkDestroySampler(_device, _drawImageLinearSampler, nullptr);
     });
 }
 
 
+void VulkanEngine::write_tonemap_present_descriptors() {
+    // One descriptor-set per swapchain-image, picked with the acquired image's index.
+    // Kept across the swapchain re-creations, more are allocated if it has more images.
+    while (_tonemapPresentDescriptorSets.size() < _swapchainImageViews.size()) {
+        _tonemapPresentDescriptorSets.push_back(_globalDescriptorSetAllocator.allocate_descriptor_set(_device, _tonemapPresentDescriptorSetLayout));
+    }
+
+    for (size_t i {0}; i < _swapchainImageViews.size(); i++) {
+        VkDescriptorImageInfo drawImageInfo {};
+        drawImageInfo.sampler = _drawImageLinearSampler;
+        drawImageInfo.imageView = _drawImage.imageView;
+        drawImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkDescriptorImageInfo swapchainImageInfo {};
+        swapchainImageInfo.imageView = _swapchainImageViews.at(i);
+        swapchainImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::array<VkWriteDescriptorSet, 2> writes {};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].pNext = nullptr;
+        writes[0].dstSet = _tonemapPresentDescriptorSets.at(i);
+        writes[0].dstBinding = 0;
+        writes[0].descriptorCount = 1;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[0].pImageInfo = &drawImageInfo;
+
+        writes[1] = writes[0];
+        writes[1].dstBinding = 1;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writes[1].pImageInfo = &swapchainImageInfo;
+
+        vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+}
+
 void VulkanEngine::create_swapchain(uint32_t width, uint32_t height) {
     vkb::SwapchainBuilder swapchainBuilder {_physicalDevice, _device, _surface};
 
     _swapchainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+
+    // The tonemap-present pass writes the swapchain-images as storage-images. It needs the surface to allow
+    // the storage usage, the format to support it, and the shaders to write without a format qualifier.
+    // Otherwise, the draw-image is blitted.
+    VkSurfaceCapabilitiesKHR surfaceCapabilities {};
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(_physicalDevice, _surface, &surfaceCapabilities);
+    VkFormatProperties swapchainFormatProperties {};
+    vkGetPhysicalDeviceFormatProperties(_physicalDevice, _swapchainImageFormat, &swapchainFormatProperties);
+    _bStoragePresentSupported = _bStorageImageWriteWithoutFormat
+        && (surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT) != 0
+        && (swapchainFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) != 0;
+
+    VkImageUsageFlags swapchainImageUsageFlags {VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+    if (_bStoragePresentSupported) {
+        swapchainImageUsageFlags |= VK_IMAGE_USAGE_STORAGE_BIT;
+    }
+
     vkb::Swapchain vkbSwapchain = swapchainBuilder
         .set_desired_format(VkSurfaceFormatKHR {.format = _swapchainImageFormat, .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR})
-        .set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
+        .set_desired_present_mode(_requestedPresentMode)
         .set_desired_extent(width, height)
-        .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+        .add_image_usage_flags(swapchainImageUsageFlags)
         .build()
         .value();
 
     _swapchainExtent = vkbSwapchain.extent;
+    _swapchainPresentMode = vkbSwapchain.present_mode;
     _swapchain = vkbSwapchain.swapchain;
     _swapchainImages = vkbSwapchain.get_images().value();
     _swapchainImageViews = vkbSwapchain.get_image_views().value();
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    _swapchainRenderFinishedSemaphores.resize(_swapchainImages.size(), VK_NULL_HANDLE);
+    for (VkSemaphore& semaphore : _swapchainRenderFinishedSemaphores) {
+        const VkResult result = vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &semaphore);
+        if (result != VK_SUCCESS) {
+            VK_LOG_ERROR("Failed to create render finished semaphore");
+            throw std::runtime_error("Failed to create render finished semaphore");
+        }
+    }
+}
+
+void VulkanEngine::recreate_swapchain() {
+    ZONE("VulkanEngine::recreate_swapchain");
+    vkDeviceWaitIdle(_device);
+
+    // The present ids in flight belong to the old swapchain
+    _framePacer.reset_presents();
+    destroy_swapchain();
+    create_swapchain(_windowExtent.width, _windowExtent.height);
+    if (_bStoragePresentSupported) {
+        write_tonemap_present_descriptors();
+    }
+    VK_LOG_INFO("Re-created the swapchain: {} images, present mode {}", _swapchainImages.size(), string_VkPresentModeKHR(_swapchainPresentMode));
 }
 
 void VulkanEngine::destroy_swapchain() {
@@ -1159,4 +2731,8 @@ void VulkanEngine::destroy_swapchain() {
     for (size_t i{0}; i < _swapchainImageViews.size(); i++) {
         vkDestroyImageView(_device, _swapchainImageViews.at(i), nullptr);
     }
+    for (VkSemaphore semaphore : _swapchainRenderFinishedSemaphores) {
+        vkDestroySemaphore(_device, semaphore, nullptr);
+    }
+    _swapchainRenderFinishedSemaphores.clear();
 }
\ No newline at end of file
@@ -1,11 +1,82 @@
 ﻿#pragma once
 
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <map>
+#include <unordered_map>
+
 #include "vk_types.h"
 #include "vk_descriptors.h"
+#include "vk_occlusion.h"
+#include "vk_instancing.h"
+#include "vk_pipeline_registry.h"
+#include "vk_render_queue.h"
+#include "vk_upload_queue.h"
+#include "vk_mipmaps.h"
+#include "vk_texture_streaming.h"
+#include "asset_streamer.h"
+#include "camera.h"
+#include "raytraced_scene.h"
+#include "vk_workgroup_tuner.h"
+#include "vk_render_graph.h"
+#include "vk_perf_overlay.h"
+#include "vk_memory.h"
+#include "vk_frame_pacing.h"
+#include "vk_jobs.h"
+#include "ecs.h"
+#include "scene_components.h"
+#include "triple_buffer.h"
+#include "imgui_draw_snapshot.h"
+
+
+/// @brief Frames the CPU records ahead of the GPU (double-buffering our commands). Each frame waits only on the fence
+/// of the frame that last used its resources.
+constexpr unsigned int FRAME_OVERLAP {2};
 
+/// @brief Maximum number of mesh instances drawn per frame (the capacity of each per-frame instance buffer).
+constexpr uint32_t INSTANCING_MAX_INSTANCES {32768};
 
-/// @brief For double-buffering our commands.
-constexpr unsigned int FRAME_OVERLAP {2};
+/// @brief Maximum number of instances that go through the Hi-Z occlusion culling passes per frame: every drawn
+/// instance, as the mesh instances are drawn from the culling commands.
+constexpr uint32_t OCCLUSION_MAX_INSTANCES {INSTANCING_MAX_INSTANCES};
+
+/// @brief Default rate of the fixed-timestep simulation (steps per second). Changed from the "Scene" window.
+constexpr int SIMULATION_DEFAULT_RATE {60};
+/// @brief Most simulation steps taken in a frame. Past it, the time the simulation is behind by is dropped (it slows
+/// down), rather than taking ever longer frames to catch up: the "spiral of death".
+constexpr uint32_t SIMULATION_MAX_STEPS_PER_FRAME {8};
+
+/// @brief Number of small random spheres added around the showcase spheres of the ray-traced scene.
+constexpr uint32_t RAYTRACED_SCENE_SCATTERED_SPHERES {2000};
+
+/// @brief Samples per pixel and bounces of the ray-traced scene's "High" quality preset, also the maximum of the accumulation settings.
+constexpr int RAYTRACED_SCENE_SAMPLES_PER_PIXEL {32};
+constexpr int RAYTRACED_SCENE_MAX_BOUNCES {8};
+
+/// @brief File caching the tuned workgroup sizes of the compute effects, per device and driver.
+constexpr const char* WORKGROUP_TUNING_CACHE_FILE {"./workgroup_sizes.cache"};
+
+/// @brief File the memory allocator's statistics are dumped to (JSON), from the "Memory" window.
+constexpr const char* MEMORY_STATS_FILE {"./memory_stats.json"};
+
+/// @brief File the CPU/GPU traces are written to (Chrome trace JSON, opens in Perfetto or chrome://tracing).
+constexpr const char* TRACE_FILE {"./trace.json"};
+/// @brief Number of frames recorded by a trace capture (started with F2, or at startup with VKENGINE_TRACE_STARTUP set).
+constexpr uint32_t TRACE_CAPTURE_FRAMES {300};
+
+/// @brief Most streaming completions handled per frame (each may queue an upload), so a burst of finished reads is
+/// spread over several frames.
+constexpr uint32_t STREAMING_MAX_COMPLETIONS_PER_FRAME {64};
+
+/// @brief Directory of the material textures (image files, sRGB), in name order: one per material, the extra ones unused.
+constexpr const char* MATERIAL_TEXTURE_DIRECTORY {"./assets/textures"};
+/// @brief Meters covered by a material texture's width, in the triplanar mapping of the meshes.
+/// @attention Must match @code textureWorldSize@endcode in instanced_mesh.frag
+constexpr float MATERIAL_TEXTURE_WORLD_SIZE {1.f};
+
+/// @brief Past this many frames, the accumulation keeps blending with a constant weight (an exponential moving average).
+constexpr uint32_t ACCUMULATION_MAX_FRAMES {65536};
 
 /// @brief This struct will help in scheduling the cleanup of objects in the right order.
 struct DeletionQueue {
@@ -38,8 +109,8 @@ struct FrameData {
 
 	// Synchronization mechanisms:
 	VkSemaphore swapchainImageAvailableSemaphore; // Signalled when swapchain image is made available for drawing
-	VkSemaphore renderFinishedSemaphore; // Signalled when rendering into the image is done
 	VkFence renderFence; // Signals the CPU that this current frame has finished rendering
+	uint64_t submitTime; // When the frame was submitted, on the trace's time-base (vktrace::now())
 
 	DeletionQueue deletionQueue;
 };
@@ -52,19 +123,119 @@ struct ComputeShaderPushConstants {
 	glm::vec4 data_4;
 };
 
+/// @brief First specialization-constant ID of the quality constants of a compute-shader effect (0 and 1 are the workgroup size)
+constexpr uint32_t COMPUTE_EFFECT_QUALITY_CONSTANT_ID {2};
+
+/// A named set of values for the quality specialization-constants of a compute-shader effect
+struct ComputeShaderQualityPreset {
+	const char* name;
+	std::vector<uint32_t> values; // For the constant IDs COMPUTE_EFFECT_QUALITY_CONSTANT_ID, +1, ...
+};
+
 /// We will have an array of this struct to switch between the compute shader pipelines, in the UI at runtime
+///
+/// Threads: belongs to the render thread once initialized. The UI edits its ComputeEffectSettings instead, and sends
+/// the chosen values in the FramePacket.
 struct ComputeShaderEffects {
 	const char* name;
-	VkPipeline pipeline;
 	VkPipelineLayout pipeline_layout;
 
-	ComputeShaderPushConstants push_constants_data;
+	// Kept alive to create the variants of the pipeline. The workgroup size is a specialization-constant (ids 0 and 1).
+	VkShaderModule shader_module;
+	VkExtent2D workgroup_size;
+
+	// Quality knobs, as specialization-constants, so the shader loops get compile-time trip counts
+	std::vector<ComputeShaderQualityPreset> quality_presets;
+	// The ray-traced scene's accumulation mode overrides the quality values with its own
+	bool supports_accumulation;
+
+	// Pipeline variants, compiled on first use. Keyed by all the specialization-constant values:
+	// the workgroup size, followed by the quality values.
+	std::map<std::vector<uint32_t>, VkPipeline> pipeline_variants;
+};
+
+/// The settings of a compute-shader effect edited by the UI, on the simulation thread (copied from the effect at
+/// initialization). Sent to the render thread in the FramePacket.
+struct ComputeEffectSettings {
+	const char* name;
+	std::vector<const char*> qualityPresetNames;
+	int qualityPreset;
+	ComputeShaderPushConstants pushConstants;
+};
+
+/// @brief Everything the render thread needs to record a frame, built by the simulation thread.
+///
+/// Immutable once published: the render thread only reads it, while the simulation thread builds the next one in
+/// another slot of the TripleBuffer. The vectors keep their capacity from one use of the slot to the next.
+struct FramePacket {
+	bool bQuit {false};                                  // Last packet: the render thread stops
+	std::chrono::steady_clock::time_point inputTime {};  // When the input of the frame was sampled (for the latency)
+
+	// Camera
+	glm::mat4 viewProjection {1.f};
+	glm::vec3 cameraPosition {0.f};
+	float cameraVerticalFov {1.f};
+
+	// The scene instances: the instanced draws with their per-instance data, and their culling input (same order)
+	std::vector<GPUCullInstance> cullInstances {};
+	std::vector<CullDrawBatch> cullBatches {};
+	std::vector<InstancedDrawBatch> instanceBatches {};
+	std::vector<GPUInstanceData> instances {};
+
+	// Background compute effect
+	int computeEffectIndex {0};
+	int computeEffectQualityPreset {0};
+	ComputeShaderPushConstants computeEffectPushConstants {};
+	bool bAccumulateRaytracedScene {false};
+	uint32_t accumulationSamplesPerFrame {1};   // Instead of the preset's quality values, while accumulating
+	uint32_t accumulationMaxBounces {1};
+
+	// Present
+	float presentExposure {1.f};
+	int presentTonemapOperator {0};
+	uint32_t targetFrameRate {0};
+	bool bLowLatency {false};
+
+	// Texture streaming
+	VkDeviceSize textureStreamingBudget {TEXTURE_STREAMING_DEFAULT_BUDGET};
+
+	// One-shot requests from the UI, handled by the render thread before recording the frame
+	std::optional<VkPresentModeKHR> presentModeRequest {};   // Re-creates the swapchain
+	bool bRetuneComputeEffect {false};
+	bool bDefragmentMemory {false};
+	bool bDumpMemoryStats {false};
+
+	ImGuiDrawDataSnapshot uiDrawData {};
+};
+
+/// @brief What the render thread reports back to the simulation thread after each frame, for the UI.
+struct RenderFrameStats {
+	std::vector<RenderGraphPassTiming> passTimings {};
+	RenderGraphStats renderGraphStats {};
+	CommandCounters commandCounters {};
+	MemoryManagerStats memoryStats {};
+	UploadQueueStats uploadQueueStats {};
+	TextureStreamerStats textureStreamerStats {};
+	FrameLatencyStats latencyStats {};
+	std::vector<float> latencyHistory {};   // Oldest first
+	VkPresentModeKHR presentMode {VK_PRESENT_MODE_FIFO_KHR};
+	uint32_t instanceBatchCount {0};
+	uint32_t instanceCount {0};
+	uint32_t accumulatedFrameCount {0};
+	uint32_t framesInFlight {0};   // Submitted and not yet completed by the GPU, measured after the submission
+	std::vector<VkExtent2D> computeEffectWorkgroupSizes {};   // Per compute effect
 };
 
 
 /// The main Vulkan Engine class.
 ///
 /// Hold all the parameters and Vulkan handles to set up the render loop.
+///
+/// run() splits a frame over two threads. The simulation thread (the main thread, which SDL needs for the events)
+/// handles the input, the UI and the scene, then extracts everything the frame needs into a FramePacket. The render
+/// thread records and submits the frame of the previous packet meanwhile. The packets go through a TripleBuffer
+/// (lock-free), and the simulation waits for its last packet to be taken before starting the next frame, so it runs
+/// at most one frame ahead. The render thread reports its statistics back through another TripleBuffer.
 class VulkanEngine {
 public:
 	// Initializes everything in the engine
@@ -73,12 +244,12 @@ public:
 	// Shuts down the engine
 	void cleanup();
 
-	// Draw loop
-	void draw();
+	// Records, submits and presents the frame of the packet (render thread)
+	void draw(const FramePacket& packet);
 	// For rendering ImGui UI using dynamic rendering
 	void draw_imgui(VkCommandBuffer commandBuffer, VkImageView targetImageView);
 
-	// Run main loop
+	// Run main loop (the simulation thread), along with the render thread
 	void run();
 
 	/// Getter for fetching the FrameData struct for the current frame.
@@ -87,12 +258,17 @@ public:
 	/// Function for immediate submit actions
 	void immediate_submit(std::function<void(VkCommandBuffer)>&& function);
 
+	/// Copies the data into a GPU-only buffer, through a temporary staging buffer and an immediate submit.
+	void upload_buffer_data(const AllocatedBuffer& dstBuffer, const void* data, size_t size);
+
 private:
 	bool _isInitialized{ false };
 	bool stop_rendering{ false };
 	VkExtent2D _windowExtent{ 1440 , 810 };
-	int _frameNumber {0};
+	int _frameNumber {0};               // Frames drawn by the render thread
+	uint64_t _simulationFrameNumber {0};   // Frames built by the simulation thread
 	std::array<FrameData, FRAME_OVERLAP> _frames{};
+	uint32_t _framesInFlight {0};   // Frames the GPU had not completed right after the last submission (render thread)
 
 	struct SDL_Window* _window{ nullptr };
 
@@ -107,10 +283,18 @@ private:
 	VkSurfaceKHR _surface{ nullptr };
 
 	VkSwapchainKHR _swapchain{ nullptr };
+	VkPresentModeKHR _swapchainPresentMode {VK_PRESENT_MODE_FIFO_KHR};
+	// Present mode asked for (the swapchain falls back to FIFO if unsupported). Changed from the "Frame Pacing" window,
+	// through the frame packets.
+	VkPresentModeKHR _requestedPresentMode {VK_PRESENT_MODE_MAILBOX_KHR};
+	std::vector<VkPresentModeKHR> _supportedPresentModes {};
 	VkFormat _swapchainImageFormat;
 	VkExtent2D _swapchainExtent;
 	std::vector<VkImage> _swapchainImages;
 	std::vector<VkImageView> _swapchainImageViews;
+	// Signalled when rendering into the image is done, waited on by its present. One per image rather than per frame:
+	// the present may still wait on it when its frame's fence signals, but not once the image is acquired again.
+	std::vector<VkSemaphore> _swapchainRenderFinishedSemaphores;
 
 	VkQueue _graphicsQueue{ nullptr };
 	uint32_t _graphicsQueueFamilyIndex{ 0 };
@@ -120,10 +304,101 @@ private:
 
 	// The main VMA allocator
 	VmaAllocator _vmaAllocator{ nullptr };
+	// Budgets, eviction of streamable resources and defragmentation, around the allocator
+	MemoryManager _memoryManager;
+	bool _bMemoryBudgetSupported {false};
 
-	// The image that we will be drawing into. Then copy onto the swapchain image for presentation.
+	// The HDR image that we will be drawing into. Then tonemapped (or copied) onto the swapchain image for presentation.
 	AllocatedImage _drawImage;
 	VkExtent2D _drawImageExtent;
+	// The depth-buffer used alongside the draw-image. Also the source of the Hi-Z pyramid.
+	// A transient image of the render-graph, which owns its memory.
+	AllocatedImage _depthImage;
+
+	// The passes of a frame, and the images they use
+	RenderGraph _renderGraph;
+	RenderGraphImageHandle _graphDrawImage;
+	RenderGraphImageHandle _graphDepthImage;
+	RenderGraphImageHandle _graphAccumulationImage;
+	RenderGraphImageHandle _graphSwapchainImage;
+	// The packet of the frame being recorded (render thread, valid during draw())
+	const FramePacket* _framePacket {nullptr};
+
+	// Simulation thread -> render thread: the frames to draw. Render thread -> simulation thread: their statistics.
+	TripleBuffer<FramePacket> _framePackets;
+	TripleBuffer<RenderFrameStats> _renderFrameStats;
+	// Set when the render thread stopped on an exception (re-thrown by run(), on the simulation thread)
+	std::atomic<bool> _bRenderThreadFailed {false};
+	std::exception_ptr _renderThreadException {};
+
+	// The scene's entities and their transforms (simulation thread)
+	EntityRegistry _sceneRegistry;
+	TransformHierarchy _sceneTransforms;
+
+	// Fixed-timestep simulation: the frame times accumulate, and are consumed in steps of 1 / _simulationRate seconds.
+	// Frames show the state in between the last two steps, interpolated by the time left over (_simulationAlpha).
+	int _simulationRate {SIMULATION_DEFAULT_RATE};
+	double _simulationAccumulator {0.0};
+	double _simulationTime {0.0};           // Time of the last step
+	float _simulationAlpha {0.f};
+	uint32_t _simulationStepsLastFrame {0};
+	double _simulationDroppedSeconds {0.0};   // Dropped by the spiral-of-death clamp, in total
+
+	// Instanced drawing of the scene meshes. The simulation thread groups the instances by mesh (one draw each),
+	// with where each entity's instance goes, and the render thread uploads them.
+	InstancedMeshRenderer _instancedMeshRenderer;
+	std::vector<uint32_t> _frameInstanceSlots {};
+	std::unordered_map<uint64_t, uint32_t> _instanceBatchLookup {};
+
+	// The draws of the frame (render thread), sorted by state before the geometry pass records them
+	RenderQueue _renderQueue;
+
+	// Asset files read in the background (I/O thread, decode jobs), and their uploads from the frame's command buffer.
+	// The completions of the streamer run on the render thread, at the start of draw(), and queue the uploads.
+	AssetStreamer _assetStreamer;
+	UploadQueue _uploadQueue;
+
+	// The material textures, their mips streamed in and out by the distance of the nearest instance of each material
+	// (render thread). The budget is set from the "Asset Streaming" window. The mips of the image files are generated
+	// on the GPU once their finest mip is uploaded.
+	TextureStreamer _textureStreamer;
+	MipmapGenerator _mipmapGenerator;
+	std::array<TextureHandle, INSTANCING_MATERIAL_TEXTURE_COUNT> _materialTextures {};
+	VkSampler _materialSampler {VK_NULL_HANDLE};
+	bool _bTextureCompressionBC {false};   // The cooked (BC) textures can be sampled
+	int _textureStreamingBudgetMiB {static_cast<int>(TEXTURE_STREAMING_DEFAULT_BUDGET / (1024 * 1024))};
+
+	// The built-in meshes, in shared vertex (storage) and index buffers
+	AllocatedBuffer _meshVertexBuffer;
+	AllocatedBuffer _meshIndexBuffer;
+	std::vector<MeshDraw> _builtinMeshes {};
+	std::vector<LocalBounds> _builtinMeshBounds {};
+
+	// A grid of the built-in meshes, spawned from the "Scene" window. Its root entity turns slowly, with the simulation.
+	std::vector<Entity> _meshFieldEntities {};
+	Entity _meshFieldRootEntity {};
+	TransformNodeId _meshFieldRoot {TRANSFORM_NODE_NONE};
+	int _meshFieldInstanceCount {0};
+
+	// Hi-Z occlusion culling of the scene instances
+	OcclusionCuller _occlusionCuller;
+	Camera _mainCamera;
+
+	// The ray-traced compute scene: spheres and their BVH, in storage-buffers
+	RaytracedScene _raytracedScene;
+	AllocatedBuffer _sceneSpheresBuffer;
+	AllocatedBuffer _sceneBVHNodesBuffer;
+
+	// Progressive accumulation of the ray-traced scene: a running average over the frames, while the view is still.
+	// The settings and the frozen animation time are the simulation thread's, the frame count the render thread's.
+	AllocatedImage _accumulationImage;
+	bool _bAccumulateRaytracedScene {false};
+	int _accumulationSamplesPerFrame {1};
+	int _accumulationMaxBounces {4};
+	float _accumulationFrozenTime {0.f};
+	uint32_t _accumulatedFrameCount {0};
+	ComputeShaderPushConstants _lastPushConstants {};
+	VkPipeline _lastComputeShaderPipeline {VK_NULL_HANDLE};
 
 	// Descriptor-Sets
 	DescriptorSetAllocator _globalDescriptorSetAllocator;
@@ -134,38 +409,138 @@ private:
 	VkPipeline _backgroundImgPipeline;
 	VkPipelineLayout _backgroundImgPipelineLayout;
 
-	// Graphics-Pipelines
-	VkPipeline _trianglePipeline;
+	// Graphics-Pipelines, created (and destroyed) by the registry: identical states share one pipeline
+	PipelineRegistry _pipelineRegistry;
+	GraphicsPipelineFeatures _graphicsPipelineFeatures {};
+	PipelineHandle _trianglePipeline {PIPELINE_HANDLE_NONE};
+	GraphicsDynamicState _triangleDynamicState {};
 	VkPipelineLayout _trianglePipelineLayout;
+	VkShaderModule _triangleVertexShaderModule {VK_NULL_HANDLE};
+	VkShaderModule _triangleFragmentShaderModule {VK_NULL_HANDLE};
 
 	// Immediate Submit Structures
 	VkFence _immediateFence{ nullptr };
 	VkCommandPool _immediateCommandPool{ nullptr };
 	VkCommandBuffer _immediateCommandBuffer{ nullptr };
 
+	// Present path: tonemap the draw-image into the swapchain-image from a compute-shader, when the swapchain
+	// supports storage-images. Otherwise the draw-image is blitted as it is (the ray-traced scene then tonemaps and
+	// encodes its own output).
+	bool _bStorageImageWriteWithoutFormat {false};
+	bool _bStoragePresentSupported {false};
+	uint32_t _frameSwapchainImageIndex {0};
+	VkSampler _drawImageLinearSampler {VK_NULL_HANDLE};
+	VkDescriptorSetLayout _tonemapPresentDescriptorSetLayout {VK_NULL_HANDLE};
+	std::vector<VkDescriptorSet> _tonemapPresentDescriptorSets {};   // One per swapchain-image
+	VkPipelineLayout _tonemapPresentPipelineLayout {VK_NULL_HANDLE};
+	VkPipeline _tonemapPresentPipeline {VK_NULL_HANDLE};
+	float _presentExposure {1.f};
+	int _presentTonemapOperator {2};   // 0: none (clamp), 1: Reinhard, 2: ACES
+
 	// Array containing the compute-shader effects for switching in the UI at runtime
-	std::vector<ComputeShaderEffects> _computeShaderBackgroundEffects {};
+	std::vector<ComputeShaderEffects> _computeShaderBackgroundEffects {};   // Render thread
+	std::vector<ComputeEffectSettings> _computeEffectSettings {};   // Simulation thread (UI), one per effect
 	int _currentComputeShaderBackgroundEffect {0};
 
+	// Picks the fastest workgroup size of each compute-shader effect, on this device
+	WorkgroupSizeTuner _workgroupSizeTuner;
+
+	// Worker threads with work stealing, shared by the CPU work of the engine (started first in init())
+	JobSystem _jobSystem;
+
+	// Frame limiter, low-latency mode and input-to-present latency (render thread), and their settings (simulation thread)
+	FramePacer _framePacer;
+	bool _bFrameLimiterEnabled {false};
+	int _frameLimiterTargetFrameRate {60};
+	bool _bLowLatency {false};
+
+	// Frame-times, GPU pass timings, memory budgets and command counts (toggled with F1)
+	PerformanceOverlay _performanceOverlay;
+	// Commands recorded in the current frame (the last frame's, until the next one is recorded)
+	CommandCounters _frameCommandCounters {};
+
+	// Tracing: frames left in the capture in progress, and the device's clock for the GPU zones (null if unsupported)
+	uint32_t _traceCaptureFramesLeft {0};
+	PFN_vkGetCalibratedTimestampsEXT _vkGetCalibratedTimestamps {nullptr};
+
 
 	// Initialization helper methods
 	void init_vulkan();
+	void init_calibrated_timestamps();
 	void init_swapchain();
 	void init_commands();
 	void init_sync_structures();
+	void init_raytraced_scene();
 	void init_pipelines();
 
 	void init_vulkan_memory_allocator();
 	void init_descriptors();
 	void init_imgui();
+	void init_occlusion_culling();
+	void init_instanced_meshes();
+	void init_asset_streaming();
+	void init_compute_workgroup_tuning();
+	void init_render_graph();
+
+	/// The render thread: draws the frame packets until the last one
+	void render_loop();
+	/// Handles the packet's requests, and sets up the settings the frame depends on (render thread)
+	void apply_frame_packet_requests(const FramePacket& packet);
+	/// Reports the statistics of the frame just drawn to the simulation thread
+	void publish_render_frame_stats();
+	/// Builds the rest of the packet from the scene and the UI settings, after the UI (simulation thread)
+	void build_frame_packet(FramePacket& packet);
+
+	// Render-graph passes
+	void record_background_pass(VkCommandBuffer commandBuffer);
+	/// GEOMETRY clears the depth, LATE_GEOMETRY draws on top of it
+	void record_geometry_pass(VkCommandBuffer commandBuffer, RenderQueuePass pass);
+	void record_tonemap_present_pass(VkCommandBuffer commandBuffer);
+
+	/// Runs the simulation steps due after a frame of frameSeconds, and sets the interpolation of the next frame
+	void update_simulation(double frameSeconds);
+	/// One fixed step of the simulation: the current states become the previous ones, then move on by deltaSeconds
+	void step_simulation(float deltaSeconds);
+	/// Writes the simulated transforms, interpolated between the last two steps, into the scene's nodes
+	void interpolate_simulated_transforms();
+	/// Recomputes the world matrices of the moved nodes, and the world bounds of their entities
+	void update_scene_transforms();
+	/// Groups the drawable entities (TransformNode + MeshDraw + MeshMaterial + WorldBounds) by mesh, and writes their
+	/// instances and their culling input into the packet
+	void extract_instance_batches(FramePacket& packet);
+	/// Collects the draws of the frame from the packet, and sorts them (render thread)
+	void build_render_queue(const FramePacket& packet);
+	/// Gives each material texture the distance of the nearest instance using it, then updates the texture streaming (render thread)
+	void update_texture_streaming(const FramePacket& packet);
+	/// Replaces the mesh field with a grid of instanceCount built-in meshes (none if 0)
+	void spawn_mesh_field(uint32_t instanceCount);
+
+	/// Adds the GPU timings read back by the render-graph to the trace in progress, on the CPU time-base
+	void trace_gpu_passes(uint64_t frameSubmitTime);
+
+	/// The first stage writing the swapchain-image, which waits for the acquire semaphore
+	VkPipelineStageFlags2 get_swapchain_write_stage() const {
+		return _bStoragePresentSupported ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_2_BLIT_BIT;
+	}
 
 	// Compute-Pipeline Initializers
 	void init_background_img_pipeline();
+	void write_scene_buffer_descriptors();
+	VkPipeline create_compute_effect_pipeline(const ComputeShaderEffects& effect, VkExtent2D workgroupSize, std::span<const uint32_t> qualityValues);
+	VkPipeline get_compute_effect_variant(ComputeShaderEffects& effect, VkExtent2D workgroupSize, std::span<const uint32_t> qualityValues);
+	std::vector<uint32_t> get_compute_effect_quality_values(const ComputeShaderEffects& effect, const FramePacket& packet) const;
+	void tune_compute_effect_workgroup_size(ComputeShaderEffects& effect);
+	void compile_compute_effect_variants();
 
 	// Graphics-Pipeline Initializers
 	void init_triangle_pipeline();
+	void init_tonemap_present_pipeline();
 
 	void create_swapchain(uint32_t width, uint32_t height);
 	void destroy_swapchain();
+	/// Re-creates the swapchain with the requested present mode (waits for the GPU to be idle)
+	void recreate_swapchain();
+	/// One descriptor-set per swapchain-image, (re-)written whenever the swapchain is created
+	void write_tonemap_present_descriptors();
 
 };
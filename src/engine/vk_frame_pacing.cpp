@@ -0,0 +1,163 @@
+#include "vk_frame_pacing.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "vk_logger.h"
+#include "vk_trace.h"
+
+namespace {
+
+    // Longest wait for a present or a fence before giving up on the frame's pacing (in nanoseconds)
+    constexpr uint64_t FRAME_PACING_TIMEOUT {1000000000};
+
+}
+
+void FramePacer::init(VkDevice device, bool bPresentWaitSupported) {
+    _device = device;
+    if (bPresentWaitSupported) {
+        _vkWaitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+    }
+    _latencyStats.bToDisplay = (_vkWaitForPresent != nullptr);
+
+    if (_vkWaitForPresent != nullptr) {
+        VK_LOG_INFO("Frame pacing: present wait supported, latency measured until display");
+    }
+    else {
+        VK_LOG_INFO("Frame pacing: present wait unsupported, latency measured until vkQueuePresentKHR");
+    }
+}
+
+void FramePacer::set_target_frame_rate(uint32_t framesPerSecond) {
+    _targetFrameRate = framesPerSecond;
+    _framePeriod = (framesPerSecond == 0) ? Clock::duration {0}
+        : std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / static_cast<double>(framesPerSecond)));
+    _nextFrameStart = Clock::now();
+}
+
+void FramePacer::wait_for_frame_start(VkSwapchainKHR swapchain, VkFence nextFrameFence) {
+    ZONE("FramePacer::wait_for_frame_start");
+    _swapchain = swapchain;
+
+    if (_bLowLatency && _vkWaitForPresent == nullptr) {
+        // The frame's own fence wait (in draw()) then returns at once
+        ZONE("Wait Render Fence");
+        const VkResult result = vkWaitForFences(_device, 1, &nextFrameFence, VK_TRUE, FRAME_PACING_TIMEOUT);
+        if (result != VK_SUCCESS) {
+            VK_LOG_WARN("Frame pacing: vkWaitForFences returned {}", string_VkResult(result));
+        }
+    }
+    collect_presents(_bLowLatency);
+
+    wait_for_limiter();
+}
+
+void FramePacer::prepare_present(VkPresentInfoKHR& presentInfo, Clock::time_point inputTime) {
+    if (_vkWaitForPresent == nullptr) {
+        return;
+    }
+
+    _presentId = _nextPresentId++;
+    _presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+    _presentIdInfo.pNext = presentInfo.pNext;
+    _presentIdInfo.swapchainCount = 1;
+    _presentIdInfo.pPresentIds = &_presentId;
+    presentInfo.pNext = &_presentIdInfo;
+
+    _pendingPresents.push_back(PendingPresent {_presentId, inputTime});
+}
+
+void FramePacer::end_frame(Clock::time_point inputTime) {
+    if (_vkWaitForPresent == nullptr) {
+        add_latency_sample(inputTime, Clock::now());
+    }
+}
+
+void FramePacer::reset_presents() {
+    _pendingPresents.clear();
+    _nextPresentId = 1;
+}
+
+void FramePacer::wait_for_limiter() {
+    if (_targetFrameRate == 0) {
+        return;
+    }
+    ZONE("Frame Limiter");
+
+    // Fixed period between the frame starts, so the waits don't accumulate the loop's overhead
+    _nextFrameStart += _framePeriod;
+    const Clock::time_point now = Clock::now();
+    if (_nextFrameStart < now) {
+        // Behind (a slow frame): start now, rather than rushing the next frames to catch up
+        _nextFrameStart = now;
+        return;
+    }
+
+    if (_nextFrameStart - now > FRAME_LIMITER_SPIN_MARGIN) {
+        std::this_thread::sleep_until(_nextFrameStart - FRAME_LIMITER_SPIN_MARGIN);
+    }
+    while (Clock::now() < _nextFrameStart) {
+        std::this_thread::yield();
+    }
+}
+
+void FramePacer::collect_presents(bool bWaitForLast) {
+    if (_vkWaitForPresent == nullptr || _pendingPresents.empty()) {
+        return;
+    }
+
+    // Waiting for an id completes every earlier id too: the pending presents are all displayed by then
+    if (bWaitForLast) {
+        ZONE("Wait For Present");
+        const VkResult result = _vkWaitForPresent(_device, _swapchain, _pendingPresents.back().presentId, FRAME_PACING_TIMEOUT);
+        if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+            const Clock::time_point now = Clock::now();
+            for (const PendingPresent& pendingPresent : _pendingPresents) {
+                add_latency_sample(pendingPresent.inputTime, now);
+            }
+            _pendingPresents.clear();
+            return;
+        }
+        if (result != VK_TIMEOUT) {
+            VK_LOG_WARN("Frame pacing: vkWaitForPresentKHR returned {}", string_VkResult(result));
+            _pendingPresents.clear();
+            return;
+        }
+        VK_LOG_WARN("Frame pacing: VK_TIMEOUT - vkWaitForPresentKHR");
+    }
+
+    // Without blocking: the presents displayed since the last frame, in order
+    while (!_pendingPresents.empty()) {
+        const VkResult result = _vkWaitForPresent(_device, _swapchain, _pendingPresents.front().presentId, 0);
+        if (result == VK_TIMEOUT) {
+            break;
+        }
+        if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+            add_latency_sample(_pendingPresents.front().inputTime, Clock::now());
+        }
+        _pendingPresents.pop_front();
+    }
+
+    // Presents that are never displayed (e.g. a hidden window) are dropped past the history's length
+    while (_pendingPresents.size() > FRAME_LATENCY_HISTORY) {
+        _pendingPresents.pop_front();
+    }
+}
+
+void FramePacer::add_latency_sample(Clock::time_point inputTime, Clock::time_point presentTime) {
+    const float milliseconds = std::chrono::duration<float, std::milli>(presentTime - inputTime).count();
+    _latencies[_latencyOffset] = milliseconds;
+    _latencyOffset = (_latencyOffset + 1) % FRAME_LATENCY_HISTORY;
+    _latencyCount = std::min(_latencyCount + 1, FRAME_LATENCY_HISTORY);
+
+    float sum {0.f};
+    float worst {0.f};
+    for (uint32_t i {0}; i < _latencyCount; i++) {
+        sum += _latencies[i];
+        worst = std::max(worst, _latencies[i]);
+    }
+    _latencyStats.lastMilliseconds = milliseconds;
+    _latencyStats.averageMilliseconds = sum / static_cast<float>(_latencyCount);
+    _latencyStats.maxMilliseconds = worst;
+    _latencyStats.sampleCount = _latencyCount;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <chrono>
+#include <deque>
+
+/// @brief Number of input-to-present latency samples kept by the FramePacer (a rolling history).
+constexpr uint32_t FRAME_LATENCY_HISTORY {256};
+
+/// @brief The frame limiter sleeps until this long before the frame's start, and spin-waits the rest
+/// (the OS sleep overshoots by up to a scheduler tick).
+constexpr std::chrono::microseconds FRAME_LIMITER_SPIN_MARGIN {2000};
+
+/// @brief Input-to-present latency over the recorded history, in milliseconds.
+struct FrameLatencyStats {
+	float lastMilliseconds {0.f};
+	float averageMilliseconds {0.f};
+	float maxMilliseconds {0.f};
+	uint32_t sampleCount {0};
+	bool bToDisplay {false};   // Measured until the image was displayed (present wait), otherwise until vkQueuePresentKHR returned
+};
+
+/// @brief Paces the frames of the main loop: frame-rate limiter, low-latency mode, and latency measurement.
+///
+/// Each frame: wait_for_frame_start() -> (input sampled, frame recorded) -> prepare_present() -> vkQueuePresentKHR -> end_frame()
+/// The input may be sampled on another thread: its time is passed along with the frame.
+///
+/// The limiter keeps the frame starts on a fixed period: it sleeps, then spin-waits the last
+/// FRAME_LIMITER_SPIN_MARGIN, so the start is precise without burning a core for the whole frame.
+///
+/// The low-latency mode moves the waiting before the input sampling, instead of after it (in the acquire or the
+/// fence wait): with VK_KHR_present_wait, the frame starts once the previous frame is on screen, so at most one
+/// frame is queued for display. Without it, the frame starts once the GPU is done with the frame about to be reused.
+///
+/// With VK_KHR_present_wait, every present gets an id, and the latency from the input sampling until the image is
+/// displayed is recorded (polled at each frame start, so to within a frame, unless the low-latency mode waits for it).
+class FramePacer {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	/// @param bPresentWaitSupported VK_KHR_present_id and VK_KHR_present_wait are enabled on the device
+	void init(VkDevice device, bool bPresentWaitSupported);
+
+	bool is_present_wait_supported() const { return _vkWaitForPresent != nullptr; }
+
+	/// Frames per second of the limiter, 0 for no limit.
+	void set_target_frame_rate(uint32_t framesPerSecond);
+	uint32_t get_target_frame_rate() const { return _targetFrameRate; }
+
+	void set_low_latency(bool bLowLatency) { _bLowLatency = bLowLatency; }
+	bool is_low_latency() const { return _bLowLatency; }
+
+	/// Waits for the start of the next frame (limiter, low-latency mode). The input is to be sampled after it returns.
+	/// @param nextFrameFence The render-fence of the frame about to be recorded (waited for in low-latency mode without present wait)
+	void wait_for_frame_start(VkSwapchainKHR swapchain, VkFence nextFrameFence);
+
+	/// Chains a VkPresentIdKHR to the present-info (if present wait is supported).
+	/// @param inputTime When the input of the frame was sampled
+	/// @attention The present-info points into this object until vkQueuePresentKHR returns
+	void prepare_present(VkPresentInfoKHR& presentInfo, Clock::time_point inputTime);
+	/// After vkQueuePresentKHR returned.
+	void end_frame(Clock::time_point inputTime);
+
+	/// Forgets the presents in flight (their ids belong to the old swapchain).
+	/// @attention The GPU must be idle, and the old swapchain not yet destroyed
+	void reset_presents();
+
+	const FrameLatencyStats& get_latency_stats() const { return _latencyStats; }
+	/// Rolling history of the latencies (in milliseconds): offset is the oldest entry once the history is full.
+	std::span<const float> get_latency_history(uint32_t& offset) const { offset = _latencyOffset; return {_latencies.data(), _latencyCount}; }
+
+private:
+	struct PendingPresent {
+		uint64_t presentId;
+		Clock::time_point inputTime;
+	};
+
+	VkDevice _device {VK_NULL_HANDLE};
+	PFN_vkWaitForPresentKHR _vkWaitForPresent {nullptr};
+	VkSwapchainKHR _swapchain {VK_NULL_HANDLE};
+
+	// Limiter
+	uint32_t _targetFrameRate {0};
+	Clock::duration _framePeriod {};
+	Clock::time_point _nextFrameStart {};
+	bool _bLowLatency {false};
+
+	// The frame being presented, and the presents not yet seen on screen
+	uint64_t _nextPresentId {1};
+	uint64_t _presentId {0};
+	VkPresentIdKHR _presentIdInfo {};
+	std::deque<PendingPresent> _pendingPresents {};
+
+	std::array<float, FRAME_LATENCY_HISTORY> _latencies {};
+	uint32_t _latencyOffset {0};
+	uint32_t _latencyCount {0};
+	FrameLatencyStats _latencyStats {};
+
+	void wait_for_limiter();
+	/// Records the latency of the pending presents that are displayed. Blocks for the last one if bWaitForLast.
+	void collect_presents(bool bWaitForLast);
+	void add_latency_sample(Clock::time_point inputTime, Clock::time_point presentTime);
+};
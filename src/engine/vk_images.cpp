@@ -1,5 +1,9 @@
 #include "vk_images.h"
 
+#include <algorithm>
+
+#include "vk_logger.h"
+
 void vkutil::transition_image_layout(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask,
     VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask) {
 
@@ -13,7 +17,11 @@ void vkutil::transition_image_layout(VkCommandBuffer commandBuffer, VkImage imag
     imageMemoryBarrier.dstAccessMask = dstAccessMask;
 
     VkImageSubresourceRange imageSubresourceRange {};
-    imageSubresourceRange.aspectMask = (newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
+    // Depth images are recognized by their layouts (either the attachment or the read-only depth layout)
+    const bool bIsDepthImage =
+        newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL ||
+        currentLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || currentLayout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+    imageSubresourceRange.aspectMask = (bIsDepthImage ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
     imageSubresourceRange.baseMipLevel = 0;
     imageSubresourceRange.levelCount = 1;
     imageSubresourceRange.baseArrayLayer = 0;
@@ -35,6 +43,24 @@ void vkutil::transition_image_layout(VkCommandBuffer commandBuffer, VkImage imag
     vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
 }
 
+void vkutil::memory_barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask) {
+    VkMemoryBarrier2 memoryBarrier {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    memoryBarrier.pNext = nullptr;
+    memoryBarrier.srcStageMask = srcStageMask;
+    memoryBarrier.srcAccessMask = srcAccessMask;
+    memoryBarrier.dstStageMask = dstStageMask;
+    memoryBarrier.dstAccessMask = dstAccessMask;
+
+    VkDependencyInfo dependencyInfo {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.pNext = nullptr;
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
 void vkutil::blit_image_to_image(VkCommandBuffer cmdBuffer, VkImage srcImage, VkImage dstImage, VkExtent2D srcImageExtent, VkExtent2D dstImageExtent) {
     // Specify the image blit operation:
     VkImageBlit2 image_blit_region{};
@@ -71,3 +97,120 @@ void vkutil::blit_image_to_image(VkCommandBuffer cmdBuffer, VkImage srcImage, Vk
     // Blit the image
     vkCmdBlitImage2(cmdBuffer, &blitImageInfo);
 }
+
+bool vkutil::supports_blit_mipmaps(VkPhysicalDevice physicalDevice, VkFormat format) {
+    VkFormatProperties formatProperties {};
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+    const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures;
+}
+
+uint32_t vkutil::generate_mipmaps(VkCommandBuffer commandBuffer, const AllocatedImage& image, VkImageLayout currentLayout) {
+    // A barrier over a range of mip levels
+    auto make_barrier = [&image](uint32_t baseMipLevel, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask) {
+        VkImageMemoryBarrier2 imageMemoryBarrier {};
+        imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        imageMemoryBarrier.pNext = nullptr;
+        imageMemoryBarrier.srcStageMask = srcStageMask;
+        imageMemoryBarrier.srcAccessMask = srcAccessMask;
+        imageMemoryBarrier.dstStageMask = dstStageMask;
+        imageMemoryBarrier.dstAccessMask = dstAccessMask;
+        imageMemoryBarrier.oldLayout = oldLayout;
+        imageMemoryBarrier.newLayout = newLayout;
+        imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.image = image.image;
+        imageMemoryBarrier.subresourceRange = VkImageSubresourceRange {VK_IMAGE_ASPECT_COLOR_BIT, baseMipLevel, levelCount, 0, 1};
+        return imageMemoryBarrier;
+    };
+    auto pipeline_barrier = [commandBuffer](std::span<const VkImageMemoryBarrier2> imageMemoryBarriers) {
+        VkDependencyInfo dependencyInfo {};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.pNext = nullptr;
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageMemoryBarriers.size());
+        dependencyInfo.pImageMemoryBarriers = imageMemoryBarriers.data();
+        vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    };
+
+    if (image.mipLevels <= 1) {
+        const VkImageMemoryBarrier2 barrier = make_barrier(0, 1, currentLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT);
+        pipeline_barrier(std::span(&barrier, 1));
+        return 1;
+    }
+
+    // Level 0 is read by the first blit, the other levels are written (their content discarded)
+    const std::array<VkImageMemoryBarrier2, 2> initialBarriers {
+        make_barrier(0, 1, currentLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT),
+        make_barrier(1, image.mipLevels - 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT)
+    };
+    pipeline_barrier(initialBarriers);
+    uint32_t barrierCount {1};
+
+    VkExtent2D srcExtent {image.imageExtent.width, image.imageExtent.height};
+    for (uint32_t level {1}; level < image.mipLevels; level++) {
+        const VkExtent2D dstExtent {std::max(srcExtent.width / 2, 1u), std::max(srcExtent.height / 2, 1u)};
+
+        VkImageBlit2 blitRegion {};
+        blitRegion.sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2;
+        blitRegion.pNext = nullptr;
+        blitRegion.srcSubresource = VkImageSubresourceLayers {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+        blitRegion.srcOffsets[1] = VkOffset3D {static_cast<int32_t>(srcExtent.width), static_cast<int32_t>(srcExtent.height), 1};
+        blitRegion.dstSubresource = VkImageSubresourceLayers {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        blitRegion.dstOffsets[1] = VkOffset3D {static_cast<int32_t>(dstExtent.width), static_cast<int32_t>(dstExtent.height), 1};
+
+        VkBlitImageInfo2 blitImageInfo {};
+        blitImageInfo.sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2;
+        blitImageInfo.pNext = nullptr;
+        blitImageInfo.srcImage = image.image;
+        blitImageInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        blitImageInfo.dstImage = image.image;
+        blitImageInfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        blitImageInfo.filter = VK_FILTER_LINEAR;
+        blitImageInfo.regionCount = 1;
+        blitImageInfo.pRegions = &blitRegion;
+        vkCmdBlitImage2(commandBuffer, &blitImageInfo);
+
+        // The source level is done, the level just written is the next source (or done too, for the last one)
+        const bool bLastLevel = level + 1 == image.mipLevels;
+        const std::array<VkImageMemoryBarrier2, 2> levelBarriers {
+            make_barrier(level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT),
+            bLastLevel
+                ? make_barrier(level, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT)
+                : make_barrier(level, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT)
+        };
+        pipeline_barrier(levelBarriers);
+        barrierCount++;
+        srcExtent = dstExtent;
+    }
+    return barrierCount;
+}
+
+vkutil::TexelBlock vkutil::get_texel_block(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            return TexelBlock {4, 1, 1};
+        case VK_FORMAT_R8G8_UNORM:
+            return TexelBlock {2, 1, 1};
+        case VK_FORMAT_R8_UNORM:
+            return TexelBlock {1, 1, 1};
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+            return TexelBlock {8, 4, 4};
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            return TexelBlock {16, 4, 4};
+        default:
+            VK_LOG_ERROR("No texel block size for the format {}", string_VkFormat(format));
+            throw std::runtime_error("No texel block size for the format");
+    }
+}
@@ -18,6 +18,28 @@ namespace vkutil {
         VkAccessFlags2 dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT
     );
 
+    /// @brief Places a global memory barrier (no layout transition) between two synchronization scopes.
+    /// @note Places a pipeline-barrier by calling @code vkCmdPipelineBarrier2@endcode
+    void memory_barrier(
+        VkCommandBuffer commandBuffer,
+        VkPipelineStageFlags2 srcStageMask,
+        VkAccessFlags2 srcAccessMask,
+        VkPipelineStageFlags2 dstStageMask,
+        VkAccessFlags2 dstAccessMask
+    );
+
+    /// @brief Size in bytes of a texel block of a format, and its extent in texels (1x1 for the uncompressed formats,
+    /// 4x4 for the BC formats).
+    struct TexelBlock {
+        uint32_t size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    /// @brief The texel block of the formats the engine uploads from the CPU.
+    /// @throws std::runtime_error for the other formats
+    TexelBlock get_texel_block(VkFormat format);
+
     /// @brief Uses the command @code vkCmdBlitImage2@endcode to blit-copy the source image, onto the destination image.
     void blit_image_to_image(
         VkCommandBuffer cmdBuffer,
@@ -27,4 +49,17 @@ namespace vkutil {
         VkExtent2D dstImageExtent
     );
 
+    /// @brief True if the format can be blitted to and from, with linear filtering (optimal tiling): what
+    /// generate_mipmaps() needs.
+    bool supports_blit_mipmaps(VkPhysicalDevice physicalDevice, VkFormat format);
+
+    /// @brief Generates every mip level of the image from its level 0, with a chain of linear blits: each level is
+    /// blitted from the previous one, behind a barrier per level.
+    /// @param currentLayout The layout of every level (the content of the levels past 0 is discarded)
+    /// @attention The image needs VK_IMAGE_USAGE_TRANSFER_SRC_BIT and VK_IMAGE_USAGE_TRANSFER_DST_BIT, in a format
+    /// of supports_blit_mipmaps(). Every level ends in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, visible to the
+    /// later commands.
+    /// @return The number of pipeline-barriers recorded
+    uint32_t generate_mipmaps(VkCommandBuffer commandBuffer, const AllocatedImage& image, VkImageLayout currentLayout);
+
 };
\ No newline at end of file
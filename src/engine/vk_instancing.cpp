@@ -0,0 +1,229 @@
+#include "vk_instancing.h"
+
+#include "vk_buffers.h"
+#include "vk_logger.h"
+#include "vk_occlusion.h"
+#include "vk_pipelines.h"
+
+// Push-constants of instanced_mesh.vert
+struct InstancedMeshPushConstants {
+    glm::mat4 viewProjection;
+};
+
+void InstancedMeshRenderer::init(VkDevice device, VmaAllocator allocator, DescriptorSetAllocator& descriptorSetAllocator, PipelineRegistry& pipelineRegistry, VkFormat colorFormat, VkFormat depthFormat, uint32_t maxInstances, uint32_t framesInFlight) {
+    _pipelineRegistry = &pipelineRegistry;
+    _maxInstances = maxInstances;
+    _frameIndex = 0;
+    _instanceCount = 0;
+
+    // Binding 0: the instances of the frame, binding 1: the shared mesh vertices (written by set_mesh_buffers()),
+    // binding 2: the material textures (written by set_material_textures()), binding 3: the visible instances (written
+    // by set_visible_instance_buffer())
+    {
+        DescriptorLayoutBuilder layoutBuilder {};
+        layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        layoutBuilder.add_binding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, INSTANCING_MATERIAL_TEXTURE_COUNT);
+        layoutBuilder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        _descriptorSetLayout = layoutBuilder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    }
+
+    // Written by the CPU every frame
+    for (uint32_t i {0}; i < framesInFlight; i++) {
+        _instanceBuffers.push_back(vkutil::create_buffer(allocator,
+            _maxInstances * sizeof(GPUInstanceData),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VMA_MEMORY_USAGE_CPU_TO_GPU
+        ));
+
+        VkDescriptorSet descriptorSet = descriptorSetAllocator.allocate_descriptor_set(device, _descriptorSetLayout);
+        VkDescriptorBufferInfo instanceBufferInfo {_instanceBuffers.back().buffer, 0, VK_WHOLE_SIZE};
+
+        VkWriteDescriptorSet write {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.pNext = nullptr;
+        write.dstSet = descriptorSet;
+        write.dstBinding = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write.pBufferInfo = &instanceBufferInfo;
+        vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+        _descriptorSets.push_back(descriptorSet);
+    }
+    _materialTextureGenerations.assign(framesInFlight, 0);
+
+    init_pipeline(device, colorFormat, depthFormat);
+
+    VK_LOG_SUCCESS("Initialized instanced mesh rendering ({} max instances, {} instance buffers)", _maxInstances, framesInFlight);
+}
+
+void InstancedMeshRenderer::destroy(VkDevice device, VmaAllocator allocator) {
+    // The compile may still be reading the shader-modules
+    _pipelineRegistry->wait_for_pipeline(_pipeline);
+    vkDestroyShaderModule(device, _vertexShaderModule, nullptr);
+    vkDestroyShaderModule(device, _fragmentShaderModule, nullptr);
+    vkDestroyPipelineLayout(device, _pipelineLayout, nullptr);
+
+    // The descriptor-sets are freed along with the pool they were allocated from
+    vkDestroyDescriptorSetLayout(device, _descriptorSetLayout, nullptr);
+
+    for (const AllocatedBuffer& instanceBuffer : _instanceBuffers) {
+        vkutil::destroy_buffer(allocator, instanceBuffer);
+    }
+    _instanceBuffers.clear();
+    _descriptorSets.clear();
+    _materialTextureGenerations.clear();
+}
+
+void InstancedMeshRenderer::set_mesh_buffers(VkDevice device, const AllocatedBuffer& vertexBuffer, const AllocatedBuffer& indexBuffer) {
+    _indexBuffer = indexBuffer.buffer;
+
+    VkDescriptorBufferInfo vertexBufferInfo {vertexBuffer.buffer, 0, VK_WHOLE_SIZE};
+    std::vector<VkWriteDescriptorSet> writes(_descriptorSets.size());
+    for (size_t i {0}; i < writes.size(); i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].pNext = nullptr;
+        writes[i].dstSet = _descriptorSets[i];
+        writes[i].dstBinding = 1;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &vertexBufferInfo;
+    }
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void InstancedMeshRenderer::set_visible_instance_buffer(VkDevice device, const AllocatedBuffer& visibleInstanceBuffer) {
+    VkDescriptorBufferInfo visibleInstanceBufferInfo {visibleInstanceBuffer.buffer, 0, VK_WHOLE_SIZE};
+    std::vector<VkWriteDescriptorSet> writes(_descriptorSets.size());
+    for (size_t i {0}; i < writes.size(); i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].pNext = nullptr;
+        writes[i].dstSet = _descriptorSets[i];
+        writes[i].dstBinding = 3;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &visibleInstanceBufferInfo;
+    }
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void InstancedMeshRenderer::set_material_textures(VkDevice device, std::span<const VkImageView, INSTANCING_MATERIAL_TEXTURE_COUNT> imageViews, VkSampler sampler, uint64_t generation) {
+    // The other sets are re-written when their frame comes (the GPU may still be reading them)
+    if (_materialTextureGenerations.at(_frameIndex) == generation) {
+        return;
+    }
+
+    std::array<VkDescriptorImageInfo, INSTANCING_MATERIAL_TEXTURE_COUNT> imageInfos {};
+    for (uint32_t i {0}; i < INSTANCING_MATERIAL_TEXTURE_COUNT; i++) {
+        imageInfos[i] = VkDescriptorImageInfo {sampler, imageViews[i], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    }
+
+    VkWriteDescriptorSet write {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = _descriptorSets[_frameIndex];
+    write.dstBinding = 2;
+    write.dstArrayElement = 0;
+    write.descriptorCount = INSTANCING_MATERIAL_TEXTURE_COUNT;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = imageInfos.data();
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+    _materialTextureGenerations[_frameIndex] = generation;
+}
+
+std::span<GPUInstanceData> InstancedMeshRenderer::begin_frame(uint32_t frameIndex) {
+    _frameIndex = frameIndex % static_cast<uint32_t>(_instanceBuffers.size());
+    _instanceCount = 0;
+    _batches.clear();
+    return {static_cast<GPUInstanceData*>(_instanceBuffers[_frameIndex].vmaAllocationInfo.pMappedData), _maxInstances};
+}
+
+void InstancedMeshRenderer::set_batches(std::span<const InstancedDrawBatch> batches) {
+    _batches.assign(batches.begin(), batches.end());
+    _instanceCount = 0;
+    for (const InstancedDrawBatch& batch : _batches) {
+        _instanceCount += batch.instanceCount;
+    }
+}
+
+void InstancedMeshRenderer::enqueue_draws(RenderQueue& renderQueue, const glm::mat4& viewProjection, const OcclusionCuller& occlusionCuller) const {
+    if (_batches.empty() || _indexBuffer == VK_NULL_HANDLE || occlusionCuller.get_batch_count() == 0) {
+        return;
+    }
+    // Still compiling: the meshes show up once it is ready
+    const VkPipeline pipeline = _pipelineRegistry->get_pipeline(_pipeline);
+    if (pipeline == VK_NULL_HANDLE) {
+        return;
+    }
+
+    // The same state for both passes
+    RenderQueueDraw draw {};
+    draw.pipeline = pipeline;
+    draw.pipelineLayout = _pipelineLayout;
+    draw.dynamicState = &_dynamicState;
+    draw.descriptorSet = _descriptorSets.at(_frameIndex);
+    draw.indexBuffer = _indexBuffer;
+    draw.pushConstantStages = VK_SHADER_STAGE_VERTEX_BIT;
+
+    InstancedMeshPushConstants pushConstants {};
+    pushConstants.viewProjection = viewProjection;
+
+    // A single indirect draw per culling pass, of a command per mesh drawing its visible instances
+    draw.indirectBuffer = occlusionCuller.get_draw_command_buffer();
+    draw.indirectDrawCount = occlusionCuller.get_batch_count();
+    draw.indirectOffset = occlusionCuller.get_draw_command_offset(CullPhase::EARLY);
+    renderQueue.push(make_draw_key(RenderQueuePass::GEOMETRY, _pipeline, 0, 0.f), draw, std::as_bytes(std::span {&pushConstants, 1}));
+    draw.indirectOffset = occlusionCuller.get_draw_command_offset(CullPhase::LATE);
+    renderQueue.push(make_draw_key(RenderQueuePass::LATE_GEOMETRY, _pipeline, 0, 0.f), draw, std::as_bytes(std::span {&pushConstants, 1}));
+}
+
+void InstancedMeshRenderer::init_pipeline(VkDevice device, VkFormat colorFormat, VkFormat depthFormat) {
+    VkPushConstantRange pushConstantRange {};
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(InstancedMeshPushConstants);
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.pNext = nullptr;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &_descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &_pipelineLayout);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create pipeline-layout for instanced meshes");
+        throw std::runtime_error("Failed to create pipeline-layout for instanced meshes");
+    }
+
+    if (!vkutil::load_shader_module(device, &_vertexShaderModule, "./shaders/instanced_mesh.vert.spv")) {
+        VK_LOG_ERROR("Failed to load SpirV shader: instanced_mesh.vert.spv");
+        throw std::runtime_error("Failed to load SpirV shader: instanced_mesh.vert.spv");
+    }
+    if (!vkutil::load_shader_module(device, &_fragmentShaderModule, "./shaders/instanced_mesh.frag.spv")) {
+        vkDestroyShaderModule(device, _vertexShaderModule, nullptr);
+        VK_LOG_ERROR("Failed to load SpirV shader: instanced_mesh.frag.spv");
+        throw std::runtime_error("Failed to load SpirV shader: instanced_mesh.frag.spv");
+    }
+
+    // Meshes are wound counter-clockwise, seen from the outside (the projection flips Y, which keeps that winding)
+    GraphicsPipelineBuilder pipelineBuilder {};
+    pipelineBuilder.set_pipeline_layout(_pipelineLayout);
+    pipelineBuilder.set_shader_modules(_vertexShaderModule, _fragmentShaderModule);
+    pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+    pipelineBuilder.set_cull_mode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+    pipelineBuilder.set_multisampling_none();
+    pipelineBuilder.set_blending_none();
+    pipelineBuilder.enable_depth_testing(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+    pipelineBuilder.set_color_attachment_format(colorFormat);
+    pipelineBuilder.set_depth_attachment_format(depthFormat);
+    pipelineBuilder.enable_dynamic_state(_pipelineRegistry->get_features());
+    _dynamicState = pipelineBuilder.get_dynamic_state();
+
+    _pipeline = _pipelineRegistry->request_graphics_pipeline(pipelineBuilder);
+    VK_LOG_INFO("Requested instanced mesh pipeline");
+}
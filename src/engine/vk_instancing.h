@@ -0,0 +1,110 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+#include "vk_pipeline_registry.h"
+#include "vk_render_queue.h"
+
+#include <glm/vec3.hpp>
+
+class OcclusionCuller;
+
+/// @brief Textures of the materials, indexed by the instances' materialIndex (modulo the count).
+/// @attention Must match the size of @code materialTextures@endcode in instanced_mesh.frag
+constexpr uint32_t INSTANCING_MATERIAL_TEXTURE_COUNT {8};
+
+/// @brief Per-instance data of the instanced draws, read by the vertex-shader at the index of the visible instance.
+/// @attention Must match the @code InstanceData@endcode struct in instanced_mesh.vert (std430)
+struct GPUInstanceData {
+	glm::mat4 worldMatrix;
+	uint32_t materialIndex;
+	uint32_t padding[3];
+};
+
+/// @brief Vertex of the shared mesh buffer, pulled from a storage-buffer by instanced_mesh.vert.
+/// @attention Must match the @code Vertex@endcode struct in instanced_mesh.vert (std430)
+struct GPUMeshVertex {
+	glm::vec3 position;
+	float uvX;
+	glm::vec3 normal;
+	float uvY;
+};
+
+/// @brief One instanced draw: the index range of a mesh, and the range of the instance buffer holding its instances.
+struct InstancedDrawBatch {
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+/// @brief Draws the instances of the scene meshes that pass the occlusion culling, from the culler's indirect commands.
+///
+/// The instances of a frame are written by the CPU into a host-visible storage-buffer (one per frame in flight),
+/// grouped by mesh: each batch is a contiguous range of it. The occlusion culler gets the same instances and batches,
+/// and compacts the visible instances of each batch into its command: the vertex-shader finds its instance at
+/// @code instances[visibleInstances[gl_InstanceIndex]]@endcode (binding 3, the culler's visible-instance buffer).
+/// The vertices are pulled from the shared mesh storage-buffer, the pipeline has no vertex input.
+///
+/// The fragment-shader samples the material textures (binding 2, an array of combined image-samplers) with triplanar
+/// mapping of the world position: the built-in meshes have no texture coordinates.
+///
+/// Per frame: begin_frame() -> fill the instances -> set_batches() -> enqueue_draws() -> set_material_textures()
+class InstancedMeshRenderer {
+public:
+	/// Creates the instance buffers and their descriptor-sets, and requests the graphics-pipeline from the registry
+	/// (compiled in the background: nothing is drawn until it is ready).
+	void init(VkDevice device, VmaAllocator allocator, DescriptorSetAllocator& descriptorSetAllocator, PipelineRegistry& pipelineRegistry, VkFormat colorFormat, VkFormat depthFormat, uint32_t maxInstances, uint32_t framesInFlight);
+	/// @attention Before the registry is destroyed (the pipeline itself is destroyed by the registry)
+	void destroy(VkDevice device, VmaAllocator allocator);
+
+	/// Sets the shared vertex (storage) and index buffers the batches draw from.
+	void set_mesh_buffers(VkDevice device, const AllocatedBuffer& vertexBuffer, const AllocatedBuffer& indexBuffer);
+	/// Sets the buffer of the indices of the visible instances (OcclusionCuller::get_visible_instance_buffer()).
+	void set_visible_instance_buffer(VkDevice device, const AllocatedBuffer& visibleInstanceBuffer);
+
+	/// Writes the material textures into the frame's descriptor-set, if they changed since it was last written.
+	/// @param generation Changes whenever an image-view changes (e.g. TextureStreamer::get_generation())
+	/// @attention After begin_frame(), and before the frame's draws are recorded
+	void set_material_textures(VkDevice device, std::span<const VkImageView, INSTANCING_MATERIAL_TEXTURE_COUNT> imageViews, VkSampler sampler, uint64_t generation);
+
+	/// Selects the instance buffer of the frame, and returns its mapped memory (maxInstances elements).
+	/// @attention The GPU must be done with the previous frame that used the same frameIndex
+	std::span<GPUInstanceData> begin_frame(uint32_t frameIndex);
+	/// The draws of the frame, referring to the instances written since begin_frame().
+	void set_batches(std::span<const InstancedDrawBatch> batches);
+
+	uint32_t get_max_instances() const { return _maxInstances; }
+	uint32_t get_batch_count() const { return static_cast<uint32_t>(_batches.size()); }
+	uint32_t get_instance_count() const { return _instanceCount; }
+
+	/// Adds the culled draws to the render queue (none while the pipeline is compiling): the instances found visible
+	/// by the early culling pass to GEOMETRY, the ones found newly visible by the late pass to LATE_GEOMETRY.
+	/// @attention The culler's instances and batches are the ones written since begin_frame(), in the same order
+	void enqueue_draws(RenderQueue& renderQueue, const glm::mat4& viewProjection, const OcclusionCuller& occlusionCuller) const;
+
+private:
+	uint32_t _maxInstances {0};
+	uint32_t _frameIndex {0};
+	uint32_t _instanceCount {0};
+	std::vector<InstancedDrawBatch> _batches {};
+
+	// One instance buffer and descriptor-set per frame in flight
+	std::vector<AllocatedBuffer> _instanceBuffers {};
+	std::vector<VkDescriptorSet> _descriptorSets {};
+	std::vector<uint64_t> _materialTextureGenerations {};   // Of the textures written in each set, 0: none yet
+	VkDescriptorSetLayout _descriptorSetLayout {VK_NULL_HANDLE};
+
+	VkBuffer _indexBuffer {VK_NULL_HANDLE};
+
+	// The shader-modules are kept alive as long as the pipeline is in the registry
+	PipelineRegistry* _pipelineRegistry {nullptr};
+	PipelineHandle _pipeline {PIPELINE_HANDLE_NONE};
+	GraphicsDynamicState _dynamicState {};
+	VkPipelineLayout _pipelineLayout {VK_NULL_HANDLE};
+	VkShaderModule _vertexShaderModule {VK_NULL_HANDLE};
+	VkShaderModule _fragmentShaderModule {VK_NULL_HANDLE};
+
+	void init_pipeline(VkDevice device, VkFormat colorFormat, VkFormat depthFormat);
+};
@@ -0,0 +1,326 @@
+#include "vk_jobs.h"
+
+#include <algorithm>
+#include <exception>
+
+#include <fmt/format.h>
+
+#include "vk_logger.h"
+#include "vk_trace.h"
+
+namespace {
+
+    static_assert((JOB_DEQUE_CAPACITY & (JOB_DEQUE_CAPACITY - 1)) == 0, "JOB_DEQUE_CAPACITY must be a power of two");
+
+    // Batches per worker picked by parallel_for(), to balance uneven batches through stealing
+    constexpr uint32_t PARALLEL_FOR_BATCHES_PER_WORKER {4};
+
+    // Attempts at finding a job before an idle worker goes to sleep
+    constexpr uint32_t WORKER_SPIN_COUNT {64};
+
+    // End of the pool's free list
+    constexpr uint32_t FREE_JOBS_END {UINT32_MAX};
+    constexpr uint64_t FREE_JOBS_TAG {uint64_t {1} << 32};
+    static_assert(JOB_POOL_CAPACITY < FREE_JOBS_END, "JOB_POOL_CAPACITY must fit the free list's indices");
+
+    // The worker the calling thread is (-1 if it is not a worker of this job system)
+    thread_local const JobSystem* t_jobSystem {nullptr};
+    thread_local int32_t t_workerIndex {-1};
+
+    // Victims are picked pseudo-randomly, so the thieves don't all hit the same deque
+    uint32_t next_random(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+}
+
+
+// WorkStealingDeque method definitions:
+
+bool WorkStealingDeque::push(Job* job) {
+    const int64_t bottom = _bottom.load(std::memory_order_relaxed);
+    const int64_t top = _top.load(std::memory_order_acquire);
+    if (bottom - top >= JOB_DEQUE_CAPACITY) {
+        return false;
+    }
+
+    _buffer[bottom & (JOB_DEQUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+Job* WorkStealingDeque::pop() {
+    const int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = _top.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+        // Empty
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Job* job = _buffer[bottom & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // The last job: race the thieves for it
+        if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            job = nullptr;
+        }
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+Job* WorkStealingDeque::steal() {
+    int64_t top = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t bottom = _bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return nullptr;
+    }
+
+    Job* job = _buffer[top & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return job;
+}
+
+
+// JobSystem method definitions:
+
+void JobSystem::init(uint32_t workerThreadCount) {
+    workerThreadCount = std::max(workerThreadCount, 1u);
+    _bStopping.store(false, std::memory_order_relaxed);
+
+    _jobPool = std::make_unique<Job[]>(JOB_POOL_CAPACITY);
+    for (uint32_t i {0}; i < JOB_POOL_CAPACITY; i++) {
+        _jobPool[i].bPooled = true;
+        _jobPool[i].nextFree.store(i + 1 < JOB_POOL_CAPACITY ? i + 1 : FREE_JOBS_END, std::memory_order_relaxed);
+    }
+    _freeJobs.store(0, std::memory_order_release);
+
+    // Worker 0 is the calling thread
+    for (uint32_t i {0}; i < workerThreadCount + 1; i++) {
+        _deques.push_back(std::make_unique<WorkStealingDeque>());
+    }
+    t_jobSystem = this;
+    t_workerIndex = 0;
+
+    for (uint32_t i {1}; i < workerThreadCount + 1; i++) {
+        _threads.emplace_back([this, i]() { worker_main(i); });
+    }
+    VK_LOG_INFO("Job system: {} worker threads", workerThreadCount);
+}
+
+void JobSystem::destroy() {
+    _bStopping.store(true, std::memory_order_release);
+    _workEpoch.fetch_add(1, std::memory_order_release);
+    _workEpoch.notify_all();
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+    _threads.clear();
+    _deques.clear();
+    _jobPool.reset();
+
+    t_jobSystem = nullptr;
+    t_workerIndex = -1;
+}
+
+Job* JobSystem::allocate_job() {
+    uint64_t freeJobs = _freeJobs.load(std::memory_order_acquire);
+    while (static_cast<uint32_t>(freeJobs) != FREE_JOBS_END) {
+        Job& job = _jobPool[static_cast<uint32_t>(freeJobs)];
+        // A stale next index (the job taken and freed again meanwhile) fails the exchange: the tag changed
+        const uint64_t next = ((freeJobs & ~uint64_t {UINT32_MAX}) + FREE_JOBS_TAG) | job.nextFree.load(std::memory_order_relaxed);
+        if (_freeJobs.compare_exchange_weak(freeJobs, next, std::memory_order_acquire, std::memory_order_acquire)) {
+            return &job;
+        }
+    }
+
+    // Every job of the pool is in flight
+    return new Job {};
+}
+
+void JobSystem::free_job(Job* job) {
+    if (!job->bPooled) {
+        delete job;
+        return;
+    }
+
+    const uint32_t index = static_cast<uint32_t>(job - _jobPool.get());
+    uint64_t freeJobs = _freeJobs.load(std::memory_order_relaxed);
+    uint64_t next {0};
+    do {
+        job->nextFree.store(static_cast<uint32_t>(freeJobs), std::memory_order_relaxed);
+        next = ((freeJobs & ~uint64_t {UINT32_MAX}) + FREE_JOBS_TAG) | index;
+    } while (!_freeJobs.compare_exchange_weak(freeJobs, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void JobSystem::submit(Job* job) {
+    if (job->counter != nullptr) {
+        job->counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (t_jobSystem == this && t_workerIndex >= 0) {
+        if (!_deques[t_workerIndex]->push(job)) {
+            // Full: run it now rather than blocking
+            execute(job);
+            return;
+        }
+    }
+    else {
+        std::scoped_lock lock {_sharedQueueMutex};
+        _sharedQueue.push_back(job);
+        _sharedQueueSize.store(static_cast<uint32_t>(_sharedQueue.size()), std::memory_order_release);
+    }
+
+    _workEpoch.fetch_add(1, std::memory_order_release);
+    _workEpoch.notify_one();
+}
+
+void JobSystem::wait(JobCounter& counter) {
+    ZONE("JobSystem::wait");
+    const int32_t workerIndex = t_jobSystem == this ? t_workerIndex : -1;
+    while (!counter.is_done()) {
+        // Read the epoch before looking for work, as the workers do
+        const uint32_t workEpoch = _workEpoch.load(std::memory_order_acquire);
+
+        Job* job {nullptr};
+        for (uint32_t i {0}; i < WORKER_SPIN_COUNT && job == nullptr && !counter.is_done(); i++) {
+            job = find_job(workerIndex);
+        }
+        if (job != nullptr) {
+            execute(job);
+            continue;
+        }
+
+        // The remaining jobs are running on other threads: sleep until a counter completes or a job is submitted.
+        // The waiter count and the counter are both seq_cst: either execute() sees the waiter, or the waiter sees
+        // the counter done.
+        _waiterCount.fetch_add(1, std::memory_order_seq_cst);
+        if (counter.pending.load(std::memory_order_seq_cst) != 0) {
+            _workEpoch.wait(workEpoch, std::memory_order_acquire);
+        }
+        _waiterCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void JobSystem::parallel_for(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t begin, uint32_t end)>& function) {
+    if (count == 0) {
+        return;
+    }
+    if (batchSize == 0) {
+        const uint32_t batchCount = get_worker_count() * PARALLEL_FOR_BATCHES_PER_WORKER;
+        batchSize = std::max((count + batchCount - 1) / batchCount, 1u);
+    }
+
+    JobCounter counter {};
+    std::mutex exceptionMutex {};
+    std::exception_ptr exception {};
+
+    for (uint32_t begin {0}; begin < count; begin += batchSize) {
+        const uint32_t end = std::min(begin + batchSize, count);
+        run([&function, &exceptionMutex, &exception, begin, end]() {
+            try {
+                function(begin, end);
+            }
+            catch (...) {
+                std::scoped_lock lock {exceptionMutex};
+                if (!exception) {
+                    exception = std::current_exception();
+                }
+            }
+        }, &counter);
+    }
+    wait(counter);
+
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+void JobSystem::worker_main(uint32_t workerIndex) {
+    t_jobSystem = this;
+    t_workerIndex = static_cast<int32_t>(workerIndex);
+    const std::string threadName = fmt::format("Worker {}", workerIndex);
+    vktrace::set_thread_name(threadName.c_str());
+
+    while (true) {
+        // Read the epoch before looking for work: a job submitted after the search changes it, and wakes us up
+        const uint32_t workEpoch = _workEpoch.load(std::memory_order_acquire);
+        if (_bStopping.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        Job* job {nullptr};
+        for (uint32_t i {0}; i < WORKER_SPIN_COUNT && job == nullptr; i++) {
+            job = find_job(static_cast<int32_t>(workerIndex));
+        }
+
+        if (job != nullptr) {
+            execute(job);
+        }
+        else {
+            _workEpoch.wait(workEpoch, std::memory_order_acquire);
+        }
+    }
+}
+
+Job* JobSystem::find_job(int32_t workerIndex) {
+    if (workerIndex >= 0) {
+        if (Job* job = _deques[workerIndex]->pop()) {
+            return job;
+        }
+    }
+
+    if (_sharedQueueSize.load(std::memory_order_acquire) > 0) {
+        std::scoped_lock lock {_sharedQueueMutex};
+        if (!_sharedQueue.empty()) {
+            // In submission order
+            Job* job = _sharedQueue.front();
+            _sharedQueue.pop_front();
+            _sharedQueueSize.store(static_cast<uint32_t>(_sharedQueue.size()), std::memory_order_release);
+            return job;
+        }
+    }
+
+    // Steal, starting from a random victim
+    thread_local uint32_t randomState {0x9E3779B9u ^ static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()))};
+    const uint32_t dequeCount = static_cast<uint32_t>(_deques.size());
+    const uint32_t firstVictim = next_random(randomState) % dequeCount;
+    for (uint32_t i {0}; i < dequeCount; i++) {
+        const uint32_t victim = (firstVictim + i) % dequeCount;
+        if (static_cast<int32_t>(victim) == workerIndex) {
+            continue;
+        }
+        if (Job* job = _deques[victim]->steal()) {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void JobSystem::execute(Job* job) {
+    {
+        ZONE("Job");
+        job->function();
+        job->function.reset();
+    }
+
+    // The counter may be gone once it reaches zero (its waiter returned): not touched past the decrement
+    JobCounter* counter = job->counter;
+    free_job(job);
+    if (counter != nullptr && counter->pending.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+        if (_waiterCount.load(std::memory_order_seq_cst) > 0) {
+            _workEpoch.fetch_add(1, std::memory_order_release);
+            _workEpoch.notify_all();
+        }
+    }
+}
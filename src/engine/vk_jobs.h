@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// @brief Capacity of each worker's deque (a power of two). A job pushed onto a full deque runs immediately instead.
+constexpr int64_t JOB_DEQUE_CAPACITY {4096};
+/// @brief Jobs allocated by init(). Past it (that many jobs in flight), a job is allocated on the heap.
+constexpr uint32_t JOB_POOL_CAPACITY {4096};
+/// @brief Bytes of a job's callable stored in the job itself. A larger callable is moved to the heap.
+constexpr size_t JOB_FUNCTION_INLINE_SIZE {32};
+
+/// @brief Number of jobs still to complete, for a group of jobs. Waited on with JobSystem::wait().
+struct JobCounter {
+	std::atomic<uint32_t> pending {0};
+
+	bool is_done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+/// @brief A callable without arguments, constructed in place when it fits (no allocation for the usual captures).
+class JobFunction {
+public:
+	JobFunction() = default;
+	JobFunction(const JobFunction&) = delete;
+	JobFunction& operator=(const JobFunction&) = delete;
+	~JobFunction() { reset(); }
+
+	template<typename Function>
+	void emplace(Function&& function) {
+		using Callable = std::decay_t<Function>;
+		reset();
+		if constexpr (sizeof(Callable) <= JOB_FUNCTION_INLINE_SIZE && alignof(Callable) <= alignof(std::max_align_t)) {
+			new (_storage) Callable(std::forward<Function>(function));
+			_invoke = [](std::byte* storage) { (*std::launder(reinterpret_cast<Callable*>(storage)))(); };
+			_destroy = [](std::byte* storage) { std::launder(reinterpret_cast<Callable*>(storage))->~Callable(); };
+		}
+		else {
+			new (_storage) Callable*(new Callable(std::forward<Function>(function)));
+			_invoke = [](std::byte* storage) { (**std::launder(reinterpret_cast<Callable**>(storage)))(); };
+			_destroy = [](std::byte* storage) { delete *std::launder(reinterpret_cast<Callable**>(storage)); };
+		}
+	}
+
+	void operator()() { _invoke(_storage); }
+
+	/// Destroys the callable (and its captures).
+	void reset() {
+		if (_destroy != nullptr) {
+			_destroy(_storage);
+			_invoke = nullptr;
+			_destroy = nullptr;
+		}
+	}
+
+private:
+	alignas(std::max_align_t) std::byte _storage[JOB_FUNCTION_INLINE_SIZE];
+	void (*_invoke)(std::byte*) {nullptr};
+	void (*_destroy)(std::byte*) {nullptr};
+};
+
+/// @brief A unit of work, and the counter it decrements once done. On its own cache line.
+struct alignas(64) Job {
+	JobFunction function;
+	JobCounter* counter {nullptr};
+	// Of the job system's pool (else allocated on the heap), and the next free job of the pool while free
+	bool bPooled {false};
+	std::atomic<uint32_t> nextFree {0};
+};
+
+/// @brief Chase-Lev work-stealing deque of a worker (Lê, Pop, Cohen, Zappa Nardelli, 2013), with a fixed capacity.
+///
+/// The owning worker pushes and pops at the bottom (LIFO, for locality). The other threads steal from the top (FIFO).
+class WorkStealingDeque {
+public:
+	/// Owner only. Returns false if the deque is full.
+	bool push(Job* job);
+	/// Owner only. Returns nullptr if the deque is empty.
+	Job* pop();
+	/// Any thread. Returns nullptr if the deque is empty, or if another thread took the job first.
+	Job* steal();
+
+private:
+	alignas(64) std::atomic<int64_t> _top {0};
+	alignas(64) std::atomic<int64_t> _bottom {0};
+	std::array<std::atomic<Job*>, JOB_DEQUE_CAPACITY> _buffer {};
+};
+
+/// @brief A fixed pool of worker threads sharing the jobs of the engine, with work stealing.
+///
+/// Every worker owns a deque: the jobs it submits go to its own deque, and an idle worker steals from the others.
+/// The thread that called init() takes part as worker 0 (when it waits on a counter). Other threads submit through
+/// a shared queue, taken from in submission order.
+///
+/// The jobs come from a fixed pool (a lock-free free list), their callables stored in place: submitting a job
+/// doesn't allocate, unless its captures are large or the pool is exhausted.
+///
+/// Waiting never blocks a worker while jobs are available: wait() runs jobs until the counter reaches zero, so jobs
+/// may themselves submit and wait for other jobs. Once only other threads' jobs are left, it sleeps until a counter
+/// completes or a job is submitted.
+/// @attention Jobs must not throw (parallel_for() forwards the exceptions of its batches to the caller)
+class JobSystem {
+public:
+	/// Starts the worker threads (at least one).
+	void init(uint32_t workerThreadCount);
+	/// Stops the worker threads. Jobs must not be submitted anymore, and every counter must have been waited on.
+	void destroy();
+
+	/// Queues a job. Increments the counter, which is decremented once the job has run.
+	template<typename Function>
+	void run(Function&& function, JobCounter* counter = nullptr) {
+		Job* job = allocate_job();
+		job->function.emplace(std::forward<Function>(function));
+		job->counter = counter;
+		submit(job);
+	}
+	/// Runs the pending jobs (of any counter) until the counter reaches zero.
+	void wait(JobCounter& counter);
+
+	/// Calls @code function(begin, end)@endcode over [0, count) split in batches, in parallel, and waits for all of them.
+	/// Rethrows the first exception thrown by a batch.
+	/// @param batchSize Indices per job. 0: picked to give a few batches per worker
+	void parallel_for(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t begin, uint32_t end)>& function);
+
+	/// Worker threads, plus the thread that called init().
+	uint32_t get_worker_count() const { return static_cast<uint32_t>(_deques.size()); }
+
+private:
+	std::vector<std::unique_ptr<WorkStealingDeque>> _deques {};  // One per worker, [0] is the thread that called init()
+	std::vector<std::thread> _threads {};
+
+	// Jobs submitted by threads that are not workers (FIFO)
+	std::mutex _sharedQueueMutex {};
+	std::deque<Job*> _sharedQueue {};
+	std::atomic<uint32_t> _sharedQueueSize {0};
+
+	// The free jobs of the pool: a stack of their indices, tagged against ABA (index in the low 32 bits, tag above)
+	std::unique_ptr<Job[]> _jobPool {};
+	alignas(64) std::atomic<uint64_t> _freeJobs {0};
+
+	// Bumped on every submission, and on the completion of a counter while a thread waits: idle threads sleep on it
+	alignas(64) std::atomic<uint32_t> _workEpoch {0};
+	std::atomic<uint32_t> _waiterCount {0};   // Threads asleep in wait()
+	std::atomic<bool> _bStopping {false};
+
+	/// A free job of the pool, or a new one on the heap if the pool is exhausted.
+	Job* allocate_job();
+	void free_job(Job* job);
+	/// Increments the job's counter, and queues it.
+	void submit(Job* job);
+	void worker_main(uint32_t workerIndex);
+	/// Takes a job: from the calling worker's own deque first, then the shared queue, then the other workers' deques.
+	Job* find_job(int32_t workerIndex);
+	void execute(Job* job);
+};
@@ -1,2 +1,395 @@
-﻿
-#include "vk_loader.h"
\ No newline at end of file
+﻿#include "vk_loader.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "vk_images.h"
+#include "vk_logger.h"
+
+namespace {
+
+    constexpr uint32_t RGBA8_TEXEL_SIZE {4};
+
+    // KTX2 container: the file identifier, then the header fields (little-endian), then the level index
+    constexpr std::array<uint8_t, 12> KTX2_IDENTIFIER {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+    constexpr size_t KTX2_HEADER_SIZE {80};
+    constexpr size_t KTX2_LEVEL_INDEX_ENTRY_SIZE {24};
+    // The levels are aligned on a multiple of every texel block size (and of 4, as required)
+    constexpr size_t KTX2_LEVEL_ALIGNMENT {16};
+
+    // Khronos data format descriptor values (khr_df.h)
+    constexpr uint32_t KHR_DF_MODEL_RGBSDA {1};
+    constexpr uint32_t KHR_DF_MODEL_BC4 {131};
+    constexpr uint32_t KHR_DF_MODEL_BC5 {132};
+    constexpr uint32_t KHR_DF_MODEL_BC7 {134};
+    constexpr uint32_t KHR_DF_PRIMARIES_BT709 {1};
+    constexpr uint32_t KHR_DF_TRANSFER_LINEAR {1};
+    constexpr uint32_t KHR_DF_TRANSFER_SRGB {2};
+    constexpr uint32_t KHR_DF_CHANNEL_RED {0};
+    constexpr uint32_t KHR_DF_CHANNEL_GREEN {1};
+    constexpr uint32_t KHR_DF_CHANNEL_BLUE {2};
+    constexpr uint32_t KHR_DF_CHANNEL_ALPHA {15};
+    constexpr uint32_t KHR_DF_SAMPLE_DATATYPE_LINEAR {0x10};
+
+    template <typename T>
+    T read_value(std::span<const std::byte> data, size_t offset) {
+        T value {};
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void write_value(std::vector<std::byte>& data, size_t offset, T value) {
+        std::memcpy(data.data() + offset, &value, sizeof(T));
+    }
+
+    // The basic data format descriptor block of a format: its color model, and the channels of a texel block
+    std::vector<uint32_t> build_data_format_descriptor(VkFormat format) {
+        struct Sample {
+            uint32_t channel;
+            uint32_t bitOffset;
+            uint32_t bitLength;
+            uint32_t upper;
+        };
+
+        const vkutil::TexelBlock block = vkutil::get_texel_block(format);
+        uint32_t model {KHR_DF_MODEL_RGBSDA};
+        bool bSrgb {false};
+        std::vector<Sample> samples {};
+        switch (format) {
+            case VK_FORMAT_R8G8B8A8_SRGB:
+                bSrgb = true;
+                [[fallthrough]];
+            case VK_FORMAT_R8G8B8A8_UNORM:
+                samples = {{KHR_DF_CHANNEL_RED, 0, 8, 255}, {KHR_DF_CHANNEL_GREEN, 8, 8, 255}, {KHR_DF_CHANNEL_BLUE, 16, 8, 255}, {KHR_DF_CHANNEL_ALPHA, 24, 8, 255}};
+                break;
+            case VK_FORMAT_R8G8_UNORM:
+                samples = {{KHR_DF_CHANNEL_RED, 0, 8, 255}, {KHR_DF_CHANNEL_GREEN, 8, 8, 255}};
+                break;
+            case VK_FORMAT_R8_UNORM:
+                samples = {{KHR_DF_CHANNEL_RED, 0, 8, 255}};
+                break;
+            case VK_FORMAT_BC4_UNORM_BLOCK:
+                model = KHR_DF_MODEL_BC4;
+                samples = {{KHR_DF_CHANNEL_RED, 0, 64, UINT32_MAX}};
+                break;
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+                model = KHR_DF_MODEL_BC5;
+                samples = {{KHR_DF_CHANNEL_RED, 0, 64, UINT32_MAX}, {KHR_DF_CHANNEL_GREEN, 64, 64, UINT32_MAX}};
+                break;
+            case VK_FORMAT_BC7_SRGB_BLOCK:
+                bSrgb = true;
+                [[fallthrough]];
+            case VK_FORMAT_BC7_UNORM_BLOCK:
+                model = KHR_DF_MODEL_BC7;
+                samples = {{0, 0, 128, UINT32_MAX}};
+                break;
+            default:
+                VK_LOG_ERROR("No KTX2 data format descriptor for the format {}", string_VkFormat(format));
+                throw std::runtime_error("No KTX2 data format descriptor for the format");
+        }
+
+        std::vector<uint32_t> descriptor {};
+        const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+        descriptor.push_back(4 + blockSize);                                       // dfdTotalSize
+        descriptor.push_back(0);                                                   // Khronos vendor, basic descriptor type
+        descriptor.push_back(2 | (blockSize << 16));                               // Version 1.3 (2), block size
+        descriptor.push_back(model | (KHR_DF_PRIMARIES_BT709 << 8) | ((bSrgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR) << 16));
+        descriptor.push_back((block.width - 1) | ((block.height - 1) << 8));       // Texel block dimensions, minus 1
+        descriptor.push_back(block.size);                                          // bytesPlane0
+        descriptor.push_back(0);
+        for (const Sample& sample : samples) {
+            // Alpha is always linear, even in the sRGB formats
+            const uint32_t channelType = sample.channel | ((bSrgb && sample.channel == KHR_DF_CHANNEL_ALPHA) ? KHR_DF_SAMPLE_DATATYPE_LINEAR : 0);
+            descriptor.push_back(sample.bitOffset | ((sample.bitLength - 1) << 16) | (channelType << 24));
+            descriptor.push_back(0);              // Sample position
+            descriptor.push_back(0);              // Lower
+            descriptor.push_back(sample.upper);   // Upper
+        }
+        return descriptor;
+    }
+
+    size_t align_up(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // sRGB to linear, per 8-bit value
+    const std::array<float, 256> SRGB_TO_LINEAR = []() {
+        std::array<float, 256> table {};
+        for (uint32_t i {0}; i < 256; i++) {
+            const float value = static_cast<float>(i) / 255.f;
+            table[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+        }
+        return table;
+    }();
+
+    uint8_t linear_to_srgb(float value) {
+        const float encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+        return static_cast<uint8_t>(std::clamp(encoded * 255.f + 0.5f, 0.f, 255.f));
+    }
+
+    /// Averages each 2x2 block of the source level into a texel of the next one (the odd last row/column is
+    /// folded into the previous block, so every source texel counts).
+    void downsample_level(const uint8_t* source, VkExtent2D sourceExtent, uint8_t* destination, VkExtent2D destinationExtent, bool bSrgb) {
+        for (uint32_t y {0}; y < destinationExtent.height; y++) {
+            const uint32_t y0 = std::min(y * 2, sourceExtent.height - 1);
+            const uint32_t y1 = (y + 1 == destinationExtent.height) ? sourceExtent.height - 1 : std::min(y * 2 + 1, sourceExtent.height - 1);
+            for (uint32_t x {0}; x < destinationExtent.width; x++) {
+                const uint32_t x0 = std::min(x * 2, sourceExtent.width - 1);
+                const uint32_t x1 = (x + 1 == destinationExtent.width) ? sourceExtent.width - 1 : std::min(x * 2 + 1, sourceExtent.width - 1);
+
+                for (uint32_t channel {0}; channel < RGBA8_TEXEL_SIZE; channel++) {
+                    float sum {0.f};
+                    uint32_t count {0};
+                    for (uint32_t sy {y0}; sy <= y1; sy++) {
+                        for (uint32_t sx {x0}; sx <= x1; sx++) {
+                            const uint8_t value = source[(sy * sourceExtent.width + sx) * RGBA8_TEXEL_SIZE + channel];
+                            // Alpha is always linear
+                            sum += (bSrgb && channel < 3) ? SRGB_TO_LINEAR[value] : static_cast<float>(value) / 255.f;
+                            count++;
+                        }
+                    }
+                    const float average = sum / static_cast<float>(count);
+                    destination[(y * destinationExtent.width + x) * RGBA8_TEXEL_SIZE + channel] = (bSrgb && channel < 3)
+                        ? linear_to_srgb(average)
+                        : static_cast<uint8_t>(std::clamp(average * 255.f + 0.5f, 0.f, 255.f));
+                }
+            }
+        }
+    }
+
+}
+
+uint32_t vkloader::get_mip_count(VkExtent2D extent) {
+    return static_cast<uint32_t>(std::bit_width(std::max({extent.width, extent.height, 1u})));
+}
+
+VkExtent2D vkloader::get_mip_extent(VkExtent2D extent, uint32_t mipLevel) {
+    return VkExtent2D {std::max(extent.width >> mipLevel, 1u), std::max(extent.height >> mipLevel, 1u)};
+}
+
+bool vkloader::read_ktx2_header(std::span<const std::byte> fileData, Ktx2Header& header) {
+    if (fileData.size() < KTX2_HEADER_SIZE || std::memcmp(fileData.data(), KTX2_IDENTIFIER.data(), KTX2_IDENTIFIER.size()) != 0) {
+        VK_LOG_WARN("Not a KTX2 file");
+        return false;
+    }
+
+    const uint32_t vkFormat = read_value<uint32_t>(fileData, 12);
+    const uint32_t pixelWidth = read_value<uint32_t>(fileData, 20);
+    const uint32_t pixelHeight = read_value<uint32_t>(fileData, 24);
+    const uint32_t pixelDepth = read_value<uint32_t>(fileData, 28);
+    const uint32_t layerCount = read_value<uint32_t>(fileData, 32);
+    const uint32_t faceCount = read_value<uint32_t>(fileData, 36);
+    const uint32_t supercompressionScheme = read_value<uint32_t>(fileData, 44);
+    // 0: the loader should generate the mips, which the engine doesn't do: the single level is used as it is
+    const uint32_t levelCount = std::max(read_value<uint32_t>(fileData, 40), 1u);
+
+    header.format = static_cast<VkFormat>(vkFormat);
+    header.extent = VkExtent2D {pixelWidth, pixelHeight};
+    if (pixelWidth == 0 || pixelHeight == 0 || pixelDepth > 1 || layerCount > 1 || faceCount != 1 || supercompressionScheme != 0
+        || levelCount > get_mip_count(header.extent)) {
+        VK_LOG_WARN("Unsupported KTX2 file: {}x{}x{}, {} layers, {} faces, {} levels, supercompression {}", pixelWidth, pixelHeight, pixelDepth,
+            layerCount, faceCount, levelCount, supercompressionScheme);
+        return false;
+    }
+    if (fileData.size() < KTX2_HEADER_SIZE + levelCount * KTX2_LEVEL_INDEX_ENTRY_SIZE) {
+        VK_LOG_WARN("Truncated KTX2 level index");
+        return false;
+    }
+
+    vkutil::TexelBlock block {};
+    switch (header.format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_R8G8_UNORM:
+        case VK_FORMAT_R8_UNORM:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            block = vkutil::get_texel_block(header.format);
+            break;
+        default:
+            VK_LOG_WARN("Unsupported KTX2 format: {}", string_VkFormat(header.format));
+            return false;
+    }
+
+    // Every level must be tightly packed: they are uploaded as they are
+    header.levels.clear();
+    for (uint32_t level {0}; level < levelCount; level++) {
+        const size_t entryOffset = KTX2_HEADER_SIZE + level * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+        const uint64_t byteOffset = read_value<uint64_t>(fileData, entryOffset);
+        const uint64_t byteLength = read_value<uint64_t>(fileData, entryOffset + 8);
+
+        const VkExtent2D levelExtent = get_mip_extent(header.extent, level);
+        const uint64_t expectedLength = uint64_t {(levelExtent.width + block.width - 1) / block.width} * ((levelExtent.height + block.height - 1) / block.height) * block.size;
+        if (byteLength != expectedLength) {
+            VK_LOG_WARN("Unsupported KTX2 level {}: {} bytes, {} expected", level, byteLength, expectedLength);
+            return false;
+        }
+        header.levels.push_back(MipLevelData {levelExtent, static_cast<size_t>(byteOffset), static_cast<size_t>(byteLength)});
+    }
+    return true;
+}
+
+bool vkloader::load_ktx2_mips(std::span<const std::byte> fileData, uint64_t fileOffset, const Ktx2Header& header, uint32_t firstMip, MipChain& mipChain, uint32_t levelCount) {
+    mipChain.format = header.format;
+    mipChain.extent = header.extent;
+    mipChain.mipCount = static_cast<uint32_t>(header.levels.size());
+    mipChain.firstMip = std::min(firstMip, mipChain.mipCount - 1);
+    mipChain.levels.clear();
+
+    // The levels [firstMip, endMip) are copied
+    const uint32_t endMip = mipChain.firstMip + std::min(levelCount, mipChain.mipCount - mipChain.firstMip);
+    size_t dataSize {0};
+    for (uint32_t mip {mipChain.firstMip}; mip < endMip; mip++) {
+        const MipLevelData& level = header.levels[mip];
+        if (level.offset < fileOffset || level.offset + level.size > fileOffset + fileData.size()) {
+            VK_LOG_WARN("KTX2 level {} out of the data read ({} bytes at {})", mip, fileData.size(), fileOffset);
+            return false;
+        }
+        mipChain.levels.push_back(MipLevelData {level.extent, dataSize, level.size});
+        dataSize += level.size;
+    }
+
+    mipChain.data.resize(dataSize);
+    for (uint32_t mip {mipChain.firstMip}; mip < endMip; mip++) {
+        const MipLevelData& level = header.levels[mip];
+        std::memcpy(mipChain.data.data() + mipChain.levels[mip - mipChain.firstMip].offset, fileData.data() + (level.offset - fileOffset), level.size);
+    }
+    return true;
+}
+
+std::vector<std::byte> vkloader::write_ktx2(const MipChain& mipChain, std::string_view writer) {
+    const uint32_t levelCount = static_cast<uint32_t>(mipChain.levels.size());
+    const std::vector<uint32_t> dataFormatDescriptor = build_data_format_descriptor(mipChain.format);
+
+    // A single key/value: KTXwriter
+    std::vector<std::byte> keyValueData {};
+    {
+        const std::string_view key {"KTXwriter"};
+        const uint32_t keyAndValueByteLength = static_cast<uint32_t>(key.size() + 1 + writer.size() + 1);
+        keyValueData.resize(align_up(sizeof(uint32_t) + keyAndValueByteLength, 4));
+        write_value<uint32_t>(keyValueData, 0, keyAndValueByteLength);
+        std::memcpy(keyValueData.data() + sizeof(uint32_t), key.data(), key.size());
+        std::memcpy(keyValueData.data() + sizeof(uint32_t) + key.size() + 1, writer.data(), writer.size());
+    }
+
+    // Header, level index, descriptor, key/values, then the levels from the smallest to the largest
+    const size_t dfdOffset = KTX2_HEADER_SIZE + levelCount * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+    const size_t dfdSize = dataFormatDescriptor.size() * sizeof(uint32_t);
+    const size_t kvdOffset = dfdOffset + dfdSize;
+    std::vector<size_t> levelOffsets(levelCount);
+    size_t fileSize = kvdOffset + keyValueData.size();
+    for (uint32_t level {levelCount}; level-- > 0;) {
+        levelOffsets[level] = align_up(fileSize, KTX2_LEVEL_ALIGNMENT);
+        fileSize = levelOffsets[level] + mipChain.levels[level].size;
+    }
+
+    std::vector<std::byte> file(fileSize);
+    std::memcpy(file.data(), KTX2_IDENTIFIER.data(), KTX2_IDENTIFIER.size());
+    write_value<uint32_t>(file, 12, static_cast<uint32_t>(mipChain.format));
+    write_value<uint32_t>(file, 16, 1);                          // typeSize: bytes, or blocks
+    write_value<uint32_t>(file, 20, mipChain.extent.width);
+    write_value<uint32_t>(file, 24, mipChain.extent.height);
+    write_value<uint32_t>(file, 28, 0);                          // pixelDepth: 2D
+    write_value<uint32_t>(file, 32, 0);                          // layerCount: not an array
+    write_value<uint32_t>(file, 36, 1);                          // faceCount
+    write_value<uint32_t>(file, 40, levelCount);
+    write_value<uint32_t>(file, 44, 0);                          // supercompressionScheme: none
+    write_value<uint32_t>(file, 48, static_cast<uint32_t>(dfdOffset));
+    write_value<uint32_t>(file, 52, static_cast<uint32_t>(dfdSize));
+    write_value<uint32_t>(file, 56, static_cast<uint32_t>(kvdOffset));
+    write_value<uint32_t>(file, 60, static_cast<uint32_t>(keyValueData.size()));
+    write_value<uint64_t>(file, 64, 0);                          // No supercompression global data
+    write_value<uint64_t>(file, 72, 0);
+
+    for (uint32_t level {0}; level < levelCount; level++) {
+        const size_t entryOffset = KTX2_HEADER_SIZE + level * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+        write_value<uint64_t>(file, entryOffset, levelOffsets[level]);
+        write_value<uint64_t>(file, entryOffset + 8, mipChain.levels[level].size);
+        write_value<uint64_t>(file, entryOffset + 16, mipChain.levels[level].size);   // uncompressedByteLength
+        std::memcpy(file.data() + levelOffsets[level], mipChain.data.data() + mipChain.levels[level].offset, mipChain.levels[level].size);
+    }
+    std::memcpy(file.data() + dfdOffset, dataFormatDescriptor.data(), dfdSize);
+    std::memcpy(file.data() + kvdOffset, keyValueData.data(), keyValueData.size());
+    return file;
+}
+
+bool vkloader::get_image_extent(std::span<const std::byte> fileData, VkExtent2D& extent) {
+    int width {0};
+    int height {0};
+    int channelCount {0};
+    if (!stbi_info_from_memory(reinterpret_cast<const stbi_uc*>(fileData.data()), static_cast<int>(fileData.size()), &width, &height, &channelCount)) {
+        return false;
+    }
+    extent = VkExtent2D {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+    return true;
+}
+
+bool vkloader::decode_image_mips(std::span<const std::byte> fileData, uint32_t firstMip, bool bSrgb, MipChain& mipChain, uint32_t levelCount) {
+    int width {0};
+    int height {0};
+    int channelCount {0};
+    stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(fileData.data()), static_cast<int>(fileData.size()), &width, &height, &channelCount, STBI_rgb_alpha);
+    if (pixels == nullptr) {
+        VK_LOG_WARN("Failed to decode image: {}", stbi_failure_reason());
+        return false;
+    }
+
+    mipChain.format = bSrgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    mipChain.extent = VkExtent2D {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+    mipChain.mipCount = get_mip_count(mipChain.extent);
+    mipChain.firstMip = std::min(firstMip, mipChain.mipCount - 1);
+    mipChain.levels.clear();
+    // The levels [firstMip, lastMip] are kept, the ones past lastMip not computed
+    const uint32_t lastMip = mipChain.firstMip + std::min(levelCount, mipChain.mipCount - mipChain.firstMip) - 1;
+
+    size_t dataSize {0};
+    for (uint32_t mip {mipChain.firstMip}; mip <= lastMip; mip++) {
+        const VkExtent2D mipExtent = get_mip_extent(mipChain.extent, mip);
+        const size_t mipSize = static_cast<size_t>(mipExtent.width) * mipExtent.height * RGBA8_TEXEL_SIZE;
+        mipChain.levels.push_back(MipLevelData {mipExtent, dataSize, mipSize});
+        dataSize += mipSize;
+    }
+    mipChain.data.resize(dataSize);
+
+    // Each level from the previous one. The levels above firstMip are only needed to get there: two scratch levels.
+    std::vector<uint8_t> previousLevel {};
+    std::vector<uint8_t> level {};
+    const uint8_t* source = pixels;
+    VkExtent2D sourceExtent = mipChain.extent;
+    if (mipChain.firstMip == 0) {
+        std::memcpy(mipChain.data.data(), pixels, mipChain.levels[0].size);
+    }
+    for (uint32_t mip {1}; mip <= lastMip; mip++) {
+        const VkExtent2D mipExtent = get_mip_extent(mipChain.extent, mip);
+        uint8_t* destination {nullptr};
+        if (mip >= mipChain.firstMip) {
+            destination = reinterpret_cast<uint8_t*>(mipChain.data.data() + mipChain.levels[mip - mipChain.firstMip].offset);
+        }
+        else {
+            level.resize(static_cast<size_t>(mipExtent.width) * mipExtent.height * RGBA8_TEXEL_SIZE);
+            destination = level.data();
+        }
+        downsample_level(source, sourceExtent, destination, mipExtent, bSrgb);
+
+        if (mip < mipChain.firstMip) {
+            std::swap(previousLevel, level);
+            source = previousLevel.data();
+        }
+        else {
+            source = destination;
+        }
+        sourceExtent = mipExtent;
+    }
+
+    stbi_image_free(pixels);
+    return true;
+}
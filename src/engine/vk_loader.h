@@ -1 +1,72 @@
 ﻿#pragma once
+
+#include "vk_types.h"
+
+#include <filesystem>
+#include <string_view>
+
+namespace vkloader {
+
+    /// @brief A mip level of a MipChain: its size, and where its texels are in the chain's data.
+    struct MipLevelData {
+        VkExtent2D extent;
+        size_t offset;
+        size_t size;
+    };
+
+    /// @brief Some levels of an image's mip chain, tightly packed one after the other (the finest first).
+    struct MipChain {
+        VkFormat format {VK_FORMAT_R8G8B8A8_UNORM};
+        VkExtent2D extent {0, 0};   // Of the full-resolution image (mip 0)
+        uint32_t mipCount {0};      // Of the full chain, down to 1x1
+        uint32_t firstMip {0};      // Finest level held by levels/data
+        std::vector<MipLevelData> levels {};
+        std::vector<std::byte> data {};
+    };
+
+    /// Levels of the full mip chain of an image (down to 1x1).
+    uint32_t get_mip_count(VkExtent2D extent);
+    /// Size of a level: halved per level (rounded down), at least 1.
+    VkExtent2D get_mip_extent(VkExtent2D extent, uint32_t mipLevel);
+
+    /// @brief Bytes of the start of a KTX2 file read to get its header, level index and mip tail in a single read
+    /// (the levels are stored from the smallest to the largest).
+    constexpr size_t KTX2_HEADER_READ_SIZE {64 * 1024};
+
+    /// @brief What the engine needs from the header of a KTX2 file: the format, and where each mip level is.
+    struct Ktx2Header {
+        VkFormat format {VK_FORMAT_UNDEFINED};
+        VkExtent2D extent {0, 0};
+        std::vector<MipLevelData> levels {};   // Mip 0 first, offsets in the file
+    };
+
+    /// @brief Parses the header and level index of a KTX2 file (2D, single layer and face, not supercompressed, in a
+    /// format of vkutil::get_texel_block()).
+    /// @return False if unsupported or truncated (logged)
+    bool read_ktx2_header(std::span<const std::byte> fileData, Ktx2Header& header);
+
+    /// @brief Copies the levels from firstMip of a KTX2 file into the mip chain, as they are (already GPU blocks).
+    /// @param fileData A part of the file, starting at the byte fileOffset of the file, holding these levels
+    /// @param levelCount Levels copied from firstMip: fewer than the rest of the chain when the coarser ones are
+    /// already on the GPU
+    /// @return False if the levels are not in fileData (logged)
+    bool load_ktx2_mips(std::span<const std::byte> fileData, uint64_t fileOffset, const Ktx2Header& header, uint32_t firstMip, MipChain& mipChain, uint32_t levelCount = UINT32_MAX);
+
+    /// @brief Encodes a full mip chain (firstMip 0) as a KTX2 file, with its data format descriptor.
+    /// @param writer Recorded as the KTXwriter metadata
+    std::vector<std::byte> write_ktx2(const MipChain& mipChain, std::string_view writer);
+
+    /// @brief Reads the size of an image file from its header, without decoding it.
+    /// @return False if the data is not a supported image
+    bool get_image_extent(std::span<const std::byte> fileData, VkExtent2D& extent);
+
+    /// @brief Decodes an image file (PNG, JPG, TGA, BMP... through stb_image) to RGBA8 (sRGB or UNORM), and builds its
+    /// mip chain on the CPU with a box filter. Only the levels from firstMip (clamped to the last level) are kept.
+    /// @param bSrgb The texels are sRGB-encoded: the box filter averages them in linear space
+    /// @param levelCount Levels kept from firstMip (the levels past them are not computed): 1 when the GPU generates
+    /// the rest (MipmapGenerator)
+    /// @return False if the data is not a supported image (logged)
+    /// @note Thread-safe (e.g. from the decode jobs of the asset streaming)
+    bool decode_image_mips(std::span<const std::byte> fileData, uint32_t firstMip, bool bSrgb, MipChain& mipChain, uint32_t levelCount = UINT32_MAX);
+
+};
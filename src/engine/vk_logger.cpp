@@ -0,0 +1,234 @@
+#include "vk_logger.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <new>
+#include <thread>
+
+namespace {
+
+    /// @brief Number of records in the log queue (a power of two). When full, new messages are dropped and counted.
+    constexpr size_t LOG_QUEUE_CAPACITY {4096};
+    static_assert((LOG_QUEUE_CAPACITY & (LOG_QUEUE_CAPACITY - 1)) == 0, "LOG_QUEUE_CAPACITY must be a power of two");
+
+    struct LevelStyle {
+        fmt::text_style style;
+        const char* prefix;
+    };
+
+    LevelStyle get_level_style(vklog::LogLevel level) {
+        switch (level) {
+            case vklog::LogLevel::DEBUG:    return {fmt::fg(fmt::color::cyan),   "[DEBUG]   "};
+            case vklog::LogLevel::INFO:     return {fmt::fg(fmt::color::gray),   "[INFO]    "};
+            case vklog::LogLevel::SUCCESS:  return {fmt::fg(fmt::color::green),  "[SUCCESS] "};
+            case vklog::LogLevel::WARN:     return {fmt::fg(fmt::color::yellow), "[WARN]    "};
+            case vklog::LogLevel::ERROR:    return {fmt::fg(fmt::color::red),    "[ERROR]   "};
+        }
+        return {fmt::text_style {}, "[LOG]     "};
+    }
+
+    // Appends the coloured line of a message to the output
+    void append_line(fmt::memory_buffer& out, vklog::LogLevel level, std::string_view message) {
+        const LevelStyle levelStyle = get_level_style(level);
+        fmt::format_to(fmt::appender(out), levelStyle.style, "{}{}", levelStyle.prefix, message);
+        out.push_back('\n');
+    }
+
+    /// @brief Bounded multi-producer / single-consumer queue of log records, and the thread writing them.
+    ///
+    /// Producers claim a cell with a compare-and-swap on the enqueue position, construct the record in place, and
+    /// publish it through the cell's sequence number (the bounded queue of Dmitry Vyukov). They never wait:
+    /// when the queue is full, the message is dropped. The log thread sleeps on an atomic while the queue is empty.
+    class LogQueue {
+    public:
+        LogQueue() {
+            for (size_t i {0}; i < LOG_QUEUE_CAPACITY; i++) {
+                _cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            _thread = std::thread([this]() { run(); });
+            _bRunning.store(true, std::memory_order_release);
+        }
+
+        // At exit: writes what's left and stops the thread. Later messages are written directly.
+        void stop() {
+            _bStopping.store(true, std::memory_order_release);
+            wake();
+            _thread.join();
+            _bRunning.store(false, std::memory_order_release);
+        }
+
+        bool is_running() const { return _bRunning.load(std::memory_order_acquire); }
+
+        vklog::LogRecord* acquire() {
+            size_t position = _enqueuePosition.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = _cells[position & (LOG_QUEUE_CAPACITY - 1)];
+                const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+                if (difference == 0) {
+                    // The cell is free: claim it
+                    if (_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        return &cell.record;
+                    }
+                }
+                else if (difference < 0) {
+                    // The cell still holds a record from the previous lap: the queue is full
+                    _droppedCount.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                else {
+                    position = _enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void commit(vklog::LogRecord* record) {
+            Cell* cell = get_cell(record);
+            // The claimed position is the cell's sequence number, the record is readable at position + 1
+            cell->sequence.store(cell->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            wake();
+        }
+
+        // Hands a claimed cell back without publishing its record (written directly once the log thread is gone)
+        void release(vklog::LogRecord* record) {
+            Cell* cell = get_cell(record);
+            // Free for the producers' next lap, as if the log thread had written it
+            cell->sequence.store(cell->sequence.load(std::memory_order_relaxed) + LOG_QUEUE_CAPACITY, std::memory_order_release);
+        }
+
+        void flush() {
+            const size_t target = _enqueuePosition.load(std::memory_order_acquire);
+            size_t written = _writtenPosition.load(std::memory_order_acquire);
+            while (written < target) {
+                _writtenPosition.wait(written, std::memory_order_acquire);
+                written = _writtenPosition.load(std::memory_order_acquire);
+            }
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            vklog::LogRecord record;
+        };
+
+        // Producers and the consumer on separate cache lines
+        alignas(64) std::atomic<size_t> _enqueuePosition {0};
+        alignas(64) std::atomic<size_t> _writtenPosition {0};
+        alignas(64) std::atomic<uint32_t> _wakeCounter {0};
+        std::atomic<uint32_t> _droppedCount {0};
+        std::atomic<bool> _bStopping {false};
+        std::atomic<bool> _bRunning {false};
+
+        std::array<Cell, LOG_QUEUE_CAPACITY> _cells;
+        std::thread _thread;
+
+        static Cell* get_cell(vklog::LogRecord* record) {
+            return reinterpret_cast<Cell*>(reinterpret_cast<std::byte*>(record) - offsetof(Cell, record));
+        }
+
+        void wake() {
+            // notify_one() only makes a system call when the log thread is actually waiting
+            _wakeCounter.fetch_add(1, std::memory_order_release);
+            _wakeCounter.notify_one();
+        }
+
+        void run() {
+            size_t dequeuePosition {0};
+            fmt::memory_buffer out;
+            fmt::memory_buffer message;
+
+            while (true) {
+                const uint32_t wakeCounter = _wakeCounter.load(std::memory_order_acquire);
+
+                // Drain every published record, then write them with a single call
+                while (true) {
+                    Cell& cell = _cells[dequeuePosition & (LOG_QUEUE_CAPACITY - 1)];
+                    if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+                        break;
+                    }
+                    vklog::LogRecord& record = cell.record;
+
+                    message.clear();
+                    record.formatArguments(record, message);
+                    record.destroyArguments(record);
+                    append_line(out, record.level, std::string_view(message.data(), message.size()));
+
+                    // Free the cell for the producers' next lap
+                    cell.sequence.store(dequeuePosition + LOG_QUEUE_CAPACITY, std::memory_order_release);
+                    dequeuePosition++;
+                }
+
+                const uint32_t droppedCount = _droppedCount.exchange(0, std::memory_order_relaxed);
+                if (droppedCount > 0) {
+                    append_line(out, vklog::LogLevel::WARN, fmt::format("Log queue full: dropped {} messages", droppedCount));
+                }
+
+                if (out.size() > 0) {
+                    std::fwrite(out.data(), 1, out.size(), stdout);
+                    std::fflush(stdout);
+                    out.clear();
+                }
+                _writtenPosition.store(dequeuePosition, std::memory_order_release);
+                _writtenPosition.notify_all();
+
+                if (_bStopping.load(std::memory_order_acquire) && dequeuePosition == _enqueuePosition.load(std::memory_order_acquire)) {
+                    return;
+                }
+                _wakeCounter.wait(wakeCounter, std::memory_order_acquire);
+            }
+        }
+    };
+
+    // Stops the log thread during the static destruction. The queue itself is never destroyed.
+    struct LogThreadStopper {
+        LogQueue& logQueue;
+        ~LogThreadStopper() { logQueue.stop(); }
+    };
+
+    // Constructed in static storage and never destroyed: the messages logged during (or after) the static destruction
+    // still find it, and are written directly once its thread is stopped
+    LogQueue& get_log_queue() {
+        alignas(LogQueue) static std::byte storage[sizeof(LogQueue)];
+        static LogQueue* logQueue = new (storage) LogQueue();
+        static LogThreadStopper logThreadStopper {*logQueue};
+        return *logQueue;
+    }
+
+}
+
+vklog::LogRecord* vklog::acquire_record() {
+    return get_log_queue().acquire();
+}
+
+void vklog::commit_record(LogRecord* record) {
+    LogQueue& logQueue = get_log_queue();
+    if (logQueue.is_running()) {
+        logQueue.commit(record);
+        return;
+    }
+
+    // The log thread is gone (static destruction): write it directly, and free its cell
+    fmt::memory_buffer message;
+    record->formatArguments(*record, message);
+    record->destroyArguments(*record);
+    const LogLevel level = record->level;
+    logQueue.release(record);
+    write_now(level, std::string_view(message.data(), message.size()));
+}
+
+void vklog::write_now(LogLevel level, std::string_view message) {
+    fmt::memory_buffer out;
+    append_line(out, level, message);
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::fflush(stdout);
+}
+
+void vklog::flush() {
+    LogQueue& logQueue = get_log_queue();
+    if (logQueue.is_running()) {
+        logQueue.flush();
+    }
+}
@@ -1,17 +1,160 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 #include <fmt/core.h>
+#include <fmt/format.h>
 #include <fmt/color.h>
 
-#ifndef NDEBUG
-    #define VK_LOG_INFO(msg, ...) fmt::print(fmt::fg(fmt::color::gray),    "[INFO]    " msg "\n", ##__VA_ARGS__)
-    #define VK_LOG_WARN(msg, ...) fmt::print(fmt::fg(fmt::color::yellow),   "[WARN]    " msg "\n", ##__VA_ARGS__)
-    #define VK_LOG_ERROR(msg, ...) fmt::print(fmt::fg(fmt::color::red),     "[ERROR]   " msg "\n", ##__VA_ARGS__)
-    #define VK_LOG_DEBUG(msg, ...) fmt::print(fmt::fg(fmt::color::cyan),    "[DEBUG]   " msg "\n", ##__VA_ARGS__)
-    #define VK_LOG_SUCCESS(msg, ...) fmt::print(fmt::fg(fmt::color::green), "[SUCCESS] " msg "\n", ##__VA_ARGS__)
+// Log levels, for the compile-time filtering (VK_LOG_MIN_LEVEL) in the preprocessor
+#define VK_LOG_LEVEL_DEBUG      0
+#define VK_LOG_LEVEL_INFO       1
+#define VK_LOG_LEVEL_SUCCESS    2
+#define VK_LOG_LEVEL_WARN       3
+#define VK_LOG_LEVEL_ERROR      4
+
+// The calls below the minimum level compile to nothing. Release builds keep the warnings and errors.
+// Can be overridden from the build (e.g. -DVK_LOG_MIN_LEVEL=VK_LOG_LEVEL_INFO).
+#ifndef VK_LOG_MIN_LEVEL
+    #ifdef NDEBUG
+        #define VK_LOG_MIN_LEVEL VK_LOG_LEVEL_WARN
+    #else
+        #define VK_LOG_MIN_LEVEL VK_LOG_LEVEL_DEBUG
+    #endif
+#endif
+
+namespace vklog {
+
+    enum class LogLevel : uint8_t {
+        DEBUG   = VK_LOG_LEVEL_DEBUG,
+        INFO    = VK_LOG_LEVEL_INFO,
+        SUCCESS = VK_LOG_LEVEL_SUCCESS,
+        WARN    = VK_LOG_LEVEL_WARN,
+        ERROR   = VK_LOG_LEVEL_ERROR
+    };
+
+    /// @brief Bytes available in a log record for the captured arguments. Larger argument lists are formatted
+    /// on the calling thread instead.
+    constexpr size_t LOG_RECORD_ARGUMENT_BYTES {192};
+
+    /// @brief A log call: its level, its format string and a copy of its arguments, formatted later by the log thread.
+    struct LogRecord {
+        using FormatFunction = void (*)(const LogRecord& record, fmt::memory_buffer& out);
+        using DestroyFunction = void (*)(LogRecord& record);
+
+        LogLevel level;
+        fmt::string_view format;   // Always a string literal (static storage)
+        FormatFunction formatArguments;
+        DestroyFunction destroyArguments;
+        alignas(std::max_align_t) std::byte arguments[LOG_RECORD_ARGUMENT_BYTES];
+    };
+
+    /// Reserves a record in the log queue. Returns nullptr if the queue is full (the message is dropped and counted).
+    /// @attention Lock-free, never blocks. The record must be published with commit_record().
+    LogRecord* acquire_record();
+    /// Hands the record over to the log thread.
+    void commit_record(LogRecord* record);
+    /// Writes a message directly on the calling thread (before the log thread starts, or after it stopped).
+    void write_now(LogLevel level, std::string_view message);
+    /// Blocks until every message logged so far is written.
+    void flush();
+
+    namespace detail {
+
+        // Arguments are captured by value. C-strings and string-views are copied into owned strings,
+        // since the memory they point to may be gone by the time the log thread formats them.
+        template <typename T>
+        auto capture_argument(T&& value) {
+            using Decayed = std::decay_t<T>;
+            if constexpr (std::is_same_v<Decayed, const char*> || std::is_same_v<Decayed, char*>) {
+                return value != nullptr ? std::string(value) : std::string("(null)");
+            }
+            else if constexpr (std::is_same_v<Decayed, std::string_view>) {
+                return std::string(value);
+            }
+            else {
+                return Decayed(std::forward<T>(value));
+            }
+        }
+
+        template <typename Arguments>
+        void format_arguments(const LogRecord& record, fmt::memory_buffer& out) {
+            const Arguments& arguments = *std::launder(reinterpret_cast<const Arguments*>(record.arguments));
+            std::apply([&](const auto&... argument) {
+                fmt::vformat_to(fmt::appender(out), record.format, fmt::make_format_args(argument...));
+            }, arguments);
+        }
+
+        template <typename Arguments>
+        void destroy_arguments(LogRecord& record) {
+            std::launder(reinterpret_cast<Arguments*>(record.arguments))->~Arguments();
+        }
+
+    }
+
+    /// @brief Queues a message for the log thread, which formats and writes it.
+    /// Errors are written before returning, since they usually precede an exception that may end the program.
+    template <typename... Args>
+    void log(LogLevel level, fmt::format_string<Args...> format, Args&&... args) {
+        using Arguments = std::tuple<decltype(detail::capture_argument(std::declval<Args>()))...>;
+
+        if constexpr (sizeof(Arguments) > LOG_RECORD_ARGUMENT_BYTES || alignof(Arguments) > alignof(std::max_align_t)) {
+            // Too large to capture: format here, and queue the resulting string
+            log(level, "{}", fmt::format(format, std::forward<Args>(args)...));
+        }
+        else {
+            LogRecord* record = acquire_record();
+            if (record == nullptr) {
+                return;
+            }
+            record->level = level;
+            record->format = static_cast<fmt::string_view>(format);
+            record->formatArguments = &detail::format_arguments<Arguments>;
+            record->destroyArguments = &detail::destroy_arguments<Arguments>;
+            new (record->arguments) Arguments(detail::capture_argument(std::forward<Args>(args))...);
+            commit_record(record);
+
+            if (level == LogLevel::ERROR) {
+                flush();
+            }
+        }
+    }
+
+}
+
+#if VK_LOG_MIN_LEVEL <= VK_LOG_LEVEL_DEBUG
+    #define VK_LOG_DEBUG(msg, ...) ::vklog::log(::vklog::LogLevel::DEBUG, msg, ##__VA_ARGS__)
+#else
+    #define VK_LOG_DEBUG(msg, ...) ((void)0)
+#endif
+
+#if VK_LOG_MIN_LEVEL <= VK_LOG_LEVEL_INFO
+    #define VK_LOG_INFO(msg, ...) ::vklog::log(::vklog::LogLevel::INFO, msg, ##__VA_ARGS__)
+#else
+    #define VK_LOG_INFO(msg, ...) ((void)0)
+#endif
+
+#if VK_LOG_MIN_LEVEL <= VK_LOG_LEVEL_SUCCESS
+    #define VK_LOG_SUCCESS(msg, ...) ::vklog::log(::vklog::LogLevel::SUCCESS, msg, ##__VA_ARGS__)
+#else
+    #define VK_LOG_SUCCESS(msg, ...) ((void)0)
+#endif
+
+#if VK_LOG_MIN_LEVEL <= VK_LOG_LEVEL_WARN
+    #define VK_LOG_WARN(msg, ...) ::vklog::log(::vklog::LogLevel::WARN, msg, ##__VA_ARGS__)
+#else
+    #define VK_LOG_WARN(msg, ...) ((void)0)
+#endif
+
+#if VK_LOG_MIN_LEVEL <= VK_LOG_LEVEL_ERROR
+    #define VK_LOG_ERROR(msg, ...) ::vklog::log(::vklog::LogLevel::ERROR, msg, ##__VA_ARGS__)
 #else
-    #define VK_LOG_INFO(msg, ...)
-    #define VK_LOG_WARN(msg, ...)
-    #define VK_LOG_ERROR(msg, ...)
-    #define VK_LOG_DEBUG(msg, ...)
+    #define VK_LOG_ERROR(msg, ...) ((void)0)
 #endif
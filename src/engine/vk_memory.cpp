@@ -0,0 +1,369 @@
+#include "vk_memory.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "vk_logger.h"
+#include "vk_trace.h"
+
+constexpr double BYTES_PER_MIB {1024.0 * 1024.0};
+
+
+void MemoryManager::init(VkDevice device, VmaAllocator allocator, uint32_t framesInFlight, ImmediateSubmitter immediateSubmit) {
+    _device = device;
+    _allocator = allocator;
+    _framesInFlight = framesInFlight;
+    _immediateSubmit = std::move(immediateSubmit);
+
+    vmaGetMemoryProperties(_allocator, &_memoryProperties);
+    _heapCount = _memoryProperties->memoryHeapCount;
+    vmaGetHeapBudgets(_allocator, _heapBudgets.data());
+}
+
+void MemoryManager::destroy() {
+    if (_defragmentationContext != VK_NULL_HANDLE) {
+        vmaEndDefragmentation(_allocator, _defragmentationContext, nullptr);
+        _defragmentationContext = VK_NULL_HANDLE;
+    }
+    _streamableResources.clear();
+    _movableResources.clear();
+}
+
+void MemoryManager::update(uint64_t frameNumber) {
+    ZONE("MemoryManager::update");
+    _frameNumber = frameNumber;
+
+    // The budgets are fetched from the driver (VK_EXT_memory_budget) at most once per frame index
+    vmaSetCurrentFrameIndex(_allocator, static_cast<uint32_t>(frameNumber));
+    vmaGetHeapBudgets(_allocator, _heapBudgets.data());
+
+    for (uint32_t heap {0}; heap < _heapCount; heap++) {
+        const bool bDeviceLocal = (_memoryProperties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        const VmaBudget& budget = _heapBudgets[heap];
+        if (bDeviceLocal && budget.budget > 0 && static_cast<double>(budget.usage) > MEMORY_BUDGET_HIGH_WATERMARK * static_cast<double>(budget.budget)) {
+            evict_under_pressure(heap);
+        }
+    }
+
+    if (_defragmentationContext != VK_NULL_HANDLE) {
+        run_defragmentation_pass();
+    }
+}
+
+bool MemoryManager::write_stats_json(const std::string& filePath) const {
+    char* statsString {nullptr};
+    vmaBuildStatsString(_allocator, &statsString, VK_TRUE);
+
+    std::ofstream statsFile(filePath, std::ios::trunc);
+    const bool bWritten = statsFile.is_open() && (statsFile << statsString);
+    vmaFreeStatsString(_allocator, statsString);
+
+    if (!bWritten) {
+        VK_LOG_WARN("Failed to write the memory statistics to {}", filePath);
+        return false;
+    }
+    VK_LOG_INFO("Wrote the memory statistics to {}", filePath);
+    return true;
+}
+
+void MemoryManager::begin_defragmentation() {
+    if (_defragmentationContext != VK_NULL_HANDLE) {
+        return;
+    }
+    if (_movableResources.empty()) {
+        VK_LOG_INFO("Defragmentation skipped: no movable resources are registered");
+        return;
+    }
+
+    VmaDefragmentationInfo defragmentationInfo {};
+    defragmentationInfo.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+    defragmentationInfo.pool = VK_NULL_HANDLE;  // The default pools
+    defragmentationInfo.maxBytesPerPass = DEFRAGMENTATION_MAX_BYTES_PER_PASS;
+    defragmentationInfo.maxAllocationsPerPass = DEFRAGMENTATION_MAX_ALLOCATIONS_PER_PASS;
+
+    VkResult result = vmaBeginDefragmentation(_allocator, &defragmentationInfo, &_defragmentationContext);
+    if (result != VK_SUCCESS) {
+        VK_LOG_WARN("vmaBeginDefragmentation failed ({})", string_VkResult(result));
+        _defragmentationContext = VK_NULL_HANDLE;
+        return;
+    }
+    _stats.bDefragmenting = true;
+    VK_LOG_INFO("Started incremental defragmentation");
+}
+
+void MemoryManager::register_streamable(VmaAllocation allocation, EvictFunction evict) {
+    _streamableResources[allocation] = StreamableResource {std::move(evict), _frameNumber};
+}
+
+void MemoryManager::mark_streamable_used(VmaAllocation allocation) {
+    auto it = _streamableResources.find(allocation);
+    if (it != _streamableResources.end()) {
+        it->second.lastUsedFrame = _frameNumber;
+    }
+}
+
+void MemoryManager::register_movable_buffer(VmaAllocation allocation, VkBuffer buffer, const VkBufferCreateInfo& createInfo, BufferMovedFunction onMoved) {
+    MovableResource resource {};
+    resource.buffer = buffer;
+    resource.bufferCreateInfo = createInfo;
+    resource.bufferCreateInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    resource.onBufferMoved = std::move(onMoved);
+    _movableResources[allocation] = std::move(resource);
+}
+
+void MemoryManager::register_movable_image(VmaAllocation allocation, VkImage image, const VkImageCreateInfo& createInfo, VkImageLayout steadyLayout, VkImageAspectFlags aspect, ImageMovedFunction onMoved) {
+    MovableResource resource {};
+    resource.image = image;
+    resource.imageCreateInfo = createInfo;
+    resource.imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource.imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    resource.steadyLayout = steadyLayout;
+    resource.aspect = aspect;
+    resource.onImageMoved = std::move(onMoved);
+    _movableResources[allocation] = std::move(resource);
+}
+
+void MemoryManager::unregister(VmaAllocation allocation) {
+    _streamableResources.erase(allocation);
+    _movableResources.erase(allocation);
+}
+
+void MemoryManager::evict_under_pressure(uint32_t heapIndex) {
+    const VmaBudget& budget = _heapBudgets[heapIndex];
+    const VkDeviceSize targetUsage = static_cast<VkDeviceSize>(MEMORY_BUDGET_LOW_WATERMARK * static_cast<double>(budget.budget));
+    VkDeviceSize usage = budget.usage;
+
+    // Least-recently-used first. Resources used by the frames that may still be in flight are kept.
+    std::vector<std::pair<uint64_t, VmaAllocation>> candidates {};
+    for (const auto& [allocation, resource] : _streamableResources) {
+        if (resource.lastUsedFrame + _framesInFlight > _frameNumber) {
+            continue;
+        }
+        VmaAllocationInfo allocationInfo {};
+        vmaGetAllocationInfo(_allocator, allocation, &allocationInfo);
+        if (_memoryProperties->memoryTypes[allocationInfo.memoryType].heapIndex == heapIndex) {
+            candidates.emplace_back(resource.lastUsedFrame, allocation);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    uint32_t evictedCount {0};
+    VkDeviceSize evictedBytes {0};
+    for (const auto& [lastUsedFrame, allocation] : candidates) {
+        if (usage <= targetUsage) {
+            break;
+        }
+        VmaAllocationInfo allocationInfo {};
+        vmaGetAllocationInfo(_allocator, allocation, &allocationInfo);
+
+        // Forget the resource before its owner frees the allocation
+        EvictFunction evict = std::move(_streamableResources.at(allocation).evict);
+        unregister(allocation);
+        evict();
+
+        usage -= std::min(usage, allocationInfo.size);
+        evictedBytes += allocationInfo.size;
+        evictedCount++;
+    }
+
+    if (evictedCount == 0) {
+        return;
+    }
+    _stats.evictedResourceCount += evictedCount;
+    _stats.evictedBytes += evictedBytes;
+    VK_LOG_WARN("Heap {} over budget ({:.1f} / {:.1f} MiB): evicted {} streamable resources ({:.1f} MiB)",
+        heapIndex, budget.usage / BYTES_PER_MIB, budget.budget / BYTES_PER_MIB, evictedCount, evictedBytes / BYTES_PER_MIB);
+
+    // The evictions leave holes in the heap
+    begin_defragmentation();
+}
+
+void MemoryManager::run_defragmentation_pass() {
+    VmaDefragmentationPassMoveInfo passInfo {};
+    VkResult result = vmaBeginDefragmentationPass(_allocator, _defragmentationContext, &passInfo);
+    if (result == VK_SUCCESS) {
+        end_defragmentation();  // Nothing left to move
+        return;
+    }
+    if (result != VK_INCOMPLETE) {
+        VK_LOG_WARN("vmaBeginDefragmentationPass failed ({})", string_VkResult(result));
+        end_defragmentation();
+        return;
+    }
+
+    // Create the new resources in the destination allocations. Only the registered resources are moved.
+    struct PendingMove {
+        MovableResource* resource;
+        VkBuffer newBuffer;
+        VkImage newImage;
+        VkDeviceSize size;
+    };
+    std::vector<PendingMove> pendingMoves {};
+
+    for (uint32_t i {0}; i < passInfo.moveCount; i++) {
+        VmaDefragmentationMove& move = passInfo.pMoves[i];
+        auto it = _movableResources.find(move.srcAllocation);
+        if (it == _movableResources.end()) {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+        MovableResource& resource = it->second;
+
+        VmaAllocationInfo allocationInfo {};
+        vmaGetAllocationInfo(_allocator, move.srcAllocation, &allocationInfo);
+
+        PendingMove pendingMove {&resource, VK_NULL_HANDLE, VK_NULL_HANDLE, allocationInfo.size};
+        if (resource.buffer != VK_NULL_HANDLE) {
+            result = vkCreateBuffer(_device, &resource.bufferCreateInfo, nullptr, &pendingMove.newBuffer);
+            if (result == VK_SUCCESS) {
+                result = vmaBindBufferMemory(_allocator, move.dstTmpAllocation, pendingMove.newBuffer);
+            }
+        }
+        else {
+            result = vkCreateImage(_device, &resource.imageCreateInfo, nullptr, &pendingMove.newImage);
+            if (result == VK_SUCCESS) {
+                result = vmaBindImageMemory(_allocator, move.dstTmpAllocation, pendingMove.newImage);
+            }
+        }
+
+        if (result != VK_SUCCESS) {
+            VK_LOG_WARN("Defragmentation: failed to re-create a moved resource ({}), leaving it in place", string_VkResult(result));
+            vkDestroyBuffer(_device, pendingMove.newBuffer, nullptr);
+            vkDestroyImage(_device, pendingMove.newImage, nullptr);
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+        pendingMoves.push_back(pendingMove);
+    }
+
+    if (!pendingMoves.empty()) {
+        // Copy the contents. The barriers wait for every previous use of the old resources on the queue
+        // (the frames in flight included), and the submission is waited on, so the old resources can be destroyed after.
+        _immediateSubmit([&](VkCommandBuffer commandBuffer) {
+            VkMemoryBarrier2 memoryBarrier {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+            memoryBarrier.pNext = nullptr;
+            memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            memoryBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+            memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+            std::vector<VkImageMemoryBarrier2> imageBarriers {};
+            auto add_image_barrier = [&](VkImage image, const MovableResource& resource, VkImageLayout oldLayout, VkImageLayout newLayout,
+                                         VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+                VkImageMemoryBarrier2 imageBarrier {};
+                imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+                imageBarrier.pNext = nullptr;
+                imageBarrier.srcStageMask = srcStage;
+                imageBarrier.srcAccessMask = srcAccess;
+                imageBarrier.dstStageMask = dstStage;
+                imageBarrier.dstAccessMask = dstAccess;
+                imageBarrier.oldLayout = oldLayout;
+                imageBarrier.newLayout = newLayout;
+                imageBarrier.image = image;
+                imageBarrier.subresourceRange.aspectMask = resource.aspect;
+                imageBarrier.subresourceRange.baseMipLevel = 0;
+                imageBarrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+                imageBarrier.subresourceRange.baseArrayLayer = 0;
+                imageBarrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+                imageBarriers.push_back(imageBarrier);
+            };
+
+            for (const PendingMove& pendingMove : pendingMoves) {
+                if (pendingMove.newImage == VK_NULL_HANDLE) {
+                    continue;
+                }
+                const MovableResource& resource = *pendingMove.resource;
+                add_image_barrier(resource.image, resource, resource.steadyLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+                add_image_barrier(pendingMove.newImage, resource, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+            }
+
+            VkDependencyInfo dependencyInfo {};
+            dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+            dependencyInfo.pNext = nullptr;
+            dependencyInfo.memoryBarrierCount = 1;
+            dependencyInfo.pMemoryBarriers = &memoryBarrier;
+            dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+            dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+            vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+            for (const PendingMove& pendingMove : pendingMoves) {
+                const MovableResource& resource = *pendingMove.resource;
+                if (pendingMove.newBuffer != VK_NULL_HANDLE) {
+                    VkBufferCopy bufferCopy {0, 0, resource.bufferCreateInfo.size};
+                    vkCmdCopyBuffer(commandBuffer, resource.buffer, pendingMove.newBuffer, 1, &bufferCopy);
+                    continue;
+                }
+
+                // Every mip level, every layer
+                const VkImageCreateInfo& createInfo = resource.imageCreateInfo;
+                std::vector<VkImageCopy> imageCopies(createInfo.mipLevels);
+                for (uint32_t mip {0}; mip < createInfo.mipLevels; mip++) {
+                    VkImageCopy& imageCopy = imageCopies[mip];
+                    imageCopy.srcSubresource = VkImageSubresourceLayers {resource.aspect, mip, 0, createInfo.arrayLayers};
+                    imageCopy.dstSubresource = imageCopy.srcSubresource;
+                    imageCopy.extent = VkExtent3D {
+                        std::max(1u, createInfo.extent.width >> mip),
+                        std::max(1u, createInfo.extent.height >> mip),
+                        std::max(1u, createInfo.extent.depth >> mip)
+                    };
+                }
+                vkCmdCopyImage(commandBuffer, resource.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, pendingMove.newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    static_cast<uint32_t>(imageCopies.size()), imageCopies.data());
+            }
+
+            // Back to the steady layouts, visible to whatever uses the resources next
+            imageBarriers.clear();
+            for (const PendingMove& pendingMove : pendingMoves) {
+                if (pendingMove.newImage != VK_NULL_HANDLE) {
+                    add_image_barrier(pendingMove.newImage, *pendingMove.resource, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, pendingMove.resource->steadyLayout,
+                        VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT);
+                }
+            }
+            memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+            memoryBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+            dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+            dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+            vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+        });
+
+        // Hand the new resources to their owners, and destroy the old ones
+        for (const PendingMove& pendingMove : pendingMoves) {
+            MovableResource& resource = *pendingMove.resource;
+            if (pendingMove.newBuffer != VK_NULL_HANDLE) {
+                resource.onBufferMoved(pendingMove.newBuffer);
+                vkDestroyBuffer(_device, resource.buffer, nullptr);
+                resource.buffer = pendingMove.newBuffer;
+            }
+            else {
+                resource.onImageMoved(pendingMove.newImage);
+                vkDestroyImage(_device, resource.image, nullptr);
+                resource.image = pendingMove.newImage;
+            }
+            _stats.movedAllocationCount++;
+            _stats.movedBytes += pendingMove.size;
+        }
+    }
+
+    // The moved allocations now point at their new memory
+    result = vmaEndDefragmentationPass(_allocator, _defragmentationContext, &passInfo);
+    _stats.defragmentationPassCount++;
+    if (result == VK_SUCCESS) {
+        end_defragmentation();
+    }
+}
+
+void MemoryManager::end_defragmentation() {
+    VmaDefragmentationStats defragmentationStats {};
+    vmaEndDefragmentation(_allocator, _defragmentationContext, &defragmentationStats);
+    _defragmentationContext = VK_NULL_HANDLE;
+    _stats.bDefragmenting = false;
+
+    VK_LOG_SUCCESS("Defragmentation done: moved {} allocations ({:.1f} MiB), freed {:.1f} MiB and {} memory blocks",
+        defragmentationStats.allocationsMoved, defragmentationStats.bytesMoved / BYTES_PER_MIB,
+        defragmentationStats.bytesFreed / BYTES_PER_MIB, defragmentationStats.deviceMemoryBlocksFreed);
+}
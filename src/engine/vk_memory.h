@@ -0,0 +1,111 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <unordered_map>
+
+/// @brief Fraction of a device-local heap's budget above which streamable resources get evicted.
+constexpr float MEMORY_BUDGET_HIGH_WATERMARK {0.90f};
+/// @brief Eviction stops once the heap's usage is back under this fraction of its budget.
+constexpr float MEMORY_BUDGET_LOW_WATERMARK {0.80f};
+
+/// @brief Limits of one incremental defragmentation pass (one pass runs per frame).
+constexpr VkDeviceSize DEFRAGMENTATION_MAX_BYTES_PER_PASS {64ull * 1024 * 1024};
+constexpr uint32_t DEFRAGMENTATION_MAX_ALLOCATIONS_PER_PASS {64};
+
+/// @brief Lifetime counters of the memory manager (evictions and defragmentation).
+struct MemoryManagerStats {
+	uint32_t evictedResourceCount {0};
+	VkDeviceSize evictedBytes {0};
+	uint32_t defragmentationPassCount {0};
+	uint32_t movedAllocationCount {0};
+	VkDeviceSize movedBytes {0};
+	bool bDefragmenting {false};
+};
+
+/// @brief Watches the memory budgets of the VMA allocator, evicts streamable resources under budget pressure,
+/// exports the allocator's statistics, and compacts the heaps with incremental defragmentation.
+///
+/// Resources take part by registering their allocation:
+/// \n - Streamable resources can be dropped (and streamed in again later). They are evicted least-recently-used first,
+///      when a device-local heap goes over MEMORY_BUDGET_HIGH_WATERMARK of its budget.
+/// \n - Movable resources can be relocated by the defragmentation. Their contents are copied on the GPU into a new
+///      VkBuffer/VkImage, which is handed to their owner to update its references (views, descriptor-sets, ...).
+///      The other allocations are never moved.
+class MemoryManager {
+public:
+	/// Records the commands into a command-buffer, submits it and waits for its completion.
+	using ImmediateSubmitter = std::function<void(std::function<void(VkCommandBuffer)>&&)>;
+	/// Called when a streamable resource is evicted: the owner destroys the resource (its allocation included).
+	using EvictFunction = std::function<void()>;
+	/// Called when a buffer was moved: the owner switches to the new buffer. The old one is destroyed by the manager.
+	using BufferMovedFunction = std::function<void(VkBuffer newBuffer)>;
+	/// Called when an image was moved: the owner switches to the new image (and re-creates its views).
+	/// The old image is destroyed by the manager, the owner destroys the views it created on it.
+	using ImageMovedFunction = std::function<void(VkImage newImage)>;
+
+	void init(VkDevice device, VmaAllocator allocator, uint32_t framesInFlight, ImmediateSubmitter immediateSubmit);
+	void destroy();
+
+	/// Once per frame, after the frame's fence was waited on: refreshes the budgets, evicts under budget pressure,
+	/// and runs a defragmentation pass if one is in progress.
+	void update(uint64_t frameNumber);
+
+	/// Writes the allocator's detailed statistics (vmaBuildStatsString) as JSON. Returns false on failure.
+	bool write_stats_json(const std::string& filePath) const;
+
+	/// Starts compacting the heaps, one bounded pass per frame. Does nothing if already in progress.
+	void begin_defragmentation();
+
+	void register_streamable(VmaAllocation allocation, EvictFunction evict);
+	/// Marks the resource as used by the current frame (it won't be evicted while the GPU may still use it).
+	void mark_streamable_used(VmaAllocation allocation);
+	/// @attention Movable resources must be created with the TRANSFER_SRC usage (images: also TRANSFER_DST),
+	/// and must not be persistently mapped.
+	void register_movable_buffer(VmaAllocation allocation, VkBuffer buffer, const VkBufferCreateInfo& createInfo, BufferMovedFunction onMoved);
+	/// @param steadyLayout Layout the image is always in when no command-buffer is using it (e.g. SHADER_READ_ONLY_OPTIMAL)
+	void register_movable_image(VmaAllocation allocation, VkImage image, const VkImageCreateInfo& createInfo, VkImageLayout steadyLayout, VkImageAspectFlags aspect, ImageMovedFunction onMoved);
+	/// Must be called before the allocation is freed by its owner.
+	void unregister(VmaAllocation allocation);
+
+	std::span<const VmaBudget> get_heap_budgets() const { return {_heapBudgets.data(), _heapCount}; }
+	const MemoryManagerStats& get_stats() const { return _stats; }
+
+private:
+	struct StreamableResource {
+		EvictFunction evict;
+		uint64_t lastUsedFrame {0};
+	};
+
+	struct MovableResource {
+		VkBuffer buffer {VK_NULL_HANDLE};
+		VkBufferCreateInfo bufferCreateInfo {};
+		BufferMovedFunction onBufferMoved;
+
+		VkImage image {VK_NULL_HANDLE};
+		VkImageCreateInfo imageCreateInfo {};
+		VkImageLayout steadyLayout {VK_IMAGE_LAYOUT_UNDEFINED};
+		VkImageAspectFlags aspect {0};
+		ImageMovedFunction onImageMoved;
+	};
+
+	VkDevice _device {VK_NULL_HANDLE};
+	VmaAllocator _allocator {VK_NULL_HANDLE};
+	uint32_t _framesInFlight {0};
+	ImmediateSubmitter _immediateSubmit;
+	uint64_t _frameNumber {0};
+
+	const VkPhysicalDeviceMemoryProperties* _memoryProperties {nullptr};
+	std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> _heapBudgets {};
+	uint32_t _heapCount {0};
+
+	std::unordered_map<VmaAllocation, StreamableResource> _streamableResources {};
+	std::unordered_map<VmaAllocation, MovableResource> _movableResources {};
+
+	VmaDefragmentationContext _defragmentationContext {VK_NULL_HANDLE};
+	MemoryManagerStats _stats {};
+
+	void evict_under_pressure(uint32_t heapIndex);
+	void run_defragmentation_pass();
+	void end_defragmentation();
+};
@@ -0,0 +1,369 @@
+#include "vk_mipmaps.h"
+
+#include <array>
+
+#include <glm/vec2.hpp>
+
+#include "vk_buffers.h"
+#include "vk_images.h"
+#include "vk_logger.h"
+#include "vk_pipelines.h"
+
+// Push-constants of mip_downsample.comp
+struct MipDownsamplePushConstants {
+    glm::ivec2 srcSize;
+    uint32_t levelCount;
+    uint32_t workgroupCount;
+};
+
+// Texels of level 0 per workgroup (per side)
+constexpr uint32_t MIPMAP_COMPUTE_TILE_SIZE {64};
+// A slice of the scratch: the count of workgroups done (padded to 16 bytes), then level 6 (64x64 vec4), rounded up
+// to the largest minStorageBufferOffsetAlignment
+constexpr VkDeviceSize MIPMAP_COMPUTE_SCRATCH_SLICE_SIZE {16 + 64 * 64 * 16 + 240};
+constexpr VkDeviceSize MIPMAP_COMPUTE_COUNTER_SIZE {16};
+
+// Loads the SpirV shader and creates a compute-pipeline out of it. The shader-module is destroyed afterwards.
+static VkPipeline create_compute_pipeline(VkDevice device, VkPipelineLayout pipelineLayout, const char* shaderPath) {
+    VkShaderModule shaderModule;
+    if (!vkutil::load_shader_module(device, &shaderModule, shaderPath)) {
+        VK_LOG_ERROR("Failed to load SpirV shader: {}", shaderPath);
+        throw std::runtime_error(std::string("Failed to load SpirV shader: ") + shaderPath);
+    }
+
+    VkPipeline pipeline {VK_NULL_HANDLE};
+    try {
+        pipeline = vkutil::create_compute_pipeline(device, pipelineLayout, shaderModule);
+    }
+    catch (const std::runtime_error&) {
+        vkDestroyShaderModule(device, shaderModule, nullptr);
+        throw;
+    }
+    vkDestroyShaderModule(device, shaderModule, nullptr); // We no longer need it after creating the pipeline
+    VK_LOG_SUCCESS("Created compute pipeline for {}", shaderPath);
+
+    return pipeline;
+}
+
+void MipmapGenerator::init(VkDevice device, VkPhysicalDevice physicalDevice, VmaAllocator allocator, uint32_t framesInFlight, bool bStorageImageWriteWithoutFormat) {
+    _device = device;
+    _physicalDevice = physicalDevice;
+    _allocator = allocator;
+    _bStorageImageWriteWithoutFormat = bStorageImageWriteWithoutFormat;
+    _frames.resize(framesInFlight);
+
+    if (!_bStorageImageWriteWithoutFormat) {
+        VK_LOG_WARN("shaderStorageImageWriteWithoutFormat is not supported: mips are generated for the blittable formats only");
+        VK_LOG_SUCCESS("Initialized the mipmap generator (blits)");
+        return;
+    }
+
+    // The per-frame pools: a descriptor-set per compute generation
+    std::vector<DescriptorSetAllocator::PoolSizeRatio> poolSizeRatios {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, static_cast<float>(MIPMAP_COMPUTE_MAX_LEVELS)},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}
+    };
+    for (FrameResources& frame : _frames) {
+        frame.descriptorSetAllocator.init_descriptor_pool(_device, MIPMAP_COMPUTE_MAX_IMAGES_PER_FRAME, poolSizeRatios);
+    }
+
+    // Point sampling: the shader fetches exact texels of level 0
+    VkSamplerCreateInfo samplerCreateInfo {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.pNext = nullptr;
+    samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+    samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.minLod = 0.f;
+    samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkResult result = vkCreateSampler(_device, &samplerCreateInfo, nullptr, &_sampler);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create mipmap downsample sampler!");
+        throw std::runtime_error("Failed to create mipmap downsample sampler!");
+    }
+
+    // binding 0 = level 0 (sampled), binding 1 = the levels written (storage), binding 2 = the scratch
+    DescriptorLayoutBuilder layoutBuilder {};
+    layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MIPMAP_COMPUTE_MAX_LEVELS);
+    layoutBuilder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    _descriptorSetLayout = layoutBuilder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkPushConstantRange pushConstantRange {};
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(MipDownsamplePushConstants);
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.pNext = nullptr;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &_descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    result = vkCreatePipelineLayout(_device, &pipelineLayoutCreateInfo, nullptr, &_pipelineLayout);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create pipeline-layout for mipmap downsample");
+        throw std::runtime_error("Failed to create pipeline-layout for mipmap downsample");
+    }
+    _pipeline = create_compute_pipeline(_device, _pipelineLayout, "./shaders/mip_downsample.comp.spv");
+
+    // A slice per compute generation of every frame in flight, its counter reset before each dispatch
+    _scratchBuffer = vkutil::create_buffer(_allocator,
+        framesInFlight * MIPMAP_COMPUTE_MAX_IMAGES_PER_FRAME * MIPMAP_COMPUTE_SCRATCH_SLICE_SIZE,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY
+    );
+
+    VK_LOG_SUCCESS("Initialized the mipmap generator (blits, single-pass compute downsampler)");
+}
+
+void MipmapGenerator::destroy() {
+    for (FrameResources& frame : _frames) {
+        for (VkImageView imageView : frame.imageViews) {
+            vkDestroyImageView(_device, imageView, nullptr);
+        }
+        frame.imageViews.clear();
+        if (_bStorageImageWriteWithoutFormat) {
+            frame.descriptorSetAllocator.destroy_descriptor_pool(_device);
+        }
+    }
+    _frames.clear();
+
+    if (_bStorageImageWriteWithoutFormat) {
+        vkutil::destroy_buffer(_allocator, _scratchBuffer);
+        vkDestroyPipeline(_device, _pipeline, nullptr);
+        vkDestroyPipelineLayout(_device, _pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(_device, _descriptorSetLayout, nullptr);
+        vkDestroySampler(_device, _sampler, nullptr);
+    }
+}
+
+void MipmapGenerator::begin_frame(uint32_t frameIndex) {
+    _frameIndex = frameIndex;
+    FrameResources& frame = _frames.at(_frameIndex);
+    for (VkImageView imageView : frame.imageViews) {
+        vkDestroyImageView(_device, imageView, nullptr);
+    }
+    frame.imageViews.clear();
+    if (frame.computeCount > 0) {
+        frame.descriptorSetAllocator.clear_all_descriptor_sets(_device);
+        frame.computeCount = 0;
+    }
+}
+
+bool MipmapGenerator::supports_image(VkFormat format, VkExtent2D extent) {
+    switch (get_method(format)) {
+        case Method::BLIT:
+            return true;
+        case Method::COMPUTE:
+            return extent.width <= MIPMAP_COMPUTE_MAX_SIZE && extent.height <= MIPMAP_COMPUTE_MAX_SIZE;
+        case Method::UNSUPPORTED:
+            break;
+    }
+    return false;
+}
+
+bool MipmapGenerator::generate(VkCommandBuffer commandBuffer, const AllocatedImage& image, VkImageLayout currentLayout, CommandCounters& counters) {
+    switch (get_method(image.imageFormat)) {
+        case Method::BLIT:
+            counters.pipelineBarriers += vkutil::generate_mipmaps(commandBuffer, image, currentLayout);
+            return true;
+        case Method::COMPUTE:
+            return generate_compute(commandBuffer, image, currentLayout, counters);
+        case Method::UNSUPPORTED:
+            break;
+    }
+    VK_LOG_ERROR("Cannot generate the mips of an image of format {}: neither blittable nor a storage image", string_VkFormat(image.imageFormat));
+    throw std::runtime_error("Cannot generate the mips of an image of this format");
+}
+
+VkImageUsageFlags MipmapGenerator::get_image_usage(VkFormat format) {
+    switch (get_method(format)) {
+        case Method::BLIT:
+            return VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        case Method::COMPUTE:
+            return VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+        case Method::UNSUPPORTED:
+            break;
+    }
+    return 0;
+}
+
+MipmapGenerator::Method MipmapGenerator::get_method(VkFormat format) {
+    auto it = _methods.find(format);
+    if (it != _methods.end()) {
+        return it->second;
+    }
+
+    Method method {Method::UNSUPPORTED};
+    if (vkutil::supports_blit_mipmaps(_physicalDevice, format)) {
+        method = Method::BLIT;
+    } else if (_bStorageImageWriteWithoutFormat) {
+        VkFormatProperties formatProperties {};
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &formatProperties);
+        constexpr VkFormatFeatureFlags requiredFeatures {VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT};
+        if ((formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures) {
+            method = Method::COMPUTE;
+        }
+    }
+    _methods.emplace(format, method);
+    return method;
+}
+
+bool MipmapGenerator::generate_compute(VkCommandBuffer commandBuffer, const AllocatedImage& image, VkImageLayout currentLayout, CommandCounters& counters) {
+    if (image.mipLevels <= 1) {
+        vkutil::transition_image_layout(commandBuffer, image.image, currentLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        counters.pipelineBarriers++;
+        return true;
+    }
+    // Rejected by supports_image(), before the image is created
+    if (image.imageExtent.width > MIPMAP_COMPUTE_MAX_SIZE || image.imageExtent.height > MIPMAP_COMPUTE_MAX_SIZE) {
+        VK_LOG_ERROR("Cannot generate the mips of a {}x{} image on compute: {} texels per side at most", image.imageExtent.width, image.imageExtent.height, MIPMAP_COMPUTE_MAX_SIZE);
+        throw std::runtime_error("Image too large for the compute mipmap downsampler");
+    }
+    FrameResources& frame = _frames.at(_frameIndex);
+    if (frame.computeCount >= MIPMAP_COMPUTE_MAX_IMAGES_PER_FRAME) {
+        return false;
+    }
+
+    // Level 0 is read, the levels 1 to 12 written (the slots past the last level repeat it, never written)
+    const uint32_t levelCount = std::min(image.mipLevels - 1, MIPMAP_COMPUTE_MAX_LEVELS);
+    VkDescriptorImageInfo srcImageInfo {};
+    srcImageInfo.sampler = _sampler;
+    srcImageInfo.imageView = create_level_view(image, 0);
+    srcImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    std::array<VkDescriptorImageInfo, MIPMAP_COMPUTE_MAX_LEVELS> dstImageInfos {};
+    for (uint32_t level {1}; level <= levelCount; level++) {
+        dstImageInfos[level - 1].imageView = create_level_view(image, level);
+        dstImageInfos[level - 1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    }
+    for (uint32_t slot {levelCount}; slot < MIPMAP_COMPUTE_MAX_LEVELS; slot++) {
+        dstImageInfos[slot] = dstImageInfos[levelCount - 1];
+    }
+
+    const VkDeviceSize scratchOffset = (_frameIndex * MIPMAP_COMPUTE_MAX_IMAGES_PER_FRAME + frame.computeCount) * MIPMAP_COMPUTE_SCRATCH_SLICE_SIZE;
+    VkDescriptorBufferInfo scratchInfo {_scratchBuffer.buffer, scratchOffset, MIPMAP_COMPUTE_SCRATCH_SLICE_SIZE};
+
+    VkDescriptorSet descriptorSet = frame.descriptorSetAllocator.allocate_descriptor_set(_device, _descriptorSetLayout);
+    frame.computeCount++;
+
+    std::array<VkWriteDescriptorSet, 3> writes {};
+    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[0].dstSet = descriptorSet;
+    writes[0].dstBinding = 0;
+    writes[0].descriptorCount = 1;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[0].pImageInfo = &srcImageInfo;
+    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[1].dstSet = descriptorSet;
+    writes[1].dstBinding = 1;
+    writes[1].descriptorCount = MIPMAP_COMPUTE_MAX_LEVELS;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writes[1].pImageInfo = dstImageInfos.data();
+    writes[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[2].dstSet = descriptorSet;
+    writes[2].dstBinding = 2;
+    writes[2].descriptorCount = 1;
+    writes[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[2].pBufferInfo = &scratchInfo;
+    vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+    // The count of finished workgroups starts at 0 (the previous user of the slice, a frame ago, is done)
+    vkCmdFillBuffer(commandBuffer, _scratchBuffer.buffer, scratchOffset, MIPMAP_COMPUTE_COUNTER_SIZE, 0);
+
+    // In one dependency: the reset counter visible to the shader, every level moved to GENERAL
+    VkMemoryBarrier2 memoryBarrier {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    memoryBarrier.pNext = nullptr;
+    memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    memoryBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+    VkImageMemoryBarrier2 imageMemoryBarrier {};
+    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    imageMemoryBarrier.pNext = nullptr;
+    imageMemoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    imageMemoryBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+    imageMemoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    imageMemoryBarrier.oldLayout = currentLayout;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.image = image.image;
+    imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+    imageMemoryBarrier.subresourceRange.levelCount = image.mipLevels;
+    imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+    imageMemoryBarrier.subresourceRange.layerCount = 1;
+
+    VkDependencyInfo dependencyInfo {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.pNext = nullptr;
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &memoryBarrier;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &imageMemoryBarrier;
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+
+    // A workgroup per 64x64 tile of level 0
+    const uint32_t groupCountX = (image.imageExtent.width + MIPMAP_COMPUTE_TILE_SIZE - 1) / MIPMAP_COMPUTE_TILE_SIZE;
+    const uint32_t groupCountY = (image.imageExtent.height + MIPMAP_COMPUTE_TILE_SIZE - 1) / MIPMAP_COMPUTE_TILE_SIZE;
+
+    MipDownsamplePushConstants pushConstants {};
+    pushConstants.srcSize = glm::ivec2(image.imageExtent.width, image.imageExtent.height);
+    pushConstants.levelCount = levelCount;
+    pushConstants.workgroupCount = groupCountX * groupCountY;
+    vkCmdPushConstants(commandBuffer, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MipDownsamplePushConstants), &pushConstants);
+
+    vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+
+    // Every level sampled by the later commands
+    imageMemoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    imageMemoryBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    imageMemoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    dependencyInfo.memoryBarrierCount = 0;
+    dependencyInfo.pMemoryBarriers = nullptr;
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    counters.pipelineBinds++;
+    counters.descriptorSetBinds++;
+    counters.dispatches++;
+    counters.pipelineBarriers += 2;
+    return true;
+}
+
+VkImageView MipmapGenerator::create_level_view(const AllocatedImage& image, uint32_t level) {
+    VkImageViewCreateInfo imageViewCreateInfo {};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.pNext = nullptr;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCreateInfo.image = image.image;
+    imageViewCreateInfo.format = image.imageFormat;
+    imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCreateInfo.subresourceRange.baseMipLevel = level;
+    imageViewCreateInfo.subresourceRange.levelCount = 1;
+    imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+    VkImageView imageView {VK_NULL_HANDLE};
+    if (vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &imageView) != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create a mip level image-view!");
+        throw std::runtime_error("Failed to create a mip level image-view!");
+    }
+    _frames.at(_frameIndex).imageViews.push_back(imageView);
+    return imageView;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+
+#include <unordered_map>
+
+/// @brief Levels the compute downsampler writes in its single dispatch (from level 1): a level 0 of up to 4096x4096.
+constexpr uint32_t MIPMAP_COMPUTE_MAX_LEVELS {12};
+/// @brief The largest level 0 the compute downsampler handles (per side).
+constexpr uint32_t MIPMAP_COMPUTE_MAX_SIZE {1u << MIPMAP_COMPUTE_MAX_LEVELS};
+/// @brief Images the compute downsampler handles per frame (each takes a descriptor-set and a slice of the scratch).
+constexpr uint32_t MIPMAP_COMPUTE_MAX_IMAGES_PER_FRAME {8};
+
+/// @brief Generates the mip levels of images on the GPU, from their level 0, in the frame's command buffer.
+///
+/// The formats that can be blitted with linear filtering go through vkutil::generate_mipmaps(): a chain of blits,
+/// each level from the previous one. The others (e.g. without linear filtering) go through a compute single-pass
+/// downsampler (mip_downsample.comp), if they can be storage images: a workgroup per 64x64 tile of level 0 writes
+/// the 6 next levels of its tile, and the last workgroup to finish writes the 6 levels after from them. A single
+/// dispatch, without a barrier between the levels.
+///
+/// Per frame: begin_frame() -> generate()
+/// @note Render thread only
+class MipmapGenerator {
+public:
+	/// @param bStorageImageWriteWithoutFormat The device feature the compute downsampler needs (without it, only the
+	/// blittable formats are supported)
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, VmaAllocator allocator, uint32_t framesInFlight, bool bStorageImageWriteWithoutFormat);
+	void destroy();
+
+	/// Frees the image-views and descriptor-sets of the frame that last used this frameIndex.
+	/// @attention The GPU must be done with that frame
+	void begin_frame(uint32_t frameIndex);
+
+	/// True if generate() can generate the mips of an image of this format and size (of level 0): the compute
+	/// downsampler handles MIPMAP_COMPUTE_MAX_SIZE texels per side at most.
+	bool supports_image(VkFormat format, VkExtent2D extent);
+	/// The usages generate() needs of an image of this format, on top of the ones it is created with.
+	VkImageUsageFlags get_image_usage(VkFormat format);
+
+	/// Records the generation of every mip level of the image from its level 0. Returns false, recording nothing, if
+	/// the frame already has MIPMAP_COMPUTE_MAX_IMAGES_PER_FRAME compute generations: to be generated the next frame.
+	/// @param currentLayout The layout of every level (the content of the levels past 0 is discarded)
+	/// @attention The image is supported (supports_image()), and has the usages of get_image_usage(). Every level
+	/// ends in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, visible to the later commands.
+	bool generate(VkCommandBuffer commandBuffer, const AllocatedImage& image, VkImageLayout currentLayout, CommandCounters& counters);
+
+private:
+	enum class Method : uint8_t {
+		BLIT,
+		COMPUTE,
+		UNSUPPORTED
+	};
+
+	// Freed once the GPU is done with the frame
+	struct FrameResources {
+		DescriptorSetAllocator descriptorSetAllocator {};
+		std::vector<VkImageView> imageViews {};
+		uint32_t computeCount {0};   // Compute generations recorded (scratch slices used)
+	};
+
+	VkDevice _device {VK_NULL_HANDLE};
+	VkPhysicalDevice _physicalDevice {VK_NULL_HANDLE};
+	VmaAllocator _allocator {VK_NULL_HANDLE};
+	bool _bStorageImageWriteWithoutFormat {false};
+	std::unordered_map<VkFormat, Method> _methods {};
+
+	std::vector<FrameResources> _frames {};
+	uint32_t _frameIndex {0};
+
+	// The compute downsampler (only with shaderStorageImageWriteWithoutFormat)
+	VkSampler _sampler {VK_NULL_HANDLE};
+	VkDescriptorSetLayout _descriptorSetLayout {VK_NULL_HANDLE};
+	VkPipelineLayout _pipelineLayout {VK_NULL_HANDLE};
+	VkPipeline _pipeline {VK_NULL_HANDLE};
+	AllocatedBuffer _scratchBuffer {};   // A slice per generation: the count of workgroups done, then level 6
+
+	Method get_method(VkFormat format);
+	bool generate_compute(VkCommandBuffer commandBuffer, const AllocatedImage& image, VkImageLayout currentLayout, CommandCounters& counters);
+	/// A view of a single level, freed with the frame's resources.
+	VkImageView create_level_view(const AllocatedImage& image, uint32_t level);
+};
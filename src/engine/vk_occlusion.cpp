@@ -0,0 +1,532 @@
+#include "vk_occlusion.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <glm/vec2.hpp>
+
+#include "vk_buffers.h"
+#include "vk_images.h"
+#include "vk_logger.h"
+#include "vk_pipelines.h"
+
+// Push-constants of hiz_build.comp
+struct HiZBuildPushConstants {
+    glm::ivec2 srcSize;
+    glm::ivec2 dstSize;
+};
+
+// Push-constants of hiz_cull.comp
+struct CullPushConstants {
+    glm::mat4 viewProjection;
+    glm::vec2 pyramidSize;
+    uint32_t instanceCount;
+    uint32_t phase;
+    uint32_t batchCount;
+};
+
+// Loads the SpirV shader and creates a compute-pipeline out of it. The shader-module is destroyed afterwards.
+static VkPipeline create_compute_pipeline(VkDevice device, VkPipelineLayout pipelineLayout, const char* shaderPath) {
+    VkShaderModule shaderModule;
+    if (!vkutil::load_shader_module(device, &shaderModule, shaderPath)) {
+        VK_LOG_ERROR("Failed to load SpirV shader: {}", shaderPath);
+        throw std::runtime_error(std::string("Failed to load SpirV shader: ") + shaderPath);
+    }
+
+    VkPipeline pipeline {VK_NULL_HANDLE};
+    try {
+        pipeline = vkutil::create_compute_pipeline(device, pipelineLayout, shaderModule);
+    }
+    catch (const std::runtime_error&) {
+        vkDestroyShaderModule(device, shaderModule, nullptr);
+        throw;
+    }
+    vkDestroyShaderModule(device, shaderModule, nullptr); // We no longer need it after creating the pipeline
+    VK_LOG_SUCCESS("Created compute pipeline for {}", shaderPath);
+
+    return pipeline;
+}
+
+// Makes the compute-shader writes to one pyramid level visible to the compute-shader reads of the next level.
+static void pyramid_level_barrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t mipLevel) {
+    VkImageMemoryBarrier2 imageMemoryBarrier {};
+    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    imageMemoryBarrier.pNext = nullptr;
+    imageMemoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    imageMemoryBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    imageMemoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.image = image;
+    imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageMemoryBarrier.subresourceRange.baseMipLevel = mipLevel;
+    imageMemoryBarrier.subresourceRange.levelCount = 1;
+    imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+    imageMemoryBarrier.subresourceRange.layerCount = 1;
+
+    VkDependencyInfo dependencyInfo {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.pNext = nullptr;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &imageMemoryBarrier;
+
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+void OcclusionCuller::init(VkDevice device, VmaAllocator allocator, DescriptorSetAllocator& descriptorSetAllocator, const AllocatedImage& depthImage, uint32_t maxInstances, uint32_t framesInFlight) {
+    _maxInstances = maxInstances;
+    _instanceCount = 0;
+    _batchCount = 0;
+    _frameIndex = 0;
+
+    init_hiz_pyramid(device, allocator, depthImage);
+    init_buffers(allocator, framesInFlight);
+    init_descriptors(device, descriptorSetAllocator, depthImage);
+    init_pipelines(device);
+
+    VK_LOG_SUCCESS("Initialized Hi-Z occlusion culling ({} pyramid levels, {} max instances)", _hizPyramid.mipLevels, _maxInstances);
+}
+
+void OcclusionCuller::destroy(VkDevice device, VmaAllocator allocator) {
+    vkDestroyPipeline(device, _cullPipeline, nullptr);
+    vkDestroyPipelineLayout(device, _cullPipelineLayout, nullptr);
+    vkDestroyPipeline(device, _hizBuildPipeline, nullptr);
+    vkDestroyPipelineLayout(device, _hizBuildPipelineLayout, nullptr);
+
+    // The descriptor-sets are freed along with the pool they were allocated from
+    vkDestroyDescriptorSetLayout(device, _cullDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, _hizBuildDescriptorSetLayout, nullptr);
+
+    vkutil::destroy_buffer(allocator, _visibleInstanceBuffer);
+    vkutil::destroy_buffer(allocator, _visibilityBuffer);
+    for (FrameResources& frame : _frames) {
+        vkutil::destroy_buffer(allocator, frame.drawCommandBuffer);
+        vkutil::destroy_buffer(allocator, frame.batchCommandBuffer);
+        vkutil::destroy_buffer(allocator, frame.instanceBuffer);
+    }
+    _frames.clear();
+
+    vkDestroySampler(device, _depthSampler, nullptr);
+    for (VkImageView mipView : _hizMipViews) {
+        vkDestroyImageView(device, mipView, nullptr);
+    }
+    vkDestroyImageView(device, _hizPyramid.imageView, nullptr);
+    vmaDestroyImage(allocator, _hizPyramid.image, _hizPyramid.vmaAllocation);
+}
+
+void OcclusionCuller::record_initial_state(VkCommandBuffer commandBuffer) {
+    // Move the whole pyramid to GENERAL, where it stays for its entire lifetime
+    VkImageMemoryBarrier2 imageMemoryBarrier {};
+    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    imageMemoryBarrier.pNext = nullptr;
+    imageMemoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
+    imageMemoryBarrier.srcAccessMask = 0;
+    imageMemoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT;
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.image = _hizPyramid.image;
+    imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+    imageMemoryBarrier.subresourceRange.levelCount = _hizPyramid.mipLevels;
+    imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+    imageMemoryBarrier.subresourceRange.layerCount = 1;
+
+    VkDependencyInfo dependencyInfo {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.pNext = nullptr;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &imageMemoryBarrier;
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    // Until the first pyramid is built, everything lies in front of the far-plane (nothing gets occluded)
+    VkClearColorValue farPlane {};
+    farPlane.float32[0] = 1.f;
+    vkCmdClearColorImage(commandBuffer, _hizPyramid.image, VK_IMAGE_LAYOUT_GENERAL, &farPlane, 1, &imageMemoryBarrier.subresourceRange);
+
+    // Nothing was visible "last frame"
+    vkCmdFillBuffer(commandBuffer, _visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+
+    vkutil::memory_barrier(commandBuffer,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+    );
+}
+
+void OcclusionCuller::begin_frame(uint32_t frameIndex) {
+    _frameIndex = frameIndex % static_cast<uint32_t>(_frames.size());
+}
+
+void OcclusionCuller::set_instances(std::span<const GPUCullInstance> instances, std::span<const CullDrawBatch> batches) {
+    FrameResources& frame = _frames.at(_frameIndex);
+    _instanceCount = std::min(static_cast<uint32_t>(instances.size()), _maxInstances);
+    if (instances.size() > _maxInstances) {
+        VK_LOG_WARN("Occlusion culling: {} instances submitted, only the first {} are kept", instances.size(), _maxInstances);
+    }
+    std::memcpy(frame.instanceBuffer.vmaAllocationInfo.pMappedData, instances.data(), _instanceCount * sizeof(GPUCullInstance));
+
+    // The reset state of the commands: no visible instance yet. The late commands compact theirs into the second half
+    // of the visible-instance buffer.
+    _batchCount = std::min(static_cast<uint32_t>(batches.size()), _maxInstances);
+    VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(frame.batchCommandBuffer.vmaAllocationInfo.pMappedData);
+    for (uint32_t i {0}; i < _batchCount; i++) {
+        const CullDrawBatch& batch = batches[i];
+        commands[i] = VkDrawIndexedIndirectCommand {batch.indexCount, 0, batch.firstIndex, batch.vertexOffset, batch.firstInstance};
+        commands[_batchCount + i] = VkDrawIndexedIndirectCommand {batch.indexCount, 0, batch.firstIndex, batch.vertexOffset, _maxInstances + batch.firstInstance};
+    }
+}
+
+void OcclusionCuller::record_cull(VkCommandBuffer commandBuffer, CullPhase phase, const glm::mat4& viewProjection, CommandCounters& counters) {
+    if (_instanceCount == 0 || _batchCount == 0) {
+        return;
+    }
+
+    const FrameResources& frame = _frames.at(_frameIndex);
+
+    // Reset the frame's commands of both phases (the GPU is done with the previous frame that used them)
+    if (phase == CullPhase::EARLY) {
+        VkBufferCopy copyRegion {0, 0, 2 * VkDeviceSize {_batchCount} * sizeof(VkDrawIndexedIndirectCommand)};
+        vkCmdCopyBuffer(commandBuffer, frame.batchCommandBuffer.buffer, frame.drawCommandBuffer.buffer, 1, &copyRegion);
+    }
+
+    // The pyramid and the visibility buffer were last written by compute-work (the previous pass or frame), the draw
+    // commands by the reset copy, and the commands and visible instances about to be written may still be read by the
+    // previous draws
+    vkutil::memory_barrier(commandBuffer,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+    );
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1, &frame.cullDescriptorSet, 0, nullptr);
+
+    CullPushConstants pushConstants {};
+    pushConstants.viewProjection = viewProjection;
+    pushConstants.pyramidSize = glm::vec2(_hizMipExtents.at(0).width, _hizMipExtents.at(0).height);
+    pushConstants.instanceCount = _instanceCount;
+    pushConstants.phase = static_cast<uint32_t>(phase);
+    pushConstants.batchCount = _batchCount;
+    vkCmdPushConstants(commandBuffer, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+
+    // 64 instances per workgroup
+    vkCmdDispatch(commandBuffer, (_instanceCount + 63) / 64, 1, 1);
+    counters.descriptorSetBinds++;
+    counters.dispatches++;
+
+    // The generated commands are consumed by the indirect draws, the visible instances by their vertex-shader
+    vkutil::memory_barrier(commandBuffer,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT
+    );
+    counters.pipelineBarriers += 2;
+}
+
+VkDeviceSize OcclusionCuller::get_draw_command_offset(CullPhase phase) const {
+    // Early commands followed by the late commands
+    return VkDeviceSize {phase == CullPhase::LATE ? _batchCount : 0} * sizeof(VkDrawIndexedIndirectCommand);
+}
+
+void OcclusionCuller::record_hiz_pyramid_build(VkCommandBuffer commandBuffer, CommandCounters& counters) {
+    // The culling passes before it sample the pyramid about to be overwritten (write-after-read: execution only)
+    vkutil::memory_barrier(commandBuffer,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_NONE,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+    );
+    counters.pipelineBarriers++;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _hizBuildPipeline);
+
+    VkExtent2D srcExtent = _depthExtent;
+    for (uint32_t level {0}; level < _hizPyramid.mipLevels; level++) {
+        const VkExtent2D dstExtent = _hizMipExtents.at(level);
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _hizBuildPipelineLayout, 0, 1, &_hizBuildDescriptorSets.at(level), 0, nullptr);
+
+        HiZBuildPushConstants pushConstants {};
+        pushConstants.srcSize = glm::ivec2(srcExtent.width, srcExtent.height);
+        pushConstants.dstSize = glm::ivec2(dstExtent.width, dstExtent.height);
+        vkCmdPushConstants(commandBuffer, _hizBuildPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZBuildPushConstants), &pushConstants);
+
+        // 16x16 workgroup size
+        vkCmdDispatch(commandBuffer, (dstExtent.width + 15) / 16, (dstExtent.height + 15) / 16, 1);
+
+        // The next level reads this one
+        pyramid_level_barrier(commandBuffer, _hizPyramid.image, level);
+        srcExtent = dstExtent;
+
+        counters.descriptorSetBinds++;
+        counters.dispatches++;
+        counters.pipelineBarriers++;
+    }
+}
+
+
+void OcclusionCuller::init_hiz_pyramid(VkDevice device, VmaAllocator allocator, const AllocatedImage& depthImage) {
+    _depthExtent = VkExtent2D {depthImage.imageExtent.width, depthImage.imageExtent.height};
+
+    // Level 0 is half the depth resolution, every following level halves again down to 1x1
+    VkExtent2D levelExtent {std::max(1u, _depthExtent.width / 2), std::max(1u, _depthExtent.height / 2)};
+    _hizPyramid.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(levelExtent.width, levelExtent.height)))) + 1;
+    for (uint32_t level {0}; level < _hizPyramid.mipLevels; level++) {
+        _hizMipExtents.push_back(levelExtent);
+        levelExtent = VkExtent2D {std::max(1u, levelExtent.width / 2), std::max(1u, levelExtent.height / 2)};
+    }
+
+    _hizPyramid.imageFormat = VK_FORMAT_R32_SFLOAT;
+    _hizPyramid.imageExtent = VkExtent3D {_hizMipExtents.at(0).width, _hizMipExtents.at(0).height, 1};
+
+    VkImageCreateInfo imageCreateInfo {};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.pNext = nullptr;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = _hizPyramid.imageFormat;
+    imageCreateInfo.extent = _hizPyramid.imageExtent;
+    imageCreateInfo.mipLevels = _hizPyramid.mipLevels;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+    VmaAllocationCreateInfo allocationCreateInfo {};
+    allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocationCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+    VkResult result = vmaCreateImage(allocator, &imageCreateInfo, &allocationCreateInfo, &_hizPyramid.image, &_hizPyramid.vmaAllocation, nullptr);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create Hi-Z pyramid image!");
+        throw std::runtime_error("Failed to create Hi-Z pyramid image!");
+    }
+
+    // One view over all levels (sampled by the culling pass), plus one view per level (written by the build pass)
+    VkImageViewCreateInfo imageViewCreateInfo {};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.pNext = nullptr;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCreateInfo.image = _hizPyramid.image;
+    imageViewCreateInfo.format = _hizPyramid.imageFormat;
+    imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+    imageViewCreateInfo.subresourceRange.levelCount = _hizPyramid.mipLevels;
+    imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+    result = vkCreateImageView(device, &imageViewCreateInfo, nullptr, &_hizPyramid.imageView);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create Hi-Z pyramid image-view!");
+        throw std::runtime_error("Failed to create Hi-Z pyramid image-view!");
+    }
+
+    for (uint32_t level {0}; level < _hizPyramid.mipLevels; level++) {
+        imageViewCreateInfo.subresourceRange.baseMipLevel = level;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+
+        VkImageView mipView {VK_NULL_HANDLE};
+        result = vkCreateImageView(device, &imageViewCreateInfo, nullptr, &mipView);
+        if (result != VK_SUCCESS) {
+            VK_LOG_ERROR("Failed to create Hi-Z pyramid mip image-view!");
+            throw std::runtime_error("Failed to create Hi-Z pyramid mip image-view!");
+        }
+        _hizMipViews.push_back(mipView);
+    }
+
+    // Point sampling: the build pass fetches exact texels, the culling pass picks exact levels
+    VkSamplerCreateInfo samplerCreateInfo {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.pNext = nullptr;
+    samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+    samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.minLod = 0.f;
+    samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    result = vkCreateSampler(device, &samplerCreateInfo, nullptr, &_depthSampler);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create Hi-Z sampler!");
+        throw std::runtime_error("Failed to create Hi-Z sampler!");
+    }
+}
+
+void OcclusionCuller::init_buffers(VmaAllocator allocator, uint32_t framesInFlight) {
+    for (uint32_t i {0}; i < framesInFlight; i++) {
+        FrameResources& frame = _frames.emplace_back();
+
+        // Written by the CPU every frame
+        frame.instanceBuffer = vkutil::create_buffer(allocator,
+            _maxInstances * sizeof(GPUCullInstance),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VMA_MEMORY_USAGE_CPU_TO_GPU
+        );
+
+        // Early commands followed by the late commands (one per batch, at most one batch per instance): written by the
+        // CPU every frame, and copied into the draw commands before the early pass
+        frame.batchCommandBuffer = vkutil::create_buffer(allocator,
+            2 * _maxInstances * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VMA_MEMORY_USAGE_CPU_TO_GPU
+        );
+        frame.drawCommandBuffer = vkutil::create_buffer(allocator,
+            2 * _maxInstances * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY
+        );
+    }
+
+    // One uint per instance, persists across frames
+    _visibilityBuffer = vkutil::create_buffer(allocator,
+        _maxInstances * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY
+    );
+
+    // The visible instances of the early commands followed by the ones of the late commands
+    _visibleInstanceBuffer = vkutil::create_buffer(allocator,
+        2 * _maxInstances * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY
+    );
+}
+
+void OcclusionCuller::init_descriptors(VkDevice device, DescriptorSetAllocator& descriptorSetAllocator, const AllocatedImage& depthImage) {
+    // Build-pass: binding 0 = source level (sampled), binding 1 = destination level (storage)
+    {
+        DescriptorLayoutBuilder layoutBuilder {};
+        layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        _hizBuildDescriptorSetLayout = layoutBuilder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    // Cull-pass: pyramid, instances, visibility, draw commands, visible instances
+    {
+        DescriptorLayoutBuilder layoutBuilder {};
+        layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        layoutBuilder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        layoutBuilder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        layoutBuilder.add_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        _cullDescriptorSetLayout = layoutBuilder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    // One build descriptor-set per pyramid level
+    for (uint32_t level {0}; level < _hizPyramid.mipLevels; level++) {
+        VkDescriptorSet descriptorSet = descriptorSetAllocator.allocate_descriptor_set(device, _hizBuildDescriptorSetLayout);
+
+        VkDescriptorImageInfo srcImageInfo {};
+        srcImageInfo.sampler = _depthSampler;
+        srcImageInfo.imageView = (level == 0 ? depthImage.imageView : _hizMipViews.at(level - 1));
+        srcImageInfo.imageLayout = (level == 0 ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL);
+
+        VkDescriptorImageInfo dstImageInfo {};
+        dstImageInfo.imageView = _hizMipViews.at(level);
+        dstImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::array<VkWriteDescriptorSet, 2> writes {};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].dstSet = descriptorSet;
+        writes[0].dstBinding = 0;
+        writes[0].descriptorCount = 1;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[0].pImageInfo = &srcImageInfo;
+        writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[1].dstSet = descriptorSet;
+        writes[1].dstBinding = 1;
+        writes[1].descriptorCount = 1;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writes[1].pImageInfo = &dstImageInfo;
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+        _hizBuildDescriptorSets.push_back(descriptorSet);
+    }
+
+    // One cull descriptor-set per frame in flight
+    for (FrameResources& frame : _frames) {
+        frame.cullDescriptorSet = descriptorSetAllocator.allocate_descriptor_set(device, _cullDescriptorSetLayout);
+
+        VkDescriptorImageInfo pyramidImageInfo {};
+        pyramidImageInfo.sampler = _depthSampler;
+        pyramidImageInfo.imageView = _hizPyramid.imageView;
+        pyramidImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        std::array<VkDescriptorBufferInfo, 4> bufferInfos {};
+        bufferInfos[0] = VkDescriptorBufferInfo {frame.instanceBuffer.buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[1] = VkDescriptorBufferInfo {_visibilityBuffer.buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[2] = VkDescriptorBufferInfo {frame.drawCommandBuffer.buffer, 0, VK_WHOLE_SIZE};
+        bufferInfos[3] = VkDescriptorBufferInfo {_visibleInstanceBuffer.buffer, 0, VK_WHOLE_SIZE};
+
+        std::array<VkWriteDescriptorSet, 5> writes {};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].dstSet = frame.cullDescriptorSet;
+        writes[0].dstBinding = 0;
+        writes[0].descriptorCount = 1;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[0].pImageInfo = &pyramidImageInfo;
+        for (uint32_t i {0}; i < bufferInfos.size(); i++) {
+            writes[i + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i + 1].dstSet = frame.cullDescriptorSet;
+            writes[i + 1].dstBinding = i + 1;
+            writes[i + 1].descriptorCount = 1;
+            writes[i + 1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i + 1].pBufferInfo = &bufferInfos[i];
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+}
+
+void OcclusionCuller::init_pipelines(VkDevice device) {
+    // Build-pass pipeline
+    {
+        VkPushConstantRange pushConstantRange {};
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(HiZBuildPushConstants);
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo {};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.pNext = nullptr;
+        pipelineLayoutCreateInfo.setLayoutCount = 1;
+        pipelineLayoutCreateInfo.pSetLayouts = &_hizBuildDescriptorSetLayout;
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &_hizBuildPipelineLayout);
+        if (result != VK_SUCCESS) {
+            VK_LOG_ERROR("Failed to create pipeline-layout for Hi-Z build");
+            throw std::runtime_error("Failed to create pipeline-layout for Hi-Z build");
+        }
+        _hizBuildPipeline = create_compute_pipeline(device, _hizBuildPipelineLayout, "./shaders/hiz_build.comp.spv");
+    }
+
+    // Cull-pass pipeline
+    {
+        VkPushConstantRange pushConstantRange {};
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(CullPushConstants);
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo {};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.pNext = nullptr;
+        pipelineLayoutCreateInfo.setLayoutCount = 1;
+        pipelineLayoutCreateInfo.pSetLayouts = &_cullDescriptorSetLayout;
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &_cullPipelineLayout);
+        if (result != VK_SUCCESS) {
+            VK_LOG_ERROR("Failed to create pipeline-layout for occlusion culling");
+            throw std::runtime_error("Failed to create pipeline-layout for occlusion culling");
+        }
+        _cullPipeline = create_compute_pipeline(device, _cullPipelineLayout, "./shaders/hiz_cull.comp.spv");
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+
+/// @brief Per-instance input of the occlusion-culling pass.
+/// @attention Must match the @code CullInstance@endcode struct in hiz_cull.comp (std430)
+struct GPUCullInstance {
+	glm::vec4 aabbMin;       // xyz: world-space AABB min
+	glm::vec4 aabbMax;       // xyz: world-space AABB max
+	uint32_t batchIndex;     // The draw it is compacted into if visible
+	uint32_t padding[3];
+};
+
+/// @brief A draw of the culling passes: the index range of a mesh, and the start of the range of the visible-instance
+/// buffer its visible instances are compacted into (the range of its instances in the instance buffer).
+struct CullDrawBatch {
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;
+};
+
+/// @brief The two culling passes of a frame.
+///
+/// EARLY tests every instance against the Hi-Z pyramid of the previous frame (built from its final depth).
+/// LATE re-tests only the instances rejected by EARLY, against the pyramid rebuilt from this frame's early depth,
+/// catching the objects that have become visible.
+enum class CullPhase : uint32_t {
+	EARLY = 0,
+	LATE = 1
+};
+
+/// @brief Hierarchical-Z occlusion culling.
+///
+/// Owns the Hi-Z depth pyramid (farthest depth per texel), the compute pipelines to build it and to cull instance
+/// bounding boxes against it, and the indirect draw commands generated by the culling passes.
+/// Each pass has a command per batch (mesh), copied from the CPU's before the early pass with instanceCount = 0: the
+/// visible instances bump the instanceCount of their batch, and write their index into the visible-instance buffer at
+/// the slot it returned. The draws stay a single @code vkCmdDrawIndexedIndirect@endcode per pass, without requiring
+/// drawIndirectCount support, and the vertex-shader finds its instance at @code visibleInstances[gl_InstanceIndex]@endcode.
+/// The buffers written by the CPU, and the draw commands reset from them, have one copy per frame in flight.
+///
+/// The pyramid is built twice per frame: after the early draws for the late pass, then after the late draws (from the
+/// complete depth) for the next frame's early pass.
+///
+/// Per frame: begin_frame() -> set_instances() -> cull(EARLY) -> draw(EARLY) -> build_hiz_pyramid() -> cull(LATE)
+/// -> draw(LATE) -> build_hiz_pyramid()
+class OcclusionCuller {
+public:
+	/// Creates the pyramid (sized after the depth image), the buffers, descriptor-sets and compute pipelines.
+	void init(VkDevice device, VmaAllocator allocator, DescriptorSetAllocator& descriptorSetAllocator, const AllocatedImage& depthImage, uint32_t maxInstances, uint32_t framesInFlight);
+	void destroy(VkDevice device, VmaAllocator allocator);
+
+	/// Records the one-time initialization of the pyramid and visibility buffer (pyramid cleared to the far-plane).
+	void record_initial_state(VkCommandBuffer commandBuffer);
+
+	/// Selects the buffers of the frame.
+	/// @attention The GPU must be done with the previous frame that used the same frameIndex
+	void begin_frame(uint32_t frameIndex);
+	/// Copies the instances and the command of each batch into the frame's (host-visible) buffers. Both clamped to
+	/// maxInstances.
+	/// @attention The instances of a batch must fit in its range: firstInstance + their count <= maxInstances
+	void set_instances(std::span<const GPUCullInstance> instances, std::span<const CullDrawBatch> batches);
+	uint32_t get_instance_count() const { return _instanceCount; }
+	uint32_t get_batch_count() const { return _batchCount; }
+
+	/// Records the culling dispatch of the given phase, followed by a barrier for the indirect-draw and vertex-shader reads.
+	/// The early phase first resets the commands of both phases.
+	void record_cull(VkCommandBuffer commandBuffer, CullPhase phase, const glm::mat4& viewProjection, CommandCounters& counters);
+
+	/// The indirect draw commands of the frame generated by the given phase: get_batch_count() commands from this
+	/// offset, one per batch, for a single @code vkCmdDrawIndexedIndirect@endcode.
+	VkBuffer get_draw_command_buffer() const { return _frames.at(_frameIndex).drawCommandBuffer.buffer; }
+	VkDeviceSize get_draw_command_offset(CullPhase phase) const;
+	/// The indices of the visible instances, read by the vertex-shader at gl_InstanceIndex (2 * maxInstances uints)
+	const AllocatedBuffer& get_visible_instance_buffer() const { return _visibleInstanceBuffer; }
+
+	/// Records the build of every pyramid level from the depth-image, after the culling passes recorded before it are
+	/// done reading the pyramid.
+	/// @attention The depth-image must be in VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, with its writes made visible to compute.
+	void record_hiz_pyramid_build(VkCommandBuffer commandBuffer, CommandCounters& counters);
+
+private:
+	// The buffers written by the CPU every frame, and the draw commands reset from them
+	struct FrameResources {
+		AllocatedBuffer instanceBuffer {};
+		AllocatedBuffer batchCommandBuffer {};   // Host-visible, the reset state of the draw commands
+		AllocatedBuffer drawCommandBuffer {};
+		VkDescriptorSet cullDescriptorSet {VK_NULL_HANDLE};
+	};
+
+	uint32_t _maxInstances {0};
+	uint32_t _instanceCount {0};
+	uint32_t _batchCount {0};
+	uint32_t _frameIndex {0};
+
+	// The Hi-Z pyramid: R32_SFLOAT, always in VK_IMAGE_LAYOUT_GENERAL
+	AllocatedImage _hizPyramid {};
+	std::vector<VkImageView> _hizMipViews {};
+	std::vector<VkExtent2D> _hizMipExtents {};
+	VkExtent2D _depthExtent {};
+
+	VkSampler _depthSampler {VK_NULL_HANDLE};
+
+	// Buffers: one set per frame in flight, plus the ones only the GPU writes (ordered by the barriers of the passes)
+	std::vector<FrameResources> _frames {};
+	AllocatedBuffer _visibilityBuffer {};
+	AllocatedBuffer _visibleInstanceBuffer {};
+
+	// Descriptors (the cull descriptor-sets are per frame)
+	VkDescriptorSetLayout _hizBuildDescriptorSetLayout {VK_NULL_HANDLE};
+	VkDescriptorSetLayout _cullDescriptorSetLayout {VK_NULL_HANDLE};
+	std::vector<VkDescriptorSet> _hizBuildDescriptorSets {};
+
+	// Compute-Pipelines
+	VkPipelineLayout _hizBuildPipelineLayout {VK_NULL_HANDLE};
+	VkPipeline _hizBuildPipeline {VK_NULL_HANDLE};
+	VkPipelineLayout _cullPipelineLayout {VK_NULL_HANDLE};
+	VkPipeline _cullPipeline {VK_NULL_HANDLE};
+
+	void init_hiz_pyramid(VkDevice device, VmaAllocator allocator, const AllocatedImage& depthImage);
+	void init_buffers(VmaAllocator allocator, uint32_t framesInFlight);
+	void init_descriptors(VkDevice device, DescriptorSetAllocator& descriptorSetAllocator, const AllocatedImage& depthImage);
+	void init_pipelines(VkDevice device);
+};
@@ -0,0 +1,94 @@
+#include "vk_perf_overlay.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "imgui.h"
+
+void PerformanceOverlay::add_frame_time(float milliseconds) {
+    _frameTimes[_frameTimeOffset] = milliseconds;
+    _frameTimeOffset = (_frameTimeOffset + 1) % PERF_OVERLAY_FRAME_HISTORY;
+    _frameTimeCount = std::min(_frameTimeCount + 1, PERF_OVERLAY_FRAME_HISTORY);
+}
+
+void PerformanceOverlay::draw(const PerformanceOverlayFrameInfo& frameInfo) {
+    if (!_bVisible) {
+        return;
+    }
+
+    ImGui::SetNextWindowBgAlpha(0.75f);
+    if (!ImGui::Begin("Performance (F1)", &_bVisible)) {
+        ImGui::End();
+        return;
+    }
+
+    // CPU frame-times: rolling graph, with the average and the worst frame of the history (the hitches)
+    if (_frameTimeCount > 0) {
+        float sum {0.f};
+        float worst {0.f};
+        for (uint32_t i {0}; i < _frameTimeCount; i++) {
+            sum += _frameTimes[i];
+            worst = std::max(worst, _frameTimes[i]);
+        }
+        const float average = sum / static_cast<float>(_frameTimeCount);
+
+        char overlayText[64];
+        std::snprintf(overlayText, sizeof(overlayText), "avg %.2f ms (%.0f FPS), max %.2f ms", average, 1000.f / average, worst);
+        // Before the history is full, the entries start at 0
+        const int valuesOffset = (_frameTimeCount == PERF_OVERLAY_FRAME_HISTORY) ? static_cast<int>(_frameTimeOffset) : 0;
+        ImGui::PlotLines("CPU frame", _frameTimes.data(), static_cast<int>(_frameTimeCount), valuesOffset, overlayText, 0.f, std::max(worst, 33.4f), ImVec2(0, 60));
+    }
+
+    // GPU time of each render-graph pass
+    if (ImGui::CollapsingHeader("GPU passes", ImGuiTreeNodeFlags_DefaultOpen)) {
+        if (frameInfo.passTimings.empty()) {
+            ImGui::TextDisabled("Timestamp queries unsupported");
+        }
+        float totalMilliseconds {0.f};
+        for (const RenderGraphPassTiming& timing : frameInfo.passTimings) {
+            ImGui::Text("%-20s %7.3f ms", timing.name, timing.milliseconds);
+            totalMilliseconds += timing.milliseconds;
+        }
+        if (!frameInfo.passTimings.empty()) {
+            ImGui::Text("%-20s %7.3f ms", "Total", totalMilliseconds);
+        }
+    }
+
+    // Usage and budget of every memory heap, as estimated by VMA
+    if (ImGui::CollapsingHeader("Memory heaps", ImGuiTreeNodeFlags_DefaultOpen)) {
+        const VkPhysicalDeviceMemoryProperties* memoryProperties {nullptr};
+        vmaGetMemoryProperties(frameInfo.allocator, &memoryProperties);
+
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets {};
+        vmaGetHeapBudgets(frameInfo.allocator, budgets.data());
+
+        constexpr double MiB {1024.0 * 1024.0};
+        for (uint32_t heap {0}; heap < memoryProperties->memoryHeapCount; heap++) {
+            const VmaBudget& budget = budgets[heap];
+            const bool bDeviceLocal = (memoryProperties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+            const float fraction = budget.budget > 0 ? static_cast<float>(static_cast<double>(budget.usage) / static_cast<double>(budget.budget)) : 0.f;
+
+            char progressText[96];
+            std::snprintf(progressText, sizeof(progressText), "%.1f / %.1f MiB (%u allocations)",
+                static_cast<double>(budget.usage) / MiB, static_cast<double>(budget.budget) / MiB, budget.statistics.allocationCount);
+            ImGui::Text("Heap %u (%s)", heap, bDeviceLocal ? "device-local" : "host");
+            ImGui::ProgressBar(fraction, ImVec2(-1, 0), progressText);
+        }
+    }
+
+    // Recorded commands of the last frame
+    if (ImGui::CollapsingHeader("Commands", ImGuiTreeNodeFlags_DefaultOpen)) {
+        const CommandCounters& counters = frameInfo.commandCounters;
+        const RenderGraphStats& graphStats = *frameInfo.renderGraphStats;
+        ImGui::Text("Draws: %u, dispatches: %u", counters.draws, counters.dispatches);
+        ImGui::Text("Barriers: %u (render-graph: %u batches, %u image, %u buffer)",
+            counters.pipelineBarriers + graphStats.barrierBatchCount, graphStats.barrierBatchCount, graphStats.imageBarrierCount, graphStats.bufferBarrierCount);
+        ImGui::Text("Pipeline binds: %u, descriptor-set binds: %u", counters.pipelineBinds, counters.descriptorSetBinds);
+        ImGui::Text("Redundant state changes skipped: %u", counters.skippedStateBinds);
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Frames in flight: %u (max %u), present mode: %s", frameInfo.framesInFlight, frameInfo.maxFramesInFlight, string_VkPresentModeKHR(frameInfo.presentMode));
+
+    ImGui::End();
+}
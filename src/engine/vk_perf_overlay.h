@@ -0,0 +1,42 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_render_graph.h"
+
+/// @brief Number of CPU frame-times kept for the rolling graph of the performance overlay.
+constexpr uint32_t PERF_OVERLAY_FRAME_HISTORY {240};
+
+/// @brief What the performance overlay shows for a frame, gathered by the engine.
+struct PerformanceOverlayFrameInfo {
+	std::span<const RenderGraphPassTiming> passTimings;   // GPU time per pass, a few frames old
+	const RenderGraphStats* renderGraphStats;
+	CommandCounters commandCounters;
+	VmaAllocator allocator;
+	uint32_t framesInFlight;      // Measured: submitted and not yet completed by the GPU
+	uint32_t maxFramesInFlight;   // FRAME_OVERLAP
+	VkPresentModeKHR presentMode;
+};
+
+/// @brief An ImGui window with the frame-time graph, the GPU time of each pass, the memory heap usage and budgets,
+/// and the per-frame command counts.
+///
+/// Cheap enough to stay on in release builds: no allocation per frame, the GPU timings are read back
+/// without stalling, and the VMA budgets are cached by VMA.
+class PerformanceOverlay {
+public:
+	/// Adds the CPU time of the last frame (in milliseconds) to the rolling history.
+	void add_frame_time(float milliseconds);
+
+	/// Builds the overlay window, between ImGui::NewFrame() and ImGui::Render().
+	void draw(const PerformanceOverlayFrameInfo& frameInfo);
+
+	void toggle() { _bVisible = !_bVisible; }
+
+private:
+	bool _bVisible {true};
+
+	// Ring buffer of the CPU frame-times: _frameTimeOffset is the oldest entry once the history is full
+	std::array<float, PERF_OVERLAY_FRAME_HISTORY> _frameTimes {};
+	uint32_t _frameTimeOffset {0};
+	uint32_t _frameTimeCount {0};
+};
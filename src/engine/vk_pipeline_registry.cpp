@@ -0,0 +1,148 @@
+#include "vk_pipeline_registry.h"
+
+#include "vk_logger.h"
+
+void PipelineRegistry::init(VkDevice device, JobSystem& jobSystem, const GraphicsPipelineFeatures& features) {
+    _device = device;
+    _jobSystem = &jobSystem;
+    _features = features;
+
+    VK_LOG_INFO("Graphics-pipelines: {}, {}",
+        _features.bGraphicsPipelineLibrary ? "linked from stage libraries" : "complete pipelines (no graphics-pipeline libraries)",
+        _features.bExtendedDynamicState3 ? "dynamic polygon mode and blending" : "static polygon mode and blending");
+}
+
+void PipelineRegistry::destroy() {
+    // No requests anymore: the compiles still queued are waited for without the lock (wait() runs other jobs too)
+    for (Entry& entry : _entries) {
+        _jobSystem->wait(entry.compileCounter);
+    }
+
+    std::lock_guard lock(_mutex);
+    for (const Entry& entry : _entries) {
+        if (entry.pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(_device, entry.pipeline, nullptr);
+        }
+    }
+    VK_LOG_INFO("Destroyed {} graphics-pipelines, shared by {} requests", _entries.size(), _requestCount);
+
+    // After the pipelines linked from them
+    {
+        std::lock_guard libraryLock(_libraryMutex);
+        for (const auto& [key, library] : _libraries) {
+            vkDestroyPipeline(_device, library, nullptr);
+        }
+        _libraries.clear();
+    }
+
+    _entries.clear();
+    _handles.clear();
+    _requestCount = 0;
+    _hitCount = 0;
+}
+
+PipelineHandle PipelineRegistry::request_graphics_pipeline(const GraphicsPipelineBuilder& builder) {
+    const GraphicsPipelineKey key = builder.get_key();
+
+    std::lock_guard lock(_mutex);
+    _requestCount++;
+    if (auto it = _handles.find(key); it != _handles.end()) {
+        _hitCount++;
+        return it->second;
+    }
+
+    const PipelineHandle handle = static_cast<PipelineHandle>(_entries.size());
+    Entry& entry = _entries.emplace_back();
+    _handles.emplace(key, handle);
+
+    // Queued under the lock: a concurrent request for the same state must find the counter already incremented
+    _jobSystem->run([this, &entry, builder = builder]() mutable {
+        // Jobs must not throw: the requesters keep their placeholder (build_pipeline() already logged the error)
+        try {
+            entry.pipeline = _features.bGraphicsPipelineLibrary ? link_pipeline(builder) : builder.build_pipeline(_device);
+            entry.state.store(PipelineState::READY, std::memory_order_release);
+        }
+        catch (const std::runtime_error&) {
+            entry.state.store(PipelineState::FAILED, std::memory_order_release);
+        }
+    }, &entry.compileCounter);
+
+    return handle;
+}
+
+VkPipeline PipelineRegistry::get_pipeline(PipelineHandle handle, VkPipeline placeholder) const {
+    const Entry& entry = get_entry(handle);
+    if (entry.state.load(std::memory_order_acquire) != PipelineState::READY) {
+        return placeholder;
+    }
+    return entry.pipeline;
+}
+
+bool PipelineRegistry::is_ready(PipelineHandle handle) const {
+    return get_entry(handle).state.load(std::memory_order_acquire) == PipelineState::READY;
+}
+
+VkPipeline PipelineRegistry::wait_for_pipeline(PipelineHandle handle) {
+    Entry* entry {nullptr};
+    {
+        std::lock_guard lock(_mutex);
+        entry = &_entries.at(handle);
+    }
+    // Not under the lock: the jobs run by wait() may request pipelines themselves
+    _jobSystem->wait(entry->compileCounter);
+    return get_pipeline(handle);
+}
+
+PipelineRegistryStats PipelineRegistry::get_stats() const {
+    std::lock_guard lock(_mutex);
+    PipelineRegistryStats stats {};
+    stats.requestCount = _requestCount;
+    stats.hitCount = _hitCount;
+    stats.pipelineCount = static_cast<uint32_t>(_entries.size());
+    {
+        std::lock_guard libraryLock(_libraryMutex);
+        stats.libraryCount = static_cast<uint32_t>(_libraries.size());
+    }
+    for (const Entry& entry : _entries) {
+        const PipelineState state = entry.state.load(std::memory_order_acquire);
+        stats.compilingCount += state == PipelineState::COMPILING ? 1 : 0;
+        stats.failedCount += state == PipelineState::FAILED ? 1 : 0;
+    }
+    return stats;
+}
+
+const PipelineRegistry::Entry& PipelineRegistry::get_entry(PipelineHandle handle) const {
+    // The deque may be growing on another thread: only its indexing needs the lock, the entry itself doesn't move
+    std::lock_guard lock(_mutex);
+    return _entries.at(handle);
+}
+
+VkPipeline PipelineRegistry::link_pipeline(GraphicsPipelineBuilder& builder) {
+    const std::array<VkPipeline, 4> libraries {
+        get_or_build_library(builder, VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT),
+        get_or_build_library(builder, VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT),
+        get_or_build_library(builder, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT),
+        get_or_build_library(builder, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT)
+    };
+    return vkutil::link_graphics_pipeline(_device, builder.get_key().pipelineLayout, libraries);
+}
+
+VkPipeline PipelineRegistry::get_or_build_library(GraphicsPipelineBuilder& builder, VkGraphicsPipelineLibraryFlagsEXT libraryPart) {
+    const GraphicsPipelineKey key = builder.get_library_key(libraryPart);
+    {
+        std::lock_guard lock(_libraryMutex);
+        if (auto it = _libraries.find(key); it != _libraries.end()) {
+            return it->second;
+        }
+    }
+
+    // Built outside the lock, so the other compiles go on. Two jobs may build the same library: the second is dropped.
+    const VkPipeline library = builder.build_pipeline_library(_device, libraryPart);
+
+    std::lock_guard lock(_libraryMutex);
+    auto [it, bInserted] = _libraries.emplace(key, library);
+    if (!bInserted) {
+        vkDestroyPipeline(_device, library, nullptr);
+    }
+    return it->second;
+}
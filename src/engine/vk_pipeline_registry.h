@@ -0,0 +1,92 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_jobs.h"
+#include "vk_pipelines.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+/// @brief Handle to a pipeline of a PipelineRegistry.
+using PipelineHandle = uint32_t;
+constexpr PipelineHandle PIPELINE_HANDLE_NONE {UINT32_MAX};
+
+/// @brief Counters of a PipelineRegistry, since its init().
+struct PipelineRegistryStats {
+	uint32_t requestCount {0};
+	uint32_t hitCount {0};        // Requests answered with a pipeline already created (or compiling)
+	uint32_t pipelineCount {0};   // Distinct states, one pipeline each
+	uint32_t compilingCount {0};
+	uint32_t failedCount {0};
+	uint32_t libraryCount {0};    // Stage libraries, shared by the linked pipelines (with graphics-pipeline libraries)
+};
+
+/// @brief Creates each distinct graphics-pipeline state once, and shares it between every request for it.
+///
+/// A request is looked up by its GraphicsPipelineKey (the builder's full state). A hit returns the handle of the
+/// existing pipeline, a miss queues its compile on the job system and returns right away: until the compile is done,
+/// get_pipeline() returns the placeholder given by the caller (e.g. VK_NULL_HANDLE to skip the draws, or a simpler
+/// pipeline). wait_for_pipeline() blocks instead, for the pipelines needed before the first frame.
+///
+/// With VK_EXT_graphics_pipeline_library, a compile builds the four stages of the pipeline (vertex input, pre-raster
+/// shaders, fragment shader, fragment output) as libraries, each looked up by its own part of the key, and links them.
+/// A new combination of known stages is then only a link, much faster than a complete compile. Without the
+/// extension, complete pipelines are built.
+///
+/// The registry owns the pipelines: they are destroyed by destroy(), not by the requesters.
+/// @note Thread-safe: requests and lookups may come from any thread
+class PipelineRegistry {
+public:
+	void init(VkDevice device, JobSystem& jobSystem, const GraphicsPipelineFeatures& features);
+	/// Waits for the compiles still in progress, then destroys every pipeline.
+	void destroy();
+
+	/// Returns the pipeline with the builder's state, queuing its compile on first use.
+	/// @attention The shader-modules and pipeline-layout must stay alive until the pipeline is compiled. Keep them
+	/// as long as the registry: the key holds their handles, which a new object may reuse once they are destroyed.
+	PipelineHandle request_graphics_pipeline(const GraphicsPipelineBuilder& builder);
+
+	/// The pipeline, or the placeholder while it is compiling (or if its compile failed).
+	VkPipeline get_pipeline(PipelineHandle handle, VkPipeline placeholder = VK_NULL_HANDLE) const;
+	bool is_ready(PipelineHandle handle) const;
+	/// Blocks until the compile is done, running jobs meanwhile. Returns VK_NULL_HANDLE if the compile failed.
+	VkPipeline wait_for_pipeline(PipelineHandle handle);
+
+	PipelineRegistryStats get_stats() const;
+	/// For GraphicsPipelineBuilder::enable_dynamic_state() and GraphicsDynamicState::record().
+	const GraphicsPipelineFeatures& get_features() const { return _features; }
+
+private:
+	enum class PipelineState : uint32_t {
+		COMPILING,
+		READY,
+		FAILED
+	};
+
+	struct Entry {
+		VkPipeline pipeline {VK_NULL_HANDLE};              // Written by the compile job, before the state
+		std::atomic<PipelineState> state {PipelineState::COMPILING};
+		JobCounter compileCounter {};
+	};
+
+	VkDevice _device {VK_NULL_HANDLE};
+	JobSystem* _jobSystem {nullptr};
+	GraphicsPipelineFeatures _features {};
+
+	mutable std::mutex _mutex {};
+	std::deque<Entry> _entries {};   // Indexed by handle. A deque: the compile jobs hold on to their entry.
+	std::unordered_map<GraphicsPipelineKey, PipelineHandle, GraphicsPipelineKeyHash> _handles {};
+	uint32_t _requestCount {0};
+	uint32_t _hitCount {0};
+
+	// Stage libraries, keyed by GraphicsPipelineBuilder::get_library_key()
+	mutable std::mutex _libraryMutex {};
+	std::unordered_map<GraphicsPipelineKey, VkPipeline, GraphicsPipelineKeyHash> _libraries {};
+
+	const Entry& get_entry(PipelineHandle handle) const;
+	/// Builds the pipeline from its stage libraries (building the ones not created yet), on a job.
+	VkPipeline link_pipeline(GraphicsPipelineBuilder& builder);
+	VkPipeline get_or_build_library(GraphicsPipelineBuilder& builder, VkGraphicsPipelineLibraryFlagsEXT libraryPart);
+};
@@ -1,5 +1,7 @@
 ﻿#include "vk_pipelines.h"
+#include <cstring>
 #include <fstream>
+#include <functional>
 
 #include "VkBootstrap.h"
 #include "vk_logger.h"
@@ -51,6 +53,158 @@ bool vkutil::load_shader_module(VkDevice device, VkShaderModule*outShaderModule,
 }
 
 
+VkPipeline vkutil::create_compute_pipeline(VkDevice device, VkPipelineLayout pipelineLayout, VkShaderModule shaderModule, const VkSpecializationInfo* specializationInfo) {
+    VkPipelineShaderStageCreateInfo stageInfo {};
+    stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageInfo.pNext = nullptr;
+    stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.module = shaderModule;
+    stageInfo.pName = "main";
+    stageInfo.pSpecializationInfo = specializationInfo;
+
+    VkComputePipelineCreateInfo pipelineCreateInfo {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.pNext = nullptr;
+    pipelineCreateInfo.layout = pipelineLayout;
+    pipelineCreateInfo.stage = stageInfo;
+
+    VkPipeline pipeline {VK_NULL_HANDLE};
+    VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create compute-pipeline - {}", string_VkResult(result));
+        throw std::runtime_error("Failed to create compute-pipeline");
+    }
+
+    return pipeline;
+}
+
+VkPipeline vkutil::link_graphics_pipeline(VkDevice device, VkPipelineLayout pipelineLayout, std::span<const VkPipeline> libraries) {
+    VkPipelineLibraryCreateInfoKHR libraryCreateInfo {};
+    libraryCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+    libraryCreateInfo.pNext = nullptr;
+    libraryCreateInfo.libraryCount = static_cast<uint32_t>(libraries.size());
+    libraryCreateInfo.pLibraries = libraries.data();
+
+    // All the state comes from the libraries
+    VkGraphicsPipelineCreateInfo pipelineCreateInfo {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.pNext = &libraryCreateInfo;
+    pipelineCreateInfo.layout = pipelineLayout;
+
+    VkPipeline pipeline {VK_NULL_HANDLE};
+    VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to link graphics-pipeline - {}", string_VkResult(result));
+        throw std::runtime_error("Failed to link graphics-pipeline");
+    }
+
+    return pipeline;
+}
+
+
+// GraphicsPipelineFeatures / GraphicsDynamicState method definitions:
+
+void GraphicsPipelineFeatures::load_functions(VkDevice device) {
+    if (bExtendedDynamicState3) {
+        vkCmdSetPolygonModeEXT = reinterpret_cast<PFN_vkCmdSetPolygonModeEXT>(vkGetDeviceProcAddr(device, "vkCmdSetPolygonModeEXT"));
+        vkCmdSetColorBlendEnableEXT = reinterpret_cast<PFN_vkCmdSetColorBlendEnableEXT>(vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEnableEXT"));
+        vkCmdSetColorBlendEquationEXT = reinterpret_cast<PFN_vkCmdSetColorBlendEquationEXT>(vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEquationEXT"));
+        vkCmdSetColorWriteMaskEXT = reinterpret_cast<PFN_vkCmdSetColorWriteMaskEXT>(vkGetDeviceProcAddr(device, "vkCmdSetColorWriteMaskEXT"));
+    }
+}
+
+void GraphicsDynamicState::record(VkCommandBuffer commandBuffer, const GraphicsPipelineFeatures& features) const {
+    // Vulkan 1.3 core (extended_dynamic_state and extended_dynamic_state2)
+    vkCmdSetCullMode(commandBuffer, cullMode);
+    vkCmdSetFrontFace(commandBuffer, frontFace);
+    vkCmdSetDepthTestEnable(commandBuffer, depthTestEnable);
+    vkCmdSetDepthWriteEnable(commandBuffer, depthWriteEnable);
+    vkCmdSetDepthCompareOp(commandBuffer, depthCompareOp);
+    vkCmdSetDepthBiasEnable(commandBuffer, depthBiasEnable);
+    vkCmdSetPrimitiveRestartEnable(commandBuffer, primitiveRestartEnable);
+    vkCmdSetRasterizerDiscardEnable(commandBuffer, VK_FALSE);
+
+    if (features.bExtendedDynamicState3) {
+        features.vkCmdSetPolygonModeEXT(commandBuffer, polygonMode);
+        features.vkCmdSetColorBlendEnableEXT(commandBuffer, 0, 1, &blendEnable);
+        features.vkCmdSetColorBlendEquationEXT(commandBuffer, 0, 1, &blendEquation);
+        features.vkCmdSetColorWriteMaskEXT(commandBuffer, 0, 1, &colorWriteMask);
+    }
+}
+
+
+// SpecializationConstants method definitions:
+
+void SpecializationConstants::add_constant(uint32_t constantID, uint32_t value) {
+    VkSpecializationMapEntry mapEntry {};
+    mapEntry.constantID = constantID;
+    mapEntry.offset = static_cast<uint32_t>(_data.size() * sizeof(uint32_t));
+    mapEntry.size = sizeof(uint32_t);
+
+    _mapEntries.push_back(mapEntry);
+    _data.push_back(value);
+}
+
+void SpecializationConstants::add_constant(uint32_t constantID, float value) {
+    uint32_t bits {0};
+    std::memcpy(&bits, &value, sizeof(float));
+    add_constant(constantID, bits);
+}
+
+VkSpecializationInfo SpecializationConstants::get_specialization_info() const {
+    VkSpecializationInfo specializationInfo {};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(_mapEntries.size());
+    specializationInfo.pMapEntries = _mapEntries.data();
+    specializationInfo.dataSize = _data.size() * sizeof(uint32_t);
+    specializationInfo.pData = _data.data();
+    return specializationInfo;
+}
+
+
+namespace {
+
+    // Boost's hash_combine
+    template <typename T>
+    void hash_combine(size_t& seed, const T& value) {
+        seed ^= std::hash<T> {}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+
+}
+
+size_t GraphicsPipelineKeyHash::operator()(const GraphicsPipelineKey& key) const {
+    size_t seed {0};
+    hash_combine(seed, key.vertexShaderModule);
+    hash_combine(seed, key.fragmentShaderModule);
+    hash_combine(seed, key.pipelineLayout);
+    hash_combine(seed, key.topology);
+    hash_combine(seed, key.primitiveRestartEnable);
+    hash_combine(seed, key.polygonMode);
+    hash_combine(seed, key.cullMode);
+    hash_combine(seed, key.frontFace);
+    hash_combine(seed, key.lineWidth);
+    hash_combine(seed, key.rasterizationSamples);
+    hash_combine(seed, key.sampleShadingEnable);
+    hash_combine(seed, key.alphaToCoverageEnable);
+    hash_combine(seed, key.blendEnable);
+    hash_combine(seed, key.srcColorBlendFactor);
+    hash_combine(seed, key.dstColorBlendFactor);
+    hash_combine(seed, key.colorBlendOp);
+    hash_combine(seed, key.srcAlphaBlendFactor);
+    hash_combine(seed, key.dstAlphaBlendFactor);
+    hash_combine(seed, key.alphaBlendOp);
+    hash_combine(seed, key.colorWriteMask);
+    hash_combine(seed, key.depthTestEnable);
+    hash_combine(seed, key.depthWriteEnable);
+    hash_combine(seed, key.depthCompareOp);
+    hash_combine(seed, key.colorAttachmentFormat);
+    hash_combine(seed, key.depthAttachmentFormat);
+    hash_combine(seed, key.bDynamicState);
+    hash_combine(seed, key.bDynamicState3);
+    hash_combine(seed, key.libraryPart);
+    return seed;
+}
+
+
 // GraphicsPipelineBuilder method definitions:
 
 void GraphicsPipelineBuilder::clear() {
@@ -60,8 +214,11 @@ void GraphicsPipelineBuilder::clear() {
     _multisampling = {.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
     _depthStencil = {.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
     _dynamicRenderInfo = {.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO};
+    _colorAttachmentFormat = VK_FORMAT_UNDEFINED;
     _pipelineLayout = {};
     _shaderStages.clear();
+    _bDynamicState = false;
+    _bDynamicState3 = false;
 }
 
 void GraphicsPipelineBuilder::set_pipeline_layout(VkPipelineLayout pipelineLayout) {
@@ -149,7 +306,177 @@ void GraphicsPipelineBuilder::disable_depth_testing() {
     _depthStencil.maxDepthBounds = 1.f;
 }
 
+void GraphicsPipelineBuilder::enable_depth_testing(bool depthWriteEnable, VkCompareOp compareOp) {
+    _depthStencil.depthTestEnable = VK_TRUE;
+    _depthStencil.depthWriteEnable = depthWriteEnable;
+    _depthStencil.depthCompareOp = compareOp;
+    _depthStencil.depthBoundsTestEnable = VK_FALSE;
+    _depthStencil.stencilTestEnable = VK_FALSE;
+    _depthStencil.front = {};
+    _depthStencil.back = {};
+    _depthStencil.minDepthBounds = 0.f;
+    _depthStencil.maxDepthBounds = 1.f;
+}
+
+void GraphicsPipelineBuilder::enable_dynamic_state(const GraphicsPipelineFeatures& features) {
+    _bDynamicState = true;
+    _bDynamicState3 = features.bExtendedDynamicState3;
+}
+
+GraphicsPipelineKey GraphicsPipelineBuilder::get_key() const {
+    GraphicsPipelineKey key {};
+    for (const VkPipelineShaderStageCreateInfo& shaderStage : _shaderStages) {
+        if (shaderStage.stage == VK_SHADER_STAGE_VERTEX_BIT) {
+            key.vertexShaderModule = shaderStage.module;
+        }
+        else if (shaderStage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) {
+            key.fragmentShaderModule = shaderStage.module;
+        }
+    }
+    key.pipelineLayout = _pipelineLayout;
+
+    key.topology = _inputAssembly.topology;
+    key.primitiveRestartEnable = _inputAssembly.primitiveRestartEnable;
+
+    key.polygonMode = _rasterizer.polygonMode;
+    key.cullMode = _rasterizer.cullMode;
+    key.frontFace = _rasterizer.frontFace;
+    key.lineWidth = _rasterizer.lineWidth;
+
+    key.rasterizationSamples = _multisampling.rasterizationSamples;
+    key.sampleShadingEnable = _multisampling.sampleShadingEnable;
+    key.alphaToCoverageEnable = _multisampling.alphaToCoverageEnable;
+
+    key.blendEnable = _colorBlendAttachment.blendEnable;
+    key.srcColorBlendFactor = _colorBlendAttachment.srcColorBlendFactor;
+    key.dstColorBlendFactor = _colorBlendAttachment.dstColorBlendFactor;
+    key.colorBlendOp = _colorBlendAttachment.colorBlendOp;
+    key.srcAlphaBlendFactor = _colorBlendAttachment.srcAlphaBlendFactor;
+    key.dstAlphaBlendFactor = _colorBlendAttachment.dstAlphaBlendFactor;
+    key.alphaBlendOp = _colorBlendAttachment.alphaBlendOp;
+    key.colorWriteMask = _colorBlendAttachment.colorWriteMask;
+
+    key.depthTestEnable = _depthStencil.depthTestEnable;
+    key.depthWriteEnable = _depthStencil.depthWriteEnable;
+    key.depthCompareOp = _depthStencil.depthCompareOp;
+
+    key.colorAttachmentFormat = _dynamicRenderInfo.colorAttachmentCount > 0 ? _colorAttachmentFormat : VK_FORMAT_UNDEFINED;
+    key.depthAttachmentFormat = _dynamicRenderInfo.depthAttachmentFormat;
+
+    key.bDynamicState = _bDynamicState;
+    key.bDynamicState3 = _bDynamicState3;
+    if (_bDynamicState) {
+        key.cullMode = {};
+        key.frontFace = {};
+        key.depthTestEnable = VK_FALSE;
+        key.depthWriteEnable = VK_FALSE;
+        key.depthCompareOp = {};
+        key.primitiveRestartEnable = VK_FALSE;
+    }
+    if (_bDynamicState3) {
+        key.polygonMode = {};
+        key.blendEnable = VK_FALSE;
+        key.srcColorBlendFactor = {};
+        key.dstColorBlendFactor = {};
+        key.colorBlendOp = {};
+        key.srcAlphaBlendFactor = {};
+        key.dstAlphaBlendFactor = {};
+        key.alphaBlendOp = {};
+        key.colorWriteMask = {};
+    }
+    return key;
+}
+
+GraphicsPipelineKey GraphicsPipelineBuilder::get_library_key(VkGraphicsPipelineLibraryFlagsEXT libraryPart) const {
+    const GraphicsPipelineKey key = get_key();
+
+    GraphicsPipelineKey libraryKey {};
+    libraryKey.bDynamicState = key.bDynamicState;
+    libraryKey.bDynamicState3 = key.bDynamicState3;
+    libraryKey.libraryPart = libraryPart;
+    switch (libraryPart) {
+    case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT:
+        libraryKey.topology = key.topology;
+        libraryKey.primitiveRestartEnable = key.primitiveRestartEnable;
+        break;
+    case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT:
+        libraryKey.vertexShaderModule = key.vertexShaderModule;
+        libraryKey.pipelineLayout = key.pipelineLayout;
+        libraryKey.polygonMode = key.polygonMode;
+        libraryKey.cullMode = key.cullMode;
+        libraryKey.frontFace = key.frontFace;
+        libraryKey.lineWidth = key.lineWidth;
+        break;
+    case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT:
+        libraryKey.fragmentShaderModule = key.fragmentShaderModule;
+        libraryKey.pipelineLayout = key.pipelineLayout;
+        libraryKey.rasterizationSamples = key.rasterizationSamples;
+        libraryKey.sampleShadingEnable = key.sampleShadingEnable;
+        libraryKey.alphaToCoverageEnable = key.alphaToCoverageEnable;
+        libraryKey.depthTestEnable = key.depthTestEnable;
+        libraryKey.depthWriteEnable = key.depthWriteEnable;
+        libraryKey.depthCompareOp = key.depthCompareOp;
+        break;
+    case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT:
+        libraryKey.rasterizationSamples = key.rasterizationSamples;
+        libraryKey.sampleShadingEnable = key.sampleShadingEnable;
+        libraryKey.alphaToCoverageEnable = key.alphaToCoverageEnable;
+        libraryKey.blendEnable = key.blendEnable;
+        libraryKey.srcColorBlendFactor = key.srcColorBlendFactor;
+        libraryKey.dstColorBlendFactor = key.dstColorBlendFactor;
+        libraryKey.colorBlendOp = key.colorBlendOp;
+        libraryKey.srcAlphaBlendFactor = key.srcAlphaBlendFactor;
+        libraryKey.dstAlphaBlendFactor = key.dstAlphaBlendFactor;
+        libraryKey.alphaBlendOp = key.alphaBlendOp;
+        libraryKey.colorWriteMask = key.colorWriteMask;
+        libraryKey.colorAttachmentFormat = key.colorAttachmentFormat;
+        libraryKey.depthAttachmentFormat = key.depthAttachmentFormat;
+        break;
+    default:
+        // Several stages in one library: the whole key
+        libraryKey = key;
+        libraryKey.libraryPart = libraryPart;
+        break;
+    }
+    return libraryKey;
+}
+
+GraphicsDynamicState GraphicsPipelineBuilder::get_dynamic_state() const {
+    GraphicsDynamicState dynamicState {};
+    dynamicState.cullMode = _rasterizer.cullMode;
+    dynamicState.frontFace = _rasterizer.frontFace;
+    dynamicState.depthTestEnable = _depthStencil.depthTestEnable;
+    dynamicState.depthWriteEnable = _depthStencil.depthWriteEnable;
+    dynamicState.depthCompareOp = _depthStencil.depthCompareOp;
+    dynamicState.depthBiasEnable = _rasterizer.depthBiasEnable;
+    dynamicState.primitiveRestartEnable = _inputAssembly.primitiveRestartEnable;
+
+    dynamicState.polygonMode = _rasterizer.polygonMode;
+    dynamicState.blendEnable = _colorBlendAttachment.blendEnable;
+    dynamicState.blendEquation.srcColorBlendFactor = _colorBlendAttachment.srcColorBlendFactor;
+    dynamicState.blendEquation.dstColorBlendFactor = _colorBlendAttachment.dstColorBlendFactor;
+    dynamicState.blendEquation.colorBlendOp = _colorBlendAttachment.colorBlendOp;
+    dynamicState.blendEquation.srcAlphaBlendFactor = _colorBlendAttachment.srcAlphaBlendFactor;
+    dynamicState.blendEquation.dstAlphaBlendFactor = _colorBlendAttachment.dstAlphaBlendFactor;
+    dynamicState.blendEquation.alphaBlendOp = _colorBlendAttachment.alphaBlendOp;
+    dynamicState.colorWriteMask = _colorBlendAttachment.colorWriteMask;
+    return dynamicState;
+}
+
 VkPipeline GraphicsPipelineBuilder::build_pipeline(VkDevice device) {
+    return create_pipeline(device, 0);
+}
+
+VkPipeline GraphicsPipelineBuilder::build_pipeline_library(VkDevice device, VkGraphicsPipelineLibraryFlagsEXT libraryParts) {
+    return create_pipeline(device, libraryParts);
+}
+
+VkPipeline GraphicsPipelineBuilder::create_pipeline(VkDevice device, VkGraphicsPipelineLibraryFlagsEXT libraryParts) {
+    // Points at our own member: re-connected, in case this builder is a copy
+    if (_dynamicRenderInfo.colorAttachmentCount > 0) {
+        _dynamicRenderInfo.pColorAttachmentFormats = &_colorAttachmentFormat;
+    }
+
     // Make the Viewport state (will only support one viewport and scissor currently)
     // Viewport and Scissor will be dynamic, hence they'll be set during command-buffer recording time
     VkPipelineViewportStateCreateInfo viewport_state_create_info {};
@@ -190,6 +517,26 @@ VkPipeline GraphicsPipelineBuilder::build_pipeline(VkDevice device) {
 
     // Define the dynamic states
     std::vector<VkDynamicState> dynamic_states = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    if (_bDynamicState) {
+        dynamic_states.insert(dynamic_states.end(), {
+            VK_DYNAMIC_STATE_CULL_MODE,
+            VK_DYNAMIC_STATE_FRONT_FACE,
+            VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE,
+            VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE,
+            VK_DYNAMIC_STATE_DEPTH_COMPARE_OP,
+            VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE,
+            VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE,
+            VK_DYNAMIC_STATE_RASTERIZER_DISCARD_ENABLE
+        });
+    }
+    if (_bDynamicState3) {
+        dynamic_states.insert(dynamic_states.end(), {
+            VK_DYNAMIC_STATE_POLYGON_MODE_EXT,
+            VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT,
+            VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT,
+            VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT
+        });
+    }
     VkPipelineDynamicStateCreateInfo dynamic_state_create_info {};
     dynamic_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
     dynamic_state_create_info.pNext = nullptr;
@@ -198,15 +545,37 @@ VkPipeline GraphicsPipelineBuilder::build_pipeline(VkDevice device) {
 
     graphics_pipeline_create_info.pDynamicState = &dynamic_state_create_info;
 
+    // A library only takes the state of its stages: the other create-infos are ignored, but the shaders are picked here
+    VkGraphicsPipelineLibraryCreateInfoEXT library_create_info {};
+    std::vector<VkPipelineShaderStageCreateInfo> library_shader_stages {};
+    if (libraryParts != 0) {
+        library_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+        library_create_info.pNext = &_dynamicRenderInfo;
+        library_create_info.flags = libraryParts;
+
+        for (const VkPipelineShaderStageCreateInfo& shaderStage : _shaderStages) {
+            const bool bVertexStage = shaderStage.stage == VK_SHADER_STAGE_VERTEX_BIT && (libraryParts & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT) != 0;
+            const bool bFragmentStage = shaderStage.stage == VK_SHADER_STAGE_FRAGMENT_BIT && (libraryParts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT) != 0;
+            if (bVertexStage || bFragmentStage) {
+                library_shader_stages.push_back(shaderStage);
+            }
+        }
+
+        graphics_pipeline_create_info.pNext = &library_create_info;
+        graphics_pipeline_create_info.flags |= VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+        graphics_pipeline_create_info.stageCount = static_cast<uint32_t>(library_shader_stages.size());
+        graphics_pipeline_create_info.pStages = library_shader_stages.data();
+    }
+
 
     // Create the Graphics-Pipeline
     VkPipeline newGraphicsPipeline {VK_NULL_HANDLE};
     VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &newGraphicsPipeline);
     if (result != VK_SUCCESS) {
-        VK_LOG_ERROR("Failed to create graphics-pipeline");
+        VK_LOG_ERROR("Failed to create graphics-pipeline{}", libraryParts != 0 ? " library" : "");
         throw std::runtime_error("Failed to create graphics-pipeline");
     }
-    VK_LOG_SUCCESS("Created graphics-pipeline");
+    VK_LOG_SUCCESS("Created graphics-pipeline{}", libraryParts != 0 ? " library" : "");
 
     return newGraphicsPipeline;
 }
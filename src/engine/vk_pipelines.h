@@ -3,6 +3,123 @@
 
 namespace vkutil {
     bool load_shader_module(VkDevice device, VkShaderModule* outShaderModule, const char* filePath);
+
+    /// @brief Creates a compute-pipeline from an already loaded shader-module (entry-point "main").
+    /// @param specializationInfo Optional specialization-constants, e.g. the workgroup size. May be nullptr.
+    /// @note The shader-module is not destroyed, so more variants of the pipeline can be created from it.
+    /// @throws std::runtime_error if the pipeline could not be created
+    VkPipeline create_compute_pipeline(
+        VkDevice device,
+        VkPipelineLayout pipelineLayout,
+        VkShaderModule shaderModule,
+        const VkSpecializationInfo* specializationInfo = nullptr
+    );
+
+    /// @brief Links graphics-pipeline libraries (VK_EXT_graphics_pipeline_library) into a complete pipeline.
+    /// @note Without link-time optimization: fast enough to link on first use, at some cost in GPU performance
+    /// @throws std::runtime_error if the pipeline could not be linked
+    VkPipeline link_graphics_pipeline(VkDevice device, VkPipelineLayout pipelineLayout, std::span<const VkPipeline> libraries);
+};
+
+
+/// @brief The optional pipeline features of the device, enabled at device creation.
+/// @note The dynamic state of VK_EXT_extended_dynamic_state and VK_EXT_extended_dynamic_state2 is core in Vulkan 1.3
+struct GraphicsPipelineFeatures {
+    bool bExtendedDynamicState3 {false};    // Polygon mode and color blend state set at draw time
+    bool bGraphicsPipelineLibrary {false};  // Pipelines linked from separately compiled stages
+
+    // VK_EXT_extended_dynamic_state3 commands (null without it)
+    PFN_vkCmdSetPolygonModeEXT vkCmdSetPolygonModeEXT {nullptr};
+    PFN_vkCmdSetColorBlendEnableEXT vkCmdSetColorBlendEnableEXT {nullptr};
+    PFN_vkCmdSetColorBlendEquationEXT vkCmdSetColorBlendEquationEXT {nullptr};
+    PFN_vkCmdSetColorWriteMaskEXT vkCmdSetColorWriteMaskEXT {nullptr};
+
+    /// Loads the commands of the enabled extensions.
+    void load_functions(VkDevice device);
+};
+
+/// @brief The state a pipeline built with GraphicsPipelineBuilder::enable_dynamic_state() takes from the command-buffer.
+struct GraphicsDynamicState {
+    VkCullModeFlags cullMode {VK_CULL_MODE_NONE};
+    VkFrontFace frontFace {VK_FRONT_FACE_COUNTER_CLOCKWISE};
+    VkBool32 depthTestEnable {VK_FALSE};
+    VkBool32 depthWriteEnable {VK_FALSE};
+    VkCompareOp depthCompareOp {VK_COMPARE_OP_NEVER};
+    VkBool32 depthBiasEnable {VK_FALSE};
+    VkBool32 primitiveRestartEnable {VK_FALSE};
+
+    // Static without VK_EXT_extended_dynamic_state3
+    VkPolygonMode polygonMode {VK_POLYGON_MODE_FILL};
+    VkBool32 blendEnable {VK_FALSE};
+    VkColorBlendEquationEXT blendEquation {};
+    VkColorComponentFlags colorWriteMask {0};
+
+    /// Sets the state on the command-buffer, after binding a pipeline built with dynamic state.
+    void record(VkCommandBuffer commandBuffer, const GraphicsPipelineFeatures& features) const;
+};
+
+
+/// @brief Collects 32-bit specialization-constant values, and describes them in a VkSpecializationInfo.
+/// @attention The returned VkSpecializationInfo points into this object, keep it alive until the pipeline is created.
+class SpecializationConstants {
+public:
+    void add_constant(uint32_t constantID, uint32_t value);
+    void add_constant(uint32_t constantID, float value);
+
+    VkSpecializationInfo get_specialization_info() const;
+
+private:
+    std::vector<VkSpecializationMapEntry> _mapEntries;
+    std::vector<uint32_t> _data;
+};
+
+
+/// @brief The full state a GraphicsPipelineBuilder creates a pipeline from, as plain values (see PipelineRegistry).
+/// @note Two builders with equal keys create interchangeable pipelines
+struct GraphicsPipelineKey {
+    VkShaderModule vertexShaderModule {VK_NULL_HANDLE};
+    VkShaderModule fragmentShaderModule {VK_NULL_HANDLE};
+    VkPipelineLayout pipelineLayout {VK_NULL_HANDLE};
+
+    VkPrimitiveTopology topology {};
+    VkBool32 primitiveRestartEnable {VK_FALSE};
+
+    VkPolygonMode polygonMode {};
+    VkCullModeFlags cullMode {};
+    VkFrontFace frontFace {};
+    float lineWidth {0.f};
+
+    VkSampleCountFlagBits rasterizationSamples {};
+    VkBool32 sampleShadingEnable {VK_FALSE};
+    VkBool32 alphaToCoverageEnable {VK_FALSE};
+
+    VkBool32 blendEnable {VK_FALSE};
+    VkBlendFactor srcColorBlendFactor {};
+    VkBlendFactor dstColorBlendFactor {};
+    VkBlendOp colorBlendOp {};
+    VkBlendFactor srcAlphaBlendFactor {};
+    VkBlendFactor dstAlphaBlendFactor {};
+    VkBlendOp alphaBlendOp {};
+    VkColorComponentFlags colorWriteMask {};
+
+    VkBool32 depthTestEnable {VK_FALSE};
+    VkBool32 depthWriteEnable {VK_FALSE};
+    VkCompareOp depthCompareOp {};
+
+    VkFormat colorAttachmentFormat {VK_FORMAT_UNDEFINED};
+    VkFormat depthAttachmentFormat {VK_FORMAT_UNDEFINED};
+
+    // The dynamic state is left out of the other fields (0), so it doesn't multiply the pipelines
+    bool bDynamicState {false};
+    bool bDynamicState3 {false};
+    // A single stage of the pipeline (VK_EXT_graphics_pipeline_library), with only the fields it uses. 0: complete
+    VkGraphicsPipelineLibraryFlagsEXT libraryPart {0};
+
+    bool operator==(const GraphicsPipelineKey&) const = default;
+};
+
+struct GraphicsPipelineKeyHash {
+    size_t operator()(const GraphicsPipelineKey& key) const;
 };
 
 
@@ -25,8 +142,24 @@ public:
     void set_color_attachment_format(VkFormat colorAttachmentFormat);
     void set_depth_attachment_format(VkFormat depthAttachmentFormat);
     void disable_depth_testing();
+    void enable_depth_testing(bool depthWriteEnable, VkCompareOp compareOp);
 
+    /// Leaves the cull mode, front face, depth test, depth bias and primitive restart to the command-buffer, and with
+    /// VK_EXT_extended_dynamic_state3 the polygon mode and blending too. Their values set on this builder are then
+    /// only the defaults returned by get_dynamic_state().
+    void enable_dynamic_state(const GraphicsPipelineFeatures& features);
+
+    /// The state set so far, to look up an identical pipeline before building one.
+    GraphicsPipelineKey get_key() const;
+    /// The state used by one stage of the pipeline (a single VK_GRAPHICS_PIPELINE_LIBRARY_* bit).
+    GraphicsPipelineKey get_library_key(VkGraphicsPipelineLibraryFlagsEXT libraryPart) const;
+    /// The values to record for the dynamic state, as set on this builder.
+    GraphicsDynamicState get_dynamic_state() const;
+
+    /// @note The builder may be copied (e.g. into a job) and built from the copy
     VkPipeline build_pipeline(VkDevice device);
+    /// Builds one or more stages of the pipeline as a library, for vkutil::link_graphics_pipeline().
+    VkPipeline build_pipeline_library(VkDevice device, VkGraphicsPipelineLibraryFlagsEXT libraryParts);
 
 private:
     std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
@@ -41,4 +174,10 @@ private:
     VkFormat _colorAttachmentFormat;
     VkPipelineLayout _pipelineLayout;
 
+    bool _bDynamicState {false};
+    bool _bDynamicState3 {false};
+
+    /// Creates a complete pipeline (libraryParts 0), or a library of the given stages.
+    VkPipeline create_pipeline(VkDevice device, VkGraphicsPipelineLibraryFlagsEXT libraryParts);
+
 };
\ No newline at end of file
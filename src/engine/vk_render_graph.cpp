@@ -0,0 +1,625 @@
+#include "vk_render_graph.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "vk_logger.h"
+#include "vk_trace.h"
+
+namespace {
+    // Everything a pass-usage implies for the synchronization and the creation of a resource
+    struct ResourceAccess {
+        VkPipelineStageFlags2 stages {VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 readAccess {VK_ACCESS_2_NONE};
+        VkAccessFlags2 writeAccess {VK_ACCESS_2_NONE};
+        VkImageLayout layout {VK_IMAGE_LAYOUT_UNDEFINED};
+        VkImageUsageFlags imageUsageFlags {0};
+    };
+
+    // The scopes of a barrier derived from two consecutive accesses of a resource
+    struct BarrierScopes {
+        VkPipelineStageFlags2 srcStages {VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 srcAccess {VK_ACCESS_2_NONE};
+        VkPipelineStageFlags2 dstStages {VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 dstAccess {VK_ACCESS_2_NONE};
+        VkImageLayout oldLayout {VK_IMAGE_LAYOUT_UNDEFINED};
+        VkImageLayout newLayout {VK_IMAGE_LAYOUT_UNDEFINED};
+    };
+
+    ResourceAccess get_image_access(RenderGraphImageUsage usage, VkImageAspectFlags aspect) {
+        switch (usage) {
+            case RenderGraphImageUsage::COMPUTE_STORAGE_READ:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_ACCESS_2_NONE,
+                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT};
+            case RenderGraphImageUsage::COMPUTE_STORAGE_WRITE:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT};
+            case RenderGraphImageUsage::COMPUTE_STORAGE_READ_WRITE:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT};
+            case RenderGraphImageUsage::COMPUTE_SAMPLED:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_ACCESS_2_NONE,
+                        (aspect & VK_IMAGE_ASPECT_DEPTH_BIT) ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_IMAGE_USAGE_SAMPLED_BIT};
+            case RenderGraphImageUsage::COLOR_ATTACHMENT_WRITE:
+                return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+            case RenderGraphImageUsage::COLOR_ATTACHMENT_READ_WRITE:
+                return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+            case RenderGraphImageUsage::DEPTH_ATTACHMENT_WRITE:
+                return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+            case RenderGraphImageUsage::DEPTH_ATTACHMENT_READ:
+                return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_ACCESS_2_NONE,
+                        VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+            case RenderGraphImageUsage::TRANSFER_SRC:
+                return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_ACCESS_2_NONE,
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT};
+            case RenderGraphImageUsage::TRANSFER_DST:
+                return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+        }
+        return {};
+    }
+
+    ResourceAccess get_buffer_access(RenderGraphBufferUsage usage) {
+        switch (usage) {
+            case RenderGraphBufferUsage::COMPUTE_STORAGE_READ:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_ACCESS_2_NONE};
+            case RenderGraphBufferUsage::COMPUTE_STORAGE_WRITE:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+            case RenderGraphBufferUsage::COMPUTE_STORAGE_READ_WRITE:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+            case RenderGraphBufferUsage::VERTEX_STORAGE_READ:
+                return {VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_ACCESS_2_NONE};
+            case RenderGraphBufferUsage::INDIRECT_READ:
+                return {VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, VK_ACCESS_2_NONE};
+            case RenderGraphBufferUsage::INDEX_READ:
+                return {VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT, VK_ACCESS_2_NONE};
+            case RenderGraphBufferUsage::TRANSFER_SRC:
+                return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_ACCESS_2_NONE};
+            case RenderGraphBufferUsage::TRANSFER_DST:
+                return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT};
+        }
+        return {};
+    }
+}
+
+// Advances the state of a resource to the given access. Returns true (and the barrier scopes) when the access has to
+// wait for the previous ones. Buffers always stay in VK_IMAGE_LAYOUT_UNDEFINED, so they never need transitions.
+template <typename State>
+static bool advance_state(State& state, const ResourceAccess& access, BarrierScopes& outScopes) {
+    const bool bWrites = access.writeAccess != VK_ACCESS_2_NONE;
+    const bool bLayoutChange = access.layout != state.layout;
+
+    outScopes = BarrierScopes {};
+    outScopes.dstStages = access.stages;
+    outScopes.dstAccess = access.readAccess | access.writeAccess;
+    outScopes.oldLayout = state.layout;
+    outScopes.newLayout = access.layout;
+
+    if (bWrites || bLayoutChange) {
+        // Wait for the last write, and for every read since (write-after-read only needs an execution dependency)
+        outScopes.srcStages = state.writeStages | state.readStages;
+        outScopes.srcAccess = state.writeAccess;
+        const bool bNeedsBarrier = bLayoutChange || outScopes.srcStages != VK_PIPELINE_STAGE_2_NONE;
+
+        state.layout = access.layout;
+        if (bWrites) {
+            state.writeStages = access.stages;
+            state.writeAccess = access.writeAccess;
+            state.readStages = VK_PIPELINE_STAGE_2_NONE;
+            state.readAccess = VK_ACCESS_2_NONE;
+        }
+        else {
+            // The layout transition acts as the last write, and is visible to this read
+            state.writeStages = access.stages;
+            state.writeAccess = VK_ACCESS_2_NONE;
+            state.readStages = access.stages;
+            state.readAccess = access.readAccess;
+        }
+        return bNeedsBarrier;
+    }
+
+    // Read-after-read: only wait if the last write isn't already visible to these stages and accesses
+    const bool bAlreadyVisible = (access.stages & ~state.readStages) == 0 && (access.readAccess & ~state.readAccess) == 0;
+    const bool bNeedsBarrier = state.writeStages != VK_PIPELINE_STAGE_2_NONE && !bAlreadyVisible;
+    if (bNeedsBarrier) {
+        outScopes.srcStages = state.writeStages;
+        outScopes.srcAccess = state.writeAccess;
+    }
+    state.readStages |= access.stages;
+    state.readAccess |= access.readAccess;
+    return bNeedsBarrier;
+}
+
+static VkImageMemoryBarrier2 make_image_barrier(const RenderGraphImageInfo& imageInfo, const BarrierScopes& scopes) {
+    VkImageMemoryBarrier2 imageMemoryBarrier {};
+    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    imageMemoryBarrier.pNext = nullptr;
+    imageMemoryBarrier.srcStageMask = scopes.srcStages;
+    imageMemoryBarrier.srcAccessMask = scopes.srcAccess;
+    imageMemoryBarrier.dstStageMask = scopes.dstStages;
+    imageMemoryBarrier.dstAccessMask = scopes.dstAccess;
+    imageMemoryBarrier.oldLayout = scopes.oldLayout;
+    imageMemoryBarrier.newLayout = scopes.newLayout;
+    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.image = imageInfo.image;
+    imageMemoryBarrier.subresourceRange.aspectMask = imageInfo.aspect;
+    imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+    imageMemoryBarrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+    imageMemoryBarrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    return imageMemoryBarrier;
+}
+
+static VkBufferMemoryBarrier2 make_buffer_barrier(VkBuffer buffer, const BarrierScopes& scopes) {
+    VkBufferMemoryBarrier2 bufferMemoryBarrier {};
+    bufferMemoryBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    bufferMemoryBarrier.pNext = nullptr;
+    bufferMemoryBarrier.srcStageMask = scopes.srcStages;
+    bufferMemoryBarrier.srcAccessMask = scopes.srcAccess;
+    bufferMemoryBarrier.dstStageMask = scopes.dstStages;
+    bufferMemoryBarrier.dstAccessMask = scopes.dstAccess;
+    bufferMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferMemoryBarrier.buffer = buffer;
+    bufferMemoryBarrier.offset = 0;
+    bufferMemoryBarrier.size = VK_WHOLE_SIZE;
+    return bufferMemoryBarrier;
+}
+
+
+// RenderGraphPass method definitions:
+
+RenderGraphPass& RenderGraphPass::use_image(RenderGraphImageHandle image, RenderGraphImageUsage usage) {
+    _imageUses.emplace_back(image, usage);
+    return *this;
+}
+
+RenderGraphPass& RenderGraphPass::use_buffer(RenderGraphBufferHandle buffer, RenderGraphBufferUsage usage) {
+    _bufferUses.emplace_back(buffer, usage);
+    return *this;
+}
+
+
+// RenderGraph method definitions:
+
+RenderGraphImageHandle RenderGraph::import_image(const std::string& name, const RenderGraphImageInfo& imageInfo, bool bPreserveContents, VkImageLayout finalLayout) {
+    ImageResource resource {};
+    resource.name = name;
+    resource.info = imageInfo;
+    resource.bImported = true;
+    resource.bPreserveContents = bPreserveContents;
+    resource.finalLayout = finalLayout;
+
+    _images.push_back(resource);
+    return RenderGraphImageHandle {static_cast<uint32_t>(_images.size() - 1)};
+}
+
+void RenderGraph::set_imported_image(RenderGraphImageHandle image, VkImage vkImage, VkImageView imageView, VkPipelineStageFlags2 availableStages) {
+    ImageResource& resource = _images.at(image.index);
+    resource.info.image = vkImage;
+    resource.info.imageView = imageView;
+
+    // A different image: nothing to wait for but its availability, and no contents to keep
+    resource.state = ResourceState {};
+    resource.state.writeStages = availableStages;
+}
+
+RenderGraphImageHandle RenderGraph::create_transient_image(const std::string& name, VkFormat format, VkExtent3D extent, VkImageAspectFlags aspect) {
+    ImageResource resource {};
+    resource.name = name;
+    resource.info.format = format;
+    resource.info.extent = extent;
+    resource.info.aspect = aspect;
+    resource.bImported = false;
+
+    _images.push_back(resource);
+    return RenderGraphImageHandle {static_cast<uint32_t>(_images.size() - 1)};
+}
+
+RenderGraphBufferHandle RenderGraph::import_buffer(const std::string& name, VkBuffer buffer) {
+    BufferResource resource {};
+    resource.name = name;
+    resource.buffer = buffer;
+
+    _buffers.push_back(resource);
+    return RenderGraphBufferHandle {static_cast<uint32_t>(_buffers.size() - 1)};
+}
+
+RenderGraphPass& RenderGraph::add_pass(const std::string& name, RenderGraphPass::ExecuteFunction execute) {
+    if (_bCompiled) {
+        VK_LOG_ERROR("Render graph: pass {} added after compile()", name);
+        throw std::runtime_error("Render graph: pass added after compile()");
+    }
+    return _passes.emplace_back(name, std::move(execute));
+}
+
+void RenderGraph::compile(VkDevice device, VmaAllocator allocator) {
+    _device = device;
+    _allocator = allocator;
+
+    cull_passes();
+    create_transient_images();
+    _bCompiled = true;
+
+    VK_LOG_SUCCESS("Compiled render graph: {} passes ({} culled), {} transient images in {} memory blocks ({} KiB)",
+        _stats.passCount, _stats.culledPassCount, _stats.transientImageCount, _stats.transientMemoryBlockCount, _stats.transientMemoryBytes / 1024);
+}
+
+void RenderGraph::cull_passes() {
+    // Resources that are visible outside the graph: imported images whose contents persist or that are outputs,
+    // and every imported buffer (the graph doesn't know who reads them).
+    std::vector<bool> bImageNeeded(_images.size(), false);
+    for (uint32_t i {0}; i < _images.size(); i++) {
+        bImageNeeded[i] = _images[i].bImported && (_images[i].bPreserveContents || _images[i].finalLayout != VK_IMAGE_LAYOUT_UNDEFINED);
+    }
+
+    // Walk back from the last pass: a pass is needed if it writes something needed later (or has side effects).
+    // Then, everything it reads is needed by the earlier passes.
+    for (auto it = _passes.rbegin(); it != _passes.rend(); ++it) {
+        RenderGraphPass& pass = *it;
+
+        bool bNeeded = pass._bHasSideEffects;
+        for (const auto& [image, usage] : pass._imageUses) {
+            const ResourceAccess access = get_image_access(usage, _images.at(image.index).info.aspect);
+            bNeeded |= access.writeAccess != VK_ACCESS_2_NONE && bImageNeeded[image.index];
+        }
+        for (const auto& [buffer, usage] : pass._bufferUses) {
+            bNeeded |= get_buffer_access(usage).writeAccess != VK_ACCESS_2_NONE;
+        }
+
+        pass._bCulled = !bNeeded;
+        if (!bNeeded) {
+            VK_LOG_INFO("Render graph: culled the unused pass {}", pass._name);
+            continue;
+        }
+        for (const auto& [image, usage] : pass._imageUses) {
+            const ResourceAccess access = get_image_access(usage, _images.at(image.index).info.aspect);
+            if (access.readAccess != VK_ACCESS_2_NONE) {
+                bImageNeeded[image.index] = true;
+            }
+        }
+    }
+
+    _stats.passCount = static_cast<uint32_t>(_passes.size());
+    _stats.culledPassCount = static_cast<uint32_t>(std::count_if(_passes.begin(), _passes.end(), [](const RenderGraphPass& pass) { return pass._bCulled; }));
+}
+
+void RenderGraph::create_transient_images() {
+    // Lifetime (first and last pass using it) and usage-flags of every transient image
+    struct Lifetime {
+        uint32_t image;
+        uint32_t firstPass;
+        uint32_t lastPass;
+    };
+    std::vector<Lifetime> lifetimes {};
+
+    for (uint32_t imageIndex {0}; imageIndex < _images.size(); imageIndex++) {
+        ImageResource& resource = _images[imageIndex];
+        if (resource.bImported) {
+            continue;
+        }
+
+        Lifetime lifetime {imageIndex, UINT32_MAX, 0};
+        for (uint32_t passIndex {0}; passIndex < _passes.size(); passIndex++) {
+            const RenderGraphPass& pass = _passes[passIndex];
+            if (pass._bCulled) {
+                continue;
+            }
+            for (const auto& [image, usage] : pass._imageUses) {
+                if (image.index == imageIndex) {
+                    resource.usageFlags |= get_image_access(usage, resource.info.aspect).imageUsageFlags;
+                    lifetime.firstPass = std::min(lifetime.firstPass, passIndex);
+                    lifetime.lastPass = std::max(lifetime.lastPass, passIndex);
+                }
+            }
+        }
+        if (lifetime.firstPass == UINT32_MAX) {
+            VK_LOG_INFO("Render graph: transient image {} is unused", resource.name);
+            continue;
+        }
+        lifetimes.push_back(lifetime);
+    }
+
+    // Create the images, without memory
+    for (const Lifetime& lifetime : lifetimes) {
+        ImageResource& resource = _images[lifetime.image];
+
+        VkImageCreateInfo imageCreateInfo {};
+        imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageCreateInfo.pNext = nullptr;
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = resource.info.format;
+        imageCreateInfo.extent = resource.info.extent;
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = resource.usageFlags;
+        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkResult result = vkCreateImage(_device, &imageCreateInfo, nullptr, &resource.info.image);
+        if (result != VK_SUCCESS) {
+            VK_LOG_ERROR("Render graph: failed to create the transient image {}", resource.name);
+            throw std::runtime_error("Render graph: failed to create a transient image");
+        }
+    }
+
+    // Assign the images to memory blocks, in the order of their first use. An image reuses the memory of a block
+    // whose images are all done before its first pass (and whose memory-types are compatible).
+    std::sort(lifetimes.begin(), lifetimes.end(), [](const Lifetime& a, const Lifetime& b) { return a.firstPass < b.firstPass; });
+    for (const Lifetime& lifetime : lifetimes) {
+        ImageResource& resource = _images[lifetime.image];
+
+        VkMemoryRequirements requirements {};
+        vkGetImageMemoryRequirements(_device, resource.info.image, &requirements);
+
+        auto block = std::find_if(_memoryBlocks.begin(), _memoryBlocks.end(), [&](const MemoryBlock& memoryBlock) {
+            return memoryBlock.lastPass < lifetime.firstPass && (memoryBlock.requirements.memoryTypeBits & requirements.memoryTypeBits) != 0;
+        });
+        if (block == _memoryBlocks.end()) {
+            _memoryBlocks.push_back(MemoryBlock {VK_NULL_HANDLE, requirements, lifetime.lastPass, {}});
+            resource.memoryBlock = static_cast<uint32_t>(_memoryBlocks.size() - 1);
+            continue;
+        }
+
+        block->requirements.size = std::max(block->requirements.size, requirements.size);
+        block->requirements.alignment = std::max(block->requirements.alignment, requirements.alignment);
+        block->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+        block->lastPass = lifetime.lastPass;
+        resource.memoryBlock = static_cast<uint32_t>(block - _memoryBlocks.begin());
+    }
+
+    // Allocate the blocks, and bind the images (each at the start of its block)
+    VmaAllocationCreateInfo allocationCreateInfo {};
+    allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocationCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+    for (MemoryBlock& block : _memoryBlocks) {
+        VkResult result = vmaAllocateMemory(_allocator, &block.requirements, &allocationCreateInfo, &block.allocation, nullptr);
+        if (result != VK_SUCCESS) {
+            VK_LOG_ERROR("Render graph: failed to allocate {} bytes of transient memory", block.requirements.size);
+            throw std::runtime_error("Render graph: failed to allocate transient memory");
+        }
+        _stats.transientMemoryBytes += block.requirements.size;
+    }
+
+    for (const Lifetime& lifetime : lifetimes) {
+        ImageResource& resource = _images[lifetime.image];
+
+        VkResult result = vmaBindImageMemory(_allocator, _memoryBlocks.at(resource.memoryBlock).allocation, resource.info.image);
+        if (result != VK_SUCCESS) {
+            VK_LOG_ERROR("Render graph: failed to bind the memory of the transient image {}", resource.name);
+            throw std::runtime_error("Render graph: failed to bind transient memory");
+        }
+
+        VkImageViewCreateInfo imageViewCreateInfo {};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.pNext = nullptr;
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.image = resource.info.image;
+        imageViewCreateInfo.format = resource.info.format;
+        imageViewCreateInfo.subresourceRange.aspectMask = resource.info.aspect;
+        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+        result = vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &resource.info.imageView);
+        if (result != VK_SUCCESS) {
+            VK_LOG_ERROR("Render graph: failed to create the image-view of the transient image {}", resource.name);
+            throw std::runtime_error("Render graph: failed to create a transient image-view");
+        }
+    }
+
+    _stats.transientImageCount = static_cast<uint32_t>(lifetimes.size());
+    _stats.transientMemoryBlockCount = static_cast<uint32_t>(_memoryBlocks.size());
+}
+
+void RenderGraph::enable_gpu_timing(VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t framesInFlight) {
+    VkPhysicalDeviceProperties deviceProperties {};
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    uint32_t queueFamilyCount {0};
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    const uint32_t timestampValidBits = queueFamilyIndex < queueFamilyCount ? queueFamilies[queueFamilyIndex].timestampValidBits : 0;
+    if (timestampValidBits == 0 || deviceProperties.limits.timestampPeriod <= 0.f) {
+        VK_LOG_WARN("Render graph: timestamp queries unsupported, passes will not be timed");
+        return;
+    }
+    _timestampMask = timestampValidBits >= 64 ? std::numeric_limits<uint64_t>::max() : (uint64_t {1} << timestampValidBits) - 1;
+    _timestampPeriod = deviceProperties.limits.timestampPeriod;
+
+    _timestampsPerFrame = _stats.passCount - _stats.culledPassCount + 1;
+    _timingFramesInFlight = framesInFlight;
+    _bTimingFrameWritten.assign(framesInFlight, false);
+
+    VkQueryPoolCreateInfo queryPoolCreateInfo {};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.pNext = nullptr;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = _timestampsPerFrame * framesInFlight;
+
+    VkResult result = vkCreateQueryPool(_device, &queryPoolCreateInfo, nullptr, &_timestampQueryPool);
+    if (result != VK_SUCCESS) {
+        VK_LOG_WARN("Render graph: failed to create the timestamp query-pool, passes will not be timed");
+        _timestampQueryPool = VK_NULL_HANDLE;
+        return;
+    }
+
+    _passTimings.clear();
+    for (const RenderGraphPass& pass : _passes) {
+        if (!pass._bCulled) {
+            _passTimings.push_back(RenderGraphPassTiming {pass._name.c_str(), 0.f, 0, 0});
+        }
+    }
+}
+
+void RenderGraph::read_pass_timings(uint32_t frameSlot) {
+    // The frame that used this slot is complete (its fence was waited on), so the results should be available.
+    // Never wait for them: keep the previous timings instead.
+    std::vector<uint64_t> timestamps(_timestampsPerFrame);
+    VkResult result = vkGetQueryPoolResults(_device, _timestampQueryPool, frameSlot * _timestampsPerFrame, _timestampsPerFrame,
+        timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        return;
+    }
+
+    for (uint32_t i {0}; i < _passTimings.size(); i++) {
+        const uint64_t ticks = ((timestamps[i + 1] & _timestampMask) - (timestamps[i] & _timestampMask)) & _timestampMask;
+        _passTimings[i].milliseconds = static_cast<float>(static_cast<double>(ticks) * _timestampPeriod / 1e6);
+        _passTimings[i].beginTimestamp = timestamps[i] & _timestampMask;
+        _passTimings[i].endTimestamp = _passTimings[i].beginTimestamp + ticks;
+    }
+    _bPassTimingsUpdated = true;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+    ZONE("RenderGraph::execute");
+
+    _stats.barrierBatchCount = 0;
+    _stats.imageBarrierCount = 0;
+    _stats.bufferBarrierCount = 0;
+    _bPassTimingsUpdated = false;
+
+    // Timestamps of this frame go to the slot of the frame that ran (FRAME_OVERLAP) frames ago
+    const bool bTiming = _timestampQueryPool != VK_NULL_HANDLE;
+    uint32_t timestampQuery {0};
+    if (bTiming) {
+        const uint32_t frameSlot = _timingFrameIndex++ % _timingFramesInFlight;
+        if (_bTimingFrameWritten[frameSlot]) {
+            read_pass_timings(frameSlot);
+        }
+        _bTimingFrameWritten[frameSlot] = true;
+
+        timestampQuery = frameSlot * _timestampsPerFrame;
+        vkCmdResetQueryPool(commandBuffer, _timestampQueryPool, timestampQuery, _timestampsPerFrame);
+        vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _timestampQueryPool, timestampQuery++);
+    }
+
+    // Contents that don't survive from one frame to the next
+    for (ImageResource& resource : _images) {
+        if (resource.bImported && !resource.bPreserveContents) {
+            resource.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+    }
+    std::vector<bool> bTransientStarted(_images.size(), false);
+
+    std::vector<VkImageMemoryBarrier2> imageBarriers {};
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers {};
+    auto flush_barriers = [&]() {
+        if (imageBarriers.empty() && bufferBarriers.empty()) {
+            return;
+        }
+        VkDependencyInfo dependencyInfo {};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.pNext = nullptr;
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+        dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+        dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+        dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+        _stats.barrierBatchCount++;
+        _stats.imageBarrierCount += static_cast<uint32_t>(imageBarriers.size());
+        _stats.bufferBarrierCount += static_cast<uint32_t>(bufferBarriers.size());
+        imageBarriers.clear();
+        bufferBarriers.clear();
+    };
+
+    BarrierScopes scopes {};
+    for (RenderGraphPass& pass : _passes) {
+        if (pass._bCulled) {
+            continue;
+        }
+
+        for (const auto& [image, usage] : pass._imageUses) {
+            ImageResource& resource = _images.at(image.index);
+            const ResourceAccess access = get_image_access(usage, resource.info.aspect);
+
+            if (!resource.bImported && !bTransientStarted[image.index]) {
+                // First use this frame: take over the memory from its last user (an aliased image, or last frame)
+                resource.state = _memoryBlocks.at(resource.memoryBlock).state;
+                resource.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                bTransientStarted[image.index] = true;
+            }
+
+            if (advance_state(resource.state, access, scopes)) {
+                imageBarriers.push_back(make_image_barrier(resource.info, scopes));
+            }
+            if (!resource.bImported) {
+                _memoryBlocks.at(resource.memoryBlock).state = resource.state;
+            }
+        }
+
+        for (const auto& [buffer, usage] : pass._bufferUses) {
+            BufferResource& resource = _buffers.at(buffer.index);
+            if (advance_state(resource.state, get_buffer_access(usage), scopes)) {
+                bufferBarriers.push_back(make_buffer_barrier(resource.buffer, scopes));
+            }
+        }
+
+        flush_barriers();
+        pass._execute(commandBuffer);
+
+        if (bTiming) {
+            // Written once the pass (and everything before it) completed
+            vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _timestampQueryPool, timestampQuery++);
+        }
+    }
+
+    // Hand the outputs over in their final layouts
+    for (ImageResource& resource : _images) {
+        if (!resource.bImported || resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || resource.finalLayout == resource.state.layout) {
+            continue;
+        }
+        scopes = BarrierScopes {};
+        scopes.srcStages = resource.state.writeStages | resource.state.readStages;
+        scopes.srcAccess = resource.state.writeAccess;
+        scopes.dstStages = VK_PIPELINE_STAGE_2_NONE;  // Synchronized by the semaphores of the submission
+        scopes.dstAccess = VK_ACCESS_2_NONE;
+        scopes.oldLayout = resource.state.layout;
+        scopes.newLayout = resource.finalLayout;
+        imageBarriers.push_back(make_image_barrier(resource.info, scopes));
+
+        resource.state = ResourceState {};
+        resource.state.layout = resource.finalLayout;
+        resource.state.writeStages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    }
+    flush_barriers();
+}
+
+void RenderGraph::destroy() {
+    if (_timestampQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(_device, _timestampQueryPool, nullptr);
+        _timestampQueryPool = VK_NULL_HANDLE;
+    }
+    _passTimings.clear();
+
+    for (ImageResource& resource : _images) {
+        if (resource.bImported || resource.info.image == VK_NULL_HANDLE) {
+            continue;
+        }
+        vkDestroyImageView(_device, resource.info.imageView, nullptr);
+        vkDestroyImage(_device, resource.info.image, nullptr);
+    }
+    for (MemoryBlock& block : _memoryBlocks) {
+        vmaFreeMemory(_allocator, block.allocation);
+    }
+
+    _passes.clear();
+    _images.clear();
+    _buffers.clear();
+    _memoryBlocks.clear();
+    _bCompiled = false;
+    _stats = RenderGraphStats {};
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "vk_types.h"
+
+/// @brief How a pass uses an image. Determines the pipeline stages, access masks and image-layout of the access.
+enum class RenderGraphImageUsage : uint32_t {
+	COMPUTE_STORAGE_READ,           // imageLoad in a compute-shader (GENERAL)
+	COMPUTE_STORAGE_WRITE,          // imageStore in a compute-shader, previous contents are overwritten (GENERAL)
+	COMPUTE_STORAGE_READ_WRITE,     // imageLoad + imageStore in a compute-shader (GENERAL)
+	COMPUTE_SAMPLED,                // Sampled in a compute-shader (SHADER_READ_ONLY, or DEPTH_READ_ONLY for depth)
+	COLOR_ATTACHMENT_WRITE,         // Color attachment, cleared or fully overwritten
+	COLOR_ATTACHMENT_READ_WRITE,    // Color attachment, loaded (VK_ATTACHMENT_LOAD_OP_LOAD) or blended
+	DEPTH_ATTACHMENT_WRITE,         // Depth attachment with depth writes (and depth tests)
+	DEPTH_ATTACHMENT_READ,          // Depth attachment with depth tests only (DEPTH_READ_ONLY)
+	TRANSFER_SRC,                   // Source of a copy or blit
+	TRANSFER_DST                    // Destination of a copy, blit or clear
+};
+
+/// @brief How a pass uses a buffer. Determines the pipeline stages and access masks of the access.
+enum class RenderGraphBufferUsage : uint32_t {
+	COMPUTE_STORAGE_READ,
+	COMPUTE_STORAGE_WRITE,
+	COMPUTE_STORAGE_READ_WRITE,
+	VERTEX_STORAGE_READ,            // Storage-buffer read in a vertex-shader (e.g. per-instance data)
+	INDIRECT_READ,                  // Indirect draw/dispatch commands
+	INDEX_READ,
+	TRANSFER_SRC,
+	TRANSFER_DST
+};
+
+struct RenderGraphImageHandle {
+	uint32_t index {UINT32_MAX};
+};
+
+struct RenderGraphBufferHandle {
+	uint32_t index {UINT32_MAX};
+};
+
+/// @brief The Vulkan handles and properties of an image of the graph.
+struct RenderGraphImageInfo {
+	VkImage image {VK_NULL_HANDLE};
+	VkImageView imageView {VK_NULL_HANDLE};
+	VkFormat format {VK_FORMAT_UNDEFINED};
+	VkExtent3D extent {};
+	VkImageAspectFlags aspect {VK_IMAGE_ASPECT_COLOR_BIT};
+};
+
+/// @brief Counters of the compiled graph and of its last execution.
+struct RenderGraphStats {
+	uint32_t passCount {0};
+	uint32_t culledPassCount {0};
+	uint32_t transientImageCount {0};
+	uint32_t transientMemoryBlockCount {0};    // Transient images sharing a block are aliased
+	VkDeviceSize transientMemoryBytes {0};
+	uint32_t barrierBatchCount {0};           // vkCmdPipelineBarrier2 calls of the last execution
+	uint32_t imageBarrierCount {0};
+	uint32_t bufferBarrierCount {0};
+};
+
+/// @brief GPU time of a pass, measured with timestamp queries a few frames ago (the frames-in-flight).
+struct RenderGraphPassTiming {
+	const char* name;
+	float milliseconds;
+	uint64_t beginTimestamp;   // Raw timestamps (ticks of the device's clock), for placing the pass on a timeline
+	uint64_t endTimestamp;
+};
+
+/// @brief A pass of the render graph: the resources it uses, and the function recording its commands.
+class RenderGraphPass {
+public:
+	using ExecuteFunction = std::function<void(VkCommandBuffer)>;
+
+	RenderGraphPass(std::string name, ExecuteFunction execute) : _name(std::move(name)), _execute(std::move(execute)) {}
+
+	RenderGraphPass& use_image(RenderGraphImageHandle image, RenderGraphImageUsage usage);
+	RenderGraphPass& use_buffer(RenderGraphBufferHandle buffer, RenderGraphBufferUsage usage);
+
+	/// The pass is never culled, even if nothing reads what it writes.
+	/// For passes writing resources the graph doesn't know about (they must synchronize those themselves).
+	RenderGraphPass& set_side_effects() { _bHasSideEffects = true; return *this; }
+
+	const std::string& get_name() const { return _name; }
+
+private:
+	friend class RenderGraph;
+
+	std::string _name;
+	ExecuteFunction _execute;
+	bool _bHasSideEffects {false};
+	bool _bCulled {false};
+
+	std::vector<std::pair<RenderGraphImageHandle, RenderGraphImageUsage>> _imageUses {};
+	std::vector<std::pair<RenderGraphBufferHandle, RenderGraphBufferUsage>> _bufferUses {};
+};
+
+/// @brief A frame graph: the passes of a frame, in submission order, and the resources they use.
+///
+/// The passes declare how they use each image and buffer. From that, the graph:
+/// \n - derives the barriers (and image-layout transitions) needed before each pass, with the minimal stage and
+///      access masks, batched into a single @code vkCmdPipelineBarrier2@endcode per pass
+/// \n - culls the passes whose results are never used
+/// \n - allocates the transient images, aliasing the memory of those whose lifetimes do not overlap
+///
+/// Setup once: import/create resources -> add passes -> compile(). Then execute() once per frame.
+/// Resource states are tracked across executions, so the first barrier of a frame waits on the previous frame's uses.
+class RenderGraph {
+public:
+	/// Registers an image owned outside the graph.
+	/// @param bPreserveContents When false, the contents are discarded at the start of every frame (layout UNDEFINED)
+	/// @param finalLayout       Layout the image is transitioned to at the end of every frame (UNDEFINED: left as is).
+	///                          An image with a final layout is an output of the graph: passes writing it are never culled.
+	RenderGraphImageHandle import_image(const std::string& name, const RenderGraphImageInfo& imageInfo, bool bPreserveContents, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+	/// Points an imported image at another VkImage for the next executions (e.g. the acquired swapchain-image).
+	/// Its contents are considered undefined.
+	/// @param availableStages Stages to wait for before the first use (e.g. the swapchain-acquire semaphore's wait stage)
+	void set_imported_image(RenderGraphImageHandle image, VkImage vkImage, VkImageView imageView, VkPipelineStageFlags2 availableStages);
+
+	/// Declares an image owned by the graph, whose contents only live within a frame.
+	/// It is created by compile(), with the usage-flags of the passes using it.
+	RenderGraphImageHandle create_transient_image(const std::string& name, VkFormat format, VkExtent3D extent, VkImageAspectFlags aspect);
+
+	/// Registers a buffer owned outside the graph. Its contents are always preserved.
+	RenderGraphBufferHandle import_buffer(const std::string& name, VkBuffer buffer);
+
+	/// Adds a pass after the previously added ones.
+	/// @attention The returned reference stays valid until the graph is destroyed
+	RenderGraphPass& add_pass(const std::string& name, RenderGraphPass::ExecuteFunction execute);
+
+	/// Culls the unused passes, and creates the transient images (with memory aliasing).
+	void compile(VkDevice device, VmaAllocator allocator);
+
+	/// Records every pass that was not culled, each preceded by its batch of barriers.
+	void execute(VkCommandBuffer commandBuffer);
+
+	/// Times every pass with timestamp queries. One set of queries per frame in flight: the results of a set are
+	/// read back (without waiting) when it is reused, once the frame's fence has been waited on.
+	/// Does nothing if the queue doesn't support timestamps.
+	/// @attention Call after compile()
+	void enable_gpu_timing(VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t framesInFlight);
+	/// GPU times of the executed passes (each includes its barriers), in execution order. Empty without GPU timing.
+	std::span<const RenderGraphPassTiming> get_pass_timings() const { return _passTimings; }
+	/// True if the last execute() read back new timings: those of the frame that previously used its frame-slot.
+	bool has_new_pass_timings() const { return _bPassTimingsUpdated; }
+	/// Nanoseconds per timestamp tick.
+	float get_timestamp_period() const { return _timestampPeriod; }
+
+	void destroy();
+
+	const RenderGraphImageInfo& get_image(RenderGraphImageHandle image) const { return _images.at(image.index).info; }
+	const RenderGraphStats& get_stats() const { return _stats; }
+
+private:
+	// Synchronization state of a resource, carried from one access to the next
+	struct ResourceState {
+		VkImageLayout layout {VK_IMAGE_LAYOUT_UNDEFINED};
+		VkPipelineStageFlags2 writeStages {VK_PIPELINE_STAGE_2_NONE};  // Stages of the last write (or layout transition)
+		VkAccessFlags2 writeAccess {VK_ACCESS_2_NONE};
+		VkPipelineStageFlags2 readStages {VK_PIPELINE_STAGE_2_NONE};   // Stages that read since the last write
+		VkAccessFlags2 readAccess {VK_ACCESS_2_NONE};                   // Accesses the last write was made visible to
+	};
+
+	struct ImageResource {
+		std::string name;
+		RenderGraphImageInfo info;
+		bool bImported {false};
+		bool bPreserveContents {false};
+		VkImageLayout finalLayout {VK_IMAGE_LAYOUT_UNDEFINED};
+		VkImageUsageFlags usageFlags {0};  // Transient images: union of the declared usages
+		uint32_t memoryBlock {UINT32_MAX}; // Transient images: index of the memory block they are bound to
+		ResourceState state {};
+	};
+
+	struct BufferResource {
+		std::string name;
+		VkBuffer buffer {VK_NULL_HANDLE};
+		ResourceState state {};
+	};
+
+	// Memory shared by transient images with disjoint lifetimes
+	struct MemoryBlock {
+		VmaAllocation allocation {VK_NULL_HANDLE};
+		VkMemoryRequirements requirements {};
+		uint32_t lastPass {0};
+		ResourceState state {};  // Last uses of the memory, by any of the images bound to it
+	};
+
+	std::deque<RenderGraphPass> _passes {};
+	std::vector<ImageResource> _images {};
+	std::vector<BufferResource> _buffers {};
+	std::vector<MemoryBlock> _memoryBlocks {};
+
+	VkDevice _device {VK_NULL_HANDLE};
+	VmaAllocator _allocator {VK_NULL_HANDLE};
+	bool _bCompiled {false};
+	RenderGraphStats _stats {};
+
+	// GPU timing: (executed passes + 1) timestamps per frame in flight, one before the first pass and one after each
+	VkQueryPool _timestampQueryPool {VK_NULL_HANDLE};
+	uint32_t _timestampsPerFrame {0};
+	uint32_t _timingFramesInFlight {0};
+	uint32_t _timingFrameIndex {0};
+	std::vector<bool> _bTimingFrameWritten {};
+	uint64_t _timestampMask {0};
+	float _timestampPeriod {0.f};   // Nanoseconds per tick
+	std::vector<RenderGraphPassTiming> _passTimings {};
+	bool _bPassTimingsUpdated {false};
+
+	void cull_passes();
+	void create_transient_images();
+	void read_pass_timings(uint32_t frameSlot);
+};
@@ -0,0 +1,222 @@
+#include "vk_render_queue.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "vk_trace.h"
+
+namespace {
+
+    constexpr uint32_t RADIX_BITS {8};
+    constexpr uint32_t RADIX_SIZE {1u << RADIX_BITS};
+    constexpr uint32_t RADIX_PASS_COUNT {64 / RADIX_BITS};
+
+    static_assert(DRAW_KEY_PASS_BITS + DRAW_KEY_PIPELINE_BITS + DRAW_KEY_MATERIAL_BITS + DRAW_KEY_DEPTH_BITS == 64);
+
+    uint32_t get_digit(uint64_t key, uint32_t radixPass) {
+        return static_cast<uint32_t>(key >> (radixPass * RADIX_BITS)) & (RADIX_SIZE - 1);
+    }
+
+    uint64_t get_field_mask(uint32_t bits) {
+        return (uint64_t {1} << bits) - 1;
+    }
+
+}
+
+uint64_t make_draw_key(RenderQueuePass pass, uint32_t pipeline, uint32_t material, float depth) {
+    const double depthMax = static_cast<double>(get_field_mask(DRAW_KEY_DEPTH_BITS));
+    const uint64_t quantizedDepth = static_cast<uint64_t>(static_cast<double>(std::clamp(depth, 0.f, 1.f)) * depthMax);
+
+    uint64_t key = static_cast<uint64_t>(pass) & get_field_mask(DRAW_KEY_PASS_BITS);
+    key = (key << DRAW_KEY_PIPELINE_BITS) | (pipeline & get_field_mask(DRAW_KEY_PIPELINE_BITS));
+    key = (key << DRAW_KEY_MATERIAL_BITS) | (material & get_field_mask(DRAW_KEY_MATERIAL_BITS));
+    key = (key << DRAW_KEY_DEPTH_BITS) | quantizedDepth;
+    return key;
+}
+
+void RenderQueue::clear() {
+    _draws.clear();
+    _pushConstantData.clear();
+    _sortItems.clear();
+}
+
+void RenderQueue::push(uint64_t key, const RenderQueueDraw& draw, std::span<const std::byte> pushConstants) {
+    _sortItems.push_back(SortItem {key, static_cast<uint32_t>(_draws.size())});
+
+    RenderQueueDraw& queuedDraw = _draws.emplace_back(draw);
+    queuedDraw.pushConstantsOffset = static_cast<uint32_t>(_pushConstantData.size());
+    queuedDraw.pushConstantsSize = static_cast<uint32_t>(pushConstants.size());
+    _pushConstantData.insert(_pushConstantData.end(), pushConstants.begin(), pushConstants.end());
+}
+
+void RenderQueue::sort(JobSystem& jobSystem) {
+    ZONE("RenderQueue::sort");
+    const uint32_t count = static_cast<uint32_t>(_sortItems.size());
+    if (count < 2) {
+        return;
+    }
+    _sortScratch.resize(count);
+
+    // A single block is sorted on this thread: the jobs would cost more than they save
+    const uint32_t blockCount = (count + RENDER_QUEUE_SORT_BLOCK_SIZE - 1) / RENDER_QUEUE_SORT_BLOCK_SIZE;
+    auto for_each_block = [&](const std::function<void(uint32_t block, uint32_t begin, uint32_t end)>& function) {
+        auto run_blocks = [&](uint32_t firstBlock, uint32_t lastBlock) {
+            for (uint32_t block {firstBlock}; block < lastBlock; block++) {
+                function(block, block * RENDER_QUEUE_SORT_BLOCK_SIZE, std::min((block + 1) * RENDER_QUEUE_SORT_BLOCK_SIZE, count));
+            }
+        };
+        if (blockCount == 1) {
+            run_blocks(0, 1);
+        }
+        else {
+            jobSystem.parallel_for(blockCount, 1, run_blocks);
+        }
+    };
+
+    // 1) The bits that differ between the keys: a digit without any of them is the same in every key, and skipped
+    std::vector<uint64_t> blockBitsSet(blockCount, 0);
+    std::vector<uint64_t> blockBitsCleared(blockCount, 0);
+    for_each_block([&](uint32_t block, uint32_t begin, uint32_t end) {
+        uint64_t bitsSet {0};
+        uint64_t bitsCleared {0};
+        for (uint32_t i {begin}; i < end; i++) {
+            bitsSet |= _sortItems[i].key;
+            bitsCleared |= ~_sortItems[i].key;
+        }
+        blockBitsSet[block] = bitsSet;
+        blockBitsCleared[block] = bitsCleared;
+    });
+    uint64_t differingBits {0};
+    {
+        uint64_t bitsSet {0};
+        uint64_t bitsCleared {0};
+        for (uint32_t block {0}; block < blockCount; block++) {
+            bitsSet |= blockBitsSet[block];
+            bitsCleared |= blockBitsCleared[block];
+        }
+        differingBits = bitsSet & bitsCleared;
+    }
+
+    // 2) One stable counting sort per differing digit, from the least significant one
+    _blockHistograms.resize(blockCount * RADIX_SIZE);
+    for (uint32_t radixPass {0}; radixPass < RADIX_PASS_COUNT; radixPass++) {
+        if (get_digit(differingBits, radixPass) == 0) {
+            continue;
+        }
+
+        for_each_block([&](uint32_t block, uint32_t begin, uint32_t end) {
+            uint32_t* histogram = _blockHistograms.data() + block * RADIX_SIZE;
+            std::fill(histogram, histogram + RADIX_SIZE, 0u);
+            for (uint32_t i {begin}; i < end; i++) {
+                histogram[get_digit(_sortItems[i].key, radixPass)]++;
+            }
+        });
+
+        // Turned into the output offset of each block's keys: after the smaller digits, and after the earlier blocks
+        uint32_t offset {0};
+        for (uint32_t digit {0}; digit < RADIX_SIZE; digit++) {
+            for (uint32_t block {0}; block < blockCount; block++) {
+                uint32_t& histogramCount = _blockHistograms[block * RADIX_SIZE + digit];
+                const uint32_t digitCount = histogramCount;
+                histogramCount = offset;
+                offset += digitCount;
+            }
+        }
+
+        for_each_block([&](uint32_t block, uint32_t begin, uint32_t end) {
+            uint32_t* offsets = _blockHistograms.data() + block * RADIX_SIZE;
+            for (uint32_t i {begin}; i < end; i++) {
+                _sortScratch[offsets[get_digit(_sortItems[i].key, radixPass)]++] = _sortItems[i];
+            }
+        });
+        std::swap(_sortItems, _sortScratch);
+    }
+}
+
+void RenderQueue::record(VkCommandBuffer commandBuffer, RenderQueuePass pass, const GraphicsPipelineFeatures& features, CommandCounters& counters) const {
+    // The draws of a pass are contiguous: the pass is the most significant field of the keys
+    constexpr uint32_t passShift {64 - DRAW_KEY_PASS_BITS};
+    const uint64_t passValue = static_cast<uint64_t>(pass);
+    auto first = std::partition_point(_sortItems.begin(), _sortItems.end(), [&](const SortItem& item) { return (item.key >> passShift) < passValue; });
+    auto last = std::partition_point(first, _sortItems.end(), [&](const SortItem& item) { return (item.key >> passShift) == passValue; });
+
+    // The state bound by the previous draws
+    VkPipeline boundPipeline {VK_NULL_HANDLE};
+    const GraphicsDynamicState* boundDynamicState {nullptr};
+    VkPipelineLayout boundPipelineLayout {VK_NULL_HANDLE};
+    VkDescriptorSet boundDescriptorSet {VK_NULL_HANDLE};
+    VkBuffer boundIndexBuffer {VK_NULL_HANDLE};
+    const RenderQueueDraw* boundPushConstantsDraw {nullptr};
+
+    for (auto it = first; it != last; ++it) {
+        const RenderQueueDraw& draw = _draws[it->drawIndex];
+
+        if (draw.pipeline != boundPipeline) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.pipeline);
+            boundPipeline = draw.pipeline;
+            boundDynamicState = nullptr;
+            counters.pipelineBinds++;
+        }
+        else {
+            counters.skippedStateBinds++;
+        }
+        // Two draws may share a pipeline with different dynamic state
+        if (draw.dynamicState != nullptr && draw.dynamicState != boundDynamicState) {
+            draw.dynamicState->record(commandBuffer, features);
+            boundDynamicState = draw.dynamicState;
+        }
+
+        // The descriptor-sets and push-constants stay bound across pipelines of the same layout
+        if (draw.pipelineLayout != boundPipelineLayout) {
+            boundPipelineLayout = draw.pipelineLayout;
+            boundDescriptorSet = VK_NULL_HANDLE;
+            boundPushConstantsDraw = nullptr;
+        }
+
+        if (draw.descriptorSet != VK_NULL_HANDLE) {
+            if (draw.descriptorSet != boundDescriptorSet) {
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.pipelineLayout, 0, 1, &draw.descriptorSet, 0, nullptr);
+                boundDescriptorSet = draw.descriptorSet;
+                counters.descriptorSetBinds++;
+            }
+            else {
+                counters.skippedStateBinds++;
+            }
+        }
+
+        if (draw.pushConstantsSize > 0) {
+            const std::byte* pushConstants = _pushConstantData.data() + draw.pushConstantsOffset;
+            const bool bSamePushConstants = boundPushConstantsDraw != nullptr
+                && boundPushConstantsDraw->pushConstantStages == draw.pushConstantStages
+                && boundPushConstantsDraw->pushConstantsSize == draw.pushConstantsSize
+                && std::memcmp(_pushConstantData.data() + boundPushConstantsDraw->pushConstantsOffset, pushConstants, draw.pushConstantsSize) == 0;
+            if (!bSamePushConstants) {
+                vkCmdPushConstants(commandBuffer, draw.pipelineLayout, draw.pushConstantStages, 0, draw.pushConstantsSize, pushConstants);
+                boundPushConstantsDraw = &draw;
+            }
+            else {
+                counters.skippedStateBinds++;
+            }
+        }
+
+        if (draw.indexBuffer == VK_NULL_HANDLE) {
+            vkCmdDraw(commandBuffer, draw.vertexOrIndexCount, draw.instanceCount, draw.firstVertexOrIndex, draw.firstInstance);
+        }
+        else {
+            if (draw.indexBuffer != boundIndexBuffer) {
+                vkCmdBindIndexBuffer(commandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+                boundIndexBuffer = draw.indexBuffer;
+            }
+            else {
+                counters.skippedStateBinds++;
+            }
+            if (draw.indirectBuffer != VK_NULL_HANDLE) {
+                vkCmdDrawIndexedIndirect(commandBuffer, draw.indirectBuffer, draw.indirectOffset, draw.indirectDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+            }
+            else {
+                vkCmdDrawIndexed(commandBuffer, draw.vertexOrIndexCount, draw.instanceCount, draw.firstVertexOrIndex, draw.vertexOffset, draw.firstInstance);
+            }
+        }
+        counters.draws++;
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_jobs.h"
+#include "vk_pipelines.h"
+
+/// @brief The passes recording draws from the RenderQueue (the most significant bits of the draw keys).
+enum class RenderQueuePass : uint8_t {
+	GEOMETRY = 0,
+	LATE_GEOMETRY = 1   // After the late culling pass, into the same attachments (the newly visible instances)
+};
+
+/// @brief Bits of each field of a draw key, from the most to the least significant.
+constexpr uint32_t DRAW_KEY_PASS_BITS {8};
+constexpr uint32_t DRAW_KEY_PIPELINE_BITS {16};
+constexpr uint32_t DRAW_KEY_MATERIAL_BITS {16};
+constexpr uint32_t DRAW_KEY_DEPTH_BITS {24};
+
+/// @brief Keys per block of the parallel radix sort (one job per block). Fewer keys are sorted on the calling thread.
+constexpr uint32_t RENDER_QUEUE_SORT_BLOCK_SIZE {4096};
+
+/// @brief Encodes the sort order of a draw: by pass, then pipeline, then material (descriptor-sets, push-constants),
+/// then front-to-back. The state that is the most expensive to change changes the least often.
+/// @param pipeline Small id of the pipeline (e.g. its PipelineHandle), truncated to DRAW_KEY_PIPELINE_BITS
+/// @param material Small id of the descriptor-sets/material state, truncated to DRAW_KEY_MATERIAL_BITS
+/// @param depth Normalized depth in [0, 1] (clamped), quantized to DRAW_KEY_DEPTH_BITS
+uint64_t make_draw_key(RenderQueuePass pass, uint32_t pipeline, uint32_t material, float depth);
+
+/// @brief Everything needed to record one draw. Draws with the same state in a row only record the draw itself.
+struct RenderQueueDraw {
+	VkPipeline pipeline {VK_NULL_HANDLE};
+	VkPipelineLayout pipelineLayout {VK_NULL_HANDLE};
+	const GraphicsDynamicState* dynamicState {nullptr};   // Recorded along with the pipeline (if built with dynamic state)
+	VkDescriptorSet descriptorSet {VK_NULL_HANDLE};       // Set 0, none if null
+	VkBuffer indexBuffer {VK_NULL_HANDLE};                // vkCmdDraw if null, otherwise vkCmdDrawIndexed (uint32 indices)
+	VkShaderStageFlags pushConstantStages {0};
+
+	uint32_t vertexOrIndexCount {0};
+	uint32_t instanceCount {1};
+	uint32_t firstVertexOrIndex {0};
+	int32_t vertexOffset {0};
+	uint32_t firstInstance {0};
+
+	// vkCmdDrawIndexedIndirect of indirectDrawCount commands from this buffer if set (with an index-buffer): the
+	// counts and firsts above are then unused
+	VkBuffer indirectBuffer {VK_NULL_HANDLE};
+	VkDeviceSize indirectOffset {0};
+	uint32_t indirectDrawCount {0};
+
+	// Range of the queue's push-constant data (written by RenderQueue::push())
+	uint32_t pushConstantsOffset {0};
+	uint32_t pushConstantsSize {0};
+};
+
+/// @brief The draws of a frame, sorted by their 64-bit keys before being recorded (see make_draw_key()).
+///
+/// Per frame: clear() -> push() the draws -> sort() -> record() each pass.
+///
+/// The keys are sorted with an LSD radix sort, 8 bits per pass. Each pass counts the digits per block of keys and
+/// scatters the blocks in parallel, each to its own offsets (so the sort stays stable). The digits shared by every key
+/// (e.g. the pass, or the pipeline in a scene with few of them) are found by a first pass over the keys, and skipped.
+///
+/// Recording walks the sorted draws and only binds what changed since the previous draw: the pipeline (and its
+/// dynamic state), the descriptor-set, the index-buffer and the push-constants.
+class RenderQueue {
+public:
+	void clear();
+
+	/// Adds a draw. Its push-constants are copied into the queue.
+	void push(uint64_t key, const RenderQueueDraw& draw, std::span<const std::byte> pushConstants = {});
+
+	/// Sorts the draws by key, in parallel on the job system when there are enough of them.
+	void sort(JobSystem& jobSystem);
+
+	/// Records the sorted draws of a pass.
+	/// @attention Inside dynamic rendering, with the viewport and scissor already set. After sort().
+	void record(VkCommandBuffer commandBuffer, RenderQueuePass pass, const GraphicsPipelineFeatures& features, CommandCounters& counters) const;
+
+	uint32_t get_draw_count() const { return static_cast<uint32_t>(_draws.size()); }
+
+private:
+	struct SortItem {
+		uint64_t key;
+		uint32_t drawIndex;
+	};
+
+	std::vector<RenderQueueDraw> _draws {};
+	std::vector<std::byte> _pushConstantData {};
+
+	// Sorted by sort() (_sortItems), and its scratch array for the radix passes
+	std::vector<SortItem> _sortItems {};
+	std::vector<SortItem> _sortScratch {};
+	// Per block, the count of each digit value (256 per block)
+	std::vector<uint32_t> _blockHistograms {};
+};
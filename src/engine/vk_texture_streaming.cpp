@@ -0,0 +1,629 @@
+#include "vk_texture_streaming.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "vk_images.h"
+#include "vk_loader.h"
+#include "vk_logger.h"
+#include "vk_memory.h"
+#include "vk_mipmaps.h"
+#include "vk_trace.h"
+
+namespace {
+
+    // Finest mip of the always-resident tail
+    uint32_t get_tail_mip(VkExtent2D extent) {
+        uint32_t mip {0};
+        for (VkExtent2D mipExtent = extent; std::max(mipExtent.width, mipExtent.height) > TEXTURE_STREAMING_TAIL_SIZE; mip++) {
+            mipExtent = vkloader::get_mip_extent(extent, mip + 1);
+        }
+        return mip;
+    }
+
+    VkImageMemoryBarrier2 make_image_barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask) {
+        VkImageMemoryBarrier2 imageBarrier {};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        imageBarrier.pNext = nullptr;
+        imageBarrier.srcStageMask = srcStageMask;
+        imageBarrier.srcAccessMask = srcAccessMask;
+        imageBarrier.dstStageMask = dstStageMask;
+        imageBarrier.dstAccessMask = dstAccessMask;
+        imageBarrier.oldLayout = oldLayout;
+        imageBarrier.newLayout = newLayout;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = image;
+        imageBarrier.subresourceRange = VkImageSubresourceRange {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1};
+        return imageBarrier;
+    }
+
+    void pipeline_barrier(VkCommandBuffer commandBuffer, std::span<const VkImageMemoryBarrier2> imageBarriers) {
+        VkDependencyInfo dependencyInfo {};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.pNext = nullptr;
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+        dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+        vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    }
+
+}
+
+struct TextureStreamer::TextureLoad {
+    vkloader::MipChain mipChain {};
+    std::shared_ptr<const vkloader::Ktx2Header> ktx2Header {};   // Parsed by the first load of a KTX2 file
+};
+
+void TextureStreamer::init(VkDevice device, VmaAllocator allocator, AssetStreamer& assetStreamer, UploadQueue& uploadQueue, MipmapGenerator& mipmapGenerator, MemoryManager& memoryManager, VkDeviceSize budget, uint32_t framesInFlight) {
+    _device = device;
+    _allocator = allocator;
+    _assetStreamer = &assetStreamer;
+    _uploadQueue = &uploadQueue;
+    _mipmapGenerator = &mipmapGenerator;
+    _memoryManager = &memoryManager;
+    _budget = budget;
+    _framesInFlight = framesInFlight;
+
+    // Cleared to white by the first record()
+    _fallbackImage = create_image(VK_FORMAT_R8G8B8A8_UNORM, VkExtent2D {1, 1}, 0, 1);
+    _bFallbackCleared = false;
+
+    // The textures are allocated from the same memory type as the fallback: its heap's budget limits theirs
+    VmaAllocationInfo allocationInfo {};
+    vmaGetAllocationInfo(_allocator, _fallbackImage.vmaAllocation, &allocationInfo);
+    const VkPhysicalDeviceMemoryProperties* memoryProperties {nullptr};
+    vmaGetMemoryProperties(_allocator, &memoryProperties);
+    _heapIndex = memoryProperties->memoryTypes[allocationInfo.memoryType].heapIndex;
+
+    VK_LOG_SUCCESS("Initialized texture streaming ({} MiB budget, mip tail of {} texels)", _budget / (1024 * 1024), TEXTURE_STREAMING_TAIL_SIZE);
+}
+
+void TextureStreamer::destroy() {
+    auto destroy_image = [this](const AllocatedImage& image) {
+        if (image.image != VK_NULL_HANDLE) {
+            vkDestroyImageView(_device, image.imageView, nullptr);
+            vmaDestroyImage(_allocator, image.image, image.vmaAllocation);
+        }
+    };
+    for (const Texture& texture : _textures) {
+        if (texture.image.image != VK_NULL_HANDLE) {
+            _memoryManager->unregister(texture.image.vmaAllocation);
+        }
+        destroy_image(texture.image);
+        destroy_image(texture.pendingImage);
+    }
+    for (const RetiredImage& retiredImage : _retiredImages) {
+        destroy_image(retiredImage.image);
+    }
+    destroy_image(_fallbackImage);
+    _textures.clear();
+    _retiredImages.clear();
+    _plannedDrops.clear();
+    _mipGenerations.clear();
+    _mipCopies.clear();
+    _fallbackImage = {};
+}
+
+TextureHandle TextureStreamer::load_texture(const std::filesystem::path& path, bool bSrgb, float worldSize) {
+    const TextureHandle handle = static_cast<TextureHandle>(_textures.size());
+    Texture& texture = _textures.emplace_back();
+    texture.path = path;
+    texture.format = bSrgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    texture.worldSize = worldSize;
+    texture.bKtx2 = path.extension() == ".ktx2";
+    if (texture.bKtx2) {
+        // The first load only reads the start of the file (without going past its end)
+        std::error_code errorCode {};
+        texture.fileSize = std::filesystem::file_size(path, errorCode);
+        if (errorCode) {
+            texture.fileSize = 0;   // The read fails, and logs it
+        }
+    }
+
+    // Its size is only known once read: the first load decodes the tail, whatever it is
+    submit_load(handle, UINT32_MAX, StreamPriority::CRITICAL);
+    return handle;
+}
+
+void TextureStreamer::request_view_distance(TextureHandle texture, float distance) {
+    Texture& streamedTexture = _textures.at(texture);
+    streamedTexture.viewDistance = streamedTexture.bRequested ? std::min(streamedTexture.viewDistance, distance) : distance;
+    streamedTexture.bRequested = true;
+}
+
+void TextureStreamer::update(uint64_t frameNumber, float viewportHeight, float verticalFov, std::span<const VmaBudget> heapBudgets) {
+    ZONE("TextureStreamer::update");
+    _frameNumber = frameNumber;
+
+    // No frame in flight uses them anymore
+    std::erase_if(_retiredImages, [this](const RetiredImage& retiredImage) {
+        if (retiredImage.frameNumber + _framesInFlight > _frameNumber) {
+            return false;
+        }
+        vkDestroyImageView(_device, retiredImage.image.imageView, nullptr);
+        vmaDestroyImage(_allocator, retiredImage.image.image, retiredImage.image.vmaAllocation);
+        return true;
+    });
+
+    // Pixels covered by a meter seen at a distance of 1 meter (straight ahead)
+    const float pixelsPerMeter = viewportHeight / (2.f * std::tan(verticalFov * 0.5f));
+
+    VkDeviceSize residentBytes {0};
+    VkDeviceSize wantedBytes {0};
+    uint32_t loadsInFlight {0};
+    _order.clear();
+    for (TextureHandle handle {0}; handle < _textures.size(); handle++) {
+        Texture& texture = _textures[handle];
+        if (texture.image.image != VK_NULL_HANDLE) {
+            residentBytes += get_mips_size(texture, texture.residentMip);
+        }
+        if (texture.request != STREAM_REQUEST_NONE || texture.pendingImage.image != VK_NULL_HANDLE) {
+            // Its resident mips may be copied into the new image: not evicted meanwhile
+            if (texture.image.image != VK_NULL_HANDLE) {
+                _memoryManager->mark_streamable_used(texture.image.vmaAllocation);
+            }
+            loadsInFlight++;
+            if (texture.pendingImage.image != VK_NULL_HANDLE) {
+                residentBytes += get_mips_size(texture, texture.requestedMip);
+            }
+        }
+
+        const bool bRequested = texture.bRequested;
+        texture.bRequested = false;
+        if (texture.failedLoadCount >= TEXTURE_STREAMING_MAX_FAILED_LOADS) {
+            continue;
+        }
+        if (texture.mipCount == 0) {
+            // The mip tail failed to load: submitted again once the backoff is over
+            if (texture.failedLoadCount > 0 && texture.request == STREAM_REQUEST_NONE && _frameNumber >= texture.retryFrame) {
+                submit_load(handle, UINT32_MAX, StreamPriority::CRITICAL);
+                loadsInFlight++;
+            }
+            continue;
+        }
+        if (texture.image.image == VK_NULL_HANDLE && !bRequested && texture.request == STREAM_REQUEST_NONE && texture.pendingImage.image == VK_NULL_HANDLE) {
+            // Evicted while unused: loaded again once requested
+            continue;
+        }
+
+        if (bRequested) {
+            texture.lastRequestedFrame = _frameNumber;
+
+            // Texels of the texture per pixel on screen: the LOD the sampler picks (ignoring the slope of the surface)
+            const float texelsPerMeter = static_cast<float>(texture.extent.width) / texture.worldSize;
+            const float distance = std::max(texture.viewDistance, 0.01f);
+            const float lod = std::log2(std::max(texelsPerMeter * distance / pixelsPerMeter, FLT_MIN));
+            const uint32_t lodMip = std::min(lod > 0.f ? static_cast<uint32_t>(lod) : 0u, texture.tailMip);
+            if (texture.wantedMip == UINT32_MAX) {
+                texture.wantedMip = lodMip;
+            }
+            else if (lodMip < texture.wantedMip && lod < static_cast<float>(texture.wantedMip) - TEXTURE_STREAMING_LOD_HYSTERESIS) {
+                texture.wantedMip = lodMip;
+            }
+            else if (lodMip > texture.wantedMip && lod >= static_cast<float>(texture.wantedMip + 1) + TEXTURE_STREAMING_LOD_HYSTERESIS) {
+                texture.wantedMip = lodMip;
+            }
+        }
+        else {
+            // Unused: the farthest of all for the budget, and only the tail after a while
+            texture.viewDistance = FLT_MAX;
+            if (texture.wantedMip == UINT32_MAX || _frameNumber - texture.lastRequestedFrame >= TEXTURE_STREAMING_UNUSED_FRAMES) {
+                texture.wantedMip = texture.tailMip;
+            }
+        }
+        texture.targetMip = texture.wantedMip;
+        wantedBytes += get_mips_size(texture, texture.wantedMip);
+        _order.push_back(handle);
+    }
+
+    // The budget can't go over what the textures hold plus the room left in their heap (before the memory manager
+    // starts evicting)
+    VkDeviceSize budget = _budget;
+    if (_heapIndex < heapBudgets.size()) {
+        const VmaBudget& heapBudget = heapBudgets[_heapIndex];
+        const VkDeviceSize heapLimit = static_cast<VkDeviceSize>(static_cast<double>(heapBudget.budget) * MEMORY_BUDGET_HIGH_WATERMARK);
+        const VkDeviceSize heapRoom = heapLimit > heapBudget.usage ? heapLimit - heapBudget.usage : 0;
+        budget = std::min(budget, residentBytes + heapRoom);
+    }
+
+    // Over the budget: one mip coarser at a time per texture, the farthest first, until it fits (the tails always stay)
+    std::sort(_order.begin(), _order.end(), [this](TextureHandle a, TextureHandle b) {
+        return _textures[a].viewDistance > _textures[b].viewDistance;
+    });
+    VkDeviceSize targetBytes = wantedBytes;
+    for (bool bCoarsened {true}; targetBytes > budget && bCoarsened;) {
+        bCoarsened = false;
+        for (TextureHandle handle : _order) {
+            Texture& texture = _textures[handle];
+            if (texture.targetMip >= texture.tailMip) {
+                continue;
+            }
+            targetBytes -= get_mips_size(texture, texture.targetMip) - get_mips_size(texture, texture.targetMip + 1);
+            texture.targetMip++;
+            bCoarsened = true;
+            if (targetBytes <= budget) {
+                break;
+            }
+        }
+    }
+
+    // The nearest first: they get the loads in flight
+    _plannedDrops.clear();
+    for (auto it = _order.rbegin(); it != _order.rend(); ++it) {
+        Texture& texture = _textures[*it];
+        if (texture.request != STREAM_REQUEST_NONE) {
+            // Finer than wanted now (the camera moved away, or the budget shrank): dropped wherever it is, the
+            // coarser load is submitted by the next frames
+            if (texture.targetMip > texture.requestedMip && _assetStreamer->cancel(texture.request)) {
+                texture.request = STREAM_REQUEST_NONE;
+                loadsInFlight--;
+                _stats.cancelledCount++;
+            }
+            continue;
+        }
+        if (texture.pendingImage.image != VK_NULL_HANDLE) {
+            continue;
+        }
+
+        if (texture.targetMip < texture.residentMip && loadsInFlight < TEXTURE_STREAMING_MAX_LOADS_IN_FLIGHT && _frameNumber >= texture.retryFrame) {
+            // Far from the wanted detail: ahead of the textures only missing a level
+            const StreamPriority priority = texture.residentMip - texture.targetMip >= 2 ? StreamPriority::HIGH : StreamPriority::NORMAL;
+            submit_load(*it, texture.targetMip, priority);
+            loadsInFlight++;
+        }
+        else if (texture.targetMip > texture.residentMip) {
+            _plannedDrops.push_back(PlannedDrop {*it, texture.targetMip});
+        }
+    }
+
+    _stats.textureCount = static_cast<uint32_t>(_textures.size());
+    _stats.loadsInFlight = loadsInFlight;
+    _stats.budgetBytes = budget;
+    _stats.residentBytes = residentBytes;
+    _stats.wantedBytes = wantedBytes;
+}
+
+void TextureStreamer::record(VkCommandBuffer commandBuffer, CommandCounters& counters) {
+    if (!_bFallbackCleared) {
+        vkutil::transition_image_layout(commandBuffer, _fallbackImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        const VkClearColorValue white {{1.f, 1.f, 1.f, 1.f}};
+        const VkImageSubresourceRange range {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        vkCmdClearColorImage(commandBuffer, _fallbackImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &white, 1, &range);
+        vkutil::transition_image_layout(commandBuffer, _fallbackImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        counters.pipelineBarriers += 2;
+        _bFallbackCleared = true;
+    }
+
+    // Swapped in once generated. Past the generator's limit per frame, the others wait for the next frame (on their
+    // previous image)
+    size_t generatedCount {0};
+    for (; generatedCount < _mipGenerations.size(); generatedCount++) {
+        Texture& texture = _textures[_mipGenerations[generatedCount]];
+        if (!_mipmapGenerator->generate(commandBuffer, texture.pendingImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, counters)) {
+            break;
+        }
+        set_image(_mipGenerations[generatedCount], texture.pendingImage, texture.requestedMip, true);
+        texture.pendingImage = {};
+        _generation++;
+    }
+    _mipGenerations.erase(_mipGenerations.begin(), _mipGenerations.begin() + static_cast<std::ptrdiff_t>(generatedCount));
+
+    if (_mipCopies.empty() && _plannedDrops.empty()) {
+        return;
+    }
+    ZONE("TextureStreamer::record");
+
+    // The remaining mips of each dropped texture, copied into a smaller image
+    std::vector<AllocatedImage> newImages {};
+    for (const PlannedDrop& drop : _plannedDrops) {
+        const Texture& texture = _textures[drop.texture];
+        newImages.push_back(create_image(texture.format, texture.extent, drop.mip, texture.mipCount));
+        _mipCopies.push_back(MipCopy {drop.texture, texture.image.image, texture.residentMip, newImages.back().image, drop.mip, VK_IMAGE_LAYOUT_UNDEFINED, drop.mip});
+    }
+
+    std::vector<VkImageMemoryBarrier2> imageBarriers {};
+    for (const MipCopy& copy : _mipCopies) {
+        // The previous frames only sampled the old image: nothing to make visible. The uploaded levels of a refined
+        // image were made visible by the upload.
+        imageBarriers.push_back(make_image_barrier(copy.srcImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT));
+        imageBarriers.push_back(make_image_barrier(copy.dstImage, copy.dstLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT));
+    }
+    pipeline_barrier(commandBuffer, imageBarriers);
+
+    std::vector<VkImageCopy> regions {};
+    for (const MipCopy& copy : _mipCopies) {
+        const Texture& texture = _textures[copy.texture];
+        regions.clear();
+        for (uint32_t mip {copy.firstMip}; mip < texture.mipCount; mip++) {
+            const VkExtent2D mipExtent = vkloader::get_mip_extent(texture.extent, mip);
+            VkImageCopy region {};
+            region.srcSubresource = VkImageSubresourceLayers {VK_IMAGE_ASPECT_COLOR_BIT, mip - copy.srcFirstMip, 0, 1};
+            region.dstSubresource = VkImageSubresourceLayers {VK_IMAGE_ASPECT_COLOR_BIT, mip - copy.dstFirstMip, 0, 1};
+            region.extent = VkExtent3D {mipExtent.width, mipExtent.height, 1};
+            regions.push_back(region);
+        }
+        vkCmdCopyImage(commandBuffer, copy.srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, copy.dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            static_cast<uint32_t>(regions.size()), regions.data());
+    }
+
+    imageBarriers.clear();
+    for (const MipCopy& copy : _mipCopies) {
+        imageBarriers.push_back(make_image_barrier(copy.dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT));
+    }
+    pipeline_barrier(commandBuffer, imageBarriers);
+    counters.pipelineBarriers += 2;
+    _mipCopies.clear();
+
+    for (size_t i {0}; i < _plannedDrops.size(); i++) {
+        set_image(_plannedDrops[i].texture, newImages[i], _plannedDrops[i].mip, false);
+        _stats.dropCount++;
+    }
+    _plannedDrops.clear();
+    _generation++;
+}
+
+VkImageView TextureStreamer::get_image_view(TextureHandle texture) const {
+    if (texture >= _textures.size() || _textures[texture].image.image == VK_NULL_HANDLE) {
+        return _fallbackImage.imageView;
+    }
+    return _textures[texture].image.imageView;
+}
+
+void TextureStreamer::mark_used(TextureHandle texture) {
+    if (texture < _textures.size() && _textures[texture].image.image != VK_NULL_HANDLE) {
+        _memoryManager->mark_streamable_used(_textures[texture].image.vmaAllocation);
+    }
+}
+
+void TextureStreamer::submit_load(TextureHandle texture, uint32_t firstMip, StreamPriority priority) {
+    Texture& streamedTexture = _textures[texture];
+    const bool bSrgb = streamedTexture.format == VK_FORMAT_R8G8B8A8_SRGB;
+
+    // Decoded by a job, uploaded by the completion (render thread)
+    auto load = std::make_shared<TextureLoad>();
+    load->ktx2Header = streamedTexture.ktx2Header;
+    StreamRequest request {};
+    request.path = streamedTexture.path;
+    request.priority = priority;
+    if (streamedTexture.bKtx2) {
+        uint32_t levelCount {UINT32_MAX};
+        if (firstMip == UINT32_MAX) {
+            // The header, level index and smallest levels: the mip tail
+            request.size = std::min<uint64_t>(streamedTexture.fileSize, vkloader::KTX2_HEADER_READ_SIZE);
+        }
+        else {
+            // The levels [firstMip, residentMip) only: the coarser ones are copied from the resident image
+            const uint32_t levelEnd = streamedTexture.image.image != VK_NULL_HANDLE
+                ? std::min(streamedTexture.residentMip, static_cast<uint32_t>(streamedTexture.ktx2Header->levels.size()))
+                : static_cast<uint32_t>(streamedTexture.ktx2Header->levels.size());
+            levelCount = levelEnd - firstMip;
+            uint64_t begin {UINT64_MAX};
+            uint64_t end {0};
+            for (uint32_t mip {firstMip}; mip < levelEnd; mip++) {
+                const vkloader::MipLevelData& level = streamedTexture.ktx2Header->levels[mip];
+                begin = std::min<uint64_t>(begin, level.offset);
+                end = std::max<uint64_t>(end, level.offset + level.size);
+            }
+            request.offset = begin;
+            request.size = end - begin;
+        }
+        request.decode = [load, firstMip, levelCount, fileOffset = request.offset](StreamResult& result) {
+            if (!load->ktx2Header) {
+                auto header = std::make_shared<vkloader::Ktx2Header>();
+                if (!vkloader::read_ktx2_header(result.fileData, *header)) {
+                    return false;
+                }
+                load->ktx2Header = std::move(header);
+            }
+            const uint32_t decodedMip = firstMip == UINT32_MAX ? get_tail_mip(load->ktx2Header->extent) : firstMip;
+            return vkloader::load_ktx2_mips(result.fileData, fileOffset, *load->ktx2Header, decodedMip, load->mipChain, levelCount);
+        };
+    }
+    else {
+        // Only the finest mip if the GPU can generate the others (formats without linear blits nor storage, and images
+        // too large for the compute downsampler: on the CPU)
+        const VkExtent2D decodedExtent = firstMip == UINT32_MAX ? VkExtent2D {TEXTURE_STREAMING_TAIL_SIZE, TEXTURE_STREAMING_TAIL_SIZE}
+            : vkloader::get_mip_extent(streamedTexture.extent, firstMip);
+        const uint32_t levelCount = _mipmapGenerator->supports_image(streamedTexture.format, decodedExtent) ? 1 : UINT32_MAX;
+        request.decode = [load, firstMip, bSrgb, levelCount](StreamResult& result) {
+            uint32_t decodedMip = firstMip;
+            if (decodedMip == UINT32_MAX) {
+                VkExtent2D extent {};
+                if (!vkloader::get_image_extent(result.fileData, extent)) {
+                    VK_LOG_WARN("Unsupported texture image file");
+                    return false;
+                }
+                decodedMip = get_tail_mip(extent);
+            }
+            return vkloader::decode_image_mips(result.fileData, decodedMip, bSrgb, load->mipChain, levelCount);
+        };
+    }
+    request.complete = [this, texture, load](StreamResult& result) {
+        finish_load(texture, *load, result.status);
+    };
+
+    streamedTexture.request = _assetStreamer->submit(std::move(request));
+    streamedTexture.requestedMip = firstMip;
+}
+
+void TextureStreamer::finish_load(TextureHandle texture, const TextureLoad& load, StreamStatus status) {
+    Texture& streamedTexture = _textures[texture];
+    streamedTexture.request = STREAM_REQUEST_NONE;
+    if (status == StreamStatus::FAILED) {
+        // The texture stays on the fallback, or on the mips it has, until the retry
+        _stats.failedCount++;
+        streamedTexture.failedLoadCount++;
+        const std::string mips = streamedTexture.mipCount == 0 ? std::string("mip tail") : fmt::format("mips from {}", streamedTexture.requestedMip);
+        if (streamedTexture.failedLoadCount >= TEXTURE_STREAMING_MAX_FAILED_LOADS) {
+            VK_LOG_ERROR("Texture streaming: failed to load the {} of {} {} times in a row, no longer streamed", mips, streamedTexture.path.string(),
+                streamedTexture.failedLoadCount);
+            return;
+        }
+        const uint64_t retryFrames = TEXTURE_STREAMING_RETRY_FRAMES << (streamedTexture.failedLoadCount - 1);
+        streamedTexture.retryFrame = _frameNumber + retryFrames;
+        VK_LOG_WARN("Texture streaming: failed to load the {} of {}, retried in {} frames", mips, streamedTexture.path.string(), retryFrames);
+        return;
+    }
+    streamedTexture.failedLoadCount = 0;
+
+    const vkloader::MipChain& mipChain = load.mipChain;
+    if (streamedTexture.mipCount == 0) {
+        streamedTexture.format = mipChain.format;
+        streamedTexture.ktx2Header = load.ktx2Header;
+        streamedTexture.extent = mipChain.extent;
+        streamedTexture.mipCount = mipChain.mipCount;
+        // A KTX2 file may hold fewer levels than the full chain
+        streamedTexture.tailMip = std::min(get_tail_mip(mipChain.extent), mipChain.mipCount - 1);
+    }
+    streamedTexture.requestedMip = mipChain.firstMip;
+
+    // The levels past the loaded ones: copied from the resident image if it holds them (a KTX2 refinement), else
+    // generated from the finest one
+    const uint32_t loadedEndMip = mipChain.firstMip + static_cast<uint32_t>(mipChain.levels.size());
+    const bool bCopyResidentMips = loadedEndMip < streamedTexture.mipCount && streamedTexture.image.image != VK_NULL_HANDLE && streamedTexture.residentMip <= loadedEndMip;
+    const bool bGenerateMips = loadedEndMip < streamedTexture.mipCount && !bCopyResidentMips;
+    streamedTexture.pendingImage = create_image(streamedTexture.format, streamedTexture.extent, mipChain.firstMip, streamedTexture.mipCount, bGenerateMips);
+    std::vector<ImageUploadLevel> levels {};
+    for (uint32_t i {0}; i < mipChain.levels.size(); i++) {
+        levels.push_back(ImageUploadLevel {i, mipChain.levels[i].extent, mipChain.levels[i].offset});
+    }
+
+    // Swapped in once copied, by UploadQueue::record() (before the passes of that frame)
+    const uint32_t firstMip = mipChain.firstMip;
+    _uploadQueue->upload_image(streamedTexture.pendingImage.image, streamedTexture.format, levels, mipChain.data, [this, texture, firstMip, loadedEndMip, bCopyResidentMips, bGenerateMips]() {
+        if (bGenerateMips) {
+            // Swapped in by record(), once its mips are generated
+            _mipGenerations.push_back(texture);
+            return;
+        }
+        Texture& uploadedTexture = _textures[texture];
+        if (bCopyResidentMips) {
+            // Recorded by record(), before the frame samples it (the retired image lives until the frame is done)
+            _mipCopies.push_back(MipCopy {texture, uploadedTexture.image.image, uploadedTexture.residentMip, uploadedTexture.pendingImage.image, firstMip,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, loadedEndMip});
+        }
+        set_image(texture, uploadedTexture.pendingImage, firstMip, false);
+        uploadedTexture.pendingImage = {};
+        _generation++;
+    });
+    _stats.loadCount++;
+}
+
+AllocatedImage TextureStreamer::create_image(VkFormat format, VkExtent2D extent, uint32_t firstMip, uint32_t mipCount, bool bGenerateMips) {
+    const VkImageCreateInfo imageCreateInfo = get_image_create_info(format, extent, firstMip, mipCount, bGenerateMips);
+
+    AllocatedImage image {};
+    image.imageFormat = format;
+    image.imageExtent = imageCreateInfo.extent;
+    image.mipLevels = imageCreateInfo.mipLevels;
+
+    VmaAllocationCreateInfo allocationCreateInfo {};
+    allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocationCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+    VkResult result = vmaCreateImage(_allocator, &imageCreateInfo, &allocationCreateInfo, &image.image, &image.vmaAllocation, nullptr);
+    if (result != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create streamed texture image!");
+        throw std::runtime_error("Failed to create streamed texture image!");
+    }
+    image.imageView = create_image_view(image.image, format, image.mipLevels);
+    return image;
+}
+
+VkImageCreateInfo TextureStreamer::get_image_create_info(VkFormat format, VkExtent2D extent, uint32_t firstMip, uint32_t mipCount, bool bGenerateMips) const {
+    const VkExtent2D firstMipExtent = vkloader::get_mip_extent(extent, firstMip);
+
+    VkImageCreateInfo imageCreateInfo {};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.pNext = nullptr;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = format;
+    imageCreateInfo.extent = VkExtent3D {firstMipExtent.width, firstMipExtent.height, 1};
+    imageCreateInfo.mipLevels = mipCount - firstMip;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    // Uploaded to, and copied from/to when mips are dropped (and by the defragmentation)
+    imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    if (bGenerateMips) {
+        imageCreateInfo.usage |= _mipmapGenerator->get_image_usage(format);
+    }
+    return imageCreateInfo;
+}
+
+VkImageView TextureStreamer::create_image_view(VkImage image, VkFormat format, uint32_t mipLevels) const {
+    VkImageViewCreateInfo imageViewCreateInfo {};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.pNext = nullptr;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCreateInfo.image = image;
+    imageViewCreateInfo.format = format;
+    imageViewCreateInfo.subresourceRange = VkImageSubresourceRange {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1};
+    // The single-channel formats (grayscale data) are sampled as gray, not red
+    if (format == VK_FORMAT_R8_UNORM || format == VK_FORMAT_BC4_UNORM_BLOCK) {
+        imageViewCreateInfo.components = VkComponentMapping {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE};
+    }
+
+    VkImageView imageView {VK_NULL_HANDLE};
+    if (vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &imageView) != VK_SUCCESS) {
+        VK_LOG_ERROR("Failed to create streamed texture image-view!");
+        throw std::runtime_error("Failed to create streamed texture image-view!");
+    }
+    return imageView;
+}
+
+void TextureStreamer::set_image(TextureHandle texture, const AllocatedImage& image, uint32_t residentMip, bool bGenerateMips) {
+    Texture& streamedTexture = _textures[texture];
+    retire_image(streamedTexture.image);
+    streamedTexture.image = image;
+    streamedTexture.residentMip = residentMip;
+
+    // In SHADER_READ_ONLY_OPTIMAL between the frames: the memory manager's updates run before any recording
+    const VkImageCreateInfo createInfo = get_image_create_info(streamedTexture.format, streamedTexture.extent, residentMip, streamedTexture.mipCount, bGenerateMips);
+    _memoryManager->register_streamable(image.vmaAllocation, [this, texture]() {
+        evict_image(texture);
+    });
+    _memoryManager->register_movable_image(image.vmaAllocation, image.image, createInfo, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT, [this, texture](VkImage newImage) {
+        // The copy was waited on: no frame uses the old view anymore
+        Texture& movedTexture = _textures[texture];
+        vkDestroyImageView(_device, movedTexture.image.imageView, nullptr);
+        movedTexture.image.image = newImage;
+        movedTexture.image.imageView = create_image_view(newImage, movedTexture.format, movedTexture.image.mipLevels);
+        _generation++;
+    });
+}
+
+void TextureStreamer::evict_image(TextureHandle texture) {
+    // Unused by the frames in flight (and already unregistered): destroyed right away. update() loads its mips again
+    // once wanted.
+    Texture& streamedTexture = _textures[texture];
+    vkDestroyImageView(_device, streamedTexture.image.imageView, nullptr);
+    vmaDestroyImage(_allocator, streamedTexture.image.image, streamedTexture.image.vmaAllocation);
+    streamedTexture.image = {};
+    streamedTexture.residentMip = UINT32_MAX;
+    _stats.evictedCount++;
+    _generation++;
+}
+
+void TextureStreamer::retire_image(AllocatedImage& image) {
+    if (image.image != VK_NULL_HANDLE) {
+        _memoryManager->unregister(image.vmaAllocation);
+        _retiredImages.push_back(RetiredImage {image, _frameNumber});
+    }
+    image = {};
+}
+
+VkDeviceSize TextureStreamer::get_mips_size(const Texture& texture, uint32_t firstMip) const {
+    const vkutil::TexelBlock block = vkutil::get_texel_block(texture.format);
+    VkDeviceSize size {0};
+    for (uint32_t mip {firstMip}; mip < texture.mipCount; mip++) {
+        const VkExtent2D mipExtent = vkloader::get_mip_extent(texture.extent, mip);
+        size += VkDeviceSize {(mipExtent.width + block.width - 1) / block.width} * ((mipExtent.height + block.height - 1) / block.height) * block.size;
+    }
+    return size;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "vk_types.h"
+#include "asset_streamer.h"
+#include "vk_upload_queue.h"
+
+#include <filesystem>
+
+namespace vkloader {
+	struct Ktx2Header;
+}
+class MipmapGenerator;
+class MemoryManager;
+
+/// @brief Handle to a texture of a TextureStreamer.
+using TextureHandle = uint32_t;
+constexpr TextureHandle TEXTURE_HANDLE_NONE {UINT32_MAX};
+
+/// @brief Default GPU memory budget of the streamed textures (clamped further by the free device-local memory).
+constexpr VkDeviceSize TEXTURE_STREAMING_DEFAULT_BUDGET {256 * 1024 * 1024};
+/// @brief The mips of at most this size (in texels, per side) stay resident, unless evicted: the "mip tail".
+constexpr uint32_t TEXTURE_STREAMING_TAIL_SIZE {64};
+/// @brief Texture loads (read, decode, upload) in flight at once.
+constexpr uint32_t TEXTURE_STREAMING_MAX_LOADS_IN_FLIGHT {4};
+/// @brief Frames without a view distance after which a texture falls back to its mip tail.
+constexpr uint64_t TEXTURE_STREAMING_UNUSED_FRAMES {120};
+/// @brief Fraction of a mip level the wanted LOD must go past before the wanted mip changes (avoids load/drop loops
+/// when the camera hovers around a level boundary).
+constexpr float TEXTURE_STREAMING_LOD_HYSTERESIS {0.25f};
+/// @brief Frames before a failed texture load is retried, doubled by each failure in a row of the same texture.
+constexpr uint64_t TEXTURE_STREAMING_RETRY_FRAMES {60};
+/// @brief Failed loads in a row after which a texture stops streaming (it keeps the mips it has, or the fallback).
+constexpr uint32_t TEXTURE_STREAMING_MAX_FAILED_LOADS {5};
+
+/// @brief Counters of a TextureStreamer.
+struct TextureStreamerStats {
+	uint32_t textureCount {0};
+	uint32_t loadsInFlight {0};
+	VkDeviceSize budgetBytes {0};      // After the clamp by the free device-local memory
+	VkDeviceSize residentBytes {0};    // Every image, the ones being uploaded included
+	VkDeviceSize wantedBytes {0};      // If every texture had its wanted mip, before the budget
+	uint64_t loadCount {0};
+	uint64_t dropCount {0};
+	uint64_t cancelledCount {0};
+	uint64_t failedCount {0};
+	uint64_t evictedCount {0};   // By the memory manager, under budget pressure
+};
+
+/// @brief Streams the mip levels of textures in and out, so the finest ones are resident only where the camera can
+/// see them, within a GPU memory budget.
+///
+/// Every frame, the texture's users give it a view distance (e.g. of the nearest instance using it). From it, the
+/// texel-to-pixel ratio gives the LOD the sampler would pick, and so the finest mip worth having. When the wanted mips
+/// don't fit the budget, the farthest textures are given coarser mips first. The mip tail (TEXTURE_STREAMING_TAIL_SIZE)
+/// is loaded first and stays, unless the memory manager evicts the image of a texture left unused (mark_used()) when
+/// the heap is over budget: it is then sampled as the fallback, until loaded again.
+///
+/// A texture is always a single image holding its resident mips, from the finest down to 1x1. Loading finer mips
+/// reads and decodes the file in the background (AssetStreamer), then uploads them into a new image (UploadQueue)
+/// which replaces the old one once copied. Of an image file, only the finest mip is decoded and uploaded: record()
+/// generates the others from it on the GPU (MipmapGenerator), then swaps it in (a frame later past the generator's
+/// limit per frame). A KTX2 file (from the texture_cooker) already holds every mip in its GPU
+/// format: only the byte range of the missing levels is read, and uploaded as it is. Dropping mips copies the remaining ones on the GPU into a smaller image.
+/// The replaced images are destroyed once no frame in flight uses them. The resident images are registered to the
+/// MemoryManager as streamable and movable (its defragmentation re-creates their views). get_generation() changes
+/// with every swap, eviction and move, for the users to re-write their descriptors.
+///
+/// Per frame: MemoryManager::update() -> update() (after AssetStreamer::dispatch_completions()) -> UploadQueue::record()
+/// -> record() -> the users read get_image_view() and mark_used()
+/// @attention The MipmapGenerator's begin_frame() comes before record()
+/// @note Render thread only
+class TextureStreamer {
+public:
+	void init(VkDevice device, VmaAllocator allocator, AssetStreamer& assetStreamer, UploadQueue& uploadQueue, MipmapGenerator& mipmapGenerator, MemoryManager& memoryManager, VkDeviceSize budget, uint32_t framesInFlight);
+	/// @attention After AssetStreamer::destroy() (no completion may run anymore), and with the GPU idle
+	void destroy();
+
+	/// Adds a texture and starts loading its mip tail. Sampled as a 1x1 white texture until then.
+	/// @param path An image file (decoded to RGBA8, mips generated on the GPU), or a KTX2 file (.ktx2, its levels stored
+	/// from the smallest, as the texture_cooker writes them)
+	/// @param bSrgb For an image file: its texels are sRGB-encoded (a KTX2 file has its own format)
+	/// @param worldSize Size in meters covered by the texture's width, where it is mapped (for the texel density)
+	TextureHandle load_texture(const std::filesystem::path& path, bool bSrgb, float worldSize);
+
+	void set_budget(VkDeviceSize budget) { _budget = budget; }
+	VkDeviceSize get_budget() const { return _budget; }
+
+	/// Distance from the camera to the nearest use of the texture this frame. The nearest of the calls is kept.
+	void request_view_distance(TextureHandle texture, float distance);
+
+	/// Picks the wanted mips, then submits the loads and plans the drops.
+	/// @param heapBudgets The VMA budgets of the heaps (MemoryManager::get_heap_budgets())
+	void update(uint64_t frameNumber, float viewportHeight, float verticalFov, std::span<const VmaBudget> heapBudgets);
+
+	/// Records the mip generation of the images uploaded this frame, then the GPU copies of the drops planned by
+	/// update(), and swaps their images.
+	void record(VkCommandBuffer commandBuffer, CommandCounters& counters);
+
+	/// The view over every resident mip of the texture (the fallback texture until its first mips are loaded).
+	/// @attention Valid until the generation changes
+	VkImageView get_image_view(TextureHandle texture) const;
+	uint64_t get_generation() const { return _generation; }
+	/// The texture is sampled by this frame: the memory manager doesn't evict it while a frame in flight may use it.
+	void mark_used(TextureHandle texture);
+
+	const TextureStreamerStats& get_stats() const { return _stats; }
+
+private:
+	struct Texture {
+		std::filesystem::path path {};
+		VkFormat format {VK_FORMAT_R8G8B8A8_UNORM};   // Of a KTX2 file: known once its header is read
+		float worldSize {1.f};
+
+		// KTX2: the size of the file, and where its levels are (parsed by the first load)
+		bool bKtx2 {false};
+		uint64_t fileSize {0};
+		std::shared_ptr<const vkloader::Ktx2Header> ktx2Header {};
+
+		// Unknown until the mip tail is decoded (mipCount 0)
+		VkExtent2D extent {0, 0};
+		uint32_t mipCount {0};
+		uint32_t tailMip {0};
+
+		// Holds the mips [residentMip, mipCount), none if the image is null
+		AllocatedImage image {};
+		uint32_t residentMip {UINT32_MAX};
+
+		// This frame's request, and the mip picked from it
+		float viewDistance {0.f};
+		uint64_t lastRequestedFrame {0};
+		bool bRequested {false};
+		uint32_t wantedMip {UINT32_MAX};   // From the distance, with hysteresis
+		uint32_t targetMip {UINT32_MAX};   // Within the budget
+
+		// A load in flight: being read and decoded (request), then uploaded (pendingImage)
+		StreamRequestId request {STREAM_REQUEST_NONE};
+		uint32_t requestedMip {UINT32_MAX};
+		AllocatedImage pendingImage {};
+
+		// Failed loads in a row, and the frame the next load can be submitted from (backoff)
+		uint32_t failedLoadCount {0};
+		uint64_t retryFrame {0};
+	};
+
+	// An image replaced by a load or drop, destroyed once the frames in flight are done with it
+	struct RetiredImage {
+		AllocatedImage image;
+		uint64_t frameNumber;
+	};
+
+	struct PlannedDrop {
+		TextureHandle texture;
+		uint32_t mip;
+	};
+
+	// The mips [firstMip, texture's mipCount) copied from a texture's previous image into its new one, on the GPU
+	struct MipCopy {
+		TextureHandle texture;
+		VkImage srcImage;
+		uint32_t srcFirstMip;   // The mip of its level 0
+		VkImage dstImage;
+		uint32_t dstFirstMip;
+		VkImageLayout dstLayout;   // UNDEFINED: a new image, SHADER_READ_ONLY: with its finer levels uploaded
+		uint32_t firstMip;
+	};
+
+	// The decoded mips of a load, from its decode job to its completion
+	struct TextureLoad;
+
+	VkDevice _device {VK_NULL_HANDLE};
+	VmaAllocator _allocator {VK_NULL_HANDLE};
+	AssetStreamer* _assetStreamer {nullptr};
+	UploadQueue* _uploadQueue {nullptr};
+	MipmapGenerator* _mipmapGenerator {nullptr};
+	MemoryManager* _memoryManager {nullptr};
+	uint32_t _framesInFlight {0};
+	uint32_t _heapIndex {0};   // Of the textures' memory, for the budget clamp
+
+	VkDeviceSize _budget {0};
+	uint64_t _frameNumber {0};
+	uint64_t _generation {1};
+
+	AllocatedImage _fallbackImage {};
+	bool _bFallbackCleared {false};
+	std::vector<Texture> _textures {};
+	std::vector<RetiredImage> _retiredImages {};
+	std::vector<PlannedDrop> _plannedDrops {};
+	std::vector<TextureHandle> _mipGenerations {};   // Uploaded, their finest mip only: still the pending image
+	std::vector<MipCopy> _mipCopies {};   // Uploaded this frame, their finer levels only (KTX2), then the drops
+	std::vector<TextureHandle> _order {};   // Scratch of update()
+	TextureStreamerStats _stats {};
+
+	/// Submits the read of the texture's file (of its levels [firstMip, residentMip) for a KTX2 file, the others are
+	/// copied from the resident image), decoding the mips from firstMip (UINT32_MAX: the mip tail).
+	void submit_load(TextureHandle texture, uint32_t firstMip, StreamPriority priority);
+	/// Completion of a load: queues the upload of the decoded mips into a new image.
+	void finish_load(TextureHandle texture, const TextureLoad& load, StreamStatus status);
+	/// Creates an image holding the mips [firstMip, mipCount), sampled and copied to/from.
+	/// @param bGenerateMips Its mips past firstMip are generated from it (with the usages the MipmapGenerator needs)
+	AllocatedImage create_image(VkFormat format, VkExtent2D extent, uint32_t firstMip, uint32_t mipCount, bool bGenerateMips = false);
+	VkImageCreateInfo get_image_create_info(VkFormat format, VkExtent2D extent, uint32_t firstMip, uint32_t mipCount, bool bGenerateMips) const;
+	VkImageView create_image_view(VkImage image, VkFormat format, uint32_t mipLevels) const;
+	/// Swaps in the texture's new image (retiring the old one), and registers it to the memory manager.
+	/// @param bGenerateMips It was created for the mip generation (create_image())
+	void set_image(TextureHandle texture, const AllocatedImage& image, uint32_t residentMip, bool bGenerateMips);
+	/// Destroys the texture's image, evicted by the memory manager: the texture is sampled as the fallback.
+	void evict_image(TextureHandle texture);
+	/// Unregisters the image from the memory manager, and destroys it once no frame in flight uses it.
+	void retire_image(AllocatedImage& image);
+	/// Bytes of the mips [firstMip, mipCount) of a texture.
+	VkDeviceSize get_mips_size(const Texture& texture, uint32_t firstMip) const;
+};
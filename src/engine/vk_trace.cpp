@@ -0,0 +1,211 @@
+#include "vk_trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "vk_logger.h"
+
+namespace {
+
+    // Process ids of the two timelines in the trace
+    constexpr uint32_t TRACE_CPU_PROCESS_ID {1};
+    constexpr uint32_t TRACE_GPU_PROCESS_ID {2};
+
+    struct Zone {
+        const char* name;
+        uint64_t beginTime;
+        uint64_t endTime;
+    };
+
+    struct FrameMarker {
+        uint64_t frameNumber;
+        uint64_t time;
+    };
+
+    // The zones of a thread. Only its thread appends to it: the mutex is only contended while a capture is
+    // written out (or cleared), never between the recording threads.
+    struct ThreadBuffer {
+        uint32_t threadId {0};
+        std::string name {};
+        std::mutex mutex {};
+        std::vector<Zone> zones {};
+    };
+
+    struct TraceState {
+        std::atomic<bool> bCapturing {false};
+        uint64_t captureBeginTime {0};
+
+        // Registered once per thread, kept until exit (the threads may end before the capture is written)
+        std::mutex mutex {};
+        std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers {};
+        std::vector<Zone> gpuZones {};
+        std::vector<FrameMarker> frameMarkers {};
+    };
+
+    TraceState& get_trace_state() {
+        static TraceState traceState;
+        return traceState;
+    }
+
+    ThreadBuffer& get_thread_buffer() {
+        thread_local ThreadBuffer* threadBuffer {nullptr};
+        if (threadBuffer == nullptr) {
+            TraceState& traceState = get_trace_state();
+            std::scoped_lock lock {traceState.mutex};
+            auto& newBuffer = traceState.threadBuffers.emplace_back(std::make_unique<ThreadBuffer>());
+            newBuffer->threadId = static_cast<uint32_t>(traceState.threadBuffers.size());
+            newBuffer->name = fmt::format("Thread {}", newBuffer->threadId);
+            threadBuffer = newBuffer.get();
+        }
+        return *threadBuffer;
+    }
+
+    // Writes the string as a JSON string (quoted and escaped)
+    void append_json_string(fmt::memory_buffer& out, std::string_view text) {
+        out.push_back('"');
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                fmt::format_to(fmt::appender(out), "\\u{:04x}", static_cast<unsigned int>(c));
+            }
+            else {
+                out.push_back(c);
+            }
+        }
+        out.push_back('"');
+    }
+
+    // A complete event ("X"): a zone with its begin time and duration, in microseconds since the capture began
+    void append_zone_event(fmt::memory_buffer& out, const Zone& zone, uint64_t captureBeginTime, uint32_t processId, uint32_t threadId) {
+        fmt::format_to(fmt::appender(out), ",\n{{\"ph\":\"X\",\"pid\":{},\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"name\":", processId, threadId,
+            static_cast<double>(zone.beginTime - captureBeginTime) / 1000.0, static_cast<double>(zone.endTime - zone.beginTime) / 1000.0);
+        append_json_string(out, zone.name);
+        out.push_back('}');
+    }
+
+    // A metadata event ("M") naming a process or a thread
+    void append_name_event(fmt::memory_buffer& out, const char* metadataName, uint32_t processId, uint32_t threadId, std::string_view name) {
+        fmt::format_to(fmt::appender(out), ",\n{{\"ph\":\"M\",\"pid\":{},\"tid\":{},\"name\":\"{}\",\"args\":{{\"name\":", processId, threadId, metadataName);
+        append_json_string(out, name);
+        out.append(std::string_view("}}"));
+    }
+
+}
+
+uint64_t vktrace::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void vktrace::set_thread_name(const char* name) {
+    ThreadBuffer& threadBuffer = get_thread_buffer();
+    std::scoped_lock lock {threadBuffer.mutex};
+    threadBuffer.name = name;
+}
+
+void vktrace::begin_capture() {
+    TraceState& traceState = get_trace_state();
+    std::scoped_lock lock {traceState.mutex};
+    for (const auto& threadBuffer : traceState.threadBuffers) {
+        std::scoped_lock threadLock {threadBuffer->mutex};
+        threadBuffer->zones.clear();
+    }
+    traceState.gpuZones.clear();
+    traceState.frameMarkers.clear();
+
+    traceState.captureBeginTime = now();
+    traceState.bCapturing.store(true, std::memory_order_release);
+}
+
+bool vktrace::is_capturing() {
+    return get_trace_state().bCapturing.load(std::memory_order_relaxed);
+}
+
+bool vktrace::end_capture(const std::string& filePath) {
+    TraceState& traceState = get_trace_state();
+    traceState.bCapturing.store(false, std::memory_order_release);
+
+    fmt::memory_buffer out;
+    size_t zoneCount {0};
+    out.append(std::string_view("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"));
+    out.append(std::string_view("{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"CPU\"}}"));
+    {
+        std::scoped_lock lock {traceState.mutex};
+        const uint64_t captureBeginTime = traceState.captureBeginTime;
+
+        for (const auto& threadBuffer : traceState.threadBuffers) {
+            std::scoped_lock threadLock {threadBuffer->mutex};
+            append_name_event(out, "thread_name", TRACE_CPU_PROCESS_ID, threadBuffer->threadId, threadBuffer->name);
+            for (const Zone& zone : threadBuffer->zones) {
+                // Skip the zones opened before the capture began
+                if (zone.beginTime >= captureBeginTime) {
+                    append_zone_event(out, zone, captureBeginTime, TRACE_CPU_PROCESS_ID, threadBuffer->threadId);
+                    zoneCount++;
+                }
+            }
+        }
+
+        append_name_event(out, "process_name", TRACE_GPU_PROCESS_ID, 0, "GPU");
+        append_name_event(out, "thread_name", TRACE_GPU_PROCESS_ID, 0, "Graphics Queue");
+        for (const Zone& zone : traceState.gpuZones) {
+            if (zone.beginTime >= captureBeginTime) {
+                append_zone_event(out, zone, captureBeginTime, TRACE_GPU_PROCESS_ID, 0);
+                zoneCount++;
+            }
+        }
+
+        // Global instant events ("i"): a line across every timeline at the start of each frame
+        for (const FrameMarker& frameMarker : traceState.frameMarkers) {
+            fmt::format_to(fmt::appender(out), ",\n{{\"ph\":\"i\",\"s\":\"g\",\"pid\":{},\"tid\":0,\"ts\":{:.3f},\"name\":\"Frame {}\"}}",
+                TRACE_CPU_PROCESS_ID, static_cast<double>(frameMarker.time - captureBeginTime) / 1000.0, frameMarker.frameNumber);
+        }
+    }
+    out.append(std::string_view("\n]}\n"));
+
+    std::ofstream traceFile(filePath, std::ios::binary | std::ios::trunc);
+    if (!traceFile.is_open()) {
+        VK_LOG_WARN("Trace: failed to open {} for writing", filePath);
+        return false;
+    }
+    traceFile.write(out.data(), static_cast<std::streamsize>(out.size()));
+    if (!traceFile.good()) {
+        VK_LOG_WARN("Trace: failed to write {}", filePath);
+        return false;
+    }
+
+    VK_LOG_INFO("Trace: wrote {} zones to {}", zoneCount, filePath);
+    return true;
+}
+
+void vktrace::add_cpu_zone(const char* name, uint64_t beginTime, uint64_t endTime) {
+    ThreadBuffer& threadBuffer = get_thread_buffer();
+    std::scoped_lock lock {threadBuffer.mutex};
+    threadBuffer.zones.push_back(Zone {name, beginTime, endTime});
+}
+
+void vktrace::add_gpu_zone(const char* name, uint64_t beginTime, uint64_t endTime) {
+    if (!is_capturing()) {
+        return;
+    }
+    TraceState& traceState = get_trace_state();
+    std::scoped_lock lock {traceState.mutex};
+    traceState.gpuZones.push_back(Zone {name, beginTime, endTime});
+}
+
+void vktrace::mark_frame(uint64_t frameNumber) {
+    if (!is_capturing()) {
+        return;
+    }
+    const uint64_t time = now();
+    TraceState& traceState = get_trace_state();
+    std::scoped_lock lock {traceState.mutex};
+    traceState.frameMarkers.push_back(FrameMarker {frameNumber, time});
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Tracing can be compiled out (ZONE() becomes a no-op): -DVK_TRACE_ENABLED=0
+#ifndef VK_TRACE_ENABLED
+	#define VK_TRACE_ENABLED 1
+#endif
+
+/// @brief Scoped CPU/GPU tracing, exported as a Chrome trace (JSON), for Perfetto or chrome://tracing.
+///
+/// Zones are only recorded while a capture is in progress (begin_capture() -> end_capture()):
+/// \n - CPU zones are opened with ZONE("name") and closed at the end of the scope. Each thread records into its own
+///      buffer, so threads never contend with each other while recording.
+/// \n - GPU zones are added once their timestamps are read back, already converted to the CPU time-base (now()).
+/// \n - Frame markers separate the frames on the timeline.
+///
+/// @attention Zone names must outlive the capture (string literals, or names owned by long-lived objects)
+namespace vktrace {
+
+	/// Nanoseconds on the steady clock: the time-base of every zone.
+	uint64_t now();
+
+	/// Names the calling thread in the trace (e.g. "Main", "Logger").
+	void set_thread_name(const char* name);
+
+	/// Starts recording the zones. Zones recorded by a previous capture are discarded.
+	void begin_capture();
+	bool is_capturing();
+	/// Stops recording, and writes the zones recorded since begin_capture() as a Chrome trace. Returns false on failure.
+	bool end_capture(const std::string& filePath);
+
+	/// Adds a completed CPU zone to the calling thread's buffer (called by ScopedZone).
+	void add_cpu_zone(const char* name, uint64_t beginTime, uint64_t endTime);
+	/// Adds a GPU zone, with times already converted to the CPU time-base.
+	void add_gpu_zone(const char* name, uint64_t beginTime, uint64_t endTime);
+	/// Marks the start of a frame on the timeline.
+	void mark_frame(uint64_t frameNumber);
+
+	/// @brief Records a CPU zone spanning its lifetime, if a capture was in progress when it was opened.
+	class ScopedZone {
+	public:
+		explicit ScopedZone(const char* name) : _name(is_capturing() ? name : nullptr), _beginTime(_name != nullptr ? now() : 0) {}
+		~ScopedZone() {
+			if (_name != nullptr) {
+				add_cpu_zone(_name, _beginTime, now());
+			}
+		}
+
+		ScopedZone(const ScopedZone&) = delete;
+		ScopedZone& operator=(const ScopedZone&) = delete;
+
+	private:
+		const char* _name;
+		uint64_t _beginTime;
+	};
+
+}
+
+#define VK_TRACE_CONCAT_IMPL(a, b) a##b
+#define VK_TRACE_CONCAT(a, b) VK_TRACE_CONCAT_IMPL(a, b)
+
+#if VK_TRACE_ENABLED
+	/// Records a CPU zone from here to the end of the enclosing scope.
+	#define ZONE(name) ::vktrace::ScopedZone VK_TRACE_CONCAT(vktraceZone, __LINE__) {name}
+#else
+	#define ZONE(name) ((void)0)
+#endif
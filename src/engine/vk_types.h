@@ -31,10 +31,36 @@
 /// @param vmaAllocation The VMA allocation handle for automatic memory management
 /// @param imageExtent  The 3D dimensions (width, height, depth) of the image
 /// @param imageFormat  The pixel format specification (ex., VK_FORMAT_R8G8B8A8_UNORM)
+/// @param mipLevels    The number of mip levels of the image (1: no mips), all covered by imageView
 struct AllocatedImage {
     VkImage image;
     VkImageView imageView;
     VmaAllocation vmaAllocation;
     VkExtent3D imageExtent;
     VkFormat imageFormat;
+    uint32_t mipLevels;
+};
+
+/// @brief Holds the data pertaining to a buffer allocated using VMA allocator
+///
+/// @param buffer            The VkBuffer handle representing the GPU buffer resource
+/// @param vmaAllocation     The VMA allocation handle for automatic memory management
+/// @param vmaAllocationInfo Allocation details (size, offset and the mapped pointer for host-visible buffers)
+struct AllocatedBuffer {
+    VkBuffer buffer;
+    VmaAllocation vmaAllocation;
+    VmaAllocationInfo vmaAllocationInfo;
+};
+
+/// @brief Counts of the commands recorded in a frame, shown in the performance overlay.
+///
+/// Incremented by the code recording the commands (an indirect draw counts as a single draw).
+/// The barriers derived by the render-graph are counted in its own stats.
+struct CommandCounters {
+    uint32_t draws {0};
+    uint32_t dispatches {0};
+    uint32_t pipelineBarriers {0};
+    uint32_t descriptorSetBinds {0};
+    uint32_t pipelineBinds {0};
+    uint32_t skippedStateBinds {0};   // Binds and push-constants left out by the render queue, already set by the previous draw
 };
\ No newline at end of file
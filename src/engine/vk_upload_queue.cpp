@@ -0,0 +1,289 @@
+#include "vk_upload_queue.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "vk_buffers.h"
+#include "vk_images.h"
+#include "vk_logger.h"
+#include "vk_trace.h"
+
+void UploadQueue::init(VmaAllocator allocator, VkDeviceSize frameBudget, uint32_t framesInFlight) {
+    _frameBudget = frameBudget;
+    for (uint32_t i {0}; i < framesInFlight; i++) {
+        _stagingBuffers.push_back(vkutil::create_buffer(allocator, _frameBudget, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY));
+    }
+    VK_LOG_SUCCESS("Initialized the upload queue ({} MiB per frame, {} staging buffers)", _frameBudget / (1024 * 1024), framesInFlight);
+}
+
+void UploadQueue::destroy(VmaAllocator allocator) {
+    for (const AllocatedBuffer& stagingBuffer : _stagingBuffers) {
+        vkutil::destroy_buffer(allocator, stagingBuffer);
+    }
+    _stagingBuffers.clear();
+    _bufferCopies.clear();
+    _imageCopies.clear();
+    _startedImages.clear();
+    _finishedImages.clear();
+    _backlog.clear();
+    _backlogBytes = 0;
+}
+
+void UploadQueue::begin_frame(uint32_t frameIndex) {
+    _frameIndex = frameIndex % static_cast<uint32_t>(_stagingBuffers.size());
+    _stagingOffset = 0;
+    _bufferCopies.clear();
+    _imageCopies.clear();
+
+    // The oldest first, until the budget runs out (the last one staged may only be in part)
+    while (!_backlog.empty()) {
+        PendingUpload& upload = _backlog.front();
+        if (upload.dstImage != VK_NULL_HANDLE) {
+            const VkDeviceSize pendingBytes = upload.pendingBytes;
+            const bool bStaged = stage_image(upload);
+            _backlogBytes -= pendingBytes - upload.pendingBytes;
+            if (!bStaged) {
+                break;
+            }
+            _finishedImages.push_back(std::move(upload));
+        } else {
+            const std::span<const std::byte> remaining = upload.data.subspan(upload.stagedBytes);
+            const VkDeviceSize stagedBytes = stage(upload.dstBuffer, upload.dstOffset + upload.stagedBytes, remaining);
+            upload.stagedBytes += stagedBytes;
+            _backlogBytes -= stagedBytes;
+            if (stagedBytes < remaining.size()) {
+                break;
+            }
+        }
+        _backlog.pop_front();
+    }
+}
+
+void UploadQueue::upload_buffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, std::span<const std::byte> data) {
+    // Behind the backlog, to keep the uploads in order (a later upload may overwrite an earlier one)
+    const VkDeviceSize stagedBytes = _backlog.empty() ? stage(dstBuffer, dstOffset, data) : 0;
+    if (stagedBytes == data.size()) {
+        return;
+    }
+
+    const std::span<const std::byte> remaining = data.subspan(stagedBytes);
+    PendingUpload upload {};
+    upload.dstBuffer = dstBuffer;
+    upload.dstOffset = dstOffset + stagedBytes;
+    upload.ownedData.assign(remaining.begin(), remaining.end());
+    upload.data = upload.ownedData;
+    _backlog.push_back(std::move(upload));
+    _backlogBytes += remaining.size();
+}
+
+void UploadQueue::upload_image(VkImage image, VkFormat format, std::span<const ImageUploadLevel> levels, std::span<const std::byte> data, ImageUploadedFunction onUploaded) {
+    PendingUpload upload {};
+    upload.dstImage = image;
+    upload.texelBlock = vkutil::get_texel_block(format);
+    upload.levels.assign(levels.begin(), levels.end());
+    upload.onUploaded = std::move(onUploaded);
+    upload.data = data;
+
+    if (levels.empty()) {
+        VK_LOG_ERROR("Image upload without any mip level");
+        throw std::runtime_error("Image upload without any mip level");
+    }
+    for (const ImageUploadLevel& level : levels) {
+        const VkDeviceSize rowBytes = VkDeviceSize {(level.extent.width + upload.texelBlock.width - 1) / upload.texelBlock.width} * upload.texelBlock.size;
+        const VkDeviceSize rowCount = (level.extent.height + upload.texelBlock.height - 1) / upload.texelBlock.height;
+        if (level.offset + rowBytes * rowCount > data.size() || rowBytes > _frameBudget) {
+            VK_LOG_ERROR("Invalid upload of the mip level {} ({}x{}): out of the data, or a row of blocks over the frame's budget", level.mipLevel, level.extent.width, level.extent.height);
+            throw std::runtime_error("Invalid image upload");
+        }
+        upload.pendingBytes += rowBytes * rowCount;
+    }
+
+    if (_backlog.empty() && stage_image(upload)) {
+        _finishedImages.push_back(std::move(upload));
+        return;
+    }
+
+    // The rest waits for the next frames: the data must outlive the caller's
+    upload.ownedData.assign(data.begin(), data.end());
+    upload.data = upload.ownedData;
+    _backlogBytes += upload.pendingBytes;
+    _backlog.push_back(std::move(upload));
+}
+
+void UploadQueue::record(VkCommandBuffer commandBuffer, CommandCounters& counters) {
+    _stats.copyCount = static_cast<uint32_t>(_bufferCopies.size() + _imageCopies.size());
+    _stats.frameBytes = _stagingOffset;
+    _stats.backlogBytes = _backlogBytes;
+    _stats.totalBytes += _stagingOffset;
+    if (_bufferCopies.empty() && _imageCopies.empty()) {
+        return;
+    }
+    ZONE("UploadQueue::record");
+
+    std::vector<VkImageMemoryBarrier2> imageBarriers {};
+    VkImageMemoryBarrier2 imageBarrier {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    imageBarrier.pNext = nullptr;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.subresourceRange = VkImageSubresourceRange {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1};
+
+    VkDependencyInfo dependencyInfo {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.pNext = nullptr;
+
+    // The images copied to for the first time: their previous content (if any) is discarded
+    if (!_startedImages.empty()) {
+        imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        imageBarrier.srcAccessMask = VK_ACCESS_2_NONE;
+        imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        imageBarrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        for (const VkImage image : _startedImages) {
+            imageBarrier.image = image;
+            imageBarriers.push_back(imageBarrier);
+        }
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+        dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+        vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+        counters.pipelineBarriers++;
+        _startedImages.clear();
+    }
+
+    // One command per run of copies into the same buffer or image
+    const VkBuffer stagingBuffer = _stagingBuffers[_frameIndex].buffer;
+    std::vector<VkBufferCopy> regions {};
+    for (size_t first {0}; first < _bufferCopies.size();) {
+        const VkBuffer dstBuffer = _bufferCopies[first].dstBuffer;
+        regions.clear();
+        size_t last {first};
+        for (; last < _bufferCopies.size() && _bufferCopies[last].dstBuffer == dstBuffer; last++) {
+            regions.push_back(_bufferCopies[last].region);
+        }
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, dstBuffer, static_cast<uint32_t>(regions.size()), regions.data());
+        first = last;
+    }
+
+    std::vector<VkBufferImageCopy> imageRegions {};
+    for (size_t first {0}; first < _imageCopies.size();) {
+        const VkImage dstImage = _imageCopies[first].dstImage;
+        imageRegions.clear();
+        size_t last {first};
+        for (; last < _imageCopies.size() && _imageCopies[last].dstImage == dstImage; last++) {
+            imageRegions.push_back(_imageCopies[last].region);
+        }
+        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(imageRegions.size()), imageRegions.data());
+        first = last;
+    }
+
+    // Whatever reads the uploaded data next: the passes of this frame, or the next frames. The images copied entirely
+    // become readable by the shaders.
+    VkMemoryBarrier2 memoryBarrier {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    memoryBarrier.pNext = nullptr;
+    memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    memoryBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+    imageBarriers.clear();
+    imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    imageBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    for (const PendingUpload& upload : _finishedImages) {
+        imageBarrier.image = upload.dstImage;
+        imageBarriers.push_back(imageBarrier);
+    }
+
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &memoryBarrier;
+    dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+    dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    counters.pipelineBarriers++;
+
+    for (PendingUpload& upload : _finishedImages) {
+        if (upload.onUploaded) {
+            upload.onUploaded();
+        }
+    }
+    _finishedImages.clear();
+}
+
+VkDeviceSize UploadQueue::stage(VkBuffer dstBuffer, VkDeviceSize dstOffset, std::span<const std::byte> data) {
+    // A part of an upload ends on the alignment too, so the next part starts aligned in the buffer
+    VkDeviceSize size = std::min<VkDeviceSize>(data.size(), get_available_staging());
+    if (size < data.size()) {
+        size -= size % UPLOAD_QUEUE_ALIGNMENT;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    VkDeviceSize stagingOffset {0};
+    std::byte* stagingMemory = allocate_staging(size, stagingOffset);
+    std::memcpy(stagingMemory, data.data(), size);
+    _bufferCopies.push_back(BufferCopy {dstBuffer, VkBufferCopy {stagingOffset, dstOffset, size}});
+    return size;
+}
+
+bool UploadQueue::stage_image(PendingUpload& upload) {
+    const vkutil::TexelBlock& block = upload.texelBlock;
+    while (upload.levelIndex < upload.levels.size()) {
+        const ImageUploadLevel& level = upload.levels[upload.levelIndex];
+        const uint32_t blockRowCount = (level.extent.height + block.height - 1) / block.height;
+        const VkDeviceSize rowBytes = VkDeviceSize {(level.extent.width + block.width - 1) / block.width} * block.size;
+
+        // Whole rows of blocks only: a copy covers a rectangle of the level
+        const uint32_t rowCount = static_cast<uint32_t>(std::min<VkDeviceSize>(blockRowCount - upload.blockRowsDone, get_available_staging() / rowBytes));
+        if (rowCount == 0) {
+            return false;
+        }
+
+        const VkDeviceSize size = rowBytes * rowCount;
+        VkDeviceSize stagingOffset {0};
+        std::byte* stagingMemory = allocate_staging(size, stagingOffset);
+        std::memcpy(stagingMemory, upload.data.data() + level.offset + rowBytes * upload.blockRowsDone, size);
+
+        if (!upload.bStarted) {
+            _startedImages.push_back(upload.dstImage);
+            upload.bStarted = true;
+        }
+
+        const uint32_t y = upload.blockRowsDone * block.height;
+        VkBufferImageCopy region {};
+        region.bufferOffset = stagingOffset;
+        region.bufferRowLength = 0;     // Tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource = VkImageSubresourceLayers {VK_IMAGE_ASPECT_COLOR_BIT, level.mipLevel, 0, 1};
+        region.imageOffset = VkOffset3D {0, static_cast<int32_t>(y), 0};
+        region.imageExtent = VkExtent3D {level.extent.width, std::min(rowCount * block.height, level.extent.height - y), 1};
+        _imageCopies.push_back(ImageCopy {upload.dstImage, region});
+
+        upload.pendingBytes -= size;
+        upload.blockRowsDone += rowCount;
+        if (upload.blockRowsDone == blockRowCount) {
+            upload.levelIndex++;
+            upload.blockRowsDone = 0;
+        }
+    }
+    return true;
+}
+
+std::byte* UploadQueue::allocate_staging(VkDeviceSize size, VkDeviceSize& stagingOffset) {
+    stagingOffset = (_stagingOffset + UPLOAD_QUEUE_ALIGNMENT - 1) / UPLOAD_QUEUE_ALIGNMENT * UPLOAD_QUEUE_ALIGNMENT;
+    if (stagingOffset + size > _frameBudget) {
+        return nullptr;
+    }
+    _stagingOffset = stagingOffset + size;
+    return static_cast<std::byte*>(_stagingBuffers[_frameIndex].vmaAllocationInfo.pMappedData) + stagingOffset;
+}
+
+VkDeviceSize UploadQueue::get_available_staging() const {
+    const VkDeviceSize offset = (_stagingOffset + UPLOAD_QUEUE_ALIGNMENT - 1) / UPLOAD_QUEUE_ALIGNMENT * UPLOAD_QUEUE_ALIGNMENT;
+    return offset < _frameBudget ? _frameBudget - offset : 0;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_images.h"
+
+#include <deque>
+
+/// @brief Staging memory per frame in flight: the most bytes the UploadQueue copies to the GPU in a frame.
+constexpr VkDeviceSize UPLOAD_QUEUE_FRAME_BUDGET {16 * 1024 * 1024};
+/// @brief Alignment of the uploads in the staging memory (enough for any texel block and copy offset).
+constexpr VkDeviceSize UPLOAD_QUEUE_ALIGNMENT {16};
+
+/// @brief A mip level of an image upload, and where its texels are in the upload's data (rows tightly packed).
+struct ImageUploadLevel {
+	uint32_t mipLevel;
+	VkExtent2D extent;
+	VkDeviceSize offset;
+};
+
+/// @brief Counters of an UploadQueue.
+struct UploadQueueStats {
+	uint32_t copyCount {0};            // Copies recorded in the last frame
+	VkDeviceSize frameBytes {0};       // Bytes uploaded by the last frame
+	VkDeviceSize backlogBytes {0};     // Left for the next frames, over the budget
+	uint64_t totalBytes {0};
+};
+
+/// @brief Uploads data to GPU buffers and images from the frame's own command buffer, a budget of bytes per frame.
+///
+/// The data is copied into staging memory (one persistently mapped buffer per frame in flight) and the copies are
+/// recorded at the start of the frame, before its passes: unlike an immediate submit, an upload never stalls the
+/// frame. Over the budget, the data is kept aside and uploaded by the next frames (split if needed, images by rows
+/// of texel blocks), in order.
+///
+/// Per frame: begin_frame() -> upload_buffer() / upload_image() -> record()
+/// @note Render thread only
+class UploadQueue {
+public:
+	/// Called by record() once the last copy of an image upload is recorded (the image is readable by the rest of
+	/// the frame).
+	using ImageUploadedFunction = std::function<void()>;
+
+	void init(VmaAllocator allocator, VkDeviceSize frameBudget, uint32_t framesInFlight);
+	void destroy(VmaAllocator allocator);
+
+	/// Selects the staging buffer of the frame, and stages the backlog of the previous frames first.
+	/// @attention The GPU must be done with the previous frame that used the same frameIndex
+	void begin_frame(uint32_t frameIndex);
+
+	/// Queues a copy of the data into the buffer (copied now, the data may be freed once this returns).
+	/// @attention The buffer needs VK_BUFFER_USAGE_TRANSFER_DST_BIT, and must stay alive until the copy is done
+	void upload_buffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, std::span<const std::byte> data);
+
+	/// Queues the copy of mip levels into an image (the data is copied now). The image goes from the undefined layout
+	/// to TRANSFER_DST_OPTIMAL before its first copy, and to SHADER_READ_ONLY_OPTIMAL (every mip level) after its last.
+	/// @attention The image needs VK_IMAGE_USAGE_TRANSFER_DST_BIT, and must not be used until onUploaded is called
+	void upload_image(VkImage image, VkFormat format, std::span<const ImageUploadLevel> levels, std::span<const std::byte> data, ImageUploadedFunction onUploaded);
+
+	/// True while uploads are waiting for a later frame (e.g. to hold back new ones).
+	bool has_backlog() const { return !_backlog.empty(); }
+
+	/// Records the copies of the frame, then the barriers making them visible to every later command.
+	void record(VkCommandBuffer commandBuffer, CommandCounters& counters);
+
+	const UploadQueueStats& get_stats() const { return _stats; }
+
+private:
+	struct BufferCopy {
+		VkBuffer dstBuffer;
+		VkBufferCopy region;
+	};
+
+	struct ImageCopy {
+		VkImage dstImage;
+		VkBufferImageCopy region;
+	};
+
+	// An upload not staged entirely yet, and how far it got. Its data is only owned once it goes to the backlog.
+	struct PendingUpload {
+		VkBuffer dstBuffer {VK_NULL_HANDLE};
+		VkDeviceSize dstOffset {0};
+
+		VkImage dstImage {VK_NULL_HANDLE};
+		vkutil::TexelBlock texelBlock {};
+		std::vector<ImageUploadLevel> levels {};
+		uint32_t levelIndex {0};      // Next level to stage
+		uint32_t blockRowsDone {0};   // Of that level
+		bool bStarted {false};        // Transitioned to TRANSFER_DST_OPTIMAL
+		ImageUploadedFunction onUploaded {};
+
+		std::vector<std::byte> ownedData {};
+		std::span<const std::byte> data {};
+		VkDeviceSize stagedBytes {0};   // Buffers only
+		VkDeviceSize pendingBytes {0};  // Images only: left to stage
+	};
+
+	VkDeviceSize _frameBudget {0};
+	std::vector<AllocatedBuffer> _stagingBuffers {};   // One per frame in flight
+	uint32_t _frameIndex {0};
+	VkDeviceSize _stagingOffset {0};
+
+	std::vector<BufferCopy> _bufferCopies {};
+	std::vector<ImageCopy> _imageCopies {};
+	std::vector<VkImage> _startedImages {};
+	std::vector<PendingUpload> _finishedImages {};
+
+	std::deque<PendingUpload> _backlog {};
+	VkDeviceSize _backlogBytes {0};
+	UploadQueueStats _stats {};
+
+	/// Copies as much of the data as fits into the frame's staging buffer, and queues its copy. Returns the bytes staged.
+	VkDeviceSize stage(VkBuffer dstBuffer, VkDeviceSize dstOffset, std::span<const std::byte> data);
+	/// Stages the next rows of the image's levels that fit. Returns true once the whole image is staged.
+	bool stage_image(PendingUpload& upload);
+	/// Reserves aligned staging memory. Returns nullptr if the frame's budget is used up.
+	std::byte* allocate_staging(VkDeviceSize size, VkDeviceSize& stagingOffset);
+	VkDeviceSize get_available_staging() const;
+};
@@ -0,0 +1,197 @@
+#include "vk_workgroup_tuner.h"
+
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "vk_images.h"
+#include "vk_logger.h"
+
+// A first, untimed dispatch warms up the caches and the clocks. The timed dispatches are averaged.
+constexpr uint32_t TUNING_WARMUP_DISPATCHES {1};
+constexpr uint32_t TUNING_TIMED_DISPATCHES {3};
+
+
+void WorkgroupSizeTuner::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, const std::string& cacheFilePath) {
+    _device = device;
+    _cacheFilePath = cacheFilePath;
+    vkGetPhysicalDeviceProperties(physicalDevice, &_deviceProperties);
+
+    load_cache();
+
+    // Timestamps must be supported on the queue that runs the compute work
+    uint32_t queueFamilyCount {0};
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    const uint32_t timestampValidBits = queueFamilyIndex < queueFamilyCount ? queueFamilies[queueFamilyIndex].timestampValidBits : 0;
+    if (timestampValidBits == 0 || _deviceProperties.limits.timestampPeriod <= 0.f) {
+        VK_LOG_WARN("Timestamp queries unsupported, compute workgroup sizes will not be tuned");
+        return;
+    }
+    _timestampMask = timestampValidBits >= 64 ? std::numeric_limits<uint64_t>::max() : (uint64_t {1} << timestampValidBits) - 1;
+
+    VkQueryPoolCreateInfo queryPoolCreateInfo {};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.pNext = nullptr;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = 2;
+
+    VkResult result = vkCreateQueryPool(_device, &queryPoolCreateInfo, nullptr, &_queryPool);
+    if (result != VK_SUCCESS) {
+        VK_LOG_WARN("Failed to create the timestamp query-pool, compute workgroup sizes will not be tuned");
+        _queryPool = VK_NULL_HANDLE;
+    }
+}
+
+void WorkgroupSizeTuner::destroy() {
+    if (_queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(_device, _queryPool, nullptr);
+        _queryPool = VK_NULL_HANDLE;
+    }
+}
+
+std::optional<VkExtent2D> WorkgroupSizeTuner::get_cached_workgroup_size(const std::string& shaderName) const {
+    for (const CacheEntry& entry : _cacheEntries) {
+        if (entry.vendorID == _deviceProperties.vendorID
+            && entry.deviceID == _deviceProperties.deviceID
+            && entry.driverVersion == _deviceProperties.driverVersion
+            && entry.shaderName == shaderName
+            && fits_device_limits(entry.workgroupSize)) {
+            return entry.workgroupSize;
+        }
+    }
+    return std::nullopt;
+}
+
+WorkgroupSizeTuner::TuningResult WorkgroupSizeTuner::tune(const std::string& shaderName, const PipelineFactory& createPipeline, const DispatchRecorder& recordDispatch, const ImmediateSubmitter& immediateSubmit) {
+    TuningResult best {WORKGROUP_SIZE_DEFAULT, VK_NULL_HANDLE};
+    if (!is_supported()) {
+        return best;
+    }
+
+    double bestMilliseconds = std::numeric_limits<double>::max();
+    for (const VkExtent2D& candidate : WORKGROUP_SIZE_CANDIDATES) {
+        if (!fits_device_limits(candidate)) {
+            continue;
+        }
+
+        VkPipeline pipeline = createPipeline(candidate);
+
+        immediateSubmit([&](VkCommandBuffer commandBuffer) {
+            vkCmdResetQueryPool(commandBuffer, _queryPool, 0, 2);
+
+            for (uint32_t i {0}; i < TUNING_WARMUP_DISPATCHES + TUNING_TIMED_DISPATCHES; i++) {
+                if (i == TUNING_WARMUP_DISPATCHES) {
+                    // Written once the warm-up dispatches are done with the compute stage
+                    vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, _queryPool, 0);
+                }
+                if (i > 0) {
+                    // The dispatches write the same image
+                    vkutil::memory_barrier(
+                        commandBuffer,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+                    );
+                }
+                recordDispatch(commandBuffer, pipeline, candidate);
+            }
+            vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, _queryPool, 1);
+        });
+
+        std::array<uint64_t, 2> timestamps {};
+        VkResult result = vkGetQueryPoolResults(_device, _queryPool, 0, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        if (result != VK_SUCCESS) {
+            VK_LOG_WARN("Failed to read the timestamps of workgroup {}x{} for {}", candidate.width, candidate.height, shaderName);
+            vkDestroyPipeline(_device, pipeline, nullptr);
+            continue;
+        }
+
+        const uint64_t ticks = ((timestamps[1] & _timestampMask) - (timestamps[0] & _timestampMask)) & _timestampMask;
+        const double milliseconds = static_cast<double>(ticks) * _deviceProperties.limits.timestampPeriod / 1e6 / TUNING_TIMED_DISPATCHES;
+        VK_LOG_INFO("Workgroup {}x{} for {}: {:.3f} ms", candidate.width, candidate.height, shaderName, milliseconds);
+
+        if (milliseconds < bestMilliseconds) {
+            bestMilliseconds = milliseconds;
+            if (best.pipeline != VK_NULL_HANDLE) {
+                vkDestroyPipeline(_device, best.pipeline, nullptr);
+            }
+            best = TuningResult {candidate, pipeline};
+        }
+        else {
+            vkDestroyPipeline(_device, pipeline, nullptr);
+        }
+    }
+
+    if (best.pipeline == VK_NULL_HANDLE) {
+        return best;
+    }
+    VK_LOG_SUCCESS("Tuned {}: workgroup {}x{} ({:.3f} ms)", shaderName, best.workgroupSize.width, best.workgroupSize.height, bestMilliseconds);
+
+    // Replace the previous result of this shader on this device, if any
+    std::erase_if(_cacheEntries, [&](const CacheEntry& entry) {
+        return entry.vendorID == _deviceProperties.vendorID
+            && entry.deviceID == _deviceProperties.deviceID
+            && entry.driverVersion == _deviceProperties.driverVersion
+            && entry.shaderName == shaderName;
+    });
+    _cacheEntries.push_back(CacheEntry {
+        _deviceProperties.vendorID,
+        _deviceProperties.deviceID,
+        _deviceProperties.driverVersion,
+        best.workgroupSize,
+        shaderName
+    });
+    save_cache();
+
+    return best;
+}
+
+bool WorkgroupSizeTuner::fits_device_limits(VkExtent2D workgroupSize) const {
+    const VkPhysicalDeviceLimits& limits = _deviceProperties.limits;
+    return workgroupSize.width > 0 && workgroupSize.height > 0
+        && workgroupSize.width <= limits.maxComputeWorkGroupSize[0]
+        && workgroupSize.height <= limits.maxComputeWorkGroupSize[1]
+        && workgroupSize.width * workgroupSize.height <= limits.maxComputeWorkGroupInvocations;
+}
+
+// Cache file format, one entry per line: <vendorID> <deviceID> <driverVersion> <width> <height> <shader name>
+void WorkgroupSizeTuner::load_cache() {
+    _cacheEntries.clear();
+
+    std::ifstream cacheFile(_cacheFilePath);
+    if (!cacheFile.is_open()) {
+        return; // Nothing tuned yet
+    }
+
+    std::string line;
+    while (std::getline(cacheFile, line)) {
+        std::istringstream lineStream(line);
+        CacheEntry entry {};
+        if (!(lineStream >> entry.vendorID >> entry.deviceID >> entry.driverVersion >> entry.workgroupSize.width >> entry.workgroupSize.height)) {
+            continue;
+        }
+        lineStream >> std::ws;
+        std::getline(lineStream, entry.shaderName);
+        if (!entry.shaderName.empty()) {
+            _cacheEntries.push_back(entry);
+        }
+    }
+    VK_LOG_INFO("Loaded {} workgroup-size tuning results from {}", _cacheEntries.size(), _cacheFilePath);
+}
+
+void WorkgroupSizeTuner::save_cache() const {
+    std::ofstream cacheFile(_cacheFilePath, std::ios::trunc);
+    if (!cacheFile.is_open()) {
+        VK_LOG_WARN("Failed to write the workgroup-size tuning results to {}", _cacheFilePath);
+        return;
+    }
+
+    for (const CacheEntry& entry : _cacheEntries) {
+        cacheFile << entry.vendorID << ' ' << entry.deviceID << ' ' << entry.driverVersion << ' '
+                  << entry.workgroupSize.width << ' ' << entry.workgroupSize.height << ' ' << entry.shaderName << '\n';
+    }
+}
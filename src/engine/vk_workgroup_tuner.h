@@ -0,0 +1,69 @@
+#pragma once
+
+#include "vk_types.h"
+
+/// @brief Workgroup shapes tried by the tuner. The ones exceeding the device limits are skipped.
+constexpr std::array<VkExtent2D, 7> WORKGROUP_SIZE_CANDIDATES {{
+	{8, 8}, {16, 8}, {8, 16}, {16, 16}, {32, 8}, {32, 4}, {64, 4}
+}};
+
+/// @brief Workgroup shape used when no tuning result is available (timestamps unsupported, etc.)
+constexpr VkExtent2D WORKGROUP_SIZE_DEFAULT {16, 16};
+
+/// @brief Picks the fastest 2D workgroup shape of a compute-shader, per device.
+///
+/// The shader must declare its workgroup size through specialization-constants:
+/// @code layout (local_size_x_id = 0, local_size_y_id = 1) in; @endcode
+/// Every candidate shape is compiled into a pipeline variant and timed with timestamp queries.
+/// The results are cached in a text file, keyed by vendor-ID, device-ID and driver-version,
+/// so tuning only runs the first time a shader is seen on a device/driver.
+class WorkgroupSizeTuner {
+public:
+	/// Creates the compute-pipeline variant of the given workgroup size. Ownership goes to the tuner.
+	using PipelineFactory = std::function<VkPipeline(VkExtent2D workgroupSize)>;
+	/// Records the bind commands and the dispatch of a representative workload, with the given variant.
+	using DispatchRecorder = std::function<void(VkCommandBuffer, VkPipeline, VkExtent2D workgroupSize)>;
+	/// Records the commands into a command-buffer, submits it and waits for its completion.
+	using ImmediateSubmitter = std::function<void(std::function<void(VkCommandBuffer)>&&)>;
+
+	/// The chosen workgroup size, and its pipeline (owned by the caller, may be VK_NULL_HANDLE for cached results)
+	struct TuningResult {
+		VkExtent2D workgroupSize;
+		VkPipeline pipeline;
+	};
+
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, const std::string& cacheFilePath);
+	void destroy();
+
+	/// Timestamp queries are required for tuning.
+	bool is_supported() const { return _queryPool != VK_NULL_HANDLE; }
+
+	/// Returns the cached workgroup size of the shader on the current device, if it was already tuned.
+	std::optional<VkExtent2D> get_cached_workgroup_size(const std::string& shaderName) const;
+
+	/// Times every candidate shape and returns the fastest one, with its pipeline. The other variants are destroyed.
+	/// The result is written to the cache file.
+	/// @attention Blocks until all candidates have run on the GPU
+	TuningResult tune(const std::string& shaderName, const PipelineFactory& createPipeline, const DispatchRecorder& recordDispatch, const ImmediateSubmitter& immediateSubmit);
+
+private:
+	struct CacheEntry {
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		VkExtent2D workgroupSize;
+		std::string shaderName;
+	};
+
+	VkDevice _device {VK_NULL_HANDLE};
+	VkPhysicalDeviceProperties _deviceProperties {};
+	uint64_t _timestampMask {0};
+	VkQueryPool _queryPool {VK_NULL_HANDLE};
+
+	std::string _cacheFilePath {};
+	std::vector<CacheEntry> _cacheEntries {};
+
+	bool fits_device_limits(VkExtent2D workgroupSize) const;
+	void load_cache();
+	void save_cache() const;
+};
@@ -0,0 +1,286 @@
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+    using Color = std::array<float, 4>;
+    using Endpoint = std::array<uint32_t, 4>;
+
+    // Interpolation weights (of 64) of the 4-bit indices
+    constexpr std::array<uint32_t, 16> BC7_WEIGHTS_4 {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    constexpr uint32_t BC7_MODE_6 {6};
+    constexpr uint32_t BC7_ENDPOINT_BITS {7};
+    constexpr uint32_t BC7_POWER_ITERATIONS {8};
+    constexpr uint32_t BC7_REFINE_PASSES {2};
+
+    // Writes the fields of a block from its lowest bit
+    class BitWriter {
+    public:
+        explicit BitWriter(uint8_t* data) : _data(data) {}
+
+        void write(uint32_t value, uint32_t bitCount) {
+            for (uint32_t bit {0}; bit < bitCount; bit++) {
+                if ((value >> bit) & 1) {
+                    _data[_position >> 3] |= static_cast<uint8_t>(1 << (_position & 7));
+                }
+                _position++;
+            }
+        }
+
+    private:
+        uint8_t* _data;
+        uint32_t _position {0};
+    };
+
+    Color get_texel(const bcenc::RgbaBlock& texels, uint32_t index) {
+        return Color {static_cast<float>(texels[index * 4]), static_cast<float>(texels[index * 4 + 1]),
+            static_cast<float>(texels[index * 4 + 2]), static_cast<float>(texels[index * 4 + 3])};
+    }
+
+    float dot(const Color& a, const Color& b) {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    }
+
+    Color clamp_color(const Color& color) {
+        Color result {};
+        for (uint32_t channel {0}; channel < 4; channel++) {
+            result[channel] = std::clamp(color[channel], 0.f, 255.f);
+        }
+        return result;
+    }
+
+    // The endpoints along the principal axis of the texels, spanning their projections
+    void fit_principal_axis(const bcenc::RgbaBlock& texels, Color& low, Color& high) {
+        Color mean {};
+        for (uint32_t texel {0}; texel < 16; texel++) {
+            const Color color = get_texel(texels, texel);
+            for (uint32_t channel {0}; channel < 4; channel++) {
+                mean[channel] += color[channel] / 16.f;
+            }
+        }
+
+        std::array<std::array<float, 4>, 4> covariance {};
+        for (uint32_t texel {0}; texel < 16; texel++) {
+            const Color color = get_texel(texels, texel);
+            for (uint32_t row {0}; row < 4; row++) {
+                for (uint32_t column {0}; column < 4; column++) {
+                    covariance[row][column] += (color[row] - mean[row]) * (color[column] - mean[column]);
+                }
+            }
+        }
+
+        Color axis {1.f, 1.f, 1.f, 1.f};
+        for (uint32_t iteration {0}; iteration < BC7_POWER_ITERATIONS; iteration++) {
+            Color next {};
+            for (uint32_t row {0}; row < 4; row++) {
+                next[row] = dot(covariance[row], axis);
+            }
+            const float length = std::sqrt(dot(next, next));
+            if (length < 1e-6f) {
+                // A single color
+                low = mean;
+                high = mean;
+                return;
+            }
+            for (uint32_t channel {0}; channel < 4; channel++) {
+                axis[channel] = next[channel] / length;
+            }
+        }
+
+        float minProjection {0.f};
+        float maxProjection {0.f};
+        for (uint32_t texel {0}; texel < 16; texel++) {
+            const Color color = get_texel(texels, texel);
+            const Color offset {color[0] - mean[0], color[1] - mean[1], color[2] - mean[2], color[3] - mean[3]};
+            const float projection = dot(offset, axis);
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+        for (uint32_t channel {0}; channel < 4; channel++) {
+            low[channel] = mean[channel] + axis[channel] * minProjection;
+            high[channel] = mean[channel] + axis[channel] * maxProjection;
+        }
+        low = clamp_color(low);
+        high = clamp_color(high);
+    }
+
+    // Assigns each texel the nearest weight along the (unquantized) endpoints, then solves the endpoints for these
+    // weights by least squares
+    void refine_endpoints(const bcenc::RgbaBlock& texels, Color& low, Color& high) {
+        const Color direction {high[0] - low[0], high[1] - low[1], high[2] - low[2], high[3] - low[3]};
+        const float lengthSquared = dot(direction, direction);
+        if (lengthSquared < 1e-6f) {
+            return;
+        }
+
+        float aa {0.f};
+        float ab {0.f};
+        float bb {0.f};
+        Color ax {};
+        Color bx {};
+        for (uint32_t texel {0}; texel < 16; texel++) {
+            const Color color = get_texel(texels, texel);
+            const Color offset {color[0] - low[0], color[1] - low[1], color[2] - low[2], color[3] - low[3]};
+            const float t = std::clamp(dot(offset, direction) / lengthSquared, 0.f, 1.f);
+
+            uint32_t bestIndex {0};
+            for (uint32_t index {1}; index < 16; index++) {
+                if (std::abs(BC7_WEIGHTS_4[index] / 64.f - t) < std::abs(BC7_WEIGHTS_4[bestIndex] / 64.f - t)) {
+                    bestIndex = index;
+                }
+            }
+
+            const float b = BC7_WEIGHTS_4[bestIndex] / 64.f;
+            const float a = 1.f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (uint32_t channel {0}; channel < 4; channel++) {
+                ax[channel] += a * color[channel];
+                bx[channel] += b * color[channel];
+            }
+        }
+
+        const float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) < 1e-6f) {
+            return;
+        }
+        for (uint32_t channel {0}; channel < 4; channel++) {
+            low[channel] = (bb * ax[channel] - ab * bx[channel]) / determinant;
+            high[channel] = (aa * bx[channel] - ab * ax[channel]) / determinant;
+        }
+        low = clamp_color(low);
+        high = clamp_color(high);
+    }
+
+    // 7 bits of an endpoint channel, given its p-bit (the decoded value is (bits << 1) | pBit)
+    uint32_t quantize_endpoint(float value, uint32_t pBit) {
+        return static_cast<uint32_t>(std::clamp(std::lround((value - static_cast<float>(pBit)) / 2.f), 0l, 127l));
+    }
+
+    // The nearest palette entry of every texel. Returns the squared error of the block.
+    uint32_t find_indices(const bcenc::RgbaBlock& texels, const Endpoint& low, const Endpoint& high, std::array<uint32_t, 16>& indices) {
+        std::array<Endpoint, 16> palette {};
+        for (uint32_t index {0}; index < 16; index++) {
+            for (uint32_t channel {0}; channel < 4; channel++) {
+                palette[index][channel] = (low[channel] * (64 - BC7_WEIGHTS_4[index]) + high[channel] * BC7_WEIGHTS_4[index] + 32) >> 6;
+            }
+        }
+
+        uint32_t totalError {0};
+        for (uint32_t texel {0}; texel < 16; texel++) {
+            uint32_t bestError {UINT32_MAX};
+            for (uint32_t index {0}; index < 16; index++) {
+                uint32_t error {0};
+                for (uint32_t channel {0}; channel < 4; channel++) {
+                    const int32_t difference = static_cast<int32_t>(texels[texel * 4 + channel]) - static_cast<int32_t>(palette[index][channel]);
+                    error += static_cast<uint32_t>(difference * difference);
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    indices[texel] = index;
+                }
+            }
+            totalError += bestError;
+        }
+        return totalError;
+    }
+
+}
+
+std::array<uint8_t, 16> bcenc::encode_bc7_block(const RgbaBlock& texels) {
+    Color low {};
+    Color high {};
+    fit_principal_axis(texels, low, high);
+    for (uint32_t pass {0}; pass < BC7_REFINE_PASSES; pass++) {
+        refine_endpoints(texels, low, high);
+    }
+
+    // Quantizes with each combination of p-bits, and keeps the best
+    Endpoint bestLow {};
+    Endpoint bestHigh {};
+    std::array<uint32_t, 2> bestPBits {};
+    std::array<uint32_t, 16> bestIndices {};
+    uint32_t bestError {UINT32_MAX};
+    for (uint32_t pBits {0}; pBits < 4; pBits++) {
+        const uint32_t lowPBit = pBits & 1;
+        const uint32_t highPBit = pBits >> 1;
+        Endpoint quantizedLow {};
+        Endpoint quantizedHigh {};
+        Endpoint decodedLow {};
+        Endpoint decodedHigh {};
+        for (uint32_t channel {0}; channel < 4; channel++) {
+            quantizedLow[channel] = quantize_endpoint(low[channel], lowPBit);
+            quantizedHigh[channel] = quantize_endpoint(high[channel], highPBit);
+            decodedLow[channel] = (quantizedLow[channel] << 1) | lowPBit;
+            decodedHigh[channel] = (quantizedHigh[channel] << 1) | highPBit;
+        }
+
+        std::array<uint32_t, 16> indices {};
+        const uint32_t error = find_indices(texels, decodedLow, decodedHigh, indices);
+        if (error < bestError) {
+            bestError = error;
+            bestLow = quantizedLow;
+            bestHigh = quantizedHigh;
+            bestPBits = {lowPBit, highPBit};
+            bestIndices = indices;
+        }
+    }
+
+    // The first index is stored without its top bit: swaps the endpoints if it is set (the weights are symmetric)
+    if (bestIndices[0] & 8) {
+        std::swap(bestLow, bestHigh);
+        std::swap(bestPBits[0], bestPBits[1]);
+        for (uint32_t& index : bestIndices) {
+            index = 15 - index;
+        }
+    }
+
+    std::array<uint8_t, 16> block {};
+    BitWriter writer {block.data()};
+    writer.write(1u << BC7_MODE_6, BC7_MODE_6 + 1);
+    for (uint32_t channel {0}; channel < 4; channel++) {
+        writer.write(bestLow[channel], BC7_ENDPOINT_BITS);
+        writer.write(bestHigh[channel], BC7_ENDPOINT_BITS);
+    }
+    writer.write(bestPBits[0], 1);
+    writer.write(bestPBits[1], 1);
+    for (uint32_t texel {0}; texel < 16; texel++) {
+        writer.write(bestIndices[texel], texel == 0 ? 3 : 4);
+    }
+    return block;
+}
+
+std::array<uint8_t, 8> bcenc::encode_bc4_block(const ChannelBlock& values) {
+    const auto [minimum, maximum] = std::minmax_element(values.begin(), values.end());
+
+    // red0 > red1: the 8-value mode, red0 then red1 then 6 values from red0 to red1
+    std::array<uint8_t, 8> block {*maximum, *minimum};
+    if (*maximum == *minimum) {
+        return block;   // Every index 0: red0
+    }
+
+    uint64_t indices {0};
+    for (uint32_t texel {0}; texel < 16; texel++) {
+        const float t = static_cast<float>(values[texel] - *minimum) / static_cast<float>(*maximum - *minimum);
+        const uint32_t step = static_cast<uint32_t>(std::lround(t * 7.f));
+        const uint32_t index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+        indices |= uint64_t {index} << (texel * 3);
+    }
+    for (uint32_t byte {0}; byte < 6; byte++) {
+        block[2 + byte] = static_cast<uint8_t>(indices >> (byte * 8));
+    }
+    return block;
+}
+
+std::array<uint8_t, 16> bcenc::encode_bc5_block(const ChannelBlock& red, const ChannelBlock& green) {
+    const std::array<uint8_t, 8> redBlock = encode_bc4_block(red);
+    const std::array<uint8_t, 8> greenBlock = encode_bc4_block(green);
+
+    std::array<uint8_t, 16> block {};
+    std::copy(redBlock.begin(), redBlock.end(), block.begin());
+    std::copy(greenBlock.begin(), greenBlock.end(), block.begin() + 8);
+    return block;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace bcenc {
+
+	/// @brief The texels of a 4x4 block, row by row (RGBA8).
+	using RgbaBlock = std::array<uint8_t, 16 * 4>;
+	/// @brief The values of a single channel of a 4x4 block, row by row.
+	using ChannelBlock = std::array<uint8_t, 16>;
+
+	/// @brief Encodes a block as BC7, in mode 6 only (a single RGBA subset, 7-bit endpoints with p-bits, 4-bit indices):
+	/// the endpoints are fit along the principal axis of the texels, then refined by least squares.
+	/// @note Mode 6 handles smooth blocks and alpha well; blocks with several distinct colors lose more than with the
+	/// partitioned modes a full encoder would also try.
+	std::array<uint8_t, 16> encode_bc7_block(const RgbaBlock& texels);
+
+	/// @brief Encodes a block as BC4 (a single channel, 8 interpolated values between the block's min and max).
+	std::array<uint8_t, 8> encode_bc4_block(const ChannelBlock& values);
+
+	/// @brief Encodes a block as BC5: BC4 for the red channel, then for the green one.
+	std::array<uint8_t, 16> encode_bc5_block(const ChannelBlock& red, const ChannelBlock& green);
+
+}
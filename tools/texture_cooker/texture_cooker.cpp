@@ -0,0 +1,231 @@
+// Offline texture cooker: decodes an image (PNG, JPG... through stb_image), builds its full mip chain, compresses it to
+// the BC format of its content and writes it as a KTX2 file, which the engine's TextureStreamer uploads as it is.
+//
+// Usage: texture_cooker [--normal | --linear] [--uncompressed] <input image> <output.ktx2>
+//   (default)       Color, sRGB-encoded: BC7 (sRGB)
+//   --linear        Linear data (masks, roughness...): BC4 if grayscale, else BC7
+//   --normal        Tangent-space normal map: renormalized per mip, X and Y in BC5 (Z is rebuilt by the shader)
+//   --uncompressed  RGBA8 (R8 for grayscale linear data, R8G8 for normal maps) instead of BC
+
+#include "vk_loader.h"
+#include "vk_images.h"
+#include "vk_logger.h"
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+    enum class TextureKind {
+        COLOR,
+        LINEAR,
+        NORMAL
+    };
+
+    constexpr std::string_view COOKER_WRITER {"VulkanEngine texture_cooker"};
+
+    bool is_grayscale(const vkloader::MipChain& mipChain) {
+        const vkloader::MipLevelData& level = mipChain.levels[0];
+        for (size_t texel {level.offset}; texel < level.offset + level.size; texel += 4) {
+            const auto* rgba = reinterpret_cast<const uint8_t*>(mipChain.data.data() + texel);
+            if (rgba[0] != rgba[1] || rgba[0] != rgba[2] || rgba[3] != 255) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The box filter shortens the averaged normals: scales them back to unit length, on every level
+    void renormalize_normals(vkloader::MipChain& mipChain) {
+        for (size_t texel {0}; texel < mipChain.data.size(); texel += 4) {
+            auto* rgba = reinterpret_cast<uint8_t*>(mipChain.data.data() + texel);
+            float normal[3] {};
+            for (uint32_t channel {0}; channel < 3; channel++) {
+                normal[channel] = rgba[channel] / 127.5f - 1.f;
+            }
+            const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            if (length < 1e-4f) {
+                continue;
+            }
+            for (uint32_t channel {0}; channel < 3; channel++) {
+                rgba[channel] = static_cast<uint8_t>(std::lround(std::clamp((normal[channel] / length + 1.f) * 127.5f, 0.f, 255.f)));
+            }
+        }
+    }
+
+    // The texels of the 4x4 block at (blockX, blockY) of a level, the ones past the edges clamped to it
+    bcenc::RgbaBlock read_block(const uint8_t* texels, VkExtent2D extent, uint32_t blockX, uint32_t blockY) {
+        bcenc::RgbaBlock block {};
+        for (uint32_t y {0}; y < 4; y++) {
+            for (uint32_t x {0}; x < 4; x++) {
+                const uint32_t sourceX = std::min(blockX * 4 + x, extent.width - 1);
+                const uint32_t sourceY = std::min(blockY * 4 + y, extent.height - 1);
+                std::copy_n(texels + (static_cast<size_t>(sourceY) * extent.width + sourceX) * 4, 4, block.data() + (y * 4 + x) * 4);
+            }
+        }
+        return block;
+    }
+
+    bcenc::ChannelBlock get_channel(const bcenc::RgbaBlock& block, uint32_t channel) {
+        bcenc::ChannelBlock values {};
+        for (uint32_t texel {0}; texel < 16; texel++) {
+            values[texel] = block[texel * 4 + channel];
+        }
+        return values;
+    }
+
+    // Converts every level of an RGBA8 mip chain to the format
+    vkloader::MipChain cook_mips(const vkloader::MipChain& source, VkFormat format) {
+        const vkutil::TexelBlock texelBlock = vkutil::get_texel_block(format);
+
+        vkloader::MipChain result {};
+        result.format = format;
+        result.extent = source.extent;
+        result.mipCount = source.mipCount;
+        result.firstMip = 0;
+        for (const vkloader::MipLevelData& level : source.levels) {
+            const uint32_t blockColumns = (level.extent.width + texelBlock.width - 1) / texelBlock.width;
+            const uint32_t blockRows = (level.extent.height + texelBlock.height - 1) / texelBlock.height;
+            result.levels.push_back(vkloader::MipLevelData {level.extent, result.data.size(), static_cast<size_t>(blockColumns) * blockRows * texelBlock.size});
+            result.data.resize(result.data.size() + result.levels.back().size);
+        }
+
+        for (size_t levelIndex {0}; levelIndex < source.levels.size(); levelIndex++) {
+            const vkloader::MipLevelData& sourceLevel = source.levels[levelIndex];
+            const vkloader::MipLevelData& level = result.levels[levelIndex];
+            const auto* texels = reinterpret_cast<const uint8_t*>(source.data.data() + sourceLevel.offset);
+            auto* output = reinterpret_cast<uint8_t*>(result.data.data() + level.offset);
+
+            if (texelBlock.width == 1) {
+                // Uncompressed: keeps the first channels of every texel
+                for (size_t texel {0}; texel < sourceLevel.size / 4; texel++) {
+                    std::copy_n(texels + texel * 4, texelBlock.size, output + texel * texelBlock.size);
+                }
+                continue;
+            }
+
+            const uint32_t blockColumns = (level.extent.width + 3) / 4;
+            const uint32_t blockRows = (level.extent.height + 3) / 4;
+            for (uint32_t blockY {0}; blockY < blockRows; blockY++) {
+                for (uint32_t blockX {0}; blockX < blockColumns; blockX++) {
+                    const bcenc::RgbaBlock block = read_block(texels, level.extent, blockX, blockY);
+                    uint8_t* blockOutput = output + (static_cast<size_t>(blockY) * blockColumns + blockX) * texelBlock.size;
+                    switch (format) {
+                        case VK_FORMAT_BC7_UNORM_BLOCK:
+                        case VK_FORMAT_BC7_SRGB_BLOCK: {
+                            const std::array<uint8_t, 16> encoded = bcenc::encode_bc7_block(block);
+                            std::copy(encoded.begin(), encoded.end(), blockOutput);
+                            break;
+                        }
+                        case VK_FORMAT_BC5_UNORM_BLOCK: {
+                            const std::array<uint8_t, 16> encoded = bcenc::encode_bc5_block(get_channel(block, 0), get_channel(block, 1));
+                            std::copy(encoded.begin(), encoded.end(), blockOutput);
+                            break;
+                        }
+                        case VK_FORMAT_BC4_UNORM_BLOCK: {
+                            const std::array<uint8_t, 8> encoded = bcenc::encode_bc4_block(get_channel(block, 0));
+                            std::copy(encoded.begin(), encoded.end(), blockOutput);
+                            break;
+                        }
+                        default:
+                            VK_LOG_ERROR("No encoder for the format {}", string_VkFormat(format));
+                            throw std::runtime_error("No encoder for the format");
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    VkFormat pick_format(TextureKind kind, bool bGrayscale, bool bUncompressed) {
+        switch (kind) {
+            case TextureKind::COLOR:
+                return bUncompressed ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_BC7_SRGB_BLOCK;
+            case TextureKind::LINEAR:
+                if (bGrayscale) {
+                    return bUncompressed ? VK_FORMAT_R8_UNORM : VK_FORMAT_BC4_UNORM_BLOCK;
+                }
+                return bUncompressed ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_BC7_UNORM_BLOCK;
+            case TextureKind::NORMAL:
+                return bUncompressed ? VK_FORMAT_R8G8_UNORM : VK_FORMAT_BC5_UNORM_BLOCK;
+        }
+        return VK_FORMAT_UNDEFINED;
+    }
+
+    void print_usage() {
+        fmt::print(stderr, "Usage: texture_cooker [--normal | --linear] [--uncompressed] <input image> <output.ktx2>\n");
+    }
+
+    int cook(int argc, char* argv[]) {
+        TextureKind kind {TextureKind::COLOR};
+        bool bUncompressed {false};
+        std::vector<std::string_view> paths {};
+        for (int argument {1}; argument < argc; argument++) {
+            const std::string_view value {argv[argument]};
+            if (value == "--normal") {
+                kind = TextureKind::NORMAL;
+            } else if (value == "--linear") {
+                kind = TextureKind::LINEAR;
+            } else if (value == "--uncompressed") {
+                bUncompressed = true;
+            } else if (value.starts_with("--")) {
+                print_usage();
+                return 1;
+            } else {
+                paths.push_back(value);
+            }
+        }
+        if (paths.size() != 2) {
+            print_usage();
+            return 1;
+        }
+        const std::filesystem::path inputPath {paths[0]};
+        const std::filesystem::path outputPath {paths[1]};
+
+        std::ifstream input {inputPath, std::ios::binary};
+        if (!input) {
+            VK_LOG_ERROR("Failed to open {}", inputPath.string());
+            return 1;
+        }
+        const std::vector<char> inputData {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+
+        vkloader::MipChain mipChain {};
+        if (!vkloader::decode_image_mips(std::as_bytes(std::span(inputData)), 0, kind == TextureKind::COLOR, mipChain)) {
+            VK_LOG_ERROR("Failed to decode {}", inputPath.string());
+            return 1;
+        }
+        if (kind == TextureKind::NORMAL) {
+            renormalize_normals(mipChain);
+        }
+
+        const VkFormat format = pick_format(kind, is_grayscale(mipChain), bUncompressed);
+        const vkloader::MipChain cookedChain = cook_mips(mipChain, format);
+        const std::vector<std::byte> file = vkloader::write_ktx2(cookedChain, COOKER_WRITER);
+
+        std::ofstream output {outputPath, std::ios::binary};
+        output.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+        if (!output) {
+            VK_LOG_ERROR("Failed to write {}", outputPath.string());
+            return 1;
+        }
+
+        fmt::print("{} -> {}: {}x{}, {} mips, {}, {} bytes\n", inputPath.string(), outputPath.string(), cookedChain.extent.width,
+            cookedChain.extent.height, cookedChain.mipCount, string_VkFormat(format), file.size());
+        return 0;
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    int result {1};
+    try {
+        result = cook(argc, argv);
+    } catch (const std::exception&) {
+        // Already logged
+    }
+    vklog::flush();
+    return result;
+}